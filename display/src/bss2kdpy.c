@@ -9,6 +9,7 @@
 #include "vulkan_instance.h"
 #include "vulkan_device.h"
 #include "vulkan_external_texture.h"
+#include "vulkan_framebuffers.h"
 #include "vulkan_texture.h"
 #include "vulkan_sampler.h"
 #include "vulkan_sync.h"
@@ -17,6 +18,7 @@
 #include "vulkan_command_pool.h"
 #include "vulkan_descriptor_set.h"
 #include "vulkan_command_buffer.h"
+#include "vulkan_textmode.h"
 #include "vulkan_swapchain.h"
 #include "vulkan_shader.h"
 #include "vulkan_renderpass.h"
@@ -24,8 +26,22 @@
 
 #include "bss2kdpy.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
+static void usage(char const *argv0)
+{
+	fprintf(stderr,
+			"Usage: %s [-c] [-f frames]\n"
+			"\n"
+			"  -c  render textmode on the GPU from the character RAM\n"
+			"  -f  frames in flight, 1 to %d (default %d)\n",
+			argv0,
+			MAX_FRAMES_IN_FLIGHT,
+			DEFAULT_FRAMES_IN_FLIGHT);
+}
+
 int main(int argc, char **argv)
 {
 	int rc = 1;
@@ -33,9 +49,39 @@ int main(int argc, char **argv)
 	struct global g =
 	{
 		.argc = argc,
-		.argv = argv
+		.argv = argv,
+		.frames_in_flight = DEFAULT_FRAMES_IN_FLIGHT
 	};
 
+	int opt;
+	while((opt = getopt(argc, argv, "cf:h")) != -1)
+	{
+		switch(opt)
+		{
+		case 'c':
+			g.gpu_textmode = true;
+			break;
+		case 'f':
+			{
+				char *end;
+				unsigned long const frames = strtoul(optarg, &end, 10);
+				if(*end || frames < 1 || frames > MAX_FRAMES_IN_FLIGHT)
+				{
+					usage(argv[0]);
+					return 1;
+				}
+				g.frames_in_flight = frames;
+			}
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
 	if(!device_setup(&g))
 		goto fail_device;
 
@@ -54,6 +100,9 @@ int main(int argc, char **argv)
 	if(!vulkan_external_texture_setup(&g))
 		goto fail_vulkan_external_texture;
 
+	if(!vulkan_framebuffers_setup(&g))
+		goto fail_vulkan_framebuffers;
+
 	if(!vulkan_texture_setup(&g))
 		goto fail_vulkan_texture;
 
@@ -78,6 +127,9 @@ int main(int argc, char **argv)
 	if(!vulkan_command_buffer_setup(&g))
 		goto fail_vulkan_command_buffer;
 
+	if(!vulkan_textmode_setup(&g))
+		goto fail_vulkan_textmode;
+
 	if(!vulkan_shader_setup(&g))
 		goto fail_vulkan_shader;
 
@@ -103,6 +155,9 @@ fail_vulkan_renderpass:
 	vulkan_shader_teardown(&g);
 
 fail_vulkan_shader:
+	vulkan_textmode_teardown(&g);
+
+fail_vulkan_textmode:
 	vulkan_command_buffer_teardown(&g);
 
 fail_vulkan_command_buffer:
@@ -127,6 +182,9 @@ fail_vulkan_sampler:
 	vulkan_texture_teardown(&g);
 
 fail_vulkan_texture:
+	vulkan_framebuffers_teardown(&g);
+
+fail_vulkan_framebuffers:
 	vulkan_external_texture_teardown(&g);
 
 fail_vulkan_external_texture:
@@ -4,13 +4,42 @@
 
 #include <vulkan/vulkan.h>
 
+#include <bss2k_ioctl.h>
+
 #include <stdbool.h>
+#include <stdint.h>
 
 #define SCREEN_WIDTH 480
 #define SCREEN_HEIGHT 360
 
 /* binding numbers, keep consistent with shaders */
 #define TEXTMODE_TEXTURE_AND_SAMPLER_BINDING 0
+#define TEXTMODE_CHARACTERS_BINDING 1
+#define TEXTMODE_FONT_BINDING 2
+#define TEXTMODE_CURSOR_BINDING 3
+
+/* character RAM, see logic/cpu/bss2k.vhdl */
+#define TERMINAL_WIDTH 80
+#define TERMINAL_HEIGHT 25
+#define TERMINAL_CURSOR_POINTER 0x7d0
+#define TERMINAL_CURSOR_MODE 0x7d4
+
+/* font ROM, 16 lines of 6 pixels per character */
+#define FONT_LINES 16
+#define FONT_CHARACTERS 256
+
+/* pipelines */
+#define TEXTURE_PIPELINE 0
+#define TEXTMODE_PIPELINE 1
+
+/* pre-recorded draws per swapchain image: one per pipeline, then one per
+ * external texture sampled directly */
+#define EXTERNAL_TEXTURE_DRAW 2
+#define DRAWS_PER_IMAGE (EXTERNAL_TEXTURE_DRAW + BSS2K_TEXTMODE_BUFFERS)
+
+/* frames recorded or executing at the same time */
+#define MAX_FRAMES_IN_FLIGHT 4
+#define DEFAULT_FRAMES_IN_FLIGHT 2
 
 struct global
 {
@@ -19,6 +48,15 @@ struct global
 
 	int bss2k_device;
 
+	/* render textmode from the character RAM on the GPU */
+	bool gpu_textmode;
+
+	/* number of frames used, at most MAX_FRAMES_IN_FLIGHT */
+	uint32_t frames_in_flight;
+
+	/* first page of emulated memory, for the cursor */
+	unsigned char const *terminal;
+
 	union
 	{
 		struct
@@ -40,8 +78,19 @@ struct global
 
 	VkSampler textmode_texture_sampler;
 
+	/* for integer textures, which are not filtered */
+	VkSampler nearest_sampler;
+
 	VkDescriptorSet textmode_descriptor_set;
 
+	/* the texture binding points to an external texture, only used if
+	 * sample_external is set */
+	VkDescriptorSet external_descriptor_sets[BSS2K_TEXTMODE_BUFFERS];
+
+	/* the GPU samples linear textures of the external format, so
+	 * textmode is drawn without copying it */
+	bool sample_external;
+
 	struct
 	{
 		struct
@@ -50,21 +99,41 @@ struct global
 			VkQueue queue;
 		} graphics, present;
 	} queue;
+	/* everything one frame uses, reused after its fence is signaled. The
+	 * draw itself is recorded per swapchain image. */
 	struct
 	{
+		VkCommandBuffer transfer;
 		VkSemaphore image_available;
 		VkSemaphore render_finished;
+		VkFence in_flight;
+		/* in_flight has been submitted and not reset since */
+		bool submitted;
+		/* external texture sampled in place, or -1 */
+		int textmode_buffer;
+	} frames[MAX_FRAMES_IN_FLIGHT];
+
+	/* next frame to record */
+	uint32_t frame;
+
+	struct
+	{
+		/* imported from the fence of the next textmode update */
+		VkSemaphore textmode_written;
 	} sem;
 	struct
 	{
-		VkFence in_flight;
+		VkFence presubmit;
 	} fence;
 	VkSwapchainKHR swapchain;
 	VkRenderPass render_pass;
 	VkPipelineLayout pipeline_layout;
-	VkPipeline pipelines[1];
+	VkPipeline pipelines[2];
 	VkCommandPool graphics_command_pool;
-	VkCommandBuffer graphics_command_buffers[2];
+	/* transfer of the next textmode update */
+	VkCommandBuffer presubmit_command_buffer;
+
+	PFN_vkImportSemaphoreFdKHR vkImportSemaphoreFdKHR;
 
 	VkSurfaceFormatKHR surface_format;
 	VkPresentModeKHR present_mode;
@@ -86,9 +155,6 @@ struct global
 	/* window currently visible */
 	bool visible;
 
-	/* GPU busy (more likely, status not collected) */
-	bool drawing;
-
 	/* current canvas size */
 	struct
 	{
@@ -98,6 +164,7 @@ struct global
 	struct
 	{
 		VkShaderModule frag;
+		VkShaderModule textmode_frag;
 		VkShaderModule vert;
 	} shaders;
 
@@ -108,10 +175,58 @@ struct global
 		VkImageView image_view;
 		VkDeviceMemory memory;
 	}
-	/* texture in FPGA address space, linear layout */
-	textmode_texture_external,
+	/* textures in FPGA address space, linear layout, the card writes
+	 * each update to the next one */
+	textmode_texture_external[BSS2K_TEXTMODE_BUFFERS],
 	/* texture in GPU address space, optimized layout */
-	textmode_texture_internal;
+	textmode_texture_internal,
+	/* character codes, copied from the start of the external texture */
+	textmode_characters,
+	/* font ROM, uploaded once */
+	textmode_font;
+
+	/* start of each external texture memory, holds the character RAM
+	 * if the card sends characters */
+	VkBuffer textmode_characters_buffer[BSS2K_TEXTMODE_BUFFERS];
+
+	/* cursor pointer and mode for textmode.frag, updated by each
+	 * transfer so the draw can be recorded in advance */
+	VkBuffer textmode_cursor_buffer;
+	VkDeviceMemory textmode_cursor_memory;
+
+	/* the dma_buf of each external texture, to export the fence of an
+	 * update in progress */
+	int textmode_dma_buf[BSS2K_TEXTMODE_BUFFERS];
+
+	/* external texture written by the last completed update */
+	uint32_t textmode_buffer;
+
+	/* a copy of the next update waits for its fence */
+	bool presubmitted;
+
+	/* graphics mode framebuffers in FPGA address space, the image starts
+	 * at offset */
+	struct
+	{
+		VkBuffer buffer;
+		VkDeviceMemory memory;
+		VkDeviceSize offset;
+	} framebuffers[BSS2K_FRAMEBUFFER_COUNT];
+
+	/* last value of BSS2K_IOC_READ_FLIP, textmode is shown until the
+	 * first flip */
+	uint64_t flip;
+
+	/* character rows of the textmode texture changed since the last
+	 * transfer, see BSS2K_IOC_READ_DAMAGE */
+	uint64_t damage;
+
+	/* internal texture holds a complete image, so only damaged rows
+	 * need to be copied */
+	bool texture_valid;
+
+	/* external textures are in the layout they are sampled in */
+	bool external_texture_ready;
 
 	/* swapchain render targets */
 	uint32_t swapchain_image_count;
@@ -122,5 +237,9 @@ struct global
 		/* owned by us */
 		VkImageView image_view;
 		VkFramebuffer framebuffer;
+		/* frame that rendered to it last, or -1 */
+		int frame;
+		/* recorded by vulkan_pipeline_setup */
+		VkCommandBuffer draw[DRAWS_PER_IMAGE];
 	} *swapchain_images;
 };
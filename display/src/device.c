@@ -6,22 +6,93 @@
 
 #include "bss2kdpy.h"
 
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <bss2k_ioctl.h>
+
+#include <endian.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
 bool device_setup(struct global *g)
 {
 	g->bss2k_device = open("/dev/bss2k-0", O_RDWR);
 	if(g->bss2k_device == -1)
-		return false;
+		goto fail_open;
+
+	if(!g->gpu_textmode)
+		return true;
+
+	/* the terminal and the cursor words are in the first page */
+	void *const terminal = mmap(
+			NULL,
+			sysconf(_SC_PAGESIZE),
+			PROT_READ,
+			MAP_SHARED,
+			g->bss2k_device,
+			0);
+	if(terminal == MAP_FAILED)
+		goto fail_mmap;
+
+	g->terminal = terminal;
+
+	unsigned long long const control =
+		BSS2K_CTL_MASK_TEXTMODE_CHARACTERS |
+		BSS2K_CTL_TEXTMODE_CHARACTERS;
+
+	if(ioctl(g->bss2k_device, BSS2K_IOC_WRITE_CONTROL, &control) == -1)
+		goto fail_write_control;
+
 	return true;
+
+fail_write_control:
+	munmap((void *)g->terminal, sysconf(_SC_PAGESIZE));
+	g->terminal = NULL;
+
+fail_mmap:
+	close(g->bss2k_device);
+	g->bss2k_device = -1;
+
+fail_open:
+	return false;
 }
 
 void device_teardown(struct global *g)
 {
+	if(g->terminal)
+	{
+		/* back to pixels for the next user */
+		unsigned long long const control =
+			BSS2K_CTL_MASK_TEXTMODE_CHARACTERS;
+
+		ioctl(g->bss2k_device, BSS2K_IOC_WRITE_CONTROL, &control);
+
+		munmap((void *)g->terminal, sysconf(_SC_PAGESIZE));
+		g->terminal = NULL;
+	}
+
 	if(g->bss2k_device != -1)
 	{
 		close(g->bss2k_device);
 		g->bss2k_device = -1;
 	}
 }
+
+void device_read_cursor(
+		struct global *g,
+		uint32_t *out_pointer,
+		uint32_t *out_mode)
+{
+	/* the CPU may still hold the words in its data cache */
+	ioctl(g->bss2k_device, BSS2K_IOC_FLUSH_DCACHE);
+
+	uint32_t pointer, mode;
+	memcpy(&pointer, g->terminal + TERMINAL_CURSOR_POINTER, sizeof pointer);
+	memcpy(&mode, g->terminal + TERMINAL_CURSOR_MODE, sizeof mode);
+
+	*out_pointer = be32toh(pointer);
+	*out_mode = be32toh(mode);
+}
@@ -1,8 +1,12 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 struct global;
 
 bool device_setup(struct global *);
 void device_teardown(struct global *);
+
+/* cursor words from emulated memory, only with gpu_textmode */
+void device_read_cursor(struct global *, uint32_t *pointer, uint32_t *mode);
@@ -0,0 +1,56 @@
+#version 450
+
+// Renders the 80x25 character RAM like textmode_output.vhdl does, with 6x14
+// pixel cells in the top 350 lines of the 480x360 screen.
+
+layout(location = 0) out vec4 outColor;
+
+layout(location = 0) in vec2 texCoord;
+
+// character codes, 80x25
+layout(binding = 1) uniform usampler2D characters;
+
+// 6 bits per line, MSB left, indexed by line and character
+layout(binding = 2) uniform usampler2D font;
+
+// written by each transfer
+layout(binding = 3) uniform Cursor
+{
+	// cell index, nothing is shown outside the screen
+	uint pointer;
+	// 0: blinking, shown steady, 1: visible, otherwise invisible
+	uint mode;
+} cursor;
+
+// the hardware writes an sRGB texture, sampling it returns linear values
+float linear(float c)
+{
+	return (c <= 0.04045) ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+}
+
+void main()
+{
+	ivec2 pixel = ivec2(texCoord * vec2(480.0, 360.0));
+
+	int column = pixel.x / 6;
+	int row = pixel.y / 14;
+
+	if(row >= 25)
+	{
+		outColor = vec4(0.0, 0.0, 0.0, 1.0);
+		return;
+	}
+
+	uint character = texelFetch(characters, ivec2(column, row), 0).r;
+	uint bits = texelFetch(font, ivec2(pixel.y % 14, character), 0).r;
+
+	bool set = ((bits >> (5 - pixel.x % 6)) & 1u) != 0u;
+
+	if(cursor.mode <= 1u && uint(row * 80 + column) == cursor.pointer)
+		set = !set;
+
+	// the background encodes the character position, as in hardware
+	outColor = set
+		? vec4(1.0, 1.0, 1.0, 1.0)
+		: vec4(linear(float(row) / 255.0), 0.0, linear(float(column) / 255.0), 1.0);
+}
@@ -6,42 +6,60 @@
 
 #include "bss2kdpy.h"
 
-bool vulkan_command_buffer_setup(struct global *g)
+static bool allocate_command_buffer(struct global *g, VkCommandBuffer *ret)
 {
-	uint32_t const command_buffer_count =
-			sizeof g->graphics_command_buffers /
-				sizeof g->graphics_command_buffers[0];
-
 	VkCommandBufferAllocateInfo const info =
 	{
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
 		.commandPool = g->graphics_command_pool,
 		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-		.commandBufferCount = command_buffer_count
+		.commandBufferCount = 1
 	};
 
 	VkResult rc = vkAllocateCommandBuffers(
 			g->device,
 			&info,
-			g->graphics_command_buffers);
-	if(rc != VK_SUCCESS)
+			ret);
+	return rc == VK_SUCCESS;
+}
+
+static VkCommandBuffer free_command_buffer(struct global *g, VkCommandBuffer buffer)
+{
+	if(buffer != VK_NULL_HANDLE)
+		vkFreeCommandBuffers(
+				g->device,
+				g->graphics_command_pool,
+				1,
+				&buffer);
+	return VK_NULL_HANDLE;
+}
+
+bool vulkan_command_buffer_setup(struct global *g)
+{
+	for(uint32_t i = 0; i < g->frames_in_flight; ++i)
+	{
+		if(!allocate_command_buffer(g, &g->frames[i].transfer))
+			goto fail_command_buffers;
+	}
+
+	if(!allocate_command_buffer(g, &g->presubmit_command_buffer))
 		goto fail_command_buffers;
 
 	return true;
 
 fail_command_buffers:
+	vulkan_command_buffer_teardown(g);
 	return false;
 }
 
 void vulkan_command_buffer_teardown(struct global *g)
 {
-	uint32_t const command_buffer_count =
-			sizeof g->graphics_command_buffers /
-				sizeof g->graphics_command_buffers[0];
+	g->presubmit_command_buffer =
+			free_command_buffer(g, g->presubmit_command_buffer);
 
-	vkFreeCommandBuffers(
-			g->device,
-			g->graphics_command_pool,
-			command_buffer_count,
-			g->graphics_command_buffers);
+	for(uint32_t i = 0; i < g->frames_in_flight; ++i)
+	{
+		g->frames[i].transfer =
+				free_command_buffer(g, g->frames[i].transfer);
+	}
 }
@@ -10,11 +10,24 @@ bool vulkan_descriptor_pool_setup(struct global *g)
 {
 	uint32_t const max_frames_in_flight = 1;
 
+	/* plus one set per external texture, which may be sampled directly */
+	uint32_t const sets = max_frames_in_flight + BSS2K_TEXTMODE_BUFFERS;
+
+	/* texture, characters and font */
+	uint32_t const images_per_set = 3;
+
+	/* cursor */
+	uint32_t const uniform_buffers_per_set = 1;
+
 	VkDescriptorPoolSize const descriptor_pool_sizes[] =
 	{
 		{
 			.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-			.descriptorCount = max_frames_in_flight
+			.descriptorCount = images_per_set * sets
+		},
+		{
+			.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			.descriptorCount = uniform_buffers_per_set * sets
 		}
 	};
 
@@ -24,7 +37,7 @@ bool vulkan_descriptor_pool_setup(struct global *g)
 		.poolSizeCount = sizeof descriptor_pool_sizes /
 				sizeof descriptor_pool_sizes[0],
 		.pPoolSizes = descriptor_pool_sizes,
-		.maxSets = max_frames_in_flight
+		.maxSets = sets
 	};
 
 	VkResult rc = vkCreateDescriptorPool(
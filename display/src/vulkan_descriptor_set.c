@@ -6,6 +6,65 @@
 
 #include "bss2kdpy.h"
 
+/* one set per external texture, only the texture binding is used by
+ * the texture pipeline */
+static bool external_descriptor_sets_setup(struct global *g)
+{
+	VkDescriptorSetLayout layouts[BSS2K_TEXTMODE_BUFFERS];
+	for(uint32_t i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+		layouts[i] = g->descriptor_set_layout;
+
+	VkDescriptorSetAllocateInfo const info =
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.pNext = NULL,
+		.descriptorPool = g->descriptor_pool,
+		.descriptorSetCount = BSS2K_TEXTMODE_BUFFERS,
+		.pSetLayouts = layouts
+	};
+
+	VkResult rc = vkAllocateDescriptorSets(
+			g->device,
+			&info,
+			g->external_descriptor_sets);
+	if(rc != VK_SUCCESS)
+		return false;
+
+	VkDescriptorImageInfo image_descriptor_info[BSS2K_TEXTMODE_BUFFERS];
+	VkWriteDescriptorSet write_descriptors[BSS2K_TEXTMODE_BUFFERS];
+
+	for(uint32_t i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+	{
+		/* linear images can only be sampled in the general layout */
+		image_descriptor_info[i] = (VkDescriptorImageInfo)
+		{
+			.imageLayout = VK_IMAGE_LAYOUT_GENERAL,
+			.imageView = g->textmode_texture_external[i].image_view,
+			.sampler = g->textmode_texture_sampler
+		};
+
+		write_descriptors[i] = (VkWriteDescriptorSet)
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = g->external_descriptor_sets[i],
+			.dstBinding = TEXTMODE_TEXTURE_AND_SAMPLER_BINDING,
+			.dstArrayElement = 0,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = 1,
+			.pImageInfo = &image_descriptor_info[i]
+		};
+	}
+
+	vkUpdateDescriptorSets(
+			g->device,
+			BSS2K_TEXTMODE_BUFFERS,
+			write_descriptors,
+			/* descriptorCopyCount */ 0,
+			/* pDescriptorCopies */ NULL);
+
+	return true;
+}
+
 bool vulkan_descriptor_set_setup(struct global *g)
 {
 	VkDescriptorSetAllocateInfo const info =
@@ -51,6 +110,9 @@ bool vulkan_descriptor_set_setup(struct global *g)
 			/* descriptorCopyCount */ 0,
 			/* pDescriptorCopies */ NULL);
 
+	if(g->sample_external)
+		return external_descriptor_sets_setup(g);
+
 	return true;
 }
 
@@ -58,4 +120,6 @@ void vulkan_descriptor_set_teardown(struct global *g)
 {
 	/* descriptor sets will be freed by freeing the pool */
 	g->textmode_descriptor_set = VK_NULL_HANDLE;
+	for(uint32_t i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+		g->external_descriptor_sets[i] = VK_NULL_HANDLE;
 }
@@ -16,6 +16,28 @@ bool vulkan_descriptor_set_layout_setup(struct global *g)
 			.descriptorCount = 1,	// not an array
 			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
 			.pImmutableSamplers = NULL
+		},
+		/* only written when textmode is rendered on the GPU */
+		{
+			.binding = TEXTMODE_CHARACTERS_BINDING,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+			.pImmutableSamplers = NULL
+		},
+		{
+			.binding = TEXTMODE_FONT_BINDING,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+			.pImmutableSamplers = NULL
+		},
+		{
+			.binding = TEXTMODE_CURSOR_BINDING,
+			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+			.pImmutableSamplers = NULL
 		}
 	};
 
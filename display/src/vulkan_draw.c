@@ -10,10 +10,49 @@
 
 #include <assert.h>
 
+/* wait until a frame has executed, so its resources can be reused */
+static void wait_frame(struct global *g, uint32_t index)
+{
+	if(!g->frames[index].submitted)
+		return;
+
+	vkWaitForFences(
+			g->device,
+			1,
+			&g->frames[index].in_flight,
+			/* waitAll */ VK_TRUE,
+			/* timeout */ UINT64_MAX);
+	vkResetFences(
+			g->device,
+			1,
+			&g->frames[index].in_flight);
+
+	g->frames[index].submitted = false;
+}
+
+/* the card writes each update to the buffer after the newest, which is the
+ * oldest one. A frame sampling an older buffer in place has to finish
+ * before the card gets to it, so only frames sampling the newest buffer
+ * are left in flight. */
+static void wait_older_textmode(struct global *g, uint32_t frame)
+{
+	for(uint32_t i = 0; i < g->frames_in_flight; ++i)
+	{
+		if(i == frame || g->frames[i].textmode_buffer == -1)
+			continue;
+		if(g->frames[i].textmode_buffer != g->frames[frame].textmode_buffer)
+			wait_frame(g, i);
+	}
+}
+
 bool vulkan_draw(struct global *g)
 {
-	// TODO
-	if(!vulkan_transfer(g))
+	uint32_t const frame = g->frame;
+
+	/* only blocks when all frames are in flight */
+	wait_frame(g, frame);
+
+	if(!vulkan_transfer(g, g->frames[frame].transfer))
 		return false;
 
 	uint32_t image_index;
@@ -22,119 +61,36 @@ bool vulkan_draw(struct global *g)
 			g->device,
 			g->swapchain,
 			/* timeout */ UINT64_MAX,
-			/* semaphore */ g->sem.image_available,
+			/* semaphore */ g->frames[frame].image_available,
 			/* fence */ VK_NULL_HANDLE,
 			&image_index);
 
 	assert(image_index < g->swapchain_image_count);
 
-	bool start = !g->drawing;
-
-	/* if not starting, sync and stop first */
-	if(!start)
-		vulkan_draw_stop(g);
-
-	/* if starting, fence may not be in ready state yet */
-	if(start)
-		assert(vkGetFenceStatus(g->device, g->fence.in_flight) == VK_NOT_READY);
-
-	g->drawing = true;
+	/* another frame may still render to this image */
+	if(g->swapchain_images[image_index].frame != -1)
+		wait_frame(g, g->swapchain_images[image_index].frame);
 
-	VkCommandBuffer const buffer = g->graphics_command_buffers[0];
+	g->swapchain_images[image_index].frame = frame;
 
-	vkResetCommandBuffer(
-			buffer,
-			/* flags */ 0);
-
-	/* begin command buffer */
+	/* recorded with the swapchain */
+	uint32_t slot = TEXTURE_PIPELINE;
+	g->frames[frame].textmode_buffer = -1;
+	if(vulkan_transfer_characters(g))
+		slot = TEXTMODE_PIPELINE;
+	else if(vulkan_transfer_sample_external(g))
 	{
-		VkCommandBufferBeginInfo const info =
-		{
-			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-			.flags = 0,
-			.pInheritanceInfo = NULL
-		};
-
-		VkResult rc = vkBeginCommandBuffer(buffer, &info);
-		if(rc != VK_SUCCESS)
-			goto fail_begin_command_buffer;
+		slot = EXTERNAL_TEXTURE_DRAW + g->textmode_buffer;
+		g->frames[frame].textmode_buffer = g->textmode_buffer;
+		wait_older_textmode(g, frame);
 	}
 
-	/* queue "bind descriptor sets" */
-	{
-		vkCmdBindDescriptorSets(
-				buffer,
-				VK_PIPELINE_BIND_POINT_GRAPHICS,
-				g->pipeline_layout,
-				/* firstSet */ 0,
-				/* descriptorSetCount */ 1,
-				&g->textmode_descriptor_set,
-				/* dynamicOffsetCount */ 0,
-				/* pDynamicOffsets */ NULL);
-	}
-
-	/* queue "begin render pass" */
-	{
-		VkClearValue const clear_values[] =
-		{
-			{
-				.color =
-				{
-					.float32 =
-					{
-						0.0f, 0.0f, 0.0f, 1.0f
-					}
-				}
-			}
-		};
-
-		VkRenderPassBeginInfo const info =
-		{
-			.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-			.renderPass = g->render_pass,
-			.framebuffer = g->swapchain_images[image_index].framebuffer,
-			.renderArea =
-			{
-				.offset =
-				{
-					.x = 0,
-					.y = 0
-				},
-				.extent =
-				{
-					.width = g->canvas.w,
-					.height = g->canvas.h
-				}
-			},
-			.clearValueCount = sizeof clear_values / sizeof clear_values[0],
-			.pClearValues = clear_values
-		};
-
-		vkCmdBeginRenderPass(buffer, &info, VK_SUBPASS_CONTENTS_INLINE);
-	}
-
-	vkCmdBindPipeline(
-			buffer,
-			VK_PIPELINE_BIND_POINT_GRAPHICS,
-			g->pipelines[0]);
-
-	vkCmdDraw(
-			buffer,
-			/* vertexCount */ 4,
-			/* instanceCount */ 1,
-			/* firstVertex */ 0,
-			/* firstInstance */ 0);
-
-	vkCmdEndRenderPass(buffer);
-
-	VkResult rc = vkEndCommandBuffer(buffer);
-	if(rc != VK_SUCCESS)
-		goto fail_end_command_buffer;
+	VkCommandBuffer const draw = g->swapchain_images[image_index].draw[slot];
 
 	{
 		VkSemaphore const wait_semaphores[] =
 		{
-			g->sem.image_available
+			g->frames[frame].image_available
 		};
 
 		VkPipelineStageFlags wait_stages[] =
@@ -144,7 +100,7 @@ bool vulkan_draw(struct global *g)
 
 		VkSemaphore const signal_semaphores[] =
 		{
-			g->sem.render_finished
+			g->frames[frame].render_finished
 		};
 
 		/* these arrays correspond with each other and need to have the
@@ -152,9 +108,11 @@ bool vulkan_draw(struct global *g)
 		_Static_assert(sizeof wait_semaphores / sizeof wait_semaphores[0] ==
 					sizeof wait_stages / sizeof wait_stages[0]);
 
+		/* the draw waits for the copies through their barriers */
 		VkCommandBuffer const command_buffers[] =
 		{
-			buffer
+			g->frames[frame].transfer,
+			draw
 		};
 
 		VkSubmitInfo const infos[] =
@@ -178,15 +136,20 @@ bool vulkan_draw(struct global *g)
 				g->queue.graphics.queue,
 				sizeof infos / sizeof infos[0],
 				infos,
-				g->fence.in_flight);
+				g->frames[frame].in_flight);
 		if(rc != VK_SUCCESS)
 			goto fail_queue_submit;
+
+		g->frames[frame].submitted = true;
 	}
 
+	/* the next draw does not wait for this one */
+	g->frame = (frame + 1) % g->frames_in_flight;
+
 	{
 		VkSemaphore const wait_semaphores[] =
 		{
-			g->sem.render_finished
+			g->frames[frame].render_finished
 		};
 
 		VkSwapchainKHR const swapchains[] =
@@ -225,32 +188,16 @@ bool vulkan_draw(struct global *g)
 
 fail_queue_present:
 fail_queue_submit:
-fail_end_command_buffer:
-fail_begin_command_buffer:
 	return false;
 
 }
 
 void vulkan_draw_stop(struct global *g)
 {
-	if(!g->drawing)
-		return;
-
-	VkFence const fences[] =
-	{
-		g->fence.in_flight
-	};
-
-	vkWaitForFences(
-			g->device,
-			sizeof fences / sizeof fences[0],
-			fences,
-			/* waitAll */ VK_TRUE,
-			/* timeout */ UINT64_MAX);
-	vkResetFences(
-			g->device,
-			sizeof fences / sizeof fences[0],
-			fences);
+	for(uint32_t i = 0; i < g->frames_in_flight; ++i)
+		wait_frame(g, i);
 
-	g->drawing = false;
+	/* the swapchain images may be replaced */
+	for(uint32_t i = 0; i < g->swapchain_image_count; ++i)
+		g->swapchain_images[i].frame = -1;
 }
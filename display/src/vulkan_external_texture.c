@@ -12,28 +12,36 @@
 
 #include <bss2k_ioctl.h>
 
-bool vulkan_external_texture_setup(struct global *g)
+#include <fcntl.h>
+#include <unistd.h>
+
+/* import one textmode buffer as a linear image */
+static bool import_texture(
+		struct global *g,
+		PFN_vkGetMemoryFdPropertiesKHR vkGetMemoryFdPropertiesKHR,
+		uint32_t index)
 {
-	// get extension function
-	PFN_vkGetMemoryFdPropertiesKHR const vkGetMemoryFdPropertiesKHR =
-		(PFN_vkGetMemoryFdPropertiesKHR)vkGetDeviceProcAddr(
-				g->device,
-				"vkGetMemoryFdPropertiesKHR");
-	if(!vkGetMemoryFdPropertiesKHR)
-		return false;
-
 	// fd representing the DMA buffer for the imported texture
-	int mem_fd;
+	struct bss2k_textmode_texture tex =
+	{
+		.index = index
+	};
 
 	{
 		int rc = ioctl(
 				g->bss2k_device,
 				BSS2K_IOC_GET_TEXTMODE_TEXTURE,
-				&mem_fd);
+				&tex);
 		if(rc == -1)
 			return false;
 	}
 
+	int const mem_fd = tex.fd;
+
+	/* Vulkan owns mem_fd after the import. Without a duplicate, nothing
+	 * is submitted ahead of updates. */
+	g->textmode_dma_buf[index] = fcntl(mem_fd, F_DUPFD_CLOEXEC, 0);
+
 	VkExternalMemoryImageCreateInfo const external_texture_image_info =
 	{
 		.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
@@ -57,7 +65,9 @@ bool vulkan_external_texture_setup(struct global *g)
 		.format = VK_FORMAT_R8G8B8A8_SRGB,
 		.tiling = VK_IMAGE_TILING_LINEAR,
 		.initialLayout = VK_IMAGE_LAYOUT_PREINITIALIZED,
-		.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		.usage = g->sample_external
+			? VK_IMAGE_USAGE_SAMPLED_BIT
+			: VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
 		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
 		.samples = VK_SAMPLE_COUNT_1_BIT,
 		.flags = 0
@@ -67,9 +77,9 @@ bool vulkan_external_texture_setup(struct global *g)
 			g->device,
 			&image_info,
 			g->allocation_callbacks,
-			&g->textmode_texture_external.image);
+			&g->textmode_texture_external[index].image);
 	if(rc != VK_SUCCESS)
-		return false;
+		goto fail_create_image;
 
 	uint32_t memory_type_index;
 
@@ -87,14 +97,14 @@ bool vulkan_external_texture_setup(struct global *g)
 				&prop);
 
 		if(rc != VK_SUCCESS)
-			return false;
+			goto fail_memory_type;
 
 		for(memory_type_index = 0; memory_type_index < 32; ++memory_type_index)
 			if(prop.memoryTypeBits & ((uint32_t)1u << memory_type_index))
 				break;
 
 		if(memory_type_index == 32)
-			return false;
+			goto fail_memory_type;
 	}
 
 	VkDeviceSize const size = 480 * 360 * 4;
@@ -116,33 +126,118 @@ bool vulkan_external_texture_setup(struct global *g)
 			.memoryTypeIndex = memory_type_index
 		};
 
+		/* takes ownership of the fd on success */
 		VkResult rc = vkAllocateMemory(
 				g->device,
 				&info,
 				g->allocation_callbacks,
-				&g->textmode_texture_external.memory);
+				&g->textmode_texture_external[index].memory);
 		if(rc != VK_SUCCESS)
-			return false;
+			goto fail_memory_type;
 	}
 
+	/* freed by the teardown from here on */
 	rc = vkBindImageMemory(
 			g->device,
-			g->textmode_texture_external.image,
-			g->textmode_texture_external.memory,
+			g->textmode_texture_external[index].image,
+			g->textmode_texture_external[index].memory,
 			/* offset */ 0);
 	if(rc != VK_SUCCESS)
 		return false;
 
+	if(g->sample_external)
+	{
+		VkImageViewCreateInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+			.image = g->textmode_texture_external[index].image,
+			.viewType = VK_IMAGE_VIEW_TYPE_2D,
+			.format = VK_FORMAT_R8G8B8A8_SRGB,
+			.subresourceRange =
+			{
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = 1,
+				.baseArrayLayer = 0,
+				.layerCount = 1
+			}
+		};
+
+		rc = vkCreateImageView(
+				g->device,
+				&info,
+				g->allocation_callbacks,
+				&g->textmode_texture_external[index].image_view);
+		if(rc != VK_SUCCESS)
+			return false;
+	}
+
+	return true;
+
+fail_memory_type:
+fail_create_image:
+	close(mem_fd);
+	return false;
+}
+
+bool vulkan_external_texture_setup(struct global *g)
+{
+	// get extension function
+	PFN_vkGetMemoryFdPropertiesKHR const vkGetMemoryFdPropertiesKHR =
+		(PFN_vkGetMemoryFdPropertiesKHR)vkGetDeviceProcAddr(
+				g->device,
+				"vkGetMemoryFdPropertiesKHR");
+	if(!vkGetMemoryFdPropertiesKHR)
+		return false;
+
+	/* nothing shown before the first update, which goes to buffer 0 */
+	g->textmode_buffer = BSS2K_TEXTMODE_BUFFERS - 1;
+
+	/* sample the textmode buffers in place if the GPU can filter linear
+	 * images, otherwise they are copied to the internal texture */
+	{
+		VkFormatProperties prop;
+		vkGetPhysicalDeviceFormatProperties(
+				g->physical_device,
+				VK_FORMAT_R8G8B8A8_SRGB,
+				&prop);
+
+		VkFormatFeatureFlags const required =
+			VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+			VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+		g->sample_external =
+			(prop.linearTilingFeatures & required) == required;
+		g->external_texture_ready = false;
+	}
+
+	for(uint32_t i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+	{
+		if(!import_texture(g, vkGetMemoryFdPropertiesKHR, i))
+		{
+			vulkan_external_texture_teardown(g);
+			return false;
+		}
+	}
+
 	return true;
 }
 
 void vulkan_external_texture_teardown(struct global *g)
 {
-	vulkan_texture_destroy(
-			g,
-			g->textmode_texture_external.image,
-			g->textmode_texture_external.image_view,
-			g->textmode_texture_external.memory);
-	g->textmode_texture_external.memory = VK_NULL_HANDLE;
-	g->textmode_texture_external.image = VK_NULL_HANDLE;
+	for(uint32_t i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+	{
+		vulkan_texture_destroy(
+				g,
+				g->textmode_texture_external[i].image,
+				g->textmode_texture_external[i].image_view,
+				g->textmode_texture_external[i].memory);
+		g->textmode_texture_external[i].image_view = VK_NULL_HANDLE;
+		g->textmode_texture_external[i].memory = VK_NULL_HANDLE;
+		g->textmode_texture_external[i].image = VK_NULL_HANDLE;
+
+		if(g->textmode_dma_buf[i] != -1)
+			close(g->textmode_dma_buf[i]);
+		g->textmode_dma_buf[i] = -1;
+	}
 }
@@ -0,0 +1,226 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "vulkan_framebuffers.h"
+
+#include "bss2kdpy.h"
+
+#include <sys/ioctl.h>
+
+#include <bss2k_ioctl.h>
+
+#include <unistd.h>
+
+/* import one graphics mode framebuffer as a buffer that can be copied into
+ * the texture. The dma_buf covers the host pages the FPGA writes to, so
+ * nothing is copied until the GPU reads it. */
+static bool import_framebuffer(
+		struct global *g,
+		PFN_vkGetMemoryFdPropertiesKHR vkGetMemoryFdPropertiesKHR,
+		uint32_t index)
+{
+	struct bss2k_framebuffer fb =
+	{
+		.index = index
+	};
+
+	{
+		int rc = ioctl(
+				g->bss2k_device,
+				BSS2K_IOC_GET_FRAMEBUFFER,
+				&fb);
+		if(rc == -1)
+			goto fail_ioctl;
+	}
+
+	{
+		VkExternalMemoryBufferCreateInfo const external_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+			.pNext = NULL,
+			.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT
+		};
+
+		VkBufferCreateInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+			.pNext = &external_info,
+			.flags = 0,
+			.size = fb.size,
+			.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+			.queueFamilyIndexCount = 0,
+			.pQueueFamilyIndices = NULL
+		};
+
+		VkResult rc = vkCreateBuffer(
+				g->device,
+				&info,
+				g->allocation_callbacks,
+				&g->framebuffers[index].buffer);
+		if(rc != VK_SUCCESS)
+			goto fail_create_buffer;
+	}
+
+	uint32_t memory_type_index;
+
+	{
+		VkMemoryFdPropertiesKHR prop =
+		{
+			.sType = VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR,
+			.pNext = NULL
+		};
+
+		VkResult rc = vkGetMemoryFdPropertiesKHR(
+				g->device,
+				VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+				fb.fd,
+				&prop);
+		if(rc != VK_SUCCESS)
+			goto fail_memory_type;
+
+		VkMemoryRequirements requirements;
+
+		vkGetBufferMemoryRequirements(
+				g->device,
+				g->framebuffers[index].buffer,
+				&requirements);
+
+		uint32_t const allowed =
+			prop.memoryTypeBits & requirements.memoryTypeBits;
+
+		for(memory_type_index = 0; memory_type_index < 32; ++memory_type_index)
+			if(allowed & ((uint32_t)1u << memory_type_index))
+				break;
+
+		if(memory_type_index == 32)
+			goto fail_memory_type;
+	}
+
+	{
+		VkImportMemoryFdInfoKHR const import_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR,
+			.pNext = NULL,
+			.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+			.fd = fb.fd
+		};
+
+		VkMemoryAllocateInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.pNext = &import_info,
+			.allocationSize = fb.size,
+			.memoryTypeIndex = memory_type_index
+		};
+
+		/* takes ownership of the fd on success */
+		VkResult rc = vkAllocateMemory(
+				g->device,
+				&info,
+				g->allocation_callbacks,
+				&g->framebuffers[index].memory);
+		if(rc != VK_SUCCESS)
+			goto fail_allocate_memory;
+	}
+
+	{
+		VkResult rc = vkBindBufferMemory(
+				g->device,
+				g->framebuffers[index].buffer,
+				g->framebuffers[index].memory,
+				/* offset */ 0);
+		if(rc != VK_SUCCESS)
+			goto fail_bind_memory;
+	}
+
+	g->framebuffers[index].offset = fb.offset;
+
+	return true;
+
+fail_bind_memory:
+	/* the fd is owned by the memory now */
+	vkFreeMemory(
+			g->device,
+			g->framebuffers[index].memory,
+			g->allocation_callbacks);
+	g->framebuffers[index].memory = VK_NULL_HANDLE;
+	vkDestroyBuffer(
+			g->device,
+			g->framebuffers[index].buffer,
+			g->allocation_callbacks);
+	g->framebuffers[index].buffer = VK_NULL_HANDLE;
+	return false;
+
+fail_allocate_memory:
+fail_memory_type:
+	vkDestroyBuffer(
+			g->device,
+			g->framebuffers[index].buffer,
+			g->allocation_callbacks);
+	g->framebuffers[index].buffer = VK_NULL_HANDLE;
+
+fail_create_buffer:
+	close(fb.fd);
+
+fail_ioctl:
+	return false;
+}
+
+bool vulkan_framebuffers_setup(struct global *g)
+{
+	PFN_vkGetMemoryFdPropertiesKHR const vkGetMemoryFdPropertiesKHR =
+		(PFN_vkGetMemoryFdPropertiesKHR)vkGetDeviceProcAddr(
+				g->device,
+				"vkGetMemoryFdPropertiesKHR");
+	if(!vkGetMemoryFdPropertiesKHR)
+		return false;
+
+	/* textmode until the first flip */
+	g->flip = 0;
+
+	for(uint32_t i = 0; i < BSS2K_FRAMEBUFFER_COUNT; ++i)
+	{
+		if(!import_framebuffer(g, vkGetMemoryFdPropertiesKHR, i))
+		{
+			vulkan_framebuffers_teardown(g);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void vulkan_framebuffers_teardown(struct global *g)
+{
+	for(uint32_t i = 0; i < BSS2K_FRAMEBUFFER_COUNT; ++i)
+	{
+		if(g->framebuffers[i].buffer != VK_NULL_HANDLE)
+		{
+			vkDestroyBuffer(
+					g->device,
+					g->framebuffers[i].buffer,
+					g->allocation_callbacks);
+			g->framebuffers[i].buffer = VK_NULL_HANDLE;
+		}
+		if(g->framebuffers[i].memory != VK_NULL_HANDLE)
+		{
+			vkFreeMemory(
+					g->device,
+					g->framebuffers[i].memory,
+					g->allocation_callbacks);
+			g->framebuffers[i].memory = VK_NULL_HANDLE;
+		}
+	}
+}
+
+void vulkan_framebuffers_update(struct global *g)
+{
+	unsigned long long flip;
+
+	if(ioctl(g->bss2k_device, BSS2K_IOC_READ_FLIP, &flip) == -1)
+		return;
+
+	g->flip = flip;
+}
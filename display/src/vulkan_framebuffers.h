@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdbool.h>
+
+struct global;
+
+bool vulkan_framebuffers_setup(struct global *g);
+void vulkan_framebuffers_teardown(struct global *g);
+
+/* read the front framebuffer after a flip interrupt */
+void vulkan_framebuffers_update(struct global *g);
@@ -22,9 +22,22 @@ bool vulkan_instance_setup(struct global *g)
 	g->descriptor_pool = VK_NULL_HANDLE;
 	g->textmode_texture_sampler = VK_NULL_HANDLE;
 	g->textmode_descriptor_set = VK_NULL_HANDLE;
-	g->sem.image_available = VK_NULL_HANDLE;
-	g->sem.render_finished = VK_NULL_HANDLE;
-	g->fence.in_flight = VK_NULL_HANDLE;
+	g->sample_external = false;
+	g->external_texture_ready = false;
+	for(uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+	{
+		g->frames[i].transfer = VK_NULL_HANDLE;
+		g->frames[i].image_available = VK_NULL_HANDLE;
+		g->frames[i].render_finished = VK_NULL_HANDLE;
+		g->frames[i].in_flight = VK_NULL_HANDLE;
+		g->frames[i].submitted = false;
+		g->frames[i].textmode_buffer = -1;
+	}
+	g->frame = 0;
+	g->presubmit_command_buffer = VK_NULL_HANDLE;
+	g->sem.textmode_written = VK_NULL_HANDLE;
+	g->fence.presubmit = VK_NULL_HANDLE;
+	g->presubmitted = false;
 	g->swapchain = VK_NULL_HANDLE;
 	g->render_pass = VK_NULL_HANDLE;
 	g->pipeline_layout = VK_NULL_HANDLE;
@@ -32,9 +45,16 @@ bool vulkan_instance_setup(struct global *g)
 	g->graphics_command_pool = VK_NULL_HANDLE;
 	g->shaders.frag = VK_NULL_HANDLE;
 	g->shaders.vert = VK_NULL_HANDLE;
-	g->textmode_texture_external.image = VK_NULL_HANDLE;
-	g->textmode_texture_external.image_view = VK_NULL_HANDLE;
-	g->textmode_texture_external.memory = VK_NULL_HANDLE;
+	for(uint32_t i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+	{
+		g->textmode_texture_external[i].image = VK_NULL_HANDLE;
+		g->textmode_texture_external[i].image_view = VK_NULL_HANDLE;
+		g->textmode_texture_external[i].memory = VK_NULL_HANDLE;
+		g->textmode_dma_buf[i] = -1;
+		g->external_descriptor_sets[i] = VK_NULL_HANDLE;
+	}
+	g->textmode_cursor_buffer = VK_NULL_HANDLE;
+	g->textmode_cursor_memory = VK_NULL_HANDLE;
 	g->textmode_texture_internal.image = VK_NULL_HANDLE;
 	g->textmode_texture_internal.image_view = VK_NULL_HANDLE;
 	g->textmode_texture_internal.memory = VK_NULL_HANDLE;
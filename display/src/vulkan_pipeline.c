@@ -6,6 +6,128 @@
 
 #include "bss2kdpy.h"
 
+/* record the render pass for one swapchain image with one pipeline and
+ * descriptor set into draw slot. Nothing in it changes until the swapchain
+ * is rebuilt; the copies and the cursor are in the transfer submitted with
+ * it. */
+static bool record_draw(
+		struct global *g,
+		uint32_t image_index,
+		uint32_t slot,
+		uint32_t pipeline,
+		VkDescriptorSet descriptor_set)
+{
+	VkCommandBuffer *const buffer =
+			&g->swapchain_images[image_index].draw[slot];
+
+	{
+		VkCommandBufferAllocateInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.commandPool = g->graphics_command_pool,
+			.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+			.commandBufferCount = 1
+		};
+
+		VkResult rc = vkAllocateCommandBuffers(
+				g->device,
+				&info,
+				buffer);
+		if(rc != VK_SUCCESS)
+		{
+			*buffer = VK_NULL_HANDLE;
+			return false;
+		}
+	}
+
+	/* begin command buffer */
+	{
+		VkCommandBufferBeginInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			.flags = 0,
+			.pInheritanceInfo = NULL
+		};
+
+		VkResult rc = vkBeginCommandBuffer(*buffer, &info);
+		if(rc != VK_SUCCESS)
+			return false;
+	}
+
+	/* queue "bind descriptor sets" */
+	{
+		vkCmdBindDescriptorSets(
+				*buffer,
+				VK_PIPELINE_BIND_POINT_GRAPHICS,
+				g->pipeline_layout,
+				/* firstSet */ 0,
+				/* descriptorSetCount */ 1,
+				&descriptor_set,
+				/* dynamicOffsetCount */ 0,
+				/* pDynamicOffsets */ NULL);
+	}
+
+	/* queue "begin render pass" */
+	{
+		VkClearValue const clear_values[] =
+		{
+			{
+				.color =
+				{
+					.float32 =
+					{
+						0.0f, 0.0f, 0.0f, 1.0f
+					}
+				}
+			}
+		};
+
+		VkRenderPassBeginInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+			.renderPass = g->render_pass,
+			.framebuffer = g->swapchain_images[image_index].framebuffer,
+			.renderArea =
+			{
+				.offset =
+				{
+					.x = 0,
+					.y = 0
+				},
+				.extent =
+				{
+					.width = g->canvas.w,
+					.height = g->canvas.h
+				}
+			},
+			.clearValueCount = sizeof clear_values / sizeof clear_values[0],
+			.pClearValues = clear_values
+		};
+
+		vkCmdBeginRenderPass(*buffer, &info, VK_SUBPASS_CONTENTS_INLINE);
+	}
+
+	vkCmdBindPipeline(
+			*buffer,
+			VK_PIPELINE_BIND_POINT_GRAPHICS,
+			g->pipelines[pipeline]);
+
+	vkCmdDraw(
+			*buffer,
+			/* vertexCount */ 4,
+			/* instanceCount */ 1,
+			/* firstVertex */ 0,
+			/* firstInstance */ 0);
+
+	vkCmdEndRenderPass(*buffer);
+
+	VkResult rc = vkEndCommandBuffer(*buffer);
+	if(rc != VK_SUCCESS)
+		return false;
+
+	return true;
+}
+
 bool vulkan_pipeline_setup(struct global *g)
 {
 	VkPipelineLayoutCreateInfo const pipeline_layout_info =
@@ -43,6 +165,22 @@ bool vulkan_pipeline_setup(struct global *g)
 		}
 	};
 
+	VkPipelineShaderStageCreateInfo const textmode_shader_info[] =
+	{
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_VERTEX_BIT,
+			.module = g->shaders.vert,
+			.pName = "main"
+		},
+		{
+			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+			.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+			.module = g->shaders.textmode_frag,
+			.pName = "main"
+		}
+	};
+
 	VkPipelineVertexInputStateCreateInfo const vertex_input_info =
 	{
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
@@ -170,6 +308,7 @@ bool vulkan_pipeline_setup(struct global *g)
 
 	VkGraphicsPipelineCreateInfo const infos[] =
 	{
+		[TEXTURE_PIPELINE] =
 		{
 			.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
 			.stageCount = sizeof shader_info / sizeof shader_info[0],
@@ -186,6 +325,25 @@ bool vulkan_pipeline_setup(struct global *g)
 			.subpass = 0,
 			.basePipelineHandle = VK_NULL_HANDLE,
 			.basePipelineIndex = -1
+		},
+		[TEXTMODE_PIPELINE] =
+		{
+			.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+			.stageCount = sizeof textmode_shader_info /
+					sizeof textmode_shader_info[0],
+			.pStages = textmode_shader_info,
+			.pVertexInputState = &vertex_input_info,
+			.pInputAssemblyState = &input_assembly_info,
+			.pViewportState = &viewport_info,
+			.pRasterizationState = &rasterization_info,
+			.pMultisampleState = &multisample_info,
+			.pColorBlendState = &color_blend_info,
+			.pDynamicState = &dynamic_info,
+			.layout = g->pipeline_layout,
+			.renderPass = g->render_pass,
+			.subpass = 0,
+			.basePipelineHandle = VK_NULL_HANDLE,
+			.basePipelineIndex = -1
 		}
 	};
 
@@ -204,8 +362,35 @@ bool vulkan_pipeline_setup(struct global *g)
 	if(rc != VK_SUCCESS)
 		goto fail_graphics_pipelines;
 
+	/* the textmode pipeline reads descriptors that only exist with
+	 * gpu_textmode */
+	for(uint32_t i = 0; i < g->swapchain_image_count; ++i)
+	{
+		if(!record_draw(g, i,
+				TEXTURE_PIPELINE, TEXTURE_PIPELINE,
+				g->textmode_descriptor_set))
+			goto fail_record_draw;
+		if(g->gpu_textmode && !record_draw(g, i,
+				TEXTMODE_PIPELINE, TEXTMODE_PIPELINE,
+				g->textmode_descriptor_set))
+			goto fail_record_draw;
+
+		if(!g->sample_external)
+			continue;
+
+		for(uint32_t j = 0; j < BSS2K_TEXTMODE_BUFFERS; ++j)
+			if(!record_draw(g, i,
+					EXTERNAL_TEXTURE_DRAW + j, TEXTURE_PIPELINE,
+					g->external_descriptor_sets[j]))
+				goto fail_record_draw;
+	}
+
 	return true;
 
+fail_record_draw:
+	vulkan_pipeline_teardown(g);
+	return false;
+
 fail_graphics_pipelines:
 	vkDestroyPipelineLayout(
 			g->device,
@@ -219,6 +404,22 @@ fail_pipeline_layout:
 
 void vulkan_pipeline_teardown(struct global *g)
 {
+	for(uint32_t i = 0; i < g->swapchain_image_count; ++i)
+	{
+		for(size_t j = 0; j < sizeof g->swapchain_images[i].draw /
+				sizeof g->swapchain_images[i].draw[0]; ++j)
+		{
+			if(g->swapchain_images[i].draw[j] == VK_NULL_HANDLE)
+				continue;
+			vkFreeCommandBuffers(
+					g->device,
+					g->graphics_command_pool,
+					1,
+					&g->swapchain_images[i].draw[j]);
+			g->swapchain_images[i].draw[j] = VK_NULL_HANDLE;
+		}
+	}
+
 	for(size_t i = 0; i < sizeof g->pipelines / sizeof g->pipelines[0]; ++i)
 	{
 		if(g->pipelines[i] == VK_NULL_HANDLE)
@@ -38,11 +38,52 @@ bool vulkan_sampler_setup(struct global *g)
 	if(rc != VK_SUCCESS)
 		return false;
 
+	/* integer textures are read with texelFetch, and cannot be
+	 * filtered */
+	VkSamplerCreateInfo const nearest_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.magFilter = VK_FILTER_NEAREST,
+		.minFilter = VK_FILTER_NEAREST,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+		.anisotropyEnable = VK_FALSE,
+		.maxAnisotropy = 1.0f,
+		.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
+		.unnormalizedCoordinates = VK_FALSE,
+		.compareEnable = VK_FALSE,
+		.compareOp = VK_COMPARE_OP_ALWAYS,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+		.mipLodBias = 0.0f,
+		.minLod = 0.0f,
+		.maxLod = 0.0f
+	};
+
+	rc = vkCreateSampler(
+			g->device,
+			&nearest_info,
+			g->allocation_callbacks,
+			&g->nearest_sampler);
+	if(rc != VK_SUCCESS)
+	{
+		vulkan_sampler_teardown(g);
+		return false;
+	}
+
 	return true;
 }
 
 void vulkan_sampler_teardown(struct global *g)
 {
+	if(g->nearest_sampler != VK_NULL_HANDLE)
+	{
+		vkDestroySampler(
+				g->device,
+				g->nearest_sampler,
+				g->allocation_callbacks);
+		g->nearest_sampler = VK_NULL_HANDLE;
+	}
 	if(g->textmode_texture_sampler != VK_NULL_HANDLE)
 	{
 		vkDestroySampler(
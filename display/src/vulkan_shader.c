@@ -41,6 +41,19 @@ bool vulkan_shader_setup(struct global *g)
 	if(rc != VK_SUCCESS)
 		goto fail;
 
+	unsigned char const textmode_frag_spv[] =
+	{
+#include "textmode_frag.inc"
+	};
+
+	rc = create_shader(
+			g,
+			textmode_frag_spv,
+			sizeof textmode_frag_spv,
+			&g->shaders.textmode_frag);
+	if(rc != VK_SUCCESS)
+		goto fail;
+
 	unsigned char const vert_spv[] =
 	{
 #include "vert.inc"
@@ -76,6 +89,8 @@ void vulkan_shader_teardown(struct global *g)
 {
 	destroy_shader(g, g->shaders.vert);
 	g->shaders.vert = VK_NULL_HANDLE;
+	destroy_shader(g, g->shaders.textmode_frag);
+	g->shaders.textmode_frag = VK_NULL_HANDLE;
 	destroy_shader(g, g->shaders.frag);
 	g->shaders.frag = VK_NULL_HANDLE;
 }
@@ -175,6 +175,10 @@ bool vulkan_swapchain_update(struct global *g)
 					swapchain_images[i];
 			g->swapchain_images[i].image_view =
 					VK_NULL_HANDLE;
+			g->swapchain_images[i].frame = -1;
+			for(size_t j = 0; j < sizeof g->swapchain_images[i].draw /
+				sizeof g->swapchain_images[i].draw[0]; ++j)
+				g->swapchain_images[i].draw[j] = VK_NULL_HANDLE;
 		}
 	}
 
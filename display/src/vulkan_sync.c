@@ -53,18 +53,36 @@ static VkFence destroy_fence(struct global *g, VkFence fence)
 	return VK_NULL_HANDLE;
 }
 
-/* fences are created in "signaled" state */
+/* fences are created in "unsignaled" state */
 bool vulkan_sync_setup(struct global *g)
 {
-	if(!create_semaphore(g, &g->sem.image_available))
-		goto fail_create_semaphore;
-	if(!create_semaphore(g, &g->sem.render_finished))
+	for(uint32_t i = 0; i < g->frames_in_flight; ++i)
+	{
+		if(!create_semaphore(g, &g->frames[i].image_available))
+			goto fail_create_semaphore;
+		if(!create_semaphore(g, &g->frames[i].render_finished))
+			goto fail_create_semaphore;
+		if(!create_fence(g, &g->frames[i].in_flight))
+			goto fail_create_fence;
+		g->frames[i].submitted = false;
+	}
+	g->frame = 0;
+
+	if(!create_semaphore(g, &g->sem.textmode_written))
 		goto fail_create_semaphore;
-	if(!create_fence(g, &g->fence.in_flight))
+	if(!create_fence(g, &g->fence.presubmit))
 		goto fail_create_fence;
 
+	g->vkImportSemaphoreFdKHR =
+		(PFN_vkImportSemaphoreFdKHR)vkGetDeviceProcAddr(
+				g->device,
+				"vkImportSemaphoreFdKHR");
+	if(!g->vkImportSemaphoreFdKHR)
+		goto fail_get_proc_addr;
+
 	return true;
 
+fail_get_proc_addr:
 fail_create_fence:
 fail_create_semaphore:
 	vulkan_sync_teardown(g);
@@ -74,10 +92,28 @@ fail_create_semaphore:
 
 void vulkan_sync_teardown(struct global *g)
 {
-	g->fence.in_flight =
-			destroy_fence(g, g->fence.in_flight);
-	g->sem.render_finished =
-			destroy_semaphore(g, g->sem.render_finished);
-	g->sem.image_available =
-			destroy_semaphore(g, g->sem.image_available);
+	/* the update it waits for has started, so this is short */
+	if(g->presubmitted)
+		vkWaitForFences(
+				g->device,
+				1,
+				&g->fence.presubmit,
+				/* waitAll */ VK_TRUE,
+				/* timeout */ UINT64_MAX);
+	g->presubmitted = false;
+
+	g->fence.presubmit =
+			destroy_fence(g, g->fence.presubmit);
+	g->sem.textmode_written =
+			destroy_semaphore(g, g->sem.textmode_written);
+
+	for(uint32_t i = 0; i < g->frames_in_flight; ++i)
+	{
+		g->frames[i].in_flight =
+				destroy_fence(g, g->frames[i].in_flight);
+		g->frames[i].render_finished =
+				destroy_semaphore(g, g->frames[i].render_finished);
+		g->frames[i].image_available =
+				destroy_semaphore(g, g->frames[i].image_available);
+	}
 }
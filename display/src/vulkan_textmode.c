@@ -0,0 +1,599 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "vulkan_textmode.h"
+
+#include "vulkan_texture.h"
+
+#include "bss2kdpy.h"
+
+#include <string.h>
+
+/* 6 pixels per line, MSB first, indexed by character and line */
+static unsigned char const font[FONT_CHARACTERS * FONT_LINES] =
+{
+#include "font.inc"
+};
+
+/* size of the character RAM at the start of the external texture */
+#define CHARACTER_RAM_SIZE 0x800
+
+static bool find_host_visible_memory_type(
+		struct global *g,
+		uint32_t allowed,
+		uint32_t *out_index)
+{
+	VkMemoryPropertyFlags const wanted =
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+			VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+	VkPhysicalDeviceMemoryProperties properties;
+
+	vkGetPhysicalDeviceMemoryProperties(
+			g->physical_device,
+			&properties);
+
+	for(uint32_t i = 0; i < properties.memoryTypeCount; ++i)
+	{
+		if(!(allowed & ((uint32_t)1u << i)))
+			continue;
+		if((properties.memoryTypes[i].propertyFlags & wanted) != wanted)
+			continue;
+		*out_index = i;
+		return true;
+	}
+
+	return false;
+}
+
+/* view the start of an imported textmode memory as a buffer, so the
+ * character codes can be copied into an image */
+static bool create_characters_buffer(struct global *g, uint32_t index)
+{
+	{
+		VkExternalMemoryBufferCreateInfo const external_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+			.pNext = NULL,
+			.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT
+		};
+
+		VkBufferCreateInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+			.pNext = &external_info,
+			.flags = 0,
+			.size = CHARACTER_RAM_SIZE,
+			.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+			.queueFamilyIndexCount = 0,
+			.pQueueFamilyIndices = NULL
+		};
+
+		VkResult rc = vkCreateBuffer(
+				g->device,
+				&info,
+				g->allocation_callbacks,
+				&g->textmode_characters_buffer[index]);
+		if(rc != VK_SUCCESS)
+			return false;
+	}
+
+	VkResult rc = vkBindBufferMemory(
+			g->device,
+			g->textmode_characters_buffer[index],
+			g->textmode_texture_external[index].memory,
+			/* offset */ 0);
+	if(rc != VK_SUCCESS)
+		return false;
+
+	return true;
+}
+
+/* cursor pointer and mode, written with vkCmdUpdateBuffer, so device local
+ * memory is preferred */
+static bool create_cursor_buffer(struct global *g)
+{
+	{
+		VkBufferCreateInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+			.pNext = NULL,
+			.flags = 0,
+			.size = 2 * sizeof(uint32_t),
+			.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+					VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+			.queueFamilyIndexCount = 0,
+			.pQueueFamilyIndices = NULL
+		};
+
+		VkResult rc = vkCreateBuffer(
+				g->device,
+				&info,
+				g->allocation_callbacks,
+				&g->textmode_cursor_buffer);
+		if(rc != VK_SUCCESS)
+			return false;
+	}
+
+	{
+		VkMemoryRequirements requirements;
+
+		vkGetBufferMemoryRequirements(
+				g->device,
+				g->textmode_cursor_buffer,
+				&requirements);
+
+		uint32_t const device_local_allowed =
+			requirements.memoryTypeBits & g->device_local_memory_types;
+
+		/* prefer device local memory, fall back otherwise */
+		uint32_t const filter =
+			device_local_allowed
+			? device_local_allowed
+			: requirements.memoryTypeBits;
+
+		uint32_t i;
+
+		for(i = 0; i < VK_MAX_MEMORY_TYPES; ++i)
+			if(filter & ((uint32_t)1u << i))
+				break;
+
+		if(i == VK_MAX_MEMORY_TYPES)
+			return false;
+
+		VkMemoryAllocateInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.pNext = NULL,
+			.allocationSize = requirements.size,
+			.memoryTypeIndex = i
+		};
+
+		VkResult rc = vkAllocateMemory(
+				g->device,
+				&info,
+				g->allocation_callbacks,
+				&g->textmode_cursor_memory);
+		if(rc != VK_SUCCESS)
+			return false;
+	}
+
+	VkResult rc = vkBindBufferMemory(
+			g->device,
+			g->textmode_cursor_buffer,
+			g->textmode_cursor_memory,
+			/* offset */ 0);
+	if(rc != VK_SUCCESS)
+		return false;
+
+	return true;
+}
+
+/* copy the font into its texture through a staging buffer, and wait for
+ * it, this happens only once */
+static bool upload_font(struct global *g)
+{
+	bool ret = false;
+
+	VkBuffer staging;
+	VkDeviceMemory staging_memory;
+
+	{
+		VkBufferCreateInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+			.pNext = NULL,
+			.flags = 0,
+			.size = sizeof font,
+			.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+			.queueFamilyIndexCount = 0,
+			.pQueueFamilyIndices = NULL
+		};
+
+		VkResult rc = vkCreateBuffer(
+				g->device,
+				&info,
+				g->allocation_callbacks,
+				&staging);
+		if(rc != VK_SUCCESS)
+			goto fail_create_buffer;
+	}
+
+	{
+		VkMemoryRequirements requirements;
+
+		vkGetBufferMemoryRequirements(
+				g->device,
+				staging,
+				&requirements);
+
+		uint32_t memory_type_index;
+
+		if(!find_host_visible_memory_type(
+					g,
+					requirements.memoryTypeBits,
+					&memory_type_index))
+			goto fail_allocate_memory;
+
+		VkMemoryAllocateInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.pNext = NULL,
+			.allocationSize = requirements.size,
+			.memoryTypeIndex = memory_type_index
+		};
+
+		VkResult rc = vkAllocateMemory(
+				g->device,
+				&info,
+				g->allocation_callbacks,
+				&staging_memory);
+		if(rc != VK_SUCCESS)
+			goto fail_allocate_memory;
+	}
+
+	{
+		VkResult rc = vkBindBufferMemory(
+				g->device,
+				staging,
+				staging_memory,
+				/* offset */ 0);
+		if(rc != VK_SUCCESS)
+			goto fail_bind_memory;
+	}
+
+	{
+		void *data;
+
+		VkResult rc = vkMapMemory(
+				g->device,
+				staging_memory,
+				/* offset */ 0,
+				sizeof font,
+				/* flags */ 0,
+				&data);
+		if(rc != VK_SUCCESS)
+			goto fail_bind_memory;
+
+		memcpy(data, font, sizeof font);
+
+		vkUnmapMemory(g->device, staging_memory);
+	}
+
+	/* no frame has been drawn yet */
+	VkCommandBuffer const buffer = g->frames[0].transfer;
+
+	vkResetCommandBuffer(
+			buffer,
+			/* flags */ 0);
+
+	{
+		VkCommandBufferBeginInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+			.pInheritanceInfo = NULL
+		};
+
+		VkResult rc = vkBeginCommandBuffer(buffer, &info);
+		if(rc != VK_SUCCESS)
+			goto fail_bind_memory;
+	}
+
+	{
+		VkImageMemoryBarrier const image_memory_barriers[] =
+		{
+			{
+				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+				.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+				.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.image = g->textmode_font.image,
+				.subresourceRange =
+				{
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.baseMipLevel = 0,
+					.levelCount = 1,
+					.baseArrayLayer = 0,
+					.layerCount = 1
+				},
+				.srcAccessMask = 0,
+				.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT
+			}
+		};
+
+		vkCmdPipelineBarrier(
+				buffer,
+				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				/* flags */ 0,
+				/* memoryBarrierCount */ 0,
+				/* pMemoryBarriers */ NULL,
+				/* bufferMemoryBarrierCount */ 0,
+				/* pBufferMemoryBarriers */ NULL,
+				sizeof image_memory_barriers /
+					sizeof image_memory_barriers[0],
+				image_memory_barriers);
+	}
+
+	{
+		VkBufferImageCopy const regions[] =
+		{
+			{
+				.bufferOffset = 0,
+				.bufferRowLength = 0,
+				.bufferImageHeight = 0,
+				.imageSubresource =
+				{
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.mipLevel = 0,
+					.baseArrayLayer = 0,
+					.layerCount = 1
+				},
+				.imageOffset =
+				{
+					.x = 0,
+					.y = 0,
+					.z = 0
+				},
+				.imageExtent =
+				{
+					.width = FONT_LINES,
+					.height = FONT_CHARACTERS,
+					.depth = 1
+				}
+			}
+		};
+
+		vkCmdCopyBufferToImage(
+				buffer,
+				staging,
+				g->textmode_font.image,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				sizeof regions / sizeof regions[0],
+				regions);
+	}
+
+	{
+		VkImageMemoryBarrier const image_memory_barriers[] =
+		{
+			{
+				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+				.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.image = g->textmode_font.image,
+				.subresourceRange =
+				{
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.baseMipLevel = 0,
+					.levelCount = 1,
+					.baseArrayLayer = 0,
+					.layerCount = 1
+				},
+				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+			}
+		};
+
+		vkCmdPipelineBarrier(
+				buffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				/* flags */ 0,
+				/* memoryBarrierCount */ 0,
+				/* pMemoryBarriers */ NULL,
+				/* bufferMemoryBarrierCount */ 0,
+				/* pBufferMemoryBarriers */ NULL,
+				sizeof image_memory_barriers /
+					sizeof image_memory_barriers[0],
+				image_memory_barriers);
+	}
+
+	{
+		VkResult rc = vkEndCommandBuffer(buffer);
+		if(rc != VK_SUCCESS)
+			goto fail_bind_memory;
+	}
+
+	{
+		VkSubmitInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+			.waitSemaphoreCount = 0,
+			.pWaitSemaphores = NULL,
+			.pWaitDstStageMask = NULL,
+			.commandBufferCount = 1,
+			.pCommandBuffers = &buffer,
+			.signalSemaphoreCount = 0,
+			.pSignalSemaphores = NULL
+		};
+
+		VkResult rc = vkQueueSubmit(
+				g->queue.graphics.queue,
+				1,
+				&info,
+				VK_NULL_HANDLE);
+		if(rc != VK_SUCCESS)
+			goto fail_bind_memory;
+	}
+
+	/* the staging buffer can go afterwards */
+	if(vkQueueWaitIdle(g->queue.graphics.queue) != VK_SUCCESS)
+		goto fail_bind_memory;
+
+	ret = true;
+
+fail_bind_memory:
+	vkFreeMemory(
+			g->device,
+			staging_memory,
+			g->allocation_callbacks);
+
+fail_allocate_memory:
+	vkDestroyBuffer(
+			g->device,
+			staging,
+			g->allocation_callbacks);
+
+fail_create_buffer:
+	return ret;
+}
+
+bool vulkan_textmode_setup(struct global *g)
+{
+	if(!g->gpu_textmode)
+		return true;
+
+	if(!vulkan_texture_create(
+			g,
+			TERMINAL_WIDTH,
+			TERMINAL_HEIGHT,
+			VK_FORMAT_R8_UINT,
+			&g->textmode_characters.image,
+			&g->textmode_characters.image_view,
+			&g->textmode_characters.memory))
+		goto fail;
+
+	if(!vulkan_texture_create(
+			g,
+			FONT_LINES,
+			FONT_CHARACTERS,
+			VK_FORMAT_R8_UINT,
+			&g->textmode_font.image,
+			&g->textmode_font.image_view,
+			&g->textmode_font.memory))
+		goto fail;
+
+	for(uint32_t i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+		if(!create_characters_buffer(g, i))
+			goto fail;
+
+	if(!create_cursor_buffer(g))
+		goto fail;
+
+	if(!upload_font(g))
+		goto fail;
+
+	{
+		VkDescriptorImageInfo const characters_info =
+		{
+			.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			.imageView = g->textmode_characters.image_view,
+			.sampler = g->nearest_sampler
+		};
+
+		VkDescriptorImageInfo const font_info =
+		{
+			.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			.imageView = g->textmode_font.image_view,
+			.sampler = g->nearest_sampler
+		};
+
+		VkDescriptorBufferInfo const cursor_info =
+		{
+			.buffer = g->textmode_cursor_buffer,
+			.offset = 0,
+			.range = VK_WHOLE_SIZE
+		};
+
+		VkWriteDescriptorSet const write_descriptors[] =
+		{
+			{
+				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+				.dstSet = g->textmode_descriptor_set,
+				.dstBinding = TEXTMODE_CHARACTERS_BINDING,
+				.dstArrayElement = 0,
+				.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				.descriptorCount = 1,
+				.pImageInfo = &characters_info
+			},
+			{
+				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+				.dstSet = g->textmode_descriptor_set,
+				.dstBinding = TEXTMODE_FONT_BINDING,
+				.dstArrayElement = 0,
+				.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				.descriptorCount = 1,
+				.pImageInfo = &font_info
+			},
+			{
+				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+				.dstSet = g->textmode_descriptor_set,
+				.dstBinding = TEXTMODE_CURSOR_BINDING,
+				.dstArrayElement = 0,
+				.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+				.descriptorCount = 1,
+				.pBufferInfo = &cursor_info
+			}
+		};
+
+		vkUpdateDescriptorSets(
+				g->device,
+				sizeof write_descriptors / sizeof write_descriptors[0],
+				write_descriptors,
+				/* descriptorCopyCount */ 0,
+				/* pDescriptorCopies */ NULL);
+	}
+
+	return true;
+
+fail:
+	vulkan_textmode_teardown(g);
+	return false;
+}
+
+void vulkan_textmode_teardown(struct global *g)
+{
+	if(g->textmode_cursor_buffer != VK_NULL_HANDLE)
+	{
+		vkDestroyBuffer(
+				g->device,
+				g->textmode_cursor_buffer,
+				g->allocation_callbacks);
+		g->textmode_cursor_buffer = VK_NULL_HANDLE;
+	}
+	if(g->textmode_cursor_memory != VK_NULL_HANDLE)
+	{
+		vkFreeMemory(
+				g->device,
+				g->textmode_cursor_memory,
+				g->allocation_callbacks);
+		g->textmode_cursor_memory = VK_NULL_HANDLE;
+	}
+
+	for(uint32_t i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+	{
+		if(g->textmode_characters_buffer[i] == VK_NULL_HANDLE)
+			continue;
+		vkDestroyBuffer(
+				g->device,
+				g->textmode_characters_buffer[i],
+				g->allocation_callbacks);
+		g->textmode_characters_buffer[i] = VK_NULL_HANDLE;
+	}
+
+	vulkan_texture_destroy(
+			g,
+			g->textmode_font.image,
+			g->textmode_font.image_view,
+			g->textmode_font.memory);
+	g->textmode_font.image_view = VK_NULL_HANDLE;
+	g->textmode_font.memory = VK_NULL_HANDLE;
+	g->textmode_font.image = VK_NULL_HANDLE;
+
+	vulkan_texture_destroy(
+			g,
+			g->textmode_characters.image,
+			g->textmode_characters.image_view,
+			g->textmode_characters.memory);
+	g->textmode_characters.image_view = VK_NULL_HANDLE;
+	g->textmode_characters.memory = VK_NULL_HANDLE;
+	g->textmode_characters.image = VK_NULL_HANDLE;
+}
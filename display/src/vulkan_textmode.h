@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+
+struct global;
+
+/* textures for rendering textmode from the character RAM, if enabled */
+bool vulkan_textmode_setup(struct global *g);
+void vulkan_textmode_teardown(struct global *g);
@@ -10,6 +10,7 @@ bool vulkan_texture_create(
 		struct global *g,
 		uint32_t width,
 		uint32_t height,
+		VkFormat format,
 		VkImage *out_image,
 		VkImageView *out_image_view,
 		VkDeviceMemory *out_memory)
@@ -32,7 +33,7 @@ bool vulkan_texture_create(
 			},
 			.mipLevels = 1,
 			.arrayLayers = 1,
-			.format = VK_FORMAT_R8G8B8A8_SRGB,
+			.format = format,
 			.tiling = VK_IMAGE_TILING_OPTIMAL,
 			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
 			.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT |
@@ -127,7 +128,7 @@ bool vulkan_texture_create(
 			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
 			.image = image,
 			.viewType = VK_IMAGE_VIEW_TYPE_2D,
-			.format = VK_FORMAT_R8G8B8A8_SRGB,
+			.format = format,
 			.subresourceRange =
 			{
 				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
@@ -203,6 +204,7 @@ bool vulkan_texture_setup(struct global *g)
 			g,
 			SCREEN_WIDTH,
 			SCREEN_HEIGHT,
+			VK_FORMAT_R8G8B8A8_SRGB,
 			&g->textmode_texture_internal.image,
 			&g->textmode_texture_internal.image_view,
 			&g->textmode_texture_internal.memory);
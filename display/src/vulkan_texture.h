@@ -11,6 +11,7 @@ bool vulkan_texture_create(
 		struct global *g,
 		uint32_t width,
 		uint32_t height,
+		VkFormat format,
 		VkImage *out_image,
 		VkImageView *out_image_view,
 		VkDeviceMemory *out_memory);
@@ -4,29 +4,96 @@
 
 #include "vulkan_transfer.h"
 
+#include "device.h"
+
 #include "bss2kdpy.h"
 
-bool vulkan_transfer(struct global *g)
+#include <sys/ioctl.h>
+
+#include <linux/dma-buf.h>
+
+#include <bss2k_ioctl.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+/* the card sent the character RAM, copy the character codes into the
+ * texture the textmode shader reads */
+static void copy_characters(struct global *g, VkCommandBuffer buffer)
 {
-	// TODO
-	VkCommandBuffer const buffer = g->graphics_command_buffers[1];
+	{
+		VkImageMemoryBarrier const image_memory_barriers[] =
+		{
+			{
+				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+				.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+				.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.image = g->textmode_characters.image,
+				.subresourceRange =
+				{
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.baseMipLevel = 0,
+					.levelCount = 1,
+					.baseArrayLayer = 0,
+					.layerCount = 1
+				},
+				.srcAccessMask = 0,
+				.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT
+			}
+		};
 
-	vkResetCommandBuffer(
-			buffer,
-			/* flags */ 0);
+		vkCmdPipelineBarrier(
+				buffer,
+				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				/* flags */ 0,
+				/* memoryBarrierCount */ 0,
+				/* pMemoryBarriers */ NULL,
+				/* bufferMemoryBarrierCount */ 0,
+				/* pBufferMemoryBarriers */ NULL,
+				sizeof image_memory_barriers /
+					sizeof image_memory_barriers[0],
+				image_memory_barriers);
+	}
 
-	/* begin command buffer */
 	{
-		VkCommandBufferBeginInfo const info =
+		VkBufferImageCopy const regions[] =
 		{
-			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-			.flags = 0,
-			.pInheritanceInfo = NULL
+			{
+				.bufferOffset = 0,
+				.bufferRowLength = TERMINAL_WIDTH,
+				.bufferImageHeight = TERMINAL_HEIGHT,
+				.imageSubresource =
+				{
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.mipLevel = 0,
+					.baseArrayLayer = 0,
+					.layerCount = 1
+				},
+				.imageOffset =
+				{
+					.x = 0,
+					.y = 0,
+					.z = 0
+				},
+				.imageExtent =
+				{
+					.width = TERMINAL_WIDTH,
+					.height = TERMINAL_HEIGHT,
+					.depth = 1
+				}
+			}
 		};
 
-		VkResult rc = vkBeginCommandBuffer(buffer, &info);
-		if(rc != VK_SUCCESS)
-			goto fail_begin_command_buffer;
+		vkCmdCopyBufferToImage(
+				buffer,
+				g->textmode_characters_buffer[g->textmode_buffer],
+				g->textmode_characters.image,
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				sizeof regions / sizeof regions[0],
+				regions);
 	}
 
 	{
@@ -34,11 +101,11 @@ bool vulkan_transfer(struct global *g)
 		{
 			{
 				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-				.oldLayout = VK_IMAGE_LAYOUT_PREINITIALIZED,
-				.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
 				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
 				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-				.image = g->textmode_texture_external.image,
+				.image = g->textmode_characters.image,
 				.subresourceRange =
 				{
 					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
@@ -47,15 +114,15 @@ bool vulkan_transfer(struct global *g)
 					.baseArrayLayer = 0,
 					.layerCount = 1
 				},
-				.srcAccessMask = 0,
-				.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
+				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
 			}
 		};
 
 		vkCmdPipelineBarrier(
 				buffer,
-				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
 				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
 				/* flags */ 0,
 				/* memoryBarrierCount */ 0,
 				/* pMemoryBarriers */ NULL,
@@ -65,13 +132,149 @@ bool vulkan_transfer(struct global *g)
 					sizeof image_memory_barriers[0],
 				image_memory_barriers);
 	}
+}
+
+/* write the cursor from emulated memory into the uniform buffer the
+ * pre-recorded draw reads */
+static void update_cursor(struct global *g, VkCommandBuffer buffer)
+{
+	uint32_t cursor[2];
+
+	device_read_cursor(g, &cursor[0], &cursor[1]);
 
 	{
+		VkBufferMemoryBarrier const buffer_memory_barriers[] =
+		{
+			{
+				.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+				.srcAccessMask = 0,
+				.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.buffer = g->textmode_cursor_buffer,
+				.offset = 0,
+				.size = VK_WHOLE_SIZE
+			}
+		};
+
+		/* wait for the previous frame to stop reading */
+		vkCmdPipelineBarrier(
+				buffer,
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				/* flags */ 0,
+				/* memoryBarrierCount */ 0,
+				/* pMemoryBarriers */ NULL,
+				sizeof buffer_memory_barriers /
+					sizeof buffer_memory_barriers[0],
+				buffer_memory_barriers,
+				/* imageMemoryBarrierCount */ 0,
+				/* pImageMemoryBarriers */ NULL);
+	}
+
+	vkCmdUpdateBuffer(
+			buffer,
+			g->textmode_cursor_buffer,
+			/* offset */ 0,
+			sizeof cursor,
+			cursor);
+
+	{
+		VkBufferMemoryBarrier const buffer_memory_barriers[] =
+		{
+			{
+				.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.buffer = g->textmode_cursor_buffer,
+				.offset = 0,
+				.size = VK_WHOLE_SIZE
+			}
+		};
+
+		vkCmdPipelineBarrier(
+				buffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				/* flags */ 0,
+				/* memoryBarrierCount */ 0,
+				/* pMemoryBarriers */ NULL,
+				sizeof buffer_memory_barriers /
+					sizeof buffer_memory_barriers[0],
+				buffer_memory_barriers,
+				/* imageMemoryBarrierCount */ 0,
+				/* pImageMemoryBarriers */ NULL);
+	}
+}
+
+/* move the external textures into the layout they are sampled in, once.
+ * The card writes them behind Vulkan's back anyway, so they stay there. */
+static void prepare_external_textures(struct global *g, VkCommandBuffer buffer)
+{
+	VkImageMemoryBarrier image_memory_barriers[BSS2K_TEXTMODE_BUFFERS];
+
+	for(uint32_t i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+	{
+		image_memory_barriers[i] = (VkImageMemoryBarrier)
+		{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+			.oldLayout = VK_IMAGE_LAYOUT_PREINITIALIZED,
+			.newLayout = VK_IMAGE_LAYOUT_GENERAL,
+			.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+			.image = g->textmode_texture_external[i].image,
+			.subresourceRange =
+			{
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.baseMipLevel = 0,
+				.levelCount = 1,
+				.baseArrayLayer = 0,
+				.layerCount = 1
+			},
+			.srcAccessMask = 0,
+			.dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+		};
+	}
+
+	vkCmdPipelineBarrier(
+			buffer,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			/* flags */ 0,
+			/* memoryBarrierCount */ 0,
+			/* pMemoryBarriers */ NULL,
+			/* bufferMemoryBarrierCount */ 0,
+			/* pBufferMemoryBarriers */ NULL,
+			BSS2K_TEXTMODE_BUFFERS,
+			image_memory_barriers);
+
+	g->external_texture_ready = true;
+}
+
+/* copy the textmode texture or the front framebuffer into the texture the
+ * plain shader samples */
+static void copy_texture(struct global *g, VkCommandBuffer buffer)
+{
+	bool const textmode = BSS2K_FLIP_COUNT(g->flip) == 0;
+
+	if(!g->texture_valid)
+		g->damage = BSS2K_DAMAGE_ALL;
+
+	/* nothing changed since the last copy */
+	if(textmode && !g->damage)
+		return;
+
+	{
+		/* keep the old contents, only damaged rows are replaced */
 		VkImageMemoryBarrier const image_memory_barriers[] =
 		{
 			{
 				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-				.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+				.oldLayout = g->texture_valid
+						? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+						: VK_IMAGE_LAYOUT_UNDEFINED,
 				.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
 				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
@@ -89,9 +292,10 @@ bool vulkan_transfer(struct global *g)
 			}
 		};
 
+		/* wait for the previous frame to stop sampling */
 		vkCmdPipelineBarrier(
 				buffer,
-				VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
 				VK_PIPELINE_STAGE_TRANSFER_BIT,
 				/* flags */ 0,
 				/* memoryBarrierCount */ 0,
@@ -103,37 +307,30 @@ bool vulkan_transfer(struct global *g)
 				image_memory_barriers);
 	}
 
+	if(!textmode)
 	{
-		VkImageCopy const regions[] =
+		/* graphics mode, copy the front framebuffer, which is tightly
+		 * packed */
+		VkBufferImageCopy const regions[] =
 		{
 			{
-				.srcSubresource =
+				.bufferOffset = g->framebuffers[BSS2K_FLIP_FRONT(g->flip)].offset,
+				.bufferRowLength = 0,
+				.bufferImageHeight = 0,
+				.imageSubresource =
 				{
 					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
 					.mipLevel = 0,
 					.baseArrayLayer = 0,
 					.layerCount = 1
 				},
-				.srcOffset =
+				.imageOffset =
 				{
 					.x = 0,
 					.y = 0,
 					.z = 0
 				},
-				.dstSubresource =
-				{
-					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-					.mipLevel = 0,
-					.baseArrayLayer = 0,
-					.layerCount = 1
-				},
-				.dstOffset =
-				{
-					.x = 0,
-					.y = 0,
-					.z = 0
-				},
-				.extent =
+				.imageExtent =
 				{
 					.width = SCREEN_WIDTH,
 					.height = SCREEN_HEIGHT,
@@ -142,15 +339,129 @@ bool vulkan_transfer(struct global *g)
 			}
 		};
 
-		vkCmdCopyImage(
+		vkCmdCopyBufferToImage(
 				buffer,
-				g->textmode_texture_external.image,
-				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				g->framebuffers[BSS2K_FLIP_FRONT(g->flip)].buffer,
 				g->textmode_texture_internal.image,
 				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 				sizeof regions / sizeof regions[0],
 				regions);
 	}
+	else
+	{
+		{
+			VkImageMemoryBarrier const image_memory_barriers[] =
+			{
+				{
+					.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+					.oldLayout = VK_IMAGE_LAYOUT_PREINITIALIZED,
+					.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+					.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+					.image = g->textmode_texture_external[g->textmode_buffer].image,
+					.subresourceRange =
+					{
+						.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+						.baseMipLevel = 0,
+						.levelCount = 1,
+						.baseArrayLayer = 0,
+						.layerCount = 1
+					},
+					.srcAccessMask = 0,
+					.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT
+				}
+			};
+
+			vkCmdPipelineBarrier(
+					buffer,
+					VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+					VK_PIPELINE_STAGE_TRANSFER_BIT,
+					/* flags */ 0,
+					/* memoryBarrierCount */ 0,
+					/* pMemoryBarriers */ NULL,
+					/* bufferMemoryBarrierCount */ 0,
+					/* pBufferMemoryBarriers */ NULL,
+					sizeof image_memory_barriers /
+						sizeof image_memory_barriers[0],
+					image_memory_barriers);
+		}
+
+		{
+			/* one region per run of damaged rows */
+			VkImageCopy regions[BSS2K_TEXTMODE_ROWS];
+			uint32_t region_count = 0;
+
+			for(uint32_t row = 0; row < BSS2K_TEXTMODE_ROWS; )
+			{
+				if(!(g->damage & (1ULL << row)))
+				{
+					++row;
+					continue;
+				}
+
+				uint32_t const first = row;
+
+				while(row < BSS2K_TEXTMODE_ROWS && (g->damage & (1ULL << row)))
+					++row;
+
+				int32_t const y = first * BSS2K_TEXTMODE_ROW_HEIGHT;
+
+				/* the last row takes the unused lines below it along */
+				uint32_t const height = (row == BSS2K_TEXTMODE_ROWS)
+						? SCREEN_HEIGHT - y
+						: (row - first) * BSS2K_TEXTMODE_ROW_HEIGHT;
+
+				regions[region_count++] = (VkImageCopy)
+				{
+					.srcSubresource =
+					{
+						.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+						.mipLevel = 0,
+						.baseArrayLayer = 0,
+						.layerCount = 1
+					},
+					.srcOffset =
+					{
+						.x = 0,
+						.y = y,
+						.z = 0
+					},
+					.dstSubresource =
+					{
+						.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+						.mipLevel = 0,
+						.baseArrayLayer = 0,
+						.layerCount = 1
+					},
+					.dstOffset =
+					{
+						.x = 0,
+						.y = y,
+						.z = 0
+					},
+					.extent =
+					{
+						.width = SCREEN_WIDTH,
+						.height = height,
+						.depth = 1
+					}
+				};
+			}
+
+			vkCmdCopyImage(
+					buffer,
+					g->textmode_texture_external[g->textmode_buffer].image,
+					VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					g->textmode_texture_internal.image,
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					region_count,
+					regions);
+		}
+	}
+
+	/* a framebuffer replaced everything, so textmode starts over */
+	g->damage = textmode ? 0 : BSS2K_DAMAGE_ALL;
+	g->texture_valid = true;
 
 	{
 		VkImageMemoryBarrier const image_memory_barriers[] =
@@ -188,6 +499,139 @@ bool vulkan_transfer(struct global *g)
 					sizeof image_memory_barriers[0],
 				image_memory_barriers);
 	}
+}
+
+void vulkan_transfer_update(struct global *g)
+{
+	unsigned long long damage;
+
+	if(ioctl(g->bss2k_device, BSS2K_IOC_READ_DAMAGE, &damage) == -1)
+		return;
+
+	unsigned long long buffer;
+
+	if(ioctl(g->bss2k_device, BSS2K_IOC_READ_TEXTMODE_BUFFER, &buffer) == -1)
+		return;
+
+	/* the newest buffer holds every damaged row, the card writes the
+	 * others meanwhile */
+	g->damage |= damage;
+	g->textmode_buffer = buffer % BSS2K_TEXTMODE_BUFFERS;
+
+	/* the card may have written the buffer again before the copy ran,
+	 * so the draw still copies the damaged rows */
+	if(g->presubmitted &&
+			vkGetFenceStatus(g->device, g->fence.presubmit) == VK_SUCCESS)
+	{
+		vkResetFences(g->device, 1, &g->fence.presubmit);
+		g->presubmitted = false;
+	}
+}
+
+/* export the fence of the update the card is writing, if there is one */
+static int next_update_fence(struct global const *g, uint32_t index)
+{
+	if(g->textmode_dma_buf[index] == -1)
+		return -1;
+
+	struct dma_buf_export_sync_file sync_file =
+	{
+		.flags = DMA_BUF_SYNC_READ,
+		.fd = -1
+	};
+
+	if(ioctl(g->textmode_dma_buf[index], DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &sync_file) == -1)
+		return -1;
+
+	/* already signaled, no update is on its way */
+	struct pollfd pfd =
+	{
+		.fd = sync_file.fd,
+		.events = POLLIN
+	};
+
+	if(poll(&pfd, 1, /* timeout */ 0) != 0)
+	{
+		close(sync_file.fd);
+		return -1;
+	}
+
+	return sync_file.fd;
+}
+
+bool vulkan_transfer_presubmit(struct global *g)
+{
+	/* graphics mode does not return to textmode */
+	if(BSS2K_FLIP_COUNT(g->flip) != 0)
+		return false;
+
+	if(g->presubmitted)
+		return false;
+
+	/* nothing to copy, the draw samples the buffer the card wrote */
+	if(vulkan_transfer_sample_external(g))
+		return false;
+
+	uint32_t const next = (g->textmode_buffer + 1) % BSS2K_TEXTMODE_BUFFERS;
+
+	int const fence_fd = next_update_fence(g, next);
+	if(fence_fd == -1)
+		return false;
+
+	{
+		VkImportSemaphoreFdInfoKHR const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR,
+			.pNext = NULL,
+			.semaphore = g->sem.textmode_written,
+			.flags = VK_SEMAPHORE_IMPORT_TEMPORARY_BIT,
+			.handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT,
+			.fd = fence_fd
+		};
+
+		/* takes ownership of the fd on success */
+		VkResult rc = g->vkImportSemaphoreFdKHR(g->device, &info);
+		if(rc != VK_SUCCESS)
+		{
+			close(fence_fd);
+			return false;
+		}
+	}
+
+	VkCommandBuffer const buffer = g->presubmit_command_buffer;
+
+	vkResetCommandBuffer(
+			buffer,
+			/* flags */ 0);
+
+	/* begin command buffer */
+	{
+		VkCommandBufferBeginInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+			.pInheritanceInfo = NULL
+		};
+
+		VkResult rc = vkBeginCommandBuffer(buffer, &info);
+		if(rc != VK_SUCCESS)
+			goto fail_begin_command_buffer;
+	}
+
+	/* the damage is not known yet, so everything is copied */
+	{
+		uint32_t const newest = g->textmode_buffer;
+
+		g->textmode_buffer = next;
+		g->damage = BSS2K_DAMAGE_ALL;
+
+		if(vulkan_transfer_characters(g))
+			copy_characters(g, buffer);
+		else
+			copy_texture(g, buffer);
+
+		g->textmode_buffer = newest;
+	}
 
 	VkResult rc = vkEndCommandBuffer(buffer);
 	if(rc != VK_SUCCESS)
@@ -196,14 +640,12 @@ bool vulkan_transfer(struct global *g)
 	{
 		VkSemaphore const wait_semaphores[] =
 		{
+			g->sem.textmode_written
 		};
 
 		VkPipelineStageFlags wait_stages[] =
 		{
-		};
-
-		VkSemaphore const signal_semaphores[] =
-		{
+			VK_PIPELINE_STAGE_TRANSFER_BIT
 		};
 
 		/* these arrays correspond with each other and need to have the
@@ -227,9 +669,8 @@ bool vulkan_transfer(struct global *g)
 				.commandBufferCount =
 						sizeof command_buffers / sizeof command_buffers[0],
 				.pCommandBuffers = command_buffers,
-				.signalSemaphoreCount =
-						sizeof signal_semaphores / sizeof signal_semaphores[0],
-				.pSignalSemaphores = signal_semaphores
+				.signalSemaphoreCount = 0,
+				.pSignalSemaphores = NULL
 			}
 		};
 
@@ -237,11 +678,13 @@ bool vulkan_transfer(struct global *g)
 				g->queue.graphics.queue,
 				sizeof infos / sizeof infos[0],
 				infos,
-				VK_NULL_HANDLE);
+				g->fence.presubmit);
 		if(rc != VK_SUCCESS)
 			goto fail_queue_submit;
 	}
 
+	g->presubmitted = true;
+
 	return true;
 
 fail_queue_submit:
@@ -249,3 +692,62 @@ fail_end_command_buffer:
 fail_begin_command_buffer:
 	return false;
 }
+
+bool vulkan_transfer_characters(struct global const *g)
+{
+	return g->gpu_textmode && BSS2K_FLIP_COUNT(g->flip) == 0;
+}
+
+bool vulkan_transfer_sample_external(struct global const *g)
+{
+	return g->sample_external && !vulkan_transfer_characters(g) &&
+			BSS2K_FLIP_COUNT(g->flip) == 0;
+}
+
+bool vulkan_transfer(struct global *g, VkCommandBuffer buffer)
+{
+	vkResetCommandBuffer(
+			buffer,
+			/* flags */ 0);
+
+	/* begin command buffer */
+	{
+		VkCommandBufferBeginInfo const info =
+		{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+			.pInheritanceInfo = NULL
+		};
+
+		VkResult rc = vkBeginCommandBuffer(buffer, &info);
+		if(rc != VK_SUCCESS)
+			goto fail_begin_command_buffer;
+	}
+
+	if(vulkan_transfer_characters(g))
+	{
+		copy_characters(g, buffer);
+		update_cursor(g, buffer);
+	}
+	else if(vulkan_transfer_sample_external(g))
+	{
+		if(!g->external_texture_ready)
+			prepare_external_textures(g, buffer);
+
+		/* the internal texture is not kept up to date */
+		g->damage = 0;
+		g->texture_valid = false;
+	}
+	else
+		copy_texture(g, buffer);
+
+	VkResult rc = vkEndCommandBuffer(buffer);
+	if(rc != VK_SUCCESS)
+		goto fail_end_command_buffer;
+
+	return true;
+
+fail_end_command_buffer:
+fail_begin_command_buffer:
+	return false;
+}
@@ -1,7 +1,26 @@
 #pragma once
 
+#include <vulkan/vulkan.h>
+
 #include <stdbool.h>
 
 struct global;
 
-bool vulkan_transfer(struct global *g);
+/* record the copies for the next frame, submitted together with its
+ * draw */
+bool vulkan_transfer(struct global *g, VkCommandBuffer buffer);
+
+/* collect the textmode rows the card rewrote, and the buffer holding
+ * them */
+void vulkan_transfer_update(struct global *g);
+
+/* submit a copy of the update the card is writing, which the GPU starts
+ * as soon as the update completes. Only possible while the driver has a
+ * fence for it. */
+bool vulkan_transfer_presubmit(struct global *g);
+
+/* textmode is rendered from the character RAM by the textmode pipeline */
+bool vulkan_transfer_characters(struct global const *g);
+
+/* textmode is rendered by sampling the newest textmode buffer in place */
+bool vulkan_transfer_sample_external(struct global const *g);
@@ -10,6 +10,8 @@
 #include "vulkan_pipeline.h"
 
 #include "vulkan_draw.h"
+#include "vulkan_framebuffers.h"
+#include "vulkan_transfer.h"
 
 #include "bss2kdpy.h"
 
@@ -205,9 +207,14 @@ bool x11_mainloop(struct global *g)
 
 			if(FD_ISSET(bss2k_fd, &readfds))
 			{
-				/* display update */
+				/* display update or flip */
+				vulkan_framebuffers_update(g);
+				vulkan_transfer_update(g);
 				if(g->mapped && g->visible)
+				{
 					vulkan_draw(g);
+					vulkan_transfer_presubmit(g);
+				}
 			}
 			if(!FD_ISSET(x11_fd, &readfds))
 				continue;
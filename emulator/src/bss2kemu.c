@@ -0,0 +1,106 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Run a command with the emulator preloaded, like
+ *
+ *   bss2kemu -s ../src/bss2krun --test-name ... program.backseat
+ *
+ * The library is searched next to this program first, so it can be used
+ * from the build directory. */
+
+static char const library_name[] = "libbss2kemu.so";
+
+static bool find_library(char *path, size_t size)
+{
+	char self[PATH_MAX];
+
+	ssize_t const len = readlink("/proc/self/exe", self, sizeof self - 1);
+	if(len > 0)
+	{
+		self[len] = '\0';
+		char *const slash = strrchr(self, '/');
+		if(slash)
+		{
+			*slash = '\0';
+			int const n = snprintf(path, size, "%s/%s", self, library_name);
+			if(n > 0 && (size_t)n < size && !access(path, R_OK))
+				return true;
+		}
+	}
+
+	snprintf(path, size, "%s/%s", BSS2KEMU_LIBDIR, library_name);
+	return !access(path, R_OK);
+}
+
+static void usage(char const *argv0)
+{
+	fprintf(stderr,
+			"Usage: %s [-s] [--] command [args...]\n"
+			"\n"
+			"  -s  report instructions per second when the CPU stops\n",
+			argv0);
+}
+
+int main(int argc, char **argv)
+{
+	bool stats = false;
+
+	int opt;
+	while((opt = getopt(argc, argv, "+sh")) != -1)
+	{
+		switch(opt)
+		{
+		case 's':
+			stats = true;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind == argc)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	char library[PATH_MAX];
+	if(!find_library(library, sizeof library))
+	{
+		fprintf(stderr, "Cannot find %s\n", library_name);
+		return 1;
+	}
+
+	char const *const preload = getenv("LD_PRELOAD");
+	if(preload && *preload)
+	{
+		size_t const size = strlen(library) + 1 + strlen(preload) + 1;
+		char *const value = malloc(size);
+		if(!value)
+			return 1;
+		snprintf(value, size, "%s:%s", library, preload);
+		setenv("LD_PRELOAD", value, 1);
+		free(value);
+	}
+	else
+		setenv("LD_PRELOAD", library, 1);
+
+	if(stats)
+		setenv("BSS2KEMU_STATS", "1", 1);
+
+	execvp(argv[optind], argv + optind);
+	perror(argv[optind]);
+	return 127;
+}
@@ -0,0 +1,515 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "cpu.h"
+
+#include <endian.h>
+#include <string.h>
+#include <time.h>
+
+/* Instruction semantics follow logic/cpu/cpu_pipelined.vhdl, which
+ * implements the complete decode table of cpu_sequential.vhdl. */
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static inline uint64_t fetch(struct cpu const *cpu, uint32_t address)
+{
+	uint64_t insn;
+	memcpy(&insn, cpu->mem + (address & ADDRESS_MASK & ~7U), sizeof insn);
+	return be64toh(insn);
+}
+
+static inline uint32_t load(struct cpu const *cpu, uint32_t address)
+{
+	uint32_t word;
+	memcpy(&word, cpu->mem + (address & ADDRESS_MASK & ~3U), sizeof word);
+	return be32toh(word);
+}
+
+static inline void store(struct cpu *cpu, uint32_t address, uint32_t value)
+{
+	uint32_t const word = htobe32(value);
+	memcpy(cpu->mem + (address & ADDRESS_MASK & ~3U), &word, sizeof word);
+	/* the textmode output snoops the unaligned address */
+	if((address & ADDRESS_MASK) < TEXTMODE_RAM_SIZE)
+	{
+		uint32_t const offset = address & (TEXTMODE_RAM_SIZE - 1);
+		cpu->textmode[offset] = (unsigned char)value;
+		/* the cursor words behind the last row are not displayed */
+		if(offset < TEXTMODE_COLUMNS * TEXTMODE_ROWS)
+			atomic_fetch_or_explicit(
+					&cpu->textmode_dirty,
+					1U << (offset / TEXTMODE_COLUMNS),
+					memory_order_relaxed);
+	}
+}
+
+/* one record per instruction or sample, see
+ * logic/board_phi/trace_output.vhdl. Every instruction takes a cycle here. */
+static void trace(struct cpu *cpu, uint32_t ip, unsigned int opcode)
+{
+	uint32_t const period = atomic_load_explicit(&cpu->trace_period, memory_order_relaxed);
+	if(period)
+	{
+		/* the period may have been shortened meanwhile */
+		if(cpu->trace_countdown > period)
+			cpu->trace_countdown = period;
+		if(--cpu->trace_countdown)
+			return;
+		cpu->trace_countdown = period;
+	}
+
+	uint32_t producer = atomic_load_explicit(&cpu->trace_producer, memory_order_relaxed);
+	uint32_t const consumer = atomic_load_explicit(&cpu->trace_consumer, memory_order_acquire);
+
+	if(producer - consumer > cpu->trace_mask)
+	{
+		atomic_fetch_add_explicit(&cpu->trace_dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	uint64_t const cycles = !producer ? 0 : period ? period : 1;
+	cpu->trace[producer & cpu->trace_mask] =
+			htole64((cycles << 40) | ((uint64_t)opcode << 24) | (ip & ADDRESS_MASK));
+
+	/* fails when tracing was restarted meanwhile, the record is in a slot
+	 * the new producer has not reached yet */
+	atomic_compare_exchange_strong_explicit(
+			&cpu->trace_producer, &producer, producer + 1,
+			memory_order_release, memory_order_relaxed);
+}
+
+/* CHECKPOINT, PRINTREGISTER and the other debug opcodes, see
+ * logic/board_phi/event_output.vhdl */
+static void debug_event(
+		struct cpu *cpu,
+		uint32_t ip,
+		unsigned int opcode,
+		unsigned int reg,
+		uint32_t value,
+		uint64_t cycles)
+{
+	/* the CPU thread is the only writer */
+	uint32_t const producer = atomic_load_explicit(&cpu->event_producer, memory_order_relaxed);
+	uint32_t const consumer = atomic_load_explicit(&cpu->event_consumer, memory_order_acquire);
+
+	if(producer - consumer > cpu->event_mask)
+	{
+		atomic_fetch_add_explicit(&cpu->event_dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	uint64_t *const event = &cpu->events[(producer & cpu->event_mask) * 2];
+	event[0] = htole64(((uint64_t)reg << 40) | ((uint64_t)opcode << 24) | (ip & ADDRESS_MASK));
+	event[1] = htole64((cycles << 32) | value);
+
+	atomic_store_explicit(&cpu->event_producer, producer + 1, memory_order_release);
+}
+
+/* JUMPif conditions, in opcode order */
+static inline bool ternary_condition(unsigned int n, uint32_t v)
+{
+	int32_t const s = (int32_t)v;
+	switch(n)
+	{
+	case 0:		return s == 0;
+	case 1:		return s > 0;
+	case 2:		return s >= 0;
+	case 3:		return s < 0;
+	default:	return s <= 0;
+	}
+}
+
+/* JUMPeq .. JUMPle and CMPeq .. CMPle conditions, in opcode order */
+static inline bool flag_condition(unsigned int n, bool c, bool z)
+{
+	switch(n)
+	{
+	case 0:		return z;
+	case 1:		return !z;
+	case 2:		return !c && !z;
+	case 3:		return !c;
+	case 4:		return c;
+	default:	return c || z;
+	}
+}
+
+void cpu_reset(struct cpu *cpu)
+{
+	memset(cpu->r, 0, sizeof cpu->r);
+	cpu->r[REG_IP] = ENTRY_POINT;
+	cpu->r[REG_SP] = STACK_START;
+	cpu->c = false;
+	cpu->z = false;
+	cpu->front_framebuffer = false;
+	cpu->swapped = false;
+	cpu->halted = false;
+	cpu->assertion_failed = false;
+	cpu->instructions = 0;
+	cpu->start_ms = now_ms();
+}
+
+uint64_t cpu_run(struct cpu *cpu, uint64_t count)
+{
+	uint32_t *const r = cpu->r;
+
+	bool c = cpu->c;
+	bool z = cpu->z;
+
+	uint64_t executed = 0;
+
+	while(executed < count)
+	{
+		uint32_t const ip = r[REG_IP];
+		uint64_t const insn = fetch(cpu, ip);
+
+		unsigned int const opcode = insn >> 48;
+		unsigned int const reg1 = (insn >> 40) & 0xff;
+		unsigned int const reg2 = (insn >> 32) & 0xff;
+		unsigned int const reg3 = (insn >> 24) & 0xff;
+		unsigned int const reg4 = (insn >> 16) & 0xff;
+		uint32_t const imm = (uint32_t)insn;
+
+		if(atomic_load_explicit(&cpu->tracing, memory_order_relaxed))
+			trace(cpu, ip, opcode);
+
+		/* increment by eight, because instructions are 64 bit */
+		uint32_t next = ip + 8;
+
+		bool halting = false;
+		bool swapping = false;
+
+		uint64_t tmp;
+		uint32_t a, b;
+
+		/* writing ip is a jump, so all writes go through here after
+		 * the operands have been read */
+#define WRITE(reg, value) \
+		do { \
+			uint32_t const v_ = (value); \
+			if((reg) == REG_IP) \
+				next = v_; \
+			else \
+				r[(reg)] = v_; \
+		} while(0)
+
+#define SET_FLAGS(carry, result) \
+		do { \
+			c = (carry); \
+			z = ((result) == 0); \
+		} while(0)
+
+		switch(opcode)
+		{
+		case 0x0000:
+			/* LI */
+			WRITE(reg1, imm);
+			break;
+		case 0x0001:
+			/* LD abs */
+			WRITE(reg1, load(cpu, imm));
+			break;
+		case 0x0002:
+			/* MOV */
+			WRITE(reg1, r[reg2]);
+			break;
+		case 0x0003:
+			/* ST abs */
+			store(cpu, imm, r[reg1]);
+			break;
+		case 0x0004:
+			/* LD [r] */
+			WRITE(reg1, load(cpu, r[reg2]));
+			break;
+		case 0x0005:
+			/* ST [r] */
+			store(cpu, r[reg1], r[reg2]);
+			break;
+		case 0x0006:
+			/* HCF */
+			halting = true;
+			break;
+		case 0x0007:
+			/* ADD */
+			tmp = (uint64_t)r[reg2] + r[reg3];
+			WRITE(reg1, (uint32_t)tmp);
+			SET_FLAGS((tmp >> 32) & 1, (uint32_t)tmp);
+			break;
+		case 0x0008:
+			/* SUB */
+			tmp = (uint64_t)r[reg2] - r[reg3];
+			WRITE(reg1, (uint32_t)tmp);
+			SET_FLAGS((tmp >> 32) & 1, (uint32_t)tmp);
+			break;
+		case 0x0009:
+			/* SBC */
+			tmp = (uint64_t)r[reg2] - r[reg3] - c;
+			WRITE(reg1, (uint32_t)tmp);
+			SET_FLAGS((tmp >> 32) & 1, (uint32_t)tmp);
+			break;
+		case 0x000a:
+			/* MUL */
+			tmp = (uint64_t)r[reg3] * r[reg4];
+			WRITE(reg1, (uint32_t)(tmp >> 32));
+			WRITE(reg2, (uint32_t)tmp);
+			SET_FLAGS(false, tmp);
+			break;
+		case 0x000b:
+			/* DIVMOD, division by zero returns all ones and the dividend */
+			a = r[reg3];
+			b = r[reg4];
+			if(b)
+			{
+				WRITE(reg1, a / b);
+				WRITE(reg2, a % b);
+			}
+			else
+			{
+				WRITE(reg1, 0xffffffffU);
+				WRITE(reg2, a);
+			}
+			break;
+		case 0x000c:
+			/* AND */
+			a = r[reg2] & r[reg3];
+			WRITE(reg1, a);
+			SET_FLAGS(false, a);
+			break;
+		case 0x000d:
+			/* OR */
+			a = r[reg2] | r[reg3];
+			WRITE(reg1, a);
+			SET_FLAGS(false, a);
+			break;
+		case 0x000e:
+			/* XOR */
+			a = r[reg2] ^ r[reg3];
+			WRITE(reg1, a);
+			SET_FLAGS(false, a);
+			break;
+		case 0x000f:
+			/* NOT */
+			a = ~r[reg2];
+			WRITE(reg1, a);
+			SET_FLAGS(false, a);
+			break;
+		case 0x0010:
+			/* SHL, 33 bit wide */
+			b = (r[reg3] > 63) ? 63 : r[reg3];
+			tmp = (uint64_t)r[reg2] << b;
+			WRITE(reg1, (uint32_t)tmp);
+			SET_FLAGS((tmp >> 32) & 1, (uint32_t)tmp);
+			break;
+		case 0x0011:
+			/* SHR, 33 bit wide, carry is the last bit shifted out */
+			b = (r[reg3] > 63) ? 63 : r[reg3];
+			tmp = ((uint64_t)r[reg2] << 1) >> b;
+			WRITE(reg1, (uint32_t)(tmp >> 1));
+			SET_FLAGS(tmp & 1, (uint32_t)(tmp >> 1));
+			break;
+		case 0x0012:
+			/* ADDI */
+			tmp = (uint64_t)r[reg2] + imm;
+			WRITE(reg1, (uint32_t)tmp);
+			SET_FLAGS((tmp >> 32) & 1, (uint32_t)tmp);
+			break;
+		case 0x0013:
+			/* SUBI */
+			tmp = (uint64_t)r[reg2] - imm;
+			WRITE(reg1, (uint32_t)tmp);
+			SET_FLAGS((tmp >> 32) & 1, (uint32_t)tmp);
+			break;
+		case 0x0014:
+			/* CMP */
+			a = r[reg2];
+			b = r[reg3];
+			if(a == b)
+				WRITE(reg1, 0x00000000U);
+			else if(a > b)
+				WRITE(reg1, 0x00000001U);
+			else
+				WRITE(reg1, 0xffffffffU);
+			c = (a < b);
+			z = (a == b);
+			break;
+		case 0x0015:
+			/* PUSH */
+			a = r[REG_SP];
+			store(cpu, a, r[reg1]);
+			WRITE(REG_SP, a - 4);
+			break;
+		case 0x0016:
+			/* POP */
+			a = r[REG_SP] + 4;
+			b = load(cpu, a);
+			WRITE(REG_SP, a);
+			WRITE(reg1, b);
+			break;
+		case 0x0017:
+		case 0x0036:
+		case 0x0037:
+			/* CALL, CALL [register], CALL [[register]] */
+			if(opcode == 0x0017)
+				b = imm;
+			else if(opcode == 0x0036)
+				b = r[reg1];
+			else
+				b = load(cpu, r[reg1]);
+			a = r[REG_SP];
+			store(cpu, a, ip + 8);
+			WRITE(REG_SP, a - 4);
+			next = b;
+			break;
+		case 0x0018:
+			/* RET */
+			a = r[REG_SP] + 4;
+			WRITE(REG_SP, a);
+			next = load(cpu, a);
+			break;
+		case 0x0019:
+			/* JUMP */
+			next = imm;
+			break;
+		case 0x001a:
+			/* JUMP [register] */
+			next = r[reg1];
+			break;
+		case 0x001b: case 0x001c: case 0x001d: case 0x001e: case 0x001f:
+			/* JUMPif register, address */
+			if(ternary_condition(opcode - 0x001b, r[reg1]))
+				next = imm;
+			break;
+		case 0x0020: case 0x0021: case 0x0022: case 0x0023: case 0x0024: case 0x0025:
+			/* JUMPxx address */
+			if(flag_condition(opcode - 0x0020, c, z))
+				next = imm;
+			break;
+		case 0x0026: case 0x0027: case 0x0028: case 0x0029: case 0x002a:
+			/* JUMPif register, [register] */
+			if(ternary_condition(opcode - 0x0026, r[reg2]))
+				next = r[reg1];
+			break;
+		case 0x002b: case 0x002c: case 0x002d: case 0x002e: case 0x002f: case 0x0030:
+			/* JUMPxx [register] */
+			if(flag_condition(opcode - 0x002b, c, z))
+				next = r[reg1];
+			break;
+		case 0x0031:
+			/* NOP */
+			break;
+		case 0x0032:
+			/* GETKEYSTATE, there is no keyboard */
+			WRITE(reg1, 0);
+			break;
+		case 0x0033:
+			/* POLL_TIME */
+			tmp = now_ms() - cpu->start_ms;
+			WRITE(reg1, (uint32_t)(tmp >> 32));
+			WRITE(reg2, (uint32_t)tmp);
+			break;
+		case 0x0034:
+			/* ADDC */
+			tmp = (uint64_t)r[reg2] + r[reg3] + c;
+			WRITE(reg1, (uint32_t)tmp);
+			SET_FLAGS((tmp >> 32) & 1, (uint32_t)tmp);
+			break;
+		case 0x0035:
+			/* SWAPFRAMEBUFFERS */
+			cpu->front_framebuffer = !cpu->front_framebuffer;
+			swapping = true;
+			break;
+		case 0x0038:
+			/* INVISIBLEFRAMEBUFFERADDRESS */
+			WRITE(reg1, cpu->front_framebuffer
+					? FIRST_FRAMEBUFFER_START
+					: SECOND_FRAMEBUFFER_START);
+			break;
+		case 0x0039:
+			/* POLL_CYCLECOUNT, one cycle per instruction */
+			tmp = cpu->instructions + executed;
+			WRITE(reg1, (uint32_t)(tmp >> 32));
+			WRITE(reg2, (uint32_t)tmp);
+			break;
+		case 0x003a: case 0x003b: case 0x003c: case 0x003d: case 0x003e: case 0x003f:
+			/* CMPxx, unsigned like CMP, flags are not changed */
+			a = r[reg2];
+			b = r[reg3];
+			WRITE(reg1, flag_condition(opcode - 0x003a, a < b, a == b) ? 1 : 0);
+			break;
+		case 0x0040:
+			/* POP <discard> */
+			WRITE(REG_SP, r[REG_SP] + 4);
+			break;
+		case 0xfff8:
+			/* CHECKPOINT */
+			debug_event(cpu, ip, opcode, reg1, imm,
+					(uint32_t)(cpu->instructions + executed));
+			break;
+		case 0xfff9:
+			/* PRINTREGISTER */
+			debug_event(cpu, ip, opcode, reg1, r[reg1],
+					(uint32_t)(cpu->instructions + executed));
+			break;
+		case 0xfffa:
+		case 0xfffe:
+		case 0xffff:
+			/* DEBUGBREAK, DUMPMEMORY, DUMPREGISTERS, reported but
+			 * nothing is dumped */
+			debug_event(cpu, ip, opcode, reg1, 0,
+					(uint32_t)(cpu->instructions + executed));
+			break;
+		case 0xfffb:
+			/* ASSERT [register] == immediate */
+			if(load(cpu, r[reg1]) != imm)
+				cpu->assertion_failed = halting = true;
+			break;
+		case 0xfffc:
+			/* ASSERT register == immediate */
+			if(r[reg1] != imm)
+				cpu->assertion_failed = halting = true;
+			break;
+		case 0xfffd:
+			/* ASSERT register == register */
+			if(r[reg2] != r[reg1])
+				cpu->assertion_failed = halting = true;
+			break;
+		default:
+			/* invalid opcode */
+			halting = true;
+			break;
+		}
+
+#undef SET_FLAGS
+#undef WRITE
+
+		++executed;
+
+		if(halting)
+		{
+			/* halted instructions do not advance */
+			cpu->halted = true;
+			break;
+		}
+
+		r[REG_IP] = next;
+
+		if(swapping)
+		{
+			/* return, so the flip is signalled before drawing goes on */
+			cpu->swapped = true;
+			break;
+		}
+	}
+
+	cpu->c = c;
+	cpu->z = z;
+	cpu->instructions += executed;
+
+	return executed;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* memory map, see logic/cpu/bss2k.vhdl */
+#define ADDRESS_MASK			0xffffffU
+#define TEXTMODE_RAM_SIZE		0x800U
+#define TEXTMODE_COLUMNS		80U
+#define TEXTMODE_ROWS			25U
+#define FIRST_FRAMEBUFFER_START		0x0007d8U
+#define SECOND_FRAMEBUFFER_START	0x0a93d8U
+#define STACK_START			0x151fd8U
+#define ENTRY_POINT			0x1d1fd8U
+
+/* special registers */
+#define REG_IP				0xfe
+#define REG_SP				0xff
+
+struct cpu
+{
+	uint32_t r[256];
+
+	/* flags */
+	bool c;
+	bool z;
+
+	bool front_framebuffer;
+	/* set by SWAPFRAMEBUFFERS, cleared by the caller */
+	bool swapped;
+
+	bool halted;
+	bool assertion_failed;
+
+	/* instructions executed since reset, also the cycle counter */
+	uint64_t instructions;
+
+	/* CLOCK_MONOTONIC at reset, in ms, for POLLTIME */
+	uint64_t start_ms;
+
+	/* 16 MiB of memory, words are big endian */
+	unsigned char *mem;
+
+	/* character RAM of the textmode output, written by stores to the
+	 * first 2 KiB */
+	unsigned char *textmode;
+
+	/* rows of the character RAM written since the last display update,
+	 * bit n for row n, taken by the device */
+	atomic_uint textmode_dirty;
+
+	/* instruction trace ring of trace_mask + 1 records, written while
+	 * tracing is set, see BSS2K_IOC_TRACE_START */
+	uint64_t *trace;
+	uint32_t trace_mask;
+	atomic_bool tracing;
+
+	/* instructions between samples, or zero to record every one, and
+	 * those left until the next sample */
+	atomic_uint_least32_t trace_period;
+	uint32_t trace_countdown;
+
+	/* records written and read since tracing started, and lost because
+	 * the ring was full. The device clears them while the CPU runs. */
+	atomic_uint_least32_t trace_producer;
+	atomic_uint_least32_t trace_consumer;
+	atomic_uint_least32_t trace_dropped;
+
+	/* debug event ring of event_mask + 1 events, two words each, see
+	 * BSS2K_EVENT_OFFSET. Events written, read, and lost because the ring
+	 * was full; the device clears them while the CPU is stopped. */
+	uint64_t *events;
+	uint32_t event_mask;
+	atomic_uint_least32_t event_producer;
+	atomic_uint_least32_t event_consumer;
+	atomic_uint_least32_t event_dropped;
+};
+
+/* reset registers and flags, memory is not touched */
+void cpu_reset(struct cpu *);
+
+/* execute up to count instructions, stopping early on halt and after
+ * SWAPFRAMEBUFFERS. Returns the number of instructions executed. */
+uint64_t cpu_run(struct cpu *, uint64_t count);
@@ -0,0 +1,1267 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "device.h"
+
+#include "cpu.h"
+#include "textmode.h"
+
+#include <bss2k_ioctl.h>
+
+#include <sys/eventfd.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if HAVE_LINUX_UDMABUF_H
+#include <linux/udmabuf.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* register bits, see linux/bss2k.c */
+#define STS_RUNNING		(1ULL << 0)
+#define STS_ASSERTION_FAILED	(1ULL << 2)
+
+#define CTL_RESET		(1ULL << 0)
+#define CTL_UPDATEDISPLAY	(1ULL << 1)
+#define CTL_FLUSH		(1ULL << 2)
+#define CTL_TEXTMODE_CHARACTERS	(1ULL << 3)
+
+#define INT_HALTED		(1ULL << 0)
+#define INT_DISPLAY		(1ULL << 1)
+#define INT_FLIP		(1ULL << 2)
+#define INT_FRONT_FRAMEBUFFER	(1ULL << 3)
+#define INT_TEXTMODE_NEWEST_SHIFT	4
+#define INT_ASSERTION		(1ULL << 6)
+#define INT_TRACE_WATERMARK	(1ULL << 7)
+
+#define INT_SOURCES		(INT_HALTED | INT_DISPLAY | INT_FLIP | INT_TRACE_WATERMARK)
+
+#define FRAMEBUFFER_SIZE	(BSS2K_FRAMEBUFFER_WIDTH * BSS2K_FRAMEBUFFER_HEIGHT * 4)
+
+/* instructions between checks for a reset from the host */
+#define CPU_SLICE		65536
+
+/* write TLPs per rendered character row, see textmode_output.vhdl, and
+ * for the character RAM */
+#define TEXTMODE_ROW_PACKETS		105
+#define TEXTMODE_CHARACTER_PACKETS	8
+
+/* processes attached to the board at the same time */
+#define BOARD_USERS		16
+
+/* shared memory segment holding the board, named after the device node,
+ * see preload.c */
+static char const board_name[] = "/bss2kemu-0";
+
+/* memory files shared between the processes attached to the board. They
+ * are memfds, so udmabuf can export them, and are passed on by opening
+ * them through /proc from a process that has them open already. */
+#define SHARED_MEMORY		0
+#define SHARED_TRACE		1
+#define SHARED_EVENTS		2
+#define SHARED_TEXTURE		3
+#define SHARED_FILES		(SHARED_TEXTURE + BSS2K_TEXTMODE_BUFFERS)
+
+struct device_file
+{
+	struct device_file *next;
+
+	/* eventfd handed to the application */
+	int fd;
+
+	int64_t pos;
+
+	/* halts and trace watermarks reported by poll so far */
+	uint64_t last_halt;
+	uint64_t last_trace;
+};
+
+/* The board state, shared by all processes that opened the device. The
+ * CPU runs in a thread of the process that released it from reset, and
+ * is held in reset again when that process exits. */
+static struct board
+{
+	/* robust, so a process dying with the lock held does not stop the
+	 * others */
+	pthread_mutex_t lock;
+
+	/* signaled when the CPU halts or is reset, see BSS2K_IOC_WAIT_HALT */
+	pthread_cond_t halt_cond;
+
+	/* signaled when an interrupt is raised, each process then wakes up
+	 * its own files */
+	pthread_cond_t irq_cond;
+	uint64_t irq_count;
+
+	/* inode of each shared file, and the descriptors each attached
+	 * process holds them under, or -1 */
+	ino_t shared_ino[SHARED_FILES];
+	struct
+	{
+		pid_t pid;
+		int fd[SHARED_FILES];
+	} users[BOARD_USERS];
+
+	/* buffer the next update goes to, and the last one completed */
+	unsigned int texture_current;
+	unsigned int texture_newest;
+
+	/* rows written before the previous updates, newest first, which
+	 * the current buffer has not seen yet */
+	uint32_t textmode_history[BSS2K_TEXTMODE_BUFFERS - 1];
+
+	unsigned char textmode[TEXTMODE_RAM_SIZE];
+
+	uint64_t control;
+	uint64_t int_mask;
+	/* masked interrupt status at the last update, to find edges */
+	uint64_t int_pending;
+
+	bool halted;
+	bool assertion_failed;
+	bool display_updated;
+
+	/* halt and trace watermark interrupts raised, reported as POLLPRI
+	 * and POLLRDBAND */
+	uint64_t halt_count;
+	uint64_t trace_count;
+
+	/* front framebuffer and flip count, see BSS2K_IOC_READ_FLIP */
+	uint64_t flip;
+
+	/* rows sent by display updates, see BSS2K_IOC_READ_DAMAGE */
+	uint64_t damage;
+
+	/* see BSS2K_IOC_READ_COUNTERS, instructions are published by the
+	 * CPU thread after each slice */
+	atomic_uint_least64_t instructions;
+	uint64_t textmode_packets;
+
+	/* the pointers in it are only valid in the process running it */
+	struct cpu cpu;
+	/* process running the CPU thread, cleared by the thread on exit */
+	pid_t runner;
+	bool thread_running;
+	atomic_bool stop;
+} *board;
+
+/* this process' view of the board */
+static struct device
+{
+	/* the board segment, also locked while attaching */
+	int board_fd;
+
+	/* emulated memory, shared with mappings of the device node */
+	int memory_fd;
+	unsigned char *memory;
+
+	/* instruction trace ring, mapped at BSS2K_TRACE_OFFSET */
+	int trace_fd;
+	uint64_t *trace;
+
+	/* debug event ring, mapped at BSS2K_EVENT_OFFSET */
+	int event_fd;
+	uint64_t *events;
+
+	/* textmode texture buffers, and the dma_buf exported for each if
+	 * udmabuf is available */
+	struct
+	{
+		int fd;
+		int dmabuf_fd;
+		unsigned char *data;
+	} texture[BSS2K_TEXTMODE_BUFFERS];
+
+	/* slot in board->users, BOARD_USERS until registered */
+	unsigned int user;
+
+	bool stats;
+
+	pthread_mutex_t files_lock;
+	struct device_file *files;
+} dev =
+{
+	.user = BOARD_USERS,
+	.files_lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static pthread_once_t dev_once = PTHREAD_ONCE_INIT;
+static bool dev_ok;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int *device_shared_fd(unsigned int index)
+{
+	switch(index)
+	{
+	case SHARED_MEMORY:	return &dev.memory_fd;
+	case SHARED_TRACE:	return &dev.trace_fd;
+	case SHARED_EVENTS:	return &dev.event_fd;
+	default:		return &dev.texture[index - SHARED_TEXTURE].fd;
+	}
+}
+
+static void board_lock(void)
+{
+	if(pthread_mutex_lock(&board->lock) == EOWNERDEAD)
+		pthread_mutex_consistent(&board->lock);
+}
+
+static void board_unlock(void)
+{
+	pthread_mutex_unlock(&board->lock);
+}
+
+/* wait with the lock held, like pthread_cond_timedwait */
+static int board_wait(pthread_cond_t *cond, struct timespec const *deadline)
+{
+	int const err = deadline
+			? pthread_cond_timedwait(cond, &board->lock, deadline)
+			: pthread_cond_wait(cond, &board->lock);
+	if(err == EOWNERDEAD)
+	{
+		pthread_mutex_consistent(&board->lock);
+		return 0;
+	}
+	return err;
+}
+
+static bool process_alive(pid_t pid)
+{
+	return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+static int memfd_sized(char const *name, unsigned int flags, size_t size)
+{
+	int const fd = memfd_create(name, MFD_CLOEXEC|flags);
+	if(fd == -1)
+		return -1;
+	if(ftruncate(fd, size) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void device_texture_setup(unsigned int index)
+{
+	dev.texture[index].dmabuf_fd = -1;
+
+	if(dev.texture[index].fd == -1)
+		return;
+	dev.texture[index].data = mmap(NULL, TEXTMODE_TEXTURE_SIZE,
+			PROT_READ|PROT_WRITE, MAP_SHARED, dev.texture[index].fd, 0);
+	if(dev.texture[index].data == MAP_FAILED)
+		goto fail;
+
+#if HAVE_LINUX_UDMABUF_H
+	/* a real dma_buf can be imported by Vulkan */
+	if(fcntl(dev.texture[index].fd, F_ADD_SEALS, F_SEAL_SHRINK) == -1)
+		return;
+
+	int const udmabuf = open("/dev/udmabuf", O_RDWR|O_CLOEXEC);
+	if(udmabuf == -1)
+		return;
+
+	struct udmabuf_create create =
+	{
+		.memfd = dev.texture[index].fd,
+		.flags = UDMABUF_FLAGS_CLOEXEC,
+		.offset = 0,
+		.size = TEXTMODE_TEXTURE_SIZE
+	};
+
+	int const rc = ioctl(udmabuf, UDMABUF_CREATE, &create);
+	if(rc != -1)
+		dev.texture[index].dmabuf_fd = rc;
+
+	close(udmabuf);
+#endif
+	return;
+
+fail:
+	dev.texture[index].data = NULL;
+	close(dev.texture[index].fd);
+	dev.texture[index].fd = -1;
+}
+
+/* a new board, held in reset like after probe. Called with the segment
+ * locked, when no other process is attached. */
+static bool board_create(void)
+{
+	memset(board, 0, sizeof *board);
+
+	pthread_mutexattr_t mutex_attr;
+	if(pthread_mutexattr_init(&mutex_attr))
+		return false;
+	pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+	int err = pthread_mutex_init(&board->lock, &mutex_attr);
+	pthread_mutexattr_destroy(&mutex_attr);
+	if(err)
+		return false;
+
+	/* timeouts are measured like in the driver, unaffected by changes
+	 * of the wall clock */
+	pthread_condattr_t attr;
+	if(pthread_condattr_init(&attr))
+		return false;
+	pthread_condattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	err = pthread_cond_init(&board->halt_cond, &attr);
+	if(!err)
+		err = pthread_cond_init(&board->irq_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if(err)
+		return false;
+
+	dev.memory_fd = memfd_sized("bss2k-memory", MFD_ALLOW_SEALING, BSS2K_MEMORY_SIZE);
+	if(dev.memory_fd == -1)
+		return false;
+	/* allows exporting framebuffers through udmabuf */
+	fcntl(dev.memory_fd, F_ADD_SEALS, F_SEAL_SHRINK);
+
+	/* the textures are optional */
+	for(unsigned int i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+	{
+		dev.texture[i].fd = memfd_sized("bss2k-textmode", MFD_ALLOW_SEALING,
+				TEXTMODE_TEXTURE_SIZE);
+		/* no buffer has seen any row yet */
+		if(i > 0)
+			board->textmode_history[i - 1] = BSS2K_DAMAGE_ALL;
+	}
+
+	dev.trace_fd = memfd_sized("bss2k-trace", 0, BSS2K_TRACE_SIZE);
+	if(dev.trace_fd == -1)
+		return false;
+	atomic_init(&board->cpu.tracing, false);
+	atomic_init(&board->cpu.trace_period, 0);
+	atomic_init(&board->cpu.trace_producer, 0);
+	atomic_init(&board->cpu.trace_consumer, 0);
+	atomic_init(&board->cpu.trace_dropped, 0);
+
+	dev.event_fd = memfd_sized("bss2k-events", 0, BSS2K_EVENT_SIZE);
+	if(dev.event_fd == -1)
+		return false;
+	atomic_init(&board->cpu.event_producer, 0);
+	atomic_init(&board->cpu.event_consumer, 0);
+	atomic_init(&board->cpu.event_dropped, 0);
+
+	for(unsigned int i = 0; i < SHARED_FILES; ++i)
+	{
+		struct stat st;
+		int const fd = *device_shared_fd(i);
+		board->shared_ino[i] = (fd != -1 && fstat(fd, &st) == 0) ? st.st_ino : 0;
+	}
+
+	/* the buffer being written always follows the newest one */
+	board->texture_newest = BSS2K_TEXTMODE_BUFFERS - 1;
+
+	/* the first update renders everything */
+	atomic_init(&board->cpu.textmode_dirty, BSS2K_DAMAGE_ALL);
+
+	/* held in reset, like after probe */
+	board->control = CTL_RESET;
+	atomic_init(&board->instructions, 0);
+	atomic_init(&board->stop, false);
+
+	return true;
+}
+
+static void close_shared_files(void)
+{
+	for(unsigned int i = 0; i < SHARED_FILES; ++i)
+	{
+		int *const fd = device_shared_fd(i);
+		if(*fd != -1)
+			close(*fd);
+		*fd = -1;
+	}
+}
+
+/* open the shared files from one of the attached processes, called with
+ * the segment locked. Fails if none of them is alive any more. */
+static bool board_attach(void)
+{
+	for(unsigned int u = 0; u < BOARD_USERS; ++u)
+	{
+		pid_t const pid = board->users[u].pid;
+		if(!process_alive(pid))
+			continue;
+
+		bool ok = true;
+		for(unsigned int i = 0; ok && i < SHARED_FILES; ++i)
+		{
+			int const their_fd = board->users[u].fd[i];
+			if(their_fd == -1)
+				continue;
+
+			char path[64];
+			snprintf(path, sizeof path, "/proc/%d/fd/%d", (int)pid, their_fd);
+
+			int const fd = open(path, O_RDWR|O_CLOEXEC);
+			struct stat st;
+			*device_shared_fd(i) = fd;
+			/* the process may have exited and its pid been reused */
+			ok = fd != -1 && fstat(fd, &st) == 0 && st.st_ino == board->shared_ino[i];
+		}
+		if(ok)
+			return true;
+
+		close_shared_files();
+	}
+	return false;
+}
+
+/* enter this process into board->users, replacing one that is gone */
+static bool board_register(void)
+{
+	for(unsigned int u = 0; u < BOARD_USERS; ++u)
+	{
+		if(process_alive(board->users[u].pid))
+			continue;
+
+		board->users[u].pid = getpid();
+		for(unsigned int i = 0; i < SHARED_FILES; ++i)
+			board->users[u].fd[i] = *device_shared_fd(i);
+		dev.user = u;
+		return true;
+	}
+	return false;
+}
+
+static void *device_irq_thread(void *arg)
+{
+	(void)arg;
+
+	board_lock();
+	uint64_t seen = board->irq_count;
+	for(;;)
+	{
+		while(board->irq_count == seen)
+			board_wait(&board->irq_cond, NULL);
+		seen = board->irq_count;
+		board_unlock();
+
+		pthread_mutex_lock(&dev.files_lock);
+		for(struct device_file *file = dev.files; file; file = file->next)
+			eventfd_write(file->fd, 1);
+		pthread_mutex_unlock(&dev.files_lock);
+
+		board_lock();
+	}
+	return NULL;
+}
+
+static void device_setup(void)
+{
+	dev.memory_fd = -1;
+	dev.trace_fd = -1;
+	dev.event_fd = -1;
+	for(unsigned int i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+		dev.texture[i].fd = -1;
+
+	dev.board_fd = shm_open(board_name, O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+	if(dev.board_fd == -1)
+		return;
+
+	/* one process at a time creates the board or attaches to it */
+	if(flock(dev.board_fd, LOCK_EX) == -1)
+		return;
+
+	struct stat st;
+	if(fstat(dev.board_fd, &st) == -1)
+		goto out;
+	bool const exists = st.st_size == sizeof *board;
+	if(!exists && ftruncate(dev.board_fd, sizeof *board) == -1)
+		goto out;
+	board = mmap(NULL, sizeof *board,
+			PROT_READ|PROT_WRITE, MAP_SHARED, dev.board_fd, 0);
+	if(board == MAP_FAILED)
+		goto out;
+
+	/* a board nobody is attached to any more starts over */
+	if(!(exists && board_attach()) && !board_create())
+		goto out;
+	if(!board_register())
+		goto out;
+
+	dev.memory = mmap(NULL, BSS2K_MEMORY_SIZE,
+			PROT_READ|PROT_WRITE, MAP_SHARED, dev.memory_fd, 0);
+	if(dev.memory == MAP_FAILED)
+		goto out;
+	dev.trace = mmap(NULL, BSS2K_TRACE_SIZE,
+			PROT_READ|PROT_WRITE, MAP_SHARED, dev.trace_fd, 0);
+	if(dev.trace == MAP_FAILED)
+		goto out;
+	dev.events = mmap(NULL, BSS2K_EVENT_SIZE,
+			PROT_READ|PROT_WRITE, MAP_SHARED, dev.event_fd, 0);
+	if(dev.events == MAP_FAILED)
+		goto out;
+
+	for(unsigned int i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+		device_texture_setup(i);
+
+	dev.stats = !!getenv("BSS2KEMU_STATS");
+
+	pthread_t irq_thread;
+	if(pthread_create(&irq_thread, NULL, &device_irq_thread, NULL))
+		goto out;
+	pthread_detach(irq_thread);
+
+	dev_ok = true;
+
+out:
+	if(!dev_ok && dev.user < BOARD_USERS)
+		board->users[dev.user].pid = 0;
+	flock(dev.board_fd, LOCK_UN);
+}
+
+/* raise interrupts on rising edges of the masked status, called with the
+ * lock held */
+static void device_update_interrupts(void)
+{
+	uint64_t int_sts = 0;
+
+	if(board->halted && !(board->control & CTL_RESET))
+		int_sts |= INT_HALTED;
+	if(board->display_updated)
+		int_sts |= INT_DISPLAY;
+
+	uint64_t const pending = int_sts & board->int_mask;
+	uint64_t const raised = pending & ~board->int_pending;
+
+	board->int_pending = pending;
+
+	/* the CPU may have stopped either way */
+	pthread_cond_broadcast(&board->halt_cond);
+
+	if(!raised)
+		return;
+
+	if(raised & INT_HALTED)
+		++board->halt_count;
+
+	++board->irq_count;
+	pthread_cond_broadcast(&board->irq_cond);
+}
+
+/* the flip interrupt is acknowledged by the driver right away, so every
+ * flip is an edge */
+static void device_flip(bool front)
+{
+	board_lock();
+	if(board->int_mask & INT_FLIP)
+	{
+		board->flip = ((BSS2K_FLIP_COUNT(board->flip) + 1) << 1) | front;
+		++board->irq_count;
+		pthread_cond_broadcast(&board->irq_cond);
+	}
+	board_unlock();
+}
+
+/* the trace ring filled up to half. Acknowledged by the driver right
+ * away as well, and raised again once the host has read below half. */
+static void device_trace_watermark(void)
+{
+	board_lock();
+	if(board->int_mask & INT_TRACE_WATERMARK)
+	{
+		++board->trace_count;
+		++board->irq_count;
+		pthread_cond_broadcast(&board->irq_cond);
+	}
+	board_unlock();
+}
+
+static void *device_cpu_thread(void *arg)
+{
+	struct cpu *const cpu = arg;
+
+	double const start = now();
+
+	/* checked after each slice, not per record like the card */
+	bool trace_half_full = false;
+
+	while(!atomic_load_explicit(&board->stop, memory_order_relaxed))
+	{
+		cpu_run(cpu, CPU_SLICE);
+		atomic_store_explicit(&board->instructions, cpu->instructions,
+				memory_order_relaxed);
+		if(cpu->swapped)
+		{
+			cpu->swapped = false;
+			device_flip(cpu->front_framebuffer);
+		}
+
+		uint32_t const unread =
+				atomic_load_explicit(&cpu->trace_producer, memory_order_relaxed) -
+				atomic_load_explicit(&cpu->trace_consumer, memory_order_relaxed);
+		bool const half_full = atomic_load_explicit(&cpu->tracing, memory_order_relaxed) &&
+				unread >= BSS2K_TRACE_RECORDS / 2;
+		if(half_full && !trace_half_full)
+			device_trace_watermark();
+		trace_half_full = half_full;
+		if(cpu->halted)
+			break;
+	}
+
+	double const elapsed = now() - start;
+
+	if(dev.stats)
+		fprintf(stderr, "bss2kemu: %s after %llu instructions in %.3f s, %.2f MIPS\n",
+				cpu->halted ? "halted" : "reset",
+				(unsigned long long)cpu->instructions,
+				elapsed,
+				(elapsed > 0) ? cpu->instructions / elapsed * 1e-6 : 0.0);
+
+	board_lock();
+	if(cpu->halted)
+	{
+		board->halted = true;
+		board->assertion_failed = cpu->assertion_failed;
+	}
+	board->thread_running = false;
+	device_update_interrupts();
+	board_unlock();
+
+	return NULL;
+}
+
+/* called with the lock held, which is dropped while waiting for the CPU
+ * thread, in whichever process it runs */
+static void device_stop_cpu(void)
+{
+	atomic_store(&board->stop, true);
+	while(board->thread_running)
+	{
+		/* killed without holding the CPU in reset */
+		if(!process_alive(board->runner))
+		{
+			board->thread_running = false;
+			break;
+		}
+
+		struct timespec deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_nsec += 100000000;
+		if(deadline.tv_nsec >= 1000000000)
+		{
+			deadline.tv_sec += 1;
+			deadline.tv_nsec -= 1000000000;
+		}
+		board_wait(&board->halt_cond, &deadline);
+	}
+	atomic_store(&board->stop, false);
+}
+
+/* the CPU runs in this process, on its mappings. Called with the lock
+ * held. */
+static int device_start_cpu(void)
+{
+	struct cpu *const cpu = &board->cpu;
+
+	cpu->mem = dev.memory;
+	cpu->textmode = board->textmode;
+	cpu->trace = dev.trace;
+	cpu->trace_mask = BSS2K_TRACE_RECORDS - 1;
+	cpu->events = dev.events;
+	cpu->event_mask = BSS2K_EVENT_RECORDS - 1;
+
+	cpu_reset(cpu);
+	atomic_store_explicit(&board->instructions, 0, memory_order_relaxed);
+	board->halted = false;
+	board->assertion_failed = false;
+
+	pthread_t thread;
+	int const err = pthread_create(&thread, NULL, &device_cpu_thread, cpu);
+	if(err)
+		return err;
+	pthread_detach(thread);
+
+	board->runner = getpid();
+	board->thread_running = true;
+	return 0;
+}
+
+/* the upper half of the value masks the lower half. Called with the lock
+ * held. */
+static int device_write_control(uint64_t value)
+{
+	uint64_t const mask = value >> 32;
+	uint64_t const old = board->control;
+	uint64_t const control = (old & ~mask) | (value & mask & 0xffffffffULL);
+
+	board->control = control;
+
+	if((control & CTL_RESET) && !(old & CTL_RESET))
+	{
+		device_stop_cpu();
+		/* the card empties the event ring during reset */
+		atomic_store(&board->cpu.event_producer, 0);
+		atomic_store(&board->cpu.event_consumer, 0);
+		atomic_store(&board->cpu.event_dropped, 0);
+	}
+
+	device_update_interrupts();
+
+	if(!(control & CTL_RESET) && (old & CTL_RESET))
+	{
+		int const err = device_start_cpu();
+		if(err)
+		{
+			board->control |= CTL_RESET;
+			errno = err;
+			return -1;
+		}
+	}
+
+	if(control & CTL_UPDATEDISPLAY)
+	{
+		uint32_t const dirty = atomic_exchange_explicit(
+				&board->cpu.textmode_dirty, 0, memory_order_relaxed);
+
+		/* rows changed since this buffer was last written */
+		uint32_t rows = dirty;
+		for(unsigned int i = 0; i < BSS2K_TEXTMODE_BUFFERS - 1; ++i)
+			rows |= board->textmode_history[i];
+		for(unsigned int i = BSS2K_TEXTMODE_BUFFERS - 2; i > 0; --i)
+			board->textmode_history[i] = board->textmode_history[i - 1];
+		board->textmode_history[0] = dirty;
+
+		unsigned char *const texture = dev.texture[board->texture_current].data;
+
+		board->display_updated = false;
+		device_update_interrupts();
+		if(texture && (control & CTL_TEXTMODE_CHARACTERS))
+		{
+			memcpy(texture, board->textmode, TEXTMODE_RAM_SIZE);
+			board->textmode_packets += TEXTMODE_CHARACTER_PACKETS;
+		}
+		else if(texture)
+		{
+			textmode_render(board->textmode, texture, rows);
+			for(uint32_t r = rows; r; r &= r - 1)
+				board->textmode_packets += TEXTMODE_ROW_PACKETS;
+		}
+		board->damage |= rows;
+		board->texture_newest = board->texture_current;
+		board->texture_current = (board->texture_current + 1) % BSS2K_TEXTMODE_BUFFERS;
+		board->display_updated = true;
+		board->control &= ~CTL_UPDATEDISPLAY;
+		device_update_interrupts();
+	}
+
+	/* memory is always coherent */
+	board->control &= ~CTL_FLUSH;
+
+	return 0;
+}
+
+/* a CPU running in this process stops with it, the card would keep
+ * running but nothing is left to run the emulated one */
+__attribute__((destructor))
+static void device_teardown(void)
+{
+	if(!dev_ok)
+		return;
+
+	board_lock();
+	if(board->thread_running && board->runner == getpid())
+		device_write_control((CTL_RESET << 32) | CTL_RESET);
+	board_unlock();
+
+	flock(dev.board_fd, LOCK_EX);
+	board->users[dev.user].pid = 0;
+	flock(dev.board_fd, LOCK_UN);
+}
+
+struct device_file *device_open(int flags)
+{
+	pthread_once(&dev_once, &device_setup);
+
+	if(!dev_ok)
+	{
+		errno = ENODEV;
+		return NULL;
+	}
+
+	struct device_file *const file = calloc(1, sizeof *file);
+	if(!file)
+		return NULL;
+
+	file->fd = eventfd(0, EFD_NONBLOCK | ((flags & O_CLOEXEC) ? EFD_CLOEXEC : 0));
+	if(file->fd == -1)
+	{
+		free(file);
+		return NULL;
+	}
+
+	board_lock();
+	file->last_halt = board->halt_count;
+	file->last_trace = board->trace_count;
+	board_unlock();
+
+	pthread_mutex_lock(&dev.files_lock);
+	file->next = dev.files;
+	dev.files = file;
+	pthread_mutex_unlock(&dev.files_lock);
+
+	return file;
+}
+
+struct device_file *device_lookup(int fd)
+{
+	struct device_file *file;
+
+	pthread_mutex_lock(&dev.files_lock);
+	for(file = dev.files; file; file = file->next)
+		if(file->fd == fd)
+			break;
+	pthread_mutex_unlock(&dev.files_lock);
+
+	return file;
+}
+
+int device_file_fd(struct device_file const *file)
+{
+	return file->fd;
+}
+
+int device_close(struct device_file *file)
+{
+	pthread_mutex_lock(&dev.files_lock);
+	for(struct device_file **p = &dev.files; *p; p = &(*p)->next)
+		if(*p == file)
+		{
+			*p = file->next;
+			break;
+		}
+	pthread_mutex_unlock(&dev.files_lock);
+
+	/* no longer found, so this reaches the C library */
+	int const rc = close(file->fd);
+	free(file);
+	return rc;
+}
+
+ssize_t device_read(struct device_file *file, void *buf, size_t count)
+{
+	if(file->pos < 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if(file->pos >= BSS2K_MEMORY_SIZE)
+		return 0;
+
+	/* limit to end of memory */
+	if(count > (size_t)(BSS2K_MEMORY_SIZE - file->pos))
+		count = BSS2K_MEMORY_SIZE - file->pos;
+
+	memcpy(buf, dev.memory + file->pos, count);
+	file->pos += count;
+	return count;
+}
+
+ssize_t device_write(struct device_file *file, void const *buf, size_t count)
+{
+	if(file->pos < 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	if(!count)
+		return 0;
+	if(file->pos >= BSS2K_MEMORY_SIZE)
+	{
+		errno = ENOSPC;
+		return -1;
+	}
+
+	/* limit to end of memory */
+	if(count > (size_t)(BSS2K_MEMORY_SIZE - file->pos))
+		count = BSS2K_MEMORY_SIZE - file->pos;
+
+	memcpy(dev.memory + file->pos, buf, count);
+	file->pos += count;
+	return count;
+}
+
+off_t device_llseek(struct device_file *file, off_t offset, int whence)
+{
+	int64_t pos;
+
+	switch(whence)
+	{
+	case SEEK_SET:	pos = offset;				break;
+	case SEEK_CUR:	pos = file->pos + offset;		break;
+	case SEEK_END:	pos = BSS2K_MEMORY_SIZE + offset;	break;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(pos < 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	file->pos = pos;
+	return pos;
+}
+
+void *device_mmap(struct device_file *file, void *addr, size_t length, int prot, int flags, int64_t offset)
+{
+	(void)file;
+
+	/* the trace and event rings are written by the card only */
+	if(offset == BSS2K_TRACE_OFFSET)
+	{
+		if(length > BSS2K_TRACE_SIZE || (prot & PROT_WRITE))
+		{
+			errno = (prot & PROT_WRITE) ? EACCES : EINVAL;
+			return MAP_FAILED;
+		}
+		return mmap(addr, length, prot, flags, dev.trace_fd, 0);
+	}
+	if(offset == BSS2K_EVENT_OFFSET)
+	{
+		if(length > BSS2K_EVENT_SIZE || (prot & PROT_WRITE))
+		{
+			errno = (prot & PROT_WRITE) ? EACCES : EINVAL;
+			return MAP_FAILED;
+		}
+		return mmap(addr, length, prot, flags, dev.event_fd, 0);
+	}
+
+	if(offset < 0 || offset > BSS2K_MEMORY_SIZE
+			|| length > (size_t)(BSS2K_MEMORY_SIZE - offset))
+	{
+		errno = EINVAL;
+		return MAP_FAILED;
+	}
+
+	return mmap(addr, length, prot, flags, dev.memory_fd, offset);
+}
+
+/* a record the CPU thread is writing right now is not counted */
+static void device_start_trace(uint32_t period)
+{
+	atomic_store(&board->cpu.tracing, false);
+	atomic_store(&board->cpu.trace_period, period);
+	atomic_store(&board->cpu.trace_producer, 0);
+	atomic_store(&board->cpu.trace_consumer, 0);
+	atomic_store(&board->cpu.trace_dropped, 0);
+	atomic_store(&board->cpu.tracing, true);
+}
+
+/* export the pages covering a framebuffer. Without udmabuf, this is the
+ * memory file descriptor, which can only be mapped, and the offset is from
+ * the start of memory. */
+static int device_get_framebuffer(struct bss2k_framebuffer *fb)
+{
+	static uint32_t const start[BSS2K_FRAMEBUFFER_COUNT] =
+	{
+		FIRST_FRAMEBUFFER_START,
+		SECOND_FRAMEBUFFER_START
+	};
+
+	if(fb->index >= BSS2K_FRAMEBUFFER_COUNT)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+#if HAVE_LINUX_UDMABUF_H
+	uint32_t const page_size = sysconf(_SC_PAGESIZE);
+	uint32_t const first = start[fb->index] & ~(page_size - 1);
+	uint32_t const end = (start[fb->index] + FRAMEBUFFER_SIZE + page_size - 1) & ~(page_size - 1);
+
+	int const udmabuf = open("/dev/udmabuf", O_RDWR|O_CLOEXEC);
+	if(udmabuf != -1)
+	{
+		struct udmabuf_create create =
+		{
+			.memfd = dev.memory_fd,
+			.flags = UDMABUF_FLAGS_CLOEXEC,
+			.offset = first,
+			.size = end - first
+		};
+
+		int const rc = ioctl(udmabuf, UDMABUF_CREATE, &create);
+		close(udmabuf);
+
+		if(rc != -1)
+		{
+			fb->fd = rc;
+			fb->offset = start[fb->index] - first;
+			fb->size = end - first;
+			return 0;
+		}
+	}
+#endif
+
+	fb->fd = fcntl(dev.memory_fd, F_DUPFD_CLOEXEC, 0);
+	if(fb->fd == -1)
+		return -1;
+	fb->offset = start[fb->index];
+	fb->size = BSS2K_MEMORY_SIZE;
+	return 0;
+}
+
+/* called with the lock held */
+static uint64_t device_status(void)
+{
+	uint64_t status = 0;
+	if(!(board->control & CTL_RESET) && !board->halted)
+		status |= STS_RUNNING;
+	if(board->assertion_failed)
+		status |= STS_ASSERTION_FAILED;
+	return status;
+}
+
+/* called with the lock held, which is dropped while waiting */
+static uint64_t device_wait_halt(uint64_t timeout_ns)
+{
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	/* even the longest timeout is some centuries */
+	uint64_t const nsec = deadline.tv_nsec + timeout_ns % 1000000000;
+	deadline.tv_sec += timeout_ns / 1000000000 + nsec / 1000000000;
+	deadline.tv_nsec = nsec % 1000000000;
+
+	while(device_status() & STS_RUNNING)
+	{
+		if(board_wait(&board->halt_cond, &deadline) == ETIMEDOUT)
+			break;
+	}
+
+	return device_status();
+}
+
+int device_ioctl(struct device_file *file, unsigned long cmd, void *arg)
+{
+	(void)file;
+
+	union
+	{
+		uint64_t as_u64;
+		int as_int;
+		struct bss2k_framebuffer as_framebuffer;
+		struct bss2k_textmode_texture as_textmode_texture;
+		struct bss2k_counters as_counters;
+		struct bss2k_trace_position as_trace_position;
+		struct bss2k_wait_halt as_wait_halt;
+	} val;
+
+	if(_IOC_DIR(cmd) & _IOC_WRITE)
+	{
+		if(!arg || _IOC_SIZE(cmd) > sizeof val)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(&val, arg, _IOC_SIZE(cmd));
+	}
+
+	int rc = 0;
+
+	board_lock();
+
+	switch(cmd)
+	{
+	case BSS2K_IOC_RESET:
+		board->int_mask = 0ULL;
+		rc = device_write_control((CTL_RESET << 32) | CTL_RESET);
+		break;
+	case BSS2K_IOC_START_CPU:
+		board->flip = 0;
+		board->int_mask = INT_SOURCES;
+		rc = device_write_control((CTL_RESET << 32) | 0);
+		break;
+	case BSS2K_IOC_FLUSH_DCACHE:
+		/* memory is always coherent */
+		break;
+	case BSS2K_IOC_READ_STATUS:
+		val.as_u64 = device_status();
+		break;
+	case BSS2K_IOC_READ_CONTROL:
+		val.as_u64 = board->control;
+		break;
+	case BSS2K_IOC_READ_INTSTS:
+		val.as_u64 = 0;
+		if(board->halted && !(board->control & CTL_RESET))
+			val.as_u64 |= INT_HALTED;
+		if(board->halted && board->assertion_failed && !(board->control & CTL_RESET))
+			val.as_u64 |= INT_ASSERTION;
+		if(board->display_updated)
+			val.as_u64 |= INT_DISPLAY;
+		if(BSS2K_FLIP_FRONT(board->flip))
+			val.as_u64 |= INT_FRONT_FRAMEBUFFER;
+		val.as_u64 |= (uint64_t)board->texture_newest << INT_TEXTMODE_NEWEST_SHIFT;
+		break;
+	case BSS2K_IOC_READ_INTMASK:
+		val.as_u64 = board->int_mask;
+		break;
+	case BSS2K_IOC_READ_FLIP:
+		val.as_u64 = board->flip;
+		break;
+	case BSS2K_IOC_READ_TEXTMODE_BUFFER:
+		val.as_u64 = board->texture_newest;
+		break;
+	case BSS2K_IOC_READ_DAMAGE:
+		val.as_u64 = board->damage;
+		board->damage = 0;
+		break;
+	case BSS2K_IOC_READ_COUNTERS:
+		/* one instruction per cycle, no caches and no PCIe */
+		memset(&val.as_counters, 0, sizeof val.as_counters);
+		if(!(board->control & CTL_RESET))
+		{
+			uint64_t const instructions = atomic_load_explicit(
+					&board->instructions, memory_order_relaxed);
+			val.as_counters.value[BSS2K_COUNTER_CYCLES] = instructions;
+			val.as_counters.value[BSS2K_COUNTER_RETIRED] = instructions;
+		}
+		val.as_counters.value[BSS2K_COUNTER_TEXTMODE_PACKETS] = board->textmode_packets;
+		break;
+	case BSS2K_IOC_TRACE_START:
+		device_start_trace(0);
+		break;
+	case BSS2K_IOC_TRACE_SAMPLE:
+		/* zero would trace every instruction */
+		if(!val.as_u64 || val.as_u64 > UINT32_MAX)
+		{
+			errno = EINVAL;
+			rc = -1;
+			break;
+		}
+		device_start_trace(val.as_u64);
+		break;
+	case BSS2K_IOC_TRACE_STOP:
+		atomic_store(&board->cpu.tracing, false);
+		break;
+	case BSS2K_IOC_TRACE_POSITION:
+		atomic_store_explicit(&board->cpu.trace_consumer,
+				val.as_trace_position.consumer, memory_order_release);
+		val.as_trace_position.producer = atomic_load_explicit(
+				&board->cpu.trace_producer, memory_order_acquire);
+		val.as_trace_position.dropped = atomic_load_explicit(
+				&board->cpu.trace_dropped, memory_order_relaxed);
+		val.as_trace_position.reserved = 0;
+		break;
+	case BSS2K_IOC_EVENT_POSITION:
+		atomic_store_explicit(&board->cpu.event_consumer,
+				val.as_trace_position.consumer, memory_order_release);
+		val.as_trace_position.producer = atomic_load_explicit(
+				&board->cpu.event_producer, memory_order_acquire);
+		val.as_trace_position.dropped = atomic_load_explicit(
+				&board->cpu.event_dropped, memory_order_relaxed);
+		val.as_trace_position.reserved = 0;
+		break;
+	case BSS2K_IOC_WAIT_HALT:
+		val.as_wait_halt.status = device_wait_halt(val.as_wait_halt.timeout_ns);
+		break;
+	case BSS2K_IOC_WRITE_CONTROL:
+		rc = device_write_control(val.as_u64);
+		break;
+	case BSS2K_IOC_WRITE_INTMASK:
+		board->int_mask = val.as_u64 & INT_SOURCES;
+		device_update_interrupts();
+		break;
+	case BSS2K_IOC_GET_TEXTMODE_TEXTURE:
+		{
+			uint32_t const index = val.as_textmode_texture.index;
+			if(index >= BSS2K_TEXTMODE_BUFFERS)
+			{
+				errno = EINVAL;
+				rc = -1;
+				break;
+			}
+			/* without udmabuf, the memfd can still be mapped */
+			int const fd = (dev.texture[index].dmabuf_fd != -1)
+					? dev.texture[index].dmabuf_fd
+					: dev.texture[index].fd;
+			if(fd == -1)
+			{
+				errno = ENOMEM;
+				rc = -1;
+				break;
+			}
+			val.as_textmode_texture.fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+			if(val.as_textmode_texture.fd == -1)
+				rc = -1;
+		}
+		break;
+	case BSS2K_IOC_GET_FRAMEBUFFER:
+		rc = device_get_framebuffer(&val.as_framebuffer);
+		break;
+	default:
+		errno = EINVAL;
+		rc = -1;
+		break;
+	}
+
+	board_unlock();
+
+	if(rc == -1)
+		return -1;
+
+	if(_IOC_DIR(cmd) & _IOC_READ)
+	{
+		if(!arg || _IOC_SIZE(cmd) > sizeof val)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		memcpy(arg, &val, _IOC_SIZE(cmd));
+	}
+
+	return 0;
+}
+
+void device_poll_consume(struct device_file *file)
+{
+	eventfd_t value;
+	eventfd_read(file->fd, &value);
+}
+
+short device_poll_priority(struct device_file *file)
+{
+	short events = 0;
+
+	board_lock();
+	if(file->last_halt != board->halt_count)
+		events |= POLLPRI;
+	if(file->last_trace != board->trace_count)
+		events |= POLLRDBAND;
+	file->last_halt = board->halt_count;
+	file->last_trace = board->trace_count;
+	board_unlock();
+
+	return events;
+}
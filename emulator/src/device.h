@@ -0,0 +1,39 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* An emulated board, shared by all opens of the device node, in this and
+ * in other processes using the library at the same time. Each open file is backed by an eventfd, so the descriptor the
+ * application sees can be waited on with select and poll, and becomes
+ * readable when an interrupt is raised.
+ *
+ * The functions return -1 or MAP_FAILED and set errno on failure, like
+ * the system calls they replace. File offsets are 64 bit regardless of
+ * _FILE_OFFSET_BITS. */
+
+struct device_file;
+
+struct device_file *device_open(int flags);
+struct device_file *device_lookup(int fd);
+
+int device_file_fd(struct device_file const *);
+
+int device_close(struct device_file *);
+ssize_t device_read(struct device_file *, void *, size_t);
+ssize_t device_write(struct device_file *, void const *, size_t);
+int64_t device_llseek(struct device_file *, int64_t, int);
+void *device_mmap(struct device_file *, void *, size_t, int, int, int64_t);
+int device_ioctl(struct device_file *, unsigned long, void *);
+
+/* called after select or poll reported the file readable, consumes the
+ * interrupts seen so far */
+void device_poll_consume(struct device_file *);
+
+/* called after select or poll reported the file readable, POLLPRI if the
+ * CPU halted and POLLRDBAND if the trace ring filled up to half since the
+ * last call */
+short device_poll_priority(struct device_file *);
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <errno.h>
+
+/* Convert a Quartus memory initialization file with binary data and
+ * hexadecimal addresses, like logic/board_phi/font.mif, into an array
+ * initializer, one byte per word. */
+
+#define MAX_DEPTH 65536
+
+static unsigned char content[MAX_DEPTH];
+
+int main(int argc, char **argv)
+{
+	if(argc != 3)
+	{
+		fprintf(stderr, "Usage: %s input output\n", argv[0]);
+		exit(1);
+	}
+
+	FILE *in = fopen(argv[1], "r");
+	if(!in)
+	{
+		fprintf(stderr, "Cannot open %s for reading: %s\n", argv[1], strerror(errno));
+		exit(1);
+	}
+
+	unsigned long depth = 0;
+	int in_content = 0;
+
+	char line[256];
+
+	for(unsigned int lineno = 1; fgets(line, sizeof line, in); ++lineno)
+	{
+		char *const comment = strstr(line, "--");
+		if(comment)
+			*comment = '\0';
+
+		char *p = line;
+		while(isspace((unsigned char)*p))
+			++p;
+		if(!*p)
+			continue;
+
+		if(!in_content)
+		{
+			if(!strncmp(p, "DEPTH", 5))
+			{
+				p = strchr(p, '=');
+				if(p)
+					depth = strtoul(p + 1, NULL, 10);
+			}
+			else if(!strncmp(p, "BEGIN", 5))
+				in_content = 1;
+			continue;
+		}
+
+		if(!strncmp(p, "END", 3))
+			break;
+
+		unsigned long first, last;
+
+		if(*p == '[')
+		{
+			char *end;
+			first = strtoul(p + 1, &end, 16);
+			if(strncmp(end, "..", 2))
+				goto syntax_error;
+			last = strtoul(end + 2, &end, 16);
+			if(*end != ']')
+				goto syntax_error;
+			p = end + 1;
+		}
+		else
+		{
+			char *end;
+			first = last = strtoul(p, &end, 16);
+			if(end == p)
+				goto syntax_error;
+			p = end;
+		}
+
+		p = strchr(p, ':');
+		if(!p)
+			goto syntax_error;
+		++p;
+
+		/* binary digits, whitespace is ignored */
+		unsigned int value = 0;
+		for(; *p && *p != ';'; ++p)
+		{
+			if(*p == '0' || *p == '1')
+				value = (value << 1) | (unsigned int)(*p - '0');
+			else if(!isspace((unsigned char)*p))
+				goto syntax_error;
+		}
+		if(*p != ';')
+			goto syntax_error;
+
+		if(first > last || last >= depth || last >= MAX_DEPTH)
+		{
+			fprintf(stderr, "%s:%u: address out of range\n", argv[1], lineno);
+			exit(1);
+		}
+
+		for(unsigned long address = first; address <= last; ++address)
+			content[address] = (unsigned char)value;
+		continue;
+
+	syntax_error:
+		fprintf(stderr, "%s:%u: syntax error\n", argv[1], lineno);
+		exit(1);
+	}
+
+	if(ferror(in))
+		exit(1);
+
+	if(!in_content)
+	{
+		fprintf(stderr, "%s: no content\n", argv[1]);
+		exit(1);
+	}
+
+	FILE *out = fopen(argv[2], "w");
+	if(!out)
+	{
+		fprintf(stderr, "Cannot open %s for writing: %s\n", argv[2], strerror(errno));
+		exit(1);
+	}
+
+	for(unsigned long address = 0; address < depth; ++address)
+	{
+		fprintf(out, "0x%02x, ", content[address]);
+		if((address & 0xf) == 0xf)
+			fprintf(out, "\n");
+	}
+	fprintf(out, "\n");
+
+	fclose(in);
+	fclose(out);
+
+	exit(0);
+}
@@ -0,0 +1,320 @@
+/* the 64 bit file offset variants are replaced separately */
+#undef _FILE_OFFSET_BITS
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "device.h"
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Preload library that replaces the device node of the PCIe card with the
+ * software emulator, so the host tools run unchanged:
+ *
+ *   LD_PRELOAD=libbss2kemu.so bss2krun ...
+ *
+ * Only calls made by the application itself are seen, so the device
+ * cannot be accessed through stdio, and only select, pselect, poll and
+ * ppoll report display events correctly. */
+
+static char const device_path[] = "/dev/bss2k-0";
+
+static int (*real_open)(char const *, int, ...);
+static int (*real_close)(int);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, void const *, size_t);
+static off_t (*real_lseek)(int, off_t, int);
+static void *(*real_mmap)(void *, size_t, int, int, int, off_t);
+static int (*real_ioctl)(int, unsigned long, ...);
+static int (*real_open64)(char const *, int, ...);
+static int (*real_openat)(int, char const *, int, ...);
+static int (*real_openat64)(int, char const *, int, ...);
+static off64_t (*real_lseek64)(int, off64_t, int);
+static void *(*real_mmap64)(void *, size_t, int, int, int, off64_t);
+static int (*real_select)(int, fd_set *, fd_set *, fd_set *, struct timeval *);
+static int (*real_pselect)(int, fd_set *, fd_set *, fd_set *, struct timespec const *, sigset_t const *);
+static int (*real_poll)(struct pollfd *, nfds_t, int);
+static int (*real_ppoll)(struct pollfd *, nfds_t, struct timespec const *, sigset_t const *);
+
+/* resolved on first use, as other constructors may already do I/O */
+static void resolve(void)
+{
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_lseek = dlsym(RTLD_NEXT, "lseek");
+	real_mmap = dlsym(RTLD_NEXT, "mmap");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_open64 = dlsym(RTLD_NEXT, "open64");
+	real_openat = dlsym(RTLD_NEXT, "openat");
+	real_openat64 = dlsym(RTLD_NEXT, "openat64");
+	real_lseek64 = dlsym(RTLD_NEXT, "lseek64");
+	real_mmap64 = dlsym(RTLD_NEXT, "mmap64");
+	real_select = dlsym(RTLD_NEXT, "select");
+	real_pselect = dlsym(RTLD_NEXT, "pselect");
+	real_poll = dlsym(RTLD_NEXT, "poll");
+	real_ppoll = dlsym(RTLD_NEXT, "ppoll");
+}
+
+#define RESOLVE() \
+	do { \
+		if(!real_open) \
+			resolve(); \
+	} while(0)
+
+static int device_open_fd(int flags)
+{
+	struct device_file *const file = device_open(flags);
+	if(!file)
+		return -1;
+	return device_file_fd(file);
+}
+
+/* a mode argument is only passed when a file may be created */
+#define MODE_ARG(flags, mode) \
+	do { \
+		if((flags) & (O_CREAT|O_TMPFILE)) \
+		{ \
+			va_list ap; \
+			va_start(ap, flags); \
+			mode = va_arg(ap, mode_t); \
+			va_end(ap); \
+		} \
+	} while(0)
+
+int open(char const *path, int flags, ...)
+{
+	mode_t mode = 0;
+	MODE_ARG(flags, mode);
+
+	RESOLVE();
+	if(!strcmp(path, device_path))
+		return device_open_fd(flags);
+	return real_open(path, flags, mode);
+}
+
+int open64(char const *path, int flags, ...)
+{
+	mode_t mode = 0;
+	MODE_ARG(flags, mode);
+
+	RESOLVE();
+	if(!strcmp(path, device_path))
+		return device_open_fd(flags);
+	return real_open64(path, flags, mode);
+}
+
+int openat(int dirfd, char const *path, int flags, ...)
+{
+	mode_t mode = 0;
+	MODE_ARG(flags, mode);
+
+	RESOLVE();
+	if(!strcmp(path, device_path))
+		return device_open_fd(flags);
+	return real_openat(dirfd, path, flags, mode);
+}
+
+int openat64(int dirfd, char const *path, int flags, ...)
+{
+	mode_t mode = 0;
+	MODE_ARG(flags, mode);
+
+	RESOLVE();
+	if(!strcmp(path, device_path))
+		return device_open_fd(flags);
+	return real_openat64(dirfd, path, flags, mode);
+}
+
+int close(int fd)
+{
+	RESOLVE();
+	struct device_file *const file = device_lookup(fd);
+	if(file)
+		return device_close(file);
+	return real_close(fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+	RESOLVE();
+	struct device_file *const file = device_lookup(fd);
+	if(file)
+		return device_read(file, buf, count);
+	return real_read(fd, buf, count);
+}
+
+ssize_t write(int fd, void const *buf, size_t count)
+{
+	RESOLVE();
+	struct device_file *const file = device_lookup(fd);
+	if(file)
+		return device_write(file, buf, count);
+	return real_write(fd, buf, count);
+}
+
+off_t lseek(int fd, off_t offset, int whence)
+{
+	RESOLVE();
+	struct device_file *const file = device_lookup(fd);
+	if(file)
+		return device_llseek(file, offset, whence);
+	return real_lseek(fd, offset, whence);
+}
+
+off64_t lseek64(int fd, off64_t offset, int whence)
+{
+	RESOLVE();
+	struct device_file *const file = device_lookup(fd);
+	if(file)
+		return device_llseek(file, offset, whence);
+	return real_lseek64(fd, offset, whence);
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	RESOLVE();
+	struct device_file *const file = (flags & MAP_ANONYMOUS) ? NULL : device_lookup(fd);
+	if(file)
+		return device_mmap(file, addr, length, prot, flags, offset);
+	return real_mmap(addr, length, prot, flags, fd, offset);
+}
+
+void *mmap64(void *addr, size_t length, int prot, int flags, int fd, off64_t offset)
+{
+	RESOLVE();
+	struct device_file *const file = (flags & MAP_ANONYMOUS) ? NULL : device_lookup(fd);
+	if(file)
+		return device_mmap(file, addr, length, prot, flags, offset);
+	return real_mmap64(addr, length, prot, flags, fd, offset);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	va_start(ap, request);
+	void *const arg = va_arg(ap, void *);
+	va_end(ap);
+
+	RESOLVE();
+	struct device_file *const file = device_lookup(fd);
+	if(file)
+		return device_ioctl(file, request, arg);
+	return real_ioctl(fd, request, arg);
+}
+
+/* The device is readable when an interrupt was raised since the last
+ * poll, and never writable. Readiness is consumed by reporting it, like
+ * in the driver. A halt is exceptional as well, and a trace watermark
+ * POLLRDBAND, but the eventfd only wakes up readers, so they are only
+ * seen by waiting for both. */
+static int select_fixup(int rc, int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+		fd_set const *exceptfds_in)
+{
+	if(rc <= 0)
+		return rc;
+
+	for(int fd = 0; fd < nfds; ++fd)
+	{
+		bool const r = readfds && FD_ISSET(fd, readfds);
+		bool const w = writefds && FD_ISSET(fd, writefds);
+		bool const e = exceptfds && FD_ISSET(fd, exceptfds_in);
+
+		if(!r && !w && !e)
+			continue;
+
+		struct device_file *const file = device_lookup(fd);
+		if(!file)
+			continue;
+
+		if(r)
+		{
+			device_poll_consume(file);
+			if(e && (device_poll_priority(file) & POLLPRI))
+			{
+				FD_SET(fd, exceptfds);
+				++rc;
+			}
+		}
+		if(w)
+		{
+			FD_CLR(fd, writefds);
+			--rc;
+		}
+	}
+	return rc;
+}
+
+static int poll_fixup(int rc, struct pollfd *fds, nfds_t nfds)
+{
+	if(rc <= 0)
+		return rc;
+
+	for(nfds_t i = 0; i < nfds; ++i)
+	{
+		if(!fds[i].revents)
+			continue;
+
+		struct device_file *const file = device_lookup(fds[i].fd);
+		if(!file)
+			continue;
+
+		if(fds[i].revents & POLLIN)
+		{
+			device_poll_consume(file);
+			fds[i].revents |= device_poll_priority(file) & fds[i].events;
+		}
+		fds[i].revents &= ~(POLLOUT|POLLWRNORM);
+		if(!fds[i].revents)
+			--rc;
+	}
+	return rc;
+}
+
+int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout)
+{
+	RESOLVE();
+	fd_set exceptfds_in;
+	if(exceptfds)
+		exceptfds_in = *exceptfds;
+	int const rc = real_select(nfds, readfds, writefds, exceptfds, timeout);
+	return select_fixup(rc, nfds, readfds, writefds, exceptfds, &exceptfds_in);
+}
+
+int pselect(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+		struct timespec const *timeout, sigset_t const *sigmask)
+{
+	RESOLVE();
+	fd_set exceptfds_in;
+	if(exceptfds)
+		exceptfds_in = *exceptfds;
+	int const rc = real_pselect(nfds, readfds, writefds, exceptfds, timeout, sigmask);
+	return select_fixup(rc, nfds, readfds, writefds, exceptfds, &exceptfds_in);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	RESOLVE();
+	int const rc = real_poll(fds, nfds, timeout);
+	return poll_fixup(rc, fds, nfds);
+}
+
+int ppoll(struct pollfd *fds, nfds_t nfds, struct timespec const *timeout, sigset_t const *sigmask)
+{
+	RESOLVE();
+	int const rc = real_ppoll(fds, nfds, timeout, sigmask);
+	return poll_fixup(rc, fds, nfds);
+}
@@ -0,0 +1,51 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "textmode.h"
+
+#include <stdbool.h>
+
+/* 6 pixels per line, MSB first, indexed by character and line */
+static unsigned char const font[4096] =
+{
+#include "font.inc"
+};
+
+#define COLUMNS		80
+#define ROWS		25
+#define FONT_WIDTH	6
+#define FONT_HEIGHT	14
+
+void textmode_render(
+		unsigned char const *textmode,
+		unsigned char *texture,
+		uint32_t rows)
+{
+	for(unsigned int r = 0; r < ROWS; ++r)
+	{
+		if(!(rows & (1U << r)))
+			continue;
+
+		unsigned char *pixel = texture +
+				r * FONT_HEIGHT * COLUMNS * FONT_WIDTH * 4;
+
+		for(unsigned int l = 0; l < FONT_HEIGHT; ++l)
+			for(unsigned int c = 0; c < COLUMNS; ++c)
+			{
+				unsigned char const ch = textmode[r * COLUMNS + c];
+				unsigned char const bits = font[(ch << 4) | l];
+
+				for(int p = FONT_WIDTH - 1; p >= 0; --p)
+				{
+					/* set pixels are white, the background
+					 * encodes the character position */
+					bool const set = (bits >> p) & 1;
+					*pixel++ = set ? 0xff : r;
+					*pixel++ = set ? 0xff : 0x00;
+					*pixel++ = set ? 0xff : c;
+					*pixel++ = 0xff;
+				}
+			}
+	}
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+/* size of the buffer the textmode output writes to */
+#define TEXTMODE_TEXTURE_SIZE	0x200000
+
+/* render the character rows set in rows (bit n for row n) into a 480 pixel
+ * wide RGBA texture, the same way logic/board_phi/textmode_output.vhdl
+ * does, other rows are left alone */
+void textmode_render(
+		unsigned char const *textmode,
+		unsigned char *texture,
+		uint32_t rows);
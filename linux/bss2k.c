@@ -2,13 +2,18 @@
 
 #include <linux/cdev.h>
 
+#include <linux/delay.h>
 #include <linux/interrupt.h>
+#include <linux/log2.h>
 #include <linux/poll.h>
 
 #include <linux/pci.h>
 
 #include <linux/dma-buf.h>
+#include <linux/dma-fence.h>
+#include <linux/dma-resv.h>
 
+#include <linux/bitfield.h>
 #include <linux/bits.h>
 
 #include "bss2k_ioctl.h"
@@ -18,6 +23,17 @@
 #define REG_INT_STATUS  2
 #define REG_INT_MASK    3
 #define REG_TEXTMODE    4
+#define REG_TEXTMODE_DAMAGE 5
+#define REG_COUNTER_SELECT 6
+#define REG_COUNTER     7
+#define REG_TRACE_BASE  24
+#define REG_TRACE_CONTROL 25
+#define REG_TRACE_PRODUCER 26
+#define REG_TRACE_CONSUMER 27
+#define REG_TRACE_PERIOD 28
+#define REG_EVENT_RING  29
+#define REG_EVENT_PRODUCER 30
+#define REG_EVENT_CONSUMER 31
 #define REG_MAPPING     16
 
 /* emulated CPU has 24 bits, we're using 2 MB pages for mapping, so 3 bits
@@ -34,16 +50,126 @@
 /* control register */
 #define CTL_RESET               BIT_ULL(0)
 #define CTL_UPDATEDISPLAY       BIT_ULL(1)
+#define CTL_FLUSH               BIT_ULL(2)
+#define CTL_TEXTMODE_CHARACTERS BIT_ULL(3)
 
 #define CTL_MASK_RESET          BIT_ULL(32)
 #define CTL_MASK_UPDATEDISPLAY  BIT_ULL(33)
+#define CTL_MASK_FLUSH          BIT_ULL(34)
+#define CTL_MASK_TEXTMODE_CHARACTERS BIT_ULL(35)
+
+/* time to wait for the data cache to be written back, in microseconds */
+#define FLUSH_TIMEOUT           1000
 
 /* interrupt registers */
 #define INT_HALTED              BIT_ULL(0)
+#define INT_DISPLAY             BIT_ULL(1)
+#define INT_FLIP                BIT_ULL(2)
+#define INT_FRONT_FRAMEBUFFER   BIT_ULL(3)
+#define INT_TEXTMODE_NEWEST     GENMASK_ULL(5, 4)
+#define INT_ASSERTION           BIT_ULL(6)
+#define INT_TRACE_WATERMARK     BIT_ULL(7)
+
+/* MSI messages, one per interrupt source, see logic/board_phi/top.vhdl.
+ * Without as many, everything shares the first. */
+#define VECTOR_HALT             0
+#define VECTOR_DISPLAY          1
+#define VECTOR_FLIP             2
+#define VECTOR_TRACE            3
+#define NUM_VECTORS             4
+
+#define INT_SOURCES             (INT_HALTED | INT_DISPLAY | INT_FLIP | INT_TRACE_WATERMARK)
+
+/* counter select register, the low bits select the counter */
+#define COUNTER_SNAPSHOT        BIT_ULL(63)
+
+/* trace control register, the ring holds 2^size records */
+#define TRACE_ENABLE            BIT_ULL(0)
+#define TRACE_SIZE(bits)        ((u64)(bits) << 8)
+#define TRACE_RING_BITS         ilog2(BSS2K_TRACE_RECORDS)
+
+/* trace producer register */
+#define TRACE_PRODUCER          GENMASK_ULL(31, 0)
+#define TRACE_DROPPED           GENMASK_ULL(63, 32)
+
+/* event ring register, the size is in the low bits of the address */
+#define EVENT_RING_BITS         ilog2(BSS2K_EVENT_RECORDS)
 
 /* aperture is two megabytes */
 #define DMA_BUF_TEXTMODE_EMULATION_SIZE	0x200000
 
+#define FRAMEBUFFER_SIZE        (BSS2K_FRAMEBUFFER_WIDTH * BSS2K_FRAMEBUFFER_HEIGHT * 4)
+
+/* framebuffers in emulated memory, see logic/cpu/bss2k.vhdl */
+#define FIRST_FRAMEBUFFER_START		0x0007d8
+#define SECOND_FRAMEBUFFER_START	0x0a93d8
+
+/* the pages holding a framebuffer lie within one mapping, so they can be
+ * exported as a single segment */
+#define FRAMEBUFFER_IN_ONE_MAPPING(start) \
+	((round_down((start), PAGE_SIZE) >> MAPPING_BITS) == \
+	 ((round_up((start) + FRAMEBUFFER_SIZE, PAGE_SIZE) - 1) >> MAPPING_BITS))
+
+static size_t const bss2k_framebuffer_start[BSS2K_FRAMEBUFFER_COUNT] =
+{
+	FIRST_FRAMEBUFFER_START,
+	SECOND_FRAMEBUFFER_START
+};
+
+struct bss2k_priv;
+
+/* an interrupt vector, and the sources raising it */
+struct bss2k_vector
+{
+	struct bss2k_priv *priv;
+
+	int irq;
+	u64 sources;
+
+	/* the status register tells which source was raised */
+	bool shared;
+};
+
+static struct
+{
+	u64 sources;
+	char const *name;
+} const bss2k_vectors[NUM_VECTORS] =
+{
+	[VECTOR_HALT] = { INT_HALTED, "bss2k-halt" },
+	[VECTOR_DISPLAY] = { INT_DISPLAY, "bss2k-display" },
+	[VECTOR_FLIP] = { INT_FLIP, "bss2k-flip" },
+	[VECTOR_TRACE] = { INT_TRACE_WATERMARK, "bss2k-trace" }
+};
+
+/* textmode trampoline buffer, the card rotates through them */
+struct bss2k_trampoline
+{
+	struct bss2k_priv *priv;
+
+	/* host pointer */
+	void *cpu;
+
+	/* DMA descriptor, the low bits are free to select the buffer */
+	dma_addr_t dma;
+
+	/* shared by every dma_buf exported for this buffer */
+	struct dma_resv resv;
+
+	/* update writing this buffer, protected by fence_lock */
+	struct dma_fence *fence;
+};
+
+/* pages of emulated memory exported for one framebuffer */
+struct bss2k_framebuffer_region
+{
+	struct bss2k_priv *priv;
+
+	/* page aligned start and size in emulated memory */
+	size_t start;
+	size_t size;
+};
+
 struct bss2k_priv
 {
 	/* hardware PCIe device */
@@ -64,23 +190,51 @@ struct bss2k_priv
 	/* emulator memory (DMA descriptors) */
 	dma_addr_t host_mem_dma[NUM_MAPPINGS];
 
-	/* trampoline buffer for textmode (host pointer) */
-	void *trampoline_cpu;
+	/* trampoline buffers for textmode */
+	struct bss2k_trampoline trampoline[BSS2K_TEXTMODE_BUFFERS];
 
-	/* trampoline buffer for textmode (DMA descriptor) */
-	dma_addr_t trampoline_dma;
+	/* framebuffers, exported as dma_buf */
+	struct bss2k_framebuffer_region framebuffer[BSS2K_FRAMEBUFFER_COUNT];
 
-	/* IRQ for graphics update */
-	int gfx_swap_irq;
+	/* front framebuffer and flip count, see BSS2K_IOC_READ_FLIP */
+	u64 flip;
 
-	/* IRQ handler bottom half */
-	struct tasklet_struct interrupt_bottomhalf;
+	/* interrupt vectors */
+	struct bss2k_vector vector[NUM_VECTORS];
+	unsigned int num_vectors;
 
-	/* wait queue */
+	/* display updates and flips, reported as POLLIN */
 	struct wait_queue_head waitqueue;
+	atomic64_t swap_event_count;
+
+	/* halts since the driver was loaded, reported as POLLPRI */
+	struct wait_queue_head halt_waitqueue;
+	u64 halt_count;
+
+	/* trace ring watermarks since the driver was loaded, reported as
+	 * POLLRDBAND */
+	struct wait_queue_head trace_waitqueue;
+	u64 trace_count;
+
+	/* serializes starting textmode updates against cancelling them */
+	struct mutex update_lock;
+
+	/* textmode update fences, also held while writing the control
+	 * register */
+	spinlock_t fence_lock;
+	u64 fence_context;
+	u64 fence_seqno;
 
-	/* event counter */
-	u64 swap_event_count;
+	/* counter select register and the snapshot behind it */
+	struct mutex counter_lock;
+
+	/* instruction trace ring */
+	void *trace;
+	dma_addr_t trace_dma;
+
+	/* debug event ring */
+	void *events;
+	dma_addr_t events_dma;
 };
 
 struct bss2k_file_priv
@@ -90,6 +244,12 @@ struct bss2k_file_priv
 
 	/* last seen event counter */
 	u64 last_swap_event;
+
+	/* last seen halt counter */
+	u64 last_halt;
+
+	/* last seen trace watermark counter */
+	u64 last_trace;
 };
 
 static int bss2k_open(
@@ -109,6 +269,8 @@ static int bss2k_open(
 
 	file_priv->device_priv = priv;
 	file_priv->last_swap_event = 0;
+	file_priv->last_halt = READ_ONCE(priv->halt_count);
+	file_priv->last_trace = READ_ONCE(priv->trace_count);
 
 	filp->private_data = file_priv;
 
@@ -126,6 +288,28 @@ static int bss2k_release(
 	return 0;
 }
 
+/* write back the data cache, so host memory is current. A stopped CPU has
+ * been flushed by the hardware already. */
+static int bss2k_flush_dcache(
+		struct bss2k_priv *priv)
+{
+	unsigned int timeout = FLUSH_TIMEOUT;
+
+	if(!(priv->reg[REG_STATUS] & STS_RUNNING))
+		return 0;
+
+	priv->reg[REG_CONTROL] = CTL_MASK_FLUSH | CTL_FLUSH;
+
+	while(priv->reg[REG_CONTROL] & CTL_FLUSH)
+	{
+		if(!--timeout)
+			return -ETIMEDOUT;
+		udelay(1);
+	}
+
+	return 0;
+}
+
 static ssize_t bss2k_read(
 		struct file *filp,
 		char __user *buf,
@@ -144,6 +328,10 @@ static ssize_t bss2k_read(
 
 	ssize_t total_read = 0;
 
+	int const err = bss2k_flush_dcache(priv);
+	if(err)
+		return err;
+
 	/* limit to end of memory */
 	if(*pos + count > end)
 		count = end - *pos;
@@ -222,13 +410,103 @@ static ssize_t bss2k_write(
 	return 0;
 }
 
+/* map one of the rings written by the card, read-only */
+static int bss2k_mmap_ring(
+		struct device *dev,
+		struct vm_area_struct *vma,
+		void *cpu_addr,
+		dma_addr_t dma_addr,
+		size_t size)
+{
+	unsigned long const vm_pgoff = vma->vm_pgoff;
+	int err;
+
+	if(vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	if(vma->vm_end - vma->vm_start > size)
+		return -EINVAL;
+
+	/* and keep it that way, mprotect must not make it writable */
+	vm_flags_clear(vma, VM_MAYWRITE);
+
+	vma->vm_pgoff = 0;
+	err = dma_mmap_coherent(dev, vma, cpu_addr, dma_addr, size);
+	vma->vm_pgoff = vm_pgoff;
+	return err;
+}
+
+/* resolve a page of emulator memory. The 2 MiB pages are separate
+ * allocations, so a mapping is filled in page by page rather than in one go. */
+static vm_fault_t bss2k_fault(
+		struct vm_fault *vmf)
+{
+	struct bss2k_priv *const priv = vmf->vma->vm_private_data;
+
+	size_t const offset_mask = MAPPING_SIZE - 1;
+	size_t const pos = vmf->pgoff << PAGE_SHIFT;
+
+	if(pos >= BSS2K_MEMORY_SIZE)
+		return VM_FAULT_SIGBUS;
+
+	return vmf_insert_pfn(
+			vmf->vma,
+			vmf->address,
+			page_to_pfn(virt_to_page(
+				priv->host_mem[pos >> MAPPING_BITS]
+					+ (pos & offset_mask))));
+}
+
+static struct vm_operations_struct const bss2k_vm_ops =
+{
+	.fault = &bss2k_fault
+};
+
+/* map emulator memory. The card sees the same pages, so a private copy
+ * would silently stop following it. */
+static int bss2k_mmap(
+		struct file *filp,
+		struct vm_area_struct *vma)
+{
+	struct bss2k_file_priv *const file_priv = filp->private_data;
+	struct bss2k_priv *const priv = file_priv->device_priv;
+	struct device *const dev = &priv->pdev->dev;
+
+	size_t const end = BSS2K_MEMORY_SIZE;
+
+	size_t pos;
+
+	if(!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+
+	if(vma->vm_pgoff == (BSS2K_TRACE_OFFSET >> PAGE_SHIFT))
+		return bss2k_mmap_ring(dev, vma,
+				priv->trace, priv->trace_dma, BSS2K_TRACE_SIZE);
+	if(vma->vm_pgoff == (BSS2K_EVENT_OFFSET >> PAGE_SHIFT))
+		return bss2k_mmap_ring(dev, vma,
+				priv->events, priv->events_dma, BSS2K_EVENT_SIZE);
+
+	if(vma->vm_pgoff > (end >> PAGE_SHIFT))
+		return -EINVAL;
+
+	pos = vma->vm_pgoff << PAGE_SHIFT;
+
+	if(vma->vm_end - vma->vm_start > end - pos)
+		return -EINVAL;
+
+	vm_flags_set(vma, VM_PFNMAP | VM_DONTEXPAND | VM_DONTDUMP);
+	vma->vm_ops = &bss2k_vm_ops;
+	vma->vm_private_data = priv;
+
+	return 0;
+}
+
 static int bss2k_attach_textmode(
 		struct dma_buf *buf,
 		struct dma_buf_attachment *attachment)
 {
-	struct bss2k_priv *const priv = buf->priv;
+	struct bss2k_trampoline *const trampoline = buf->priv;
 
-	attachment->priv = priv;
+	attachment->priv = trampoline;
 	attachment->peer2peer = false;
 
 	return 0;
@@ -238,14 +516,17 @@ static struct sg_table *bss2k_map_textmode(
 		struct dma_buf_attachment *attachment,
 		enum dma_data_direction direction)
 {
-	struct bss2k_priv *const priv = attachment->priv;
+	struct bss2k_trampoline *const trampoline = attachment->priv;
+	struct bss2k_priv *const priv = trampoline->priv;
 	struct pci_dev *const pdev = priv->pdev;
 	struct device *const dev = &pdev->dev;
 
 	int err;
 	struct sg_table *sg;
+	unsigned int i;
 
-	bool const trampoline_is_set_up = !!priv->trampoline_cpu;
+	bool const trampoline_is_set_up =
+		!!priv->trampoline[BSS2K_TEXTMODE_BUFFERS - 1].cpu;
 
 	sg = devm_kmalloc(dev, sizeof *sg, GFP_KERNEL);
 	if(!sg)
@@ -258,18 +539,27 @@ static struct sg_table *bss2k_map_textmode(
 
 	/* TODO: locking */
 
-	if(!priv->trampoline_cpu)
-		priv->trampoline_cpu = dmam_alloc_coherent(
-				dev,
-				DMA_BUF_TEXTMODE_EMULATION_SIZE,
-				&priv->trampoline_dma,
-				GFP_KERNEL);
+	/* the card needs all of them before it can rotate */
+	for(i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+	{
+		struct bss2k_trampoline *const t = &priv->trampoline[i];
 
-	if(!priv->trampoline_cpu)
-		goto fail_alloc_buf;
+		if(!t->cpu)
+			t->cpu = dmam_alloc_coherent(
+					dev,
+					DMA_BUF_TEXTMODE_EMULATION_SIZE,
+					&t->dma,
+					GFP_KERNEL);
+
+		if(!t->cpu)
+			goto fail_alloc_buf;
+	}
 
+	/* buffer 0 sets all of them, so it goes first. The card renders all
+	 * rows again after an address changed. */
 	if(!trampoline_is_set_up)
-		priv->reg[REG_TEXTMODE] = priv->trampoline_dma;
+		for(i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+			priv->reg[REG_TEXTMODE] = priv->trampoline[i].dma | i;
 
 	sg->sgl = devm_kmalloc(dev, sizeof(*sg->sgl), GFP_KERNEL);
 	if(!sg->sgl)
@@ -277,8 +567,8 @@ static struct sg_table *bss2k_map_textmode(
 
 	sg_init_table(sg->sgl, 1);
 
-	sg_set_buf(&sg->sgl[0], priv->trampoline_cpu, DMA_BUF_TEXTMODE_EMULATION_SIZE);
-	sg_dma_address(&sg->sgl[0]) = priv->trampoline_dma;
+	sg_set_buf(&sg->sgl[0], trampoline->cpu, DMA_BUF_TEXTMODE_EMULATION_SIZE);
+	sg_dma_address(&sg->sgl[0]) = trampoline->dma;
 #ifdef CONFIG_NEED_SG_DMA_LENGTH
 	sg_dma_len(&sg->sgl[0]) = DMA_BUF_TEXTMODE_EMULATION_SIZE;
 #endif
@@ -301,7 +591,8 @@ void bss2k_unmap_textmode(
 		struct sg_table *sg,
 		enum dma_data_direction direction)
 {
-	struct bss2k_priv *const priv = attachment->priv;
+	struct bss2k_trampoline *const trampoline = attachment->priv;
+	struct bss2k_priv *const priv = trampoline->priv;
 	struct pci_dev *const pdev = priv->pdev;
 	struct device *const dev = &pdev->dev;
 
@@ -324,6 +615,254 @@ static struct dma_buf_ops const bss2k_textmode_ops =
 	.release = &bss2k_release_textmode
 };
 
+static char const *bss2k_fence_get_driver_name(
+		struct dma_fence *fence)
+{
+	return KBUILD_MODNAME;
+}
+
+static char const *bss2k_fence_get_timeline_name(
+		struct dma_fence *fence)
+{
+	return "textmode";
+}
+
+static struct dma_fence_ops const bss2k_fence_ops =
+{
+	.get_driver_name = &bss2k_fence_get_driver_name,
+	.get_timeline_name = &bss2k_fence_get_timeline_name
+};
+
+/* buffer the card writes next, the one after the newest */
+static unsigned int bss2k_textmode_current(
+		struct bss2k_priv *priv)
+{
+	u64 const newest =
+		(priv->reg[REG_INT_STATUS] & INT_TEXTMODE_NEWEST) >> 4;
+
+	return (newest + 1) % BSS2K_TEXTMODE_BUFFERS;
+}
+
+/* signal the fences of completed updates, or all of them with an error.
+ * Called with fence_lock held.
+ *
+ * The card is asked whether an update is running, rather than counting
+ * interrupts: the next update may have started before the handler for the
+ * previous one runs, and its fence must not be signaled early. Only then is
+ * the buffer it goes to needed. */
+static void bss2k_signal_textmode_fences(
+		struct bss2k_priv *priv,
+		int error)
+{
+	bool const busy =
+		!error && (priv->reg[REG_CONTROL] & CTL_UPDATEDISPLAY);
+	unsigned int const current =
+		busy ? bss2k_textmode_current(priv) : BSS2K_TEXTMODE_BUFFERS;
+
+	unsigned int i;
+
+	for(i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+	{
+		struct bss2k_trampoline *const t = &priv->trampoline[i];
+
+		if(!t->fence)
+			continue;
+		if(i == current)
+			continue;
+
+		if(error)
+			dma_fence_set_error(t->fence, error);
+		dma_fence_signal_locked(t->fence);
+		dma_fence_put(t->fence);
+		t->fence = NULL;
+	}
+}
+
+static void bss2k_cancel_textmode_fences(
+		struct bss2k_priv *priv)
+{
+	spin_lock_irq(&priv->fence_lock);
+	bss2k_signal_textmode_fences(priv, -ECANCELED);
+	spin_unlock_irq(&priv->fence_lock);
+}
+
+/* add a write fence for the update about to start to the buffer it goes
+ * to, so importers of the dma_buf wait for it. Nothing would signal it
+ * without the display interrupt, and an update in progress has its fence
+ * already. Called with update_lock held. */
+static struct dma_fence *bss2k_textmode_fence(
+		struct bss2k_priv *priv,
+		struct bss2k_trampoline **trampoline)
+{
+	struct bss2k_trampoline *t;
+	struct dma_fence *fence;
+	int err;
+
+	if(!(priv->reg[REG_INT_MASK] & INT_DISPLAY))
+		return NULL;
+	if(priv->reg[REG_CONTROL] & CTL_UPDATEDISPLAY)
+		return NULL;
+
+	t = &priv->trampoline[bss2k_textmode_current(priv)];
+
+	fence = kzalloc(sizeof *fence, GFP_KERNEL);
+	if(!fence)
+		return NULL;
+
+	spin_lock_irq(&priv->fence_lock);
+	dma_fence_init(
+			fence,
+			&bss2k_fence_ops,
+			&priv->fence_lock,
+			priv->fence_context,
+			++priv->fence_seqno);
+	spin_unlock_irq(&priv->fence_lock);
+
+	dma_resv_lock(&t->resv, NULL);
+	err = dma_resv_reserve_fences(&t->resv, 1);
+	if(!err)
+		dma_resv_add_fence(&t->resv, fence, DMA_RESV_USAGE_WRITE);
+	dma_resv_unlock(&t->resv);
+
+	if(err)
+	{
+		/* never published, so it can be dropped unsignaled */
+		dma_fence_put(fence);
+		return NULL;
+	}
+
+	*trampoline = t;
+	return fence;
+}
+
+static void bss2k_write_control(
+		struct bss2k_priv *priv,
+		u64 value)
+{
+	bool const starts_update =
+		(value & CTL_MASK_UPDATEDISPLAY) && (value & CTL_UPDATEDISPLAY);
+
+	struct bss2k_trampoline *trampoline = NULL;
+	struct dma_fence *fence = NULL;
+
+	if(starts_update)
+	{
+		mutex_lock(&priv->update_lock);
+		fence = bss2k_textmode_fence(priv, &trampoline);
+	}
+
+	/* the interrupt handler sees the fence and the started update
+	 * together */
+	spin_lock_irq(&priv->fence_lock);
+	if(fence)
+		trampoline->fence = fence;
+	priv->reg[REG_CONTROL] = value;
+	spin_unlock_irq(&priv->fence_lock);
+
+	if(starts_update)
+		mutex_unlock(&priv->update_lock);
+}
+
+static int bss2k_attach_framebuffer(
+		struct dma_buf *buf,
+		struct dma_buf_attachment *attachment)
+{
+	struct bss2k_framebuffer_region *const region = buf->priv;
+
+	attachment->priv = region;
+	attachment->peer2peer = false;
+
+	return 0;
+}
+
+/* the region lies within one mapping, so it is a single DMA segment */
+static struct sg_table *bss2k_map_framebuffer(
+		struct dma_buf_attachment *attachment,
+		enum dma_data_direction direction)
+{
+	struct bss2k_framebuffer_region *const region = attachment->priv;
+	struct bss2k_priv *const priv = region->priv;
+
+	size_t const page = region->start >> MAPPING_BITS;
+	size_t const offset = region->start & (MAPPING_SIZE - 1);
+
+	int err;
+	struct sg_table *sg;
+
+	sg = kzalloc(sizeof *sg, GFP_KERNEL);
+	if(!sg)
+		return ERR_PTR(-ENOMEM);
+
+	err = sg_alloc_table(sg, 1, GFP_KERNEL);
+	if(err)
+		goto fail_alloc_table;
+
+	sg_set_buf(sg->sgl, priv->host_mem[page] + offset, region->size);
+	sg_dma_address(sg->sgl) = priv->host_mem_dma[page] + offset;
+#ifdef CONFIG_NEED_SG_DMA_LENGTH
+	sg_dma_len(sg->sgl) = region->size;
+#endif
+
+	return sg;
+
+fail_alloc_table:
+	kfree(sg);
+	return ERR_PTR(err);
+}
+
+static void bss2k_unmap_framebuffer(
+		struct dma_buf_attachment *attachment,
+		struct sg_table *sg,
+		enum dma_data_direction direction)
+{
+	sg_free_table(sg);
+	kfree(sg);
+}
+
+static void bss2k_release_framebuffer(
+		struct dma_buf *buf)
+{
+	/* memory belongs to the device */
+}
+
+static struct dma_buf_ops const bss2k_framebuffer_ops =
+{
+	.cache_sgt_mapping = true,
+	.attach = &bss2k_attach_framebuffer,
+	.map_dma_buf = &bss2k_map_framebuffer,
+	.unmap_dma_buf = &bss2k_unmap_framebuffer,
+	.release = &bss2k_release_framebuffer
+};
+
+/* enabling clears the producer index, so the ring is empty */
+static void bss2k_start_trace(
+		struct bss2k_priv *priv,
+		u32 period)
+{
+	priv->reg[REG_TRACE_CONTROL] = TRACE_SIZE(TRACE_RING_BITS);
+	priv->reg[REG_TRACE_CONSUMER] = 0ULL;
+	priv->reg[REG_TRACE_PERIOD] = period;
+	priv->reg[REG_TRACE_CONTROL] = TRACE_SIZE(TRACE_RING_BITS) | TRACE_ENABLE;
+}
+
+/* pass the consumer index, then read the producer. The read does not pass
+ * the posted writes of the ring, so those records are visible. */
+static void bss2k_ring_position(
+		struct bss2k_priv *priv,
+		unsigned int consumer_reg,
+		unsigned int producer_reg,
+		struct bss2k_trace_position *position)
+{
+	u64 producer;
+
+	priv->reg[consumer_reg] = position->consumer;
+	producer = priv->reg[producer_reg];
+
+	position->producer = FIELD_GET(TRACE_PRODUCER, producer);
+	position->dropped = FIELD_GET(TRACE_DROPPED, producer);
+	position->reserved = 0;
+}
+
 static long bss2k_ioctl(
 		struct file *filp,
 		unsigned int cmd,
@@ -336,6 +875,11 @@ static long bss2k_ioctl(
 	{
 		u64 as_u64;
 		int as_int;
+		struct bss2k_framebuffer as_framebuffer;
+		struct bss2k_textmode_texture as_textmode_texture;
+		struct bss2k_counters as_counters;
+		struct bss2k_trace_position as_trace_position;
+		struct bss2k_wait_halt as_wait_halt;
 	} val;
 
 	if(_IOC_DIR(cmd) & _IOC_WRITE)
@@ -352,13 +896,30 @@ static long bss2k_ioctl(
 	switch(cmd)
 	{
 	case BSS2K_IOC_RESET:
+		mutex_lock(&priv->update_lock);
 		priv->reg[REG_INT_MASK] = 0ULL;
 		priv->reg[REG_CONTROL] = CTL_MASK_RESET | CTL_RESET;
+		/* the card empties the event ring during reset */
+		priv->reg[REG_EVENT_CONSUMER] = 0ULL;
+		/* the display interrupt is off, so nothing signals them */
+		bss2k_cancel_textmode_fences(priv);
+		mutex_unlock(&priv->update_lock);
+		/* the CPU is no longer running, and raises no interrupt to say
+		 * so */
+		wake_up(&priv->halt_waitqueue);
 		break;
 	case BSS2K_IOC_START_CPU:
-		priv->reg[REG_INT_MASK] = 3ULL;
+		WRITE_ONCE(priv->flip, 0);
+		priv->reg[REG_INT_MASK] = INT_SOURCES;
 		priv->reg[REG_CONTROL] = CTL_MASK_RESET | 0;
 		break;
+	case BSS2K_IOC_FLUSH_DCACHE:
+		{
+			int const err = bss2k_flush_dcache(priv);
+			if(err)
+				return err;
+		}
+		break;
 	case BSS2K_IOC_READ_STATUS:
 		val.as_u64 = priv->reg[REG_STATUS];
 		break;
@@ -371,26 +932,146 @@ static long bss2k_ioctl(
 	case BSS2K_IOC_READ_INTMASK:
 		val.as_u64 = priv->reg[REG_INT_MASK];
 		break;
+	case BSS2K_IOC_READ_FLIP:
+		val.as_u64 = READ_ONCE(priv->flip);
+		break;
+	case BSS2K_IOC_READ_TEXTMODE_BUFFER:
+		val.as_u64 = (priv->reg[REG_INT_STATUS] & INT_TEXTMODE_NEWEST) >> 4;
+		break;
+	case BSS2K_IOC_READ_DAMAGE:
+		/* write 1 to clear, so rows sent in between are kept */
+		val.as_u64 = priv->reg[REG_TEXTMODE_DAMAGE];
+		priv->reg[REG_TEXTMODE_DAMAGE] = val.as_u64;
+		break;
+	case BSS2K_IOC_READ_COUNTERS:
+		{
+			unsigned int i;
+
+			/* reads are not reordered before the posted writes */
+			mutex_lock(&priv->counter_lock);
+			priv->reg[REG_COUNTER_SELECT] = COUNTER_SNAPSHOT | 0;
+			for(i = 0; i < BSS2K_COUNTERS; ++i)
+			{
+				if(i)
+					priv->reg[REG_COUNTER_SELECT] = i;
+				val.as_counters.value[i] = priv->reg[REG_COUNTER];
+			}
+			mutex_unlock(&priv->counter_lock);
+		}
+		break;
+	case BSS2K_IOC_TRACE_START:
+		bss2k_start_trace(priv, 0);
+		break;
+	case BSS2K_IOC_TRACE_SAMPLE:
+		/* zero would trace every instruction */
+		if(!val.as_u64 || val.as_u64 > U32_MAX)
+			return -EINVAL;
+		bss2k_start_trace(priv, val.as_u64);
+		break;
+	case BSS2K_IOC_TRACE_STOP:
+		priv->reg[REG_TRACE_CONTROL] = TRACE_SIZE(TRACE_RING_BITS);
+		break;
+	case BSS2K_IOC_TRACE_POSITION:
+		bss2k_ring_position(priv, REG_TRACE_CONSUMER, REG_TRACE_PRODUCER,
+				&val.as_trace_position);
+		break;
+	case BSS2K_IOC_EVENT_POSITION:
+		bss2k_ring_position(priv, REG_EVENT_CONSUMER, REG_EVENT_PRODUCER,
+				&val.as_trace_position);
+		break;
+	case BSS2K_IOC_WAIT_HALT:
+		{
+			long const timeout = min_t(u64,
+					nsecs_to_jiffies64(val.as_wait_halt.timeout_ns),
+					MAX_SCHEDULE_TIMEOUT);
+			long const ret = wait_event_interruptible_timeout(
+					priv->halt_waitqueue,
+					!(priv->reg[REG_STATUS] & STS_RUNNING),
+					timeout);
+			if(ret < 0)
+				return ret;
+			val.as_wait_halt.status = priv->reg[REG_STATUS];
+		}
+		break;
 	case BSS2K_IOC_WRITE_CONTROL:
-		priv->reg[REG_CONTROL] = val.as_u64;
+		bss2k_write_control(priv, val.as_u64);
 		break;
 	case BSS2K_IOC_WRITE_INTMASK:
+		mutex_lock(&priv->update_lock);
 		priv->reg[REG_INT_MASK] = val.as_u64;
+		if(!(val.as_u64 & INT_DISPLAY))
+			bss2k_cancel_textmode_fences(priv);
+		mutex_unlock(&priv->update_lock);
 		break;
 	case BSS2K_IOC_GET_TEXTMODE_TEXTURE:
 		{
-			struct dma_buf_export_info const info =
+			u32 const index = val.as_textmode_texture.index;
+
+			struct dma_buf *buf;
+			int fd;
+
+			if(index >= BSS2K_TEXTMODE_BUFFERS)
+				return -EINVAL;
+
+			{
+				struct dma_buf_export_info const info =
+				{
+					.exp_name = KBUILD_MODNAME,
+					.owner = THIS_MODULE,
+					.ops = &bss2k_textmode_ops,
+					.size = DMA_BUF_TEXTMODE_EMULATION_SIZE,
+					.flags = O_RDONLY,
+					.resv = &priv->trampoline[index].resv,
+					.priv = &priv->trampoline[index]
+				};
+
+				buf = dma_buf_export(&info);
+			}
+
+			if(IS_ERR(buf))
 			{
-				.exp_name = KBUILD_MODNAME,
-				.owner = THIS_MODULE,
-				.ops = &bss2k_textmode_ops,
-				.size = DMA_BUF_TEXTMODE_EMULATION_SIZE,
-				.flags = O_RDONLY,
-				.resv = NULL,
-				.priv = priv
-			};
+				dev_err(&priv->pdev->dev, "cannot dma_buf_export: %ld", PTR_ERR(buf));
+				return PTR_ERR(buf);
+			}
+
+			fd = dma_buf_fd(buf, O_CLOEXEC);
+			if(fd < 0)
+			{
+				dev_err(&priv->pdev->dev, "cannot dma_buf_fd: %d", fd);
+				dma_buf_put(buf);
+				return fd;
+			}
+
+			val.as_textmode_texture.fd = fd;
+		}
+		break;
+	case BSS2K_IOC_GET_FRAMEBUFFER:
+		{
+			u32 const index = val.as_framebuffer.index;
+
+			struct bss2k_framebuffer_region *region;
+			struct dma_buf *buf;
+			int fd;
 
-			struct dma_buf *const buf = dma_buf_export(&info);
+			if(index >= BSS2K_FRAMEBUFFER_COUNT)
+				return -EINVAL;
+
+			region = &priv->framebuffer[index];
+
+			{
+				struct dma_buf_export_info const info =
+				{
+					.exp_name = KBUILD_MODNAME,
+					.owner = THIS_MODULE,
+					.ops = &bss2k_framebuffer_ops,
+					.size = region->size,
+					.flags = O_RDONLY,
+					.resv = NULL,
+					.priv = region
+				};
+
+				buf = dma_buf_export(&info);
+			}
 
 			if(IS_ERR(buf))
 			{
@@ -398,12 +1079,17 @@ static long bss2k_ioctl(
 				return PTR_ERR(buf);
 			}
 
-			val.as_int = dma_buf_fd(buf, O_CLOEXEC);
-			if(val.as_int < 0)
+			fd = dma_buf_fd(buf, O_CLOEXEC);
+			if(fd < 0)
 			{
-				dev_err(&priv->pdev->dev, "cannot dma_buf_fd: %d", val.as_int);
-				return val.as_int;
+				dev_err(&priv->pdev->dev, "cannot dma_buf_fd: %d", fd);
+				dma_buf_put(buf);
+				return fd;
 			}
+
+			val.as_framebuffer.fd = fd;
+			val.as_framebuffer.offset = bss2k_framebuffer_start[index] - region->start;
+			val.as_framebuffer.size = region->size;
 		}
 		break;
 	default:
@@ -431,11 +1117,15 @@ static __poll_t bss2k_poll(
 	struct bss2k_file_priv *const file_priv = filp->private_data;
 	struct bss2k_priv *const priv = file_priv->device_priv;
 
-	u64 swap_event_count = priv->swap_event_count;
+	u64 swap_event_count = atomic64_read(&priv->swap_event_count);
+	u64 halt_count = READ_ONCE(priv->halt_count);
+	u64 trace_count = READ_ONCE(priv->trace_count);
 
 	__poll_t ret = 0;
 
 	poll_wait(filp, &priv->waitqueue, wait);
+	poll_wait(filp, &priv->halt_waitqueue, wait);
+	poll_wait(filp, &priv->trace_waitqueue, wait);
 
 	if(swap_event_count != file_priv->last_swap_event)
 	{
@@ -443,6 +1133,18 @@ static __poll_t bss2k_poll(
 		ret |= POLLIN;
 	}
 
+	if(halt_count != file_priv->last_halt)
+	{
+		file_priv->last_halt = halt_count;
+		ret |= POLLPRI;
+	}
+
+	if(trace_count != file_priv->last_trace)
+	{
+		file_priv->last_trace = trace_count;
+		ret |= POLLRDBAND;
+	}
+
 	return ret;
 }
 
@@ -454,30 +1156,90 @@ static struct file_operations const bss2k_fops =
 	.release = &bss2k_release,
 	.read = &bss2k_read,
 	.write = &bss2k_write,
+	.mmap = &bss2k_mmap,
 	.unlocked_ioctl = &bss2k_ioctl,
 	.poll = &bss2k_poll
 };
 
-static irqreturn_t bss2k_interrupt(int irq, void *data)
+/* a failed assertion is raised together with the halt, and shows in the
+ * status register as well */
+static void bss2k_interrupt_halt(
+		struct bss2k_priv *priv)
 {
-	struct pci_dev *const pdev = data;
-	struct device *const dev = &pdev->dev;
-	struct bss2k_priv *const priv = dev_get_drvdata(dev);
+	priv->reg[REG_INT_STATUS] = INT_HALTED | INT_ASSERTION;
+	WRITE_ONCE(priv->halt_count, priv->halt_count + 1);
+
+	wake_up(&priv->halt_waitqueue);
+}
 
-	tasklet_schedule(&priv->interrupt_bottomhalf);
+/* the newest textmode buffer is read by BSS2K_IOC_READ_TEXTMODE_BUFFER,
+ * the card has already moved on to the next one */
+static void bss2k_interrupt_display(
+		struct bss2k_priv *priv)
+{
+	spin_lock(&priv->fence_lock);
+	priv->reg[REG_INT_STATUS] = INT_DISPLAY;
+	bss2k_signal_textmode_fences(priv, 0);
+	spin_unlock(&priv->fence_lock);
 
-	return IRQ_HANDLED;
+	atomic64_inc(&priv->swap_event_count);
+	wake_up(&priv->waitqueue);
 }
 
-static void bss2k_interrupt_bottomhalf(unsigned long data)
+/* the front buffer is read back rather than toggled: the CPU may flip
+ * again before the acknowledge, and the two flips raise one interrupt */
+static void bss2k_interrupt_flip(
+		struct bss2k_priv *priv)
 {
-	struct bss2k_priv *const priv = (struct bss2k_priv *)data;
+	u64 const flip = READ_ONCE(priv->flip);
+	u64 front;
+
+	/* acknowledge before reading the front buffer, so a later flip
+	 * raises the interrupt again */
+	priv->reg[REG_INT_STATUS] = INT_FLIP;
+	front = !!(priv->reg[REG_INT_STATUS] & INT_FRONT_FRAMEBUFFER);
 
-	++priv->swap_event_count;
+	WRITE_ONCE(priv->flip, ((BSS2K_FLIP_COUNT(flip) + 1) << 1) | front);
 
+	atomic64_inc(&priv->swap_event_count);
 	wake_up(&priv->waitqueue);
 }
 
+/* raised again once the host has read the ring below half */
+static void bss2k_interrupt_trace(
+		struct bss2k_priv *priv)
+{
+	priv->reg[REG_INT_STATUS] = INT_TRACE_WATERMARK;
+	WRITE_ONCE(priv->trace_count, priv->trace_count + 1);
+
+	wake_up(&priv->trace_waitqueue);
+}
+
+static irqreturn_t bss2k_interrupt(int irq, void *data)
+{
+	struct bss2k_vector *const vector = data;
+	struct bss2k_priv *const priv = vector->priv;
+
+	/* a message of its own is only sent when its source was raised */
+	u64 const pending = vector->shared ?
+		priv->reg[REG_INT_STATUS] & vector->sources :
+		vector->sources;
+
+	if(!pending)
+		return IRQ_NONE;
+
+	if(pending & INT_HALTED)
+		bss2k_interrupt_halt(priv);
+	if(pending & INT_DISPLAY)
+		bss2k_interrupt_display(priv);
+	if(pending & INT_FLIP)
+		bss2k_interrupt_flip(priv);
+	if(pending & INT_TRACE_WATERMARK)
+		bss2k_interrupt_trace(priv);
+
+	return IRQ_HANDLED;
+}
+
 static struct
 {
 	/* TODO clean up */
@@ -540,6 +1302,56 @@ static int bss2k_probe(
 	for(i = 0; i < NUM_MAPPINGS; ++i)
 		priv->reg[REG_MAPPING + i] = priv->host_mem_dma[i];
 
+	/* page aligned, as the card requires */
+	priv->trace = dmam_alloc_coherent(dev,
+			BSS2K_TRACE_SIZE,
+			&priv->trace_dma,
+			GFP_KERNEL);
+	if(!priv->trace)
+		return -ENOMEM;
+
+	priv->reg[REG_TRACE_CONTROL] = TRACE_SIZE(TRACE_RING_BITS);
+	priv->reg[REG_TRACE_BASE] = priv->trace_dma;
+
+	/* events are always written while the CPU runs */
+	priv->events = dmam_alloc_coherent(dev,
+			BSS2K_EVENT_SIZE,
+			&priv->events_dma,
+			GFP_KERNEL);
+	if(!priv->events)
+		return -ENOMEM;
+
+	priv->reg[REG_EVENT_CONSUMER] = 0ULL;
+	priv->reg[REG_EVENT_RING] = priv->events_dma | EVENT_RING_BITS;
+
+	for(i = 0; i < BSS2K_FRAMEBUFFER_COUNT; ++i)
+	{
+		size_t const start = bss2k_framebuffer_start[i];
+		size_t const end = start + FRAMEBUFFER_SIZE;
+
+		struct bss2k_framebuffer_region *const region = &priv->framebuffer[i];
+
+		region->priv = priv;
+		region->start = round_down(start, PAGE_SIZE);
+		region->size = round_up(end, PAGE_SIZE) - region->start;
+	}
+
+	BUILD_BUG_ON(!FRAMEBUFFER_IN_ONE_MAPPING(FIRST_FRAMEBUFFER_START));
+	BUILD_BUG_ON(!FRAMEBUFFER_IN_ONE_MAPPING(SECOND_FRAMEBUFFER_START));
+
+	mutex_init(&priv->update_lock);
+	mutex_init(&priv->counter_lock);
+	spin_lock_init(&priv->fence_lock);
+	priv->fence_context = dma_fence_context_alloc(1);
+	priv->fence_seqno = 0;
+
+	/* allocated when first mapped */
+	for(i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+	{
+		priv->trampoline[i].priv = priv;
+		dma_resv_init(&priv->trampoline[i].resv);
+	}
+
 	if(priv->reg[REG_STATUS] & STS_MAPPING_ERROR)
 	{
 		dev_err(dev, "status still shows mapping error "
@@ -548,28 +1360,42 @@ static int bss2k_probe(
 	}
 
 	init_waitqueue_head(&priv->waitqueue);
-	priv->swap_event_count = 0;
-
-	tasklet_init(
-			&priv->interrupt_bottomhalf,
-			&bss2k_interrupt_bottomhalf,
-			(unsigned long)priv);
-
-	err = pci_alloc_irq_vectors(pdev, 1, 4, PCI_IRQ_ALL_TYPES);
+	atomic64_set(&priv->swap_event_count, 0);
+	init_waitqueue_head(&priv->halt_waitqueue);
+	priv->halt_count = 0;
+	init_waitqueue_head(&priv->trace_waitqueue);
+	priv->trace_count = 0;
+
+	/* the card sends message n for source n, as long as there are that
+	 * many, so anything between one and all of them would be shared */
+	err = pci_alloc_irq_vectors(pdev, NUM_VECTORS, NUM_VECTORS, PCI_IRQ_MSI);
+	if(err < 0)
+		err = pci_alloc_irq_vectors(pdev, 1, 1, PCI_IRQ_ALL_TYPES);
 	if(err < 0)
 		goto fail_alloc_irq_vectors;
 
-	priv->gfx_swap_irq = pci_irq_vector(pdev, 0);
+	priv->num_vectors = err;
 
-	err = devm_request_irq(
-			dev,
-			priv->gfx_swap_irq,
-			&bss2k_interrupt,
-			IRQF_SHARED,
-			"bss2k",
-			pdev);
-	if(err < 0)
-		goto fail_request_irq;
+	for(i = 0; i < priv->num_vectors; ++i)
+	{
+		struct bss2k_vector *const vector = &priv->vector[i];
+
+		vector->priv = priv;
+		vector->irq = pci_irq_vector(pdev, i);
+		vector->shared = priv->num_vectors != NUM_VECTORS;
+		vector->sources = vector->shared ?
+			INT_SOURCES : bss2k_vectors[i].sources;
+
+		err = devm_request_irq(
+				dev,
+				vector->irq,
+				&bss2k_interrupt,
+				vector->shared ? IRQF_SHARED : 0,
+				vector->shared ? "bss2k" : bss2k_vectors[i].name,
+				vector);
+		if(err < 0)
+			goto fail_request_irq;
+	}
 
 	cdev_init(&priv->cdev, &bss2k_fops);
 
@@ -597,9 +1423,11 @@ fail_device_create:
 	cdev_del(&priv->cdev);
 
 fail_cdev_add:
-	devm_free_irq(dev, priv->gfx_swap_irq, priv);
+	i = priv->num_vectors;
 
 fail_request_irq:
+	while(i--)
+		devm_free_irq(dev, priv->vector[i].irq, &priv->vector[i]);
 	pci_free_irq_vectors(pdev);
 
 fail_alloc_irq_vectors:
@@ -620,9 +1448,14 @@ static void bss2k_remove(
 	/* disable interrupts */
 	priv->reg[REG_INT_MASK] = 0ULL;
 
-	devm_free_irq(dev, priv->gfx_swap_irq, priv);
+	for(i = 0; i < priv->num_vectors; ++i)
+		devm_free_irq(dev, priv->vector[i].irq, &priv->vector[i]);
 	pci_free_irq_vectors(pdev);
 
+	bss2k_cancel_textmode_fences(priv);
+	for(i = 0; i < BSS2K_TEXTMODE_BUFFERS; ++i)
+		dma_resv_fini(&priv->trampoline[i].resv);
+
 	/* clear mappings, for safety */
 	for(i = 0; i < NUM_MAPPINGS; ++i)
 		priv->reg[REG_MAPPING + i] = 0ULL;
@@ -630,6 +1463,13 @@ static void bss2k_remove(
 	/* disable textmode trampoline */
 	priv->reg[REG_TEXTMODE] = 0ULL;
 
+	/* stop tracing before the ring is freed */
+	priv->reg[REG_TRACE_CONTROL] = 0ULL;
+	priv->reg[REG_TRACE_BASE] = 0ULL;
+
+	/* a zero size disables the event ring */
+	priv->reg[REG_EVENT_RING] = 0ULL;
+
 	/// TODO cleanup
 	device_destroy(
 			bss2k_driver_data.class,
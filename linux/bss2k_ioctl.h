@@ -1,25 +1,212 @@
 #pragma once
 
 #include <asm/ioctl.h>
+#include <linux/types.h>
 
 /* ioctls */
 
 #define BSS2K_MAGIC (2*'K')
 
+/* size of emulated memory, readable, writable and mappable on the device */
+#define BSS2K_MEMORY_SIZE		0x1000000
+
+/* textmode texture buffers, the card writes each update to the next one */
+#define BSS2K_TEXTMODE_BUFFERS		3
+
+/* graphics mode framebuffers, 32 bit RGBA without padding */
+#define BSS2K_FRAMEBUFFER_COUNT		2
+#define BSS2K_FRAMEBUFFER_WIDTH		480
+#define BSS2K_FRAMEBUFFER_HEIGHT	360
+
 /* reset entire system */
 #define BSS2K_IOC_RESET			_IO(BSS2K_MAGIC, 0)
 
 /* start CPU */
 #define BSS2K_IOC_START_CPU		_IO(BSS2K_MAGIC, 1)
 
+/* write back data cache, so mapped memory is current */
+#define BSS2K_IOC_FLUSH_DCACHE		_IO(BSS2K_MAGIC, 2)
+
 /* read card registers */
 #define BSS2K_IOC_READ_STATUS		_IOR(BSS2K_MAGIC, 0, unsigned long long)
 #define BSS2K_IOC_READ_CONTROL		_IOR(BSS2K_MAGIC, 1, unsigned long long)
 #define BSS2K_IOC_READ_INTSTS		_IOR(BSS2K_MAGIC, 2, unsigned long long)
 #define BSS2K_IOC_READ_INTMASK		_IOR(BSS2K_MAGIC, 3, unsigned long long)
 
-/* export DMA buffer */
-#define BSS2K_IOC_GET_TEXTMODE_TEXTURE	_IOR(BSS2K_MAGIC, 64, int)
+/* status register bits */
+#define BSS2K_STATUS_RUNNING		(1ULL << 0)
+#define BSS2K_STATUS_ASSERTION_FAILED	(1ULL << 2)
+
+/* front framebuffer and number of SWAPFRAMEBUFFERS since the CPU was
+ * started, updated by the flip interrupt */
+#define BSS2K_IOC_READ_FLIP		_IOR(BSS2K_MAGIC, 4, unsigned long long)
+
+#define BSS2K_FLIP_FRONT(flip)		((flip) & 1)
+#define BSS2K_FLIP_COUNT(flip)		((flip) >> 1)
+
+/* character rows rewritten in the textmode texture since the last call, bit
+ * n for row n. A row covers 14 lines of pixels. */
+#define BSS2K_IOC_READ_DAMAGE		_IOR(BSS2K_MAGIC, 5, unsigned long long)
+
+#define BSS2K_TEXTMODE_ROWS		25
+#define BSS2K_TEXTMODE_ROW_HEIGHT	14
+#define BSS2K_DAMAGE_ALL		((1ULL << BSS2K_TEXTMODE_ROWS) - 1)
+
+/* textmode buffer written by the last completed update, valid after the
+ * display update event */
+#define BSS2K_IOC_READ_TEXTMODE_BUFFER	_IOR(BSS2K_MAGIC, 6, unsigned long long)
+
+/* performance counters, all copied at the same time. The CPU counters and
+ * the cycles are cleared while the CPU is held in reset, the PCIe counters
+ * only when the link is reset. */
+#define BSS2K_COUNTER_CYCLES			0	/* CPU not halted */
+#define BSS2K_COUNTER_RETIRED			1	/* instructions */
+#define BSS2K_COUNTER_FETCH_STALLS		2	/* cycles waiting for instructions */
+#define BSS2K_COUNTER_DATA_STALLS		3	/* cycles waiting for loads and stores */
+#define BSS2K_COUNTER_ICACHE_HITS		4
+#define BSS2K_COUNTER_ICACHE_MISSES		5
+#define BSS2K_COUNTER_DCACHE_HITS		6
+#define BSS2K_COUNTER_DCACHE_MISSES		7
+#define BSS2K_COUNTER_BRANCH_MISPREDICTS	8
+#define BSS2K_COUNTER_BRANCH_REDIRECTS		9
+#define BSS2K_COUNTER_REDIRECT_PENALTY		10
+#define BSS2K_COUNTER_DMA_I_READ_REQUESTS	11	/* instruction fetches */
+#define BSS2K_COUNTER_DMA_I_READ_COMPLETIONS	12
+#define BSS2K_COUNTER_DMA_D_READ_REQUESTS	13	/* data cache refills */
+#define BSS2K_COUNTER_DMA_D_READ_COMPLETIONS	14
+#define BSS2K_COUNTER_TEXTMODE_PACKETS		15	/* write TLPs */
+#define BSS2K_COUNTER_ARBITER_WAIT		16	/* cycles an agent waited for the link */
+#define BSS2K_COUNTERS				17
+
+struct bss2k_counters
+{
+	__u64 value[BSS2K_COUNTERS];
+};
+
+#define BSS2K_IOC_READ_COUNTERS		_IOR(BSS2K_MAGIC, 7, struct bss2k_counters)
+
+/* instruction trace ring, mappable read-only at BSS2K_TRACE_OFFSET. While
+ * tracing, the card writes a record for every instruction it decodes. */
+#define BSS2K_TRACE_OFFSET		BSS2K_MEMORY_SIZE
+#define BSS2K_TRACE_SIZE		0x200000
+#define BSS2K_TRACE_RECORDS		(BSS2K_TRACE_SIZE / 8)
+
+/* a record is a little endian 64 bit word. The cycles are those since the
+ * previous record, saturating, and zero in the first record. */
+#define BSS2K_TRACE_IP(record)		((record) & 0xffffff)
+#define BSS2K_TRACE_OPCODE(record)	(((record) >> 24) & 0xffff)
+#define BSS2K_TRACE_CYCLES(record)	((record) >> 40)
+
+/* start tracing into an empty ring, and stop */
+#define BSS2K_IOC_TRACE_START		_IO(BSS2K_MAGIC, 3)
+#define BSS2K_IOC_TRACE_STOP		_IO(BSS2K_MAGIC, 4)
+
+/* pass the records read so far, and return how far the card got. Indexes
+ * count records since tracing started, record n is at n modulo
+ * BSS2K_TRACE_RECORDS in the ring. */
+struct bss2k_trace_position
+{
+	/* records read, the card does not overwrite the rest (in) */
+	__u32 consumer;
+	/* records written (out) */
+	__u32 producer;
+	/* records lost because the ring was full (out) */
+	__u32 dropped;
+	__u32 reserved;
+};
+
+#define BSS2K_IOC_TRACE_POSITION	_IOWR(BSS2K_MAGIC, 66, struct bss2k_trace_position)
+
+/* start sampling into an empty trace ring: every given number of cycles
+ * the CPU runs, record the instruction it is executing. The cycles in a
+ * record are those since the previous sample. Stopped by
+ * BSS2K_IOC_TRACE_STOP. */
+#define BSS2K_IOC_TRACE_SAMPLE		_IOW(BSS2K_MAGIC, 8, unsigned long long)
+
+/* debug event ring, mappable read-only at BSS2K_EVENT_OFFSET. The card
+ * writes an event for every CHECKPOINT, PRINTREGISTER, DEBUGBREAK,
+ * DUMPMEMORY and DUMPREGISTERS the CPU executes, without stopping it;
+ * nothing is dumped. The ring is emptied while the CPU is held in reset. */
+#define BSS2K_EVENT_OFFSET		(BSS2K_TRACE_OFFSET + BSS2K_TRACE_SIZE)
+#define BSS2K_EVENT_SIZE		0x10000
+#define BSS2K_EVENT_RECORDS		(BSS2K_EVENT_SIZE / 16)
+
+/* an event is two little endian 64 bit words. The first one holds the
+ * address, opcode and first register operand of the instruction, the
+ * second one the value and the low half of the cycle counter. The value
+ * is the immediate of CHECKPOINT, the register of PRINTREGISTER, and zero
+ * otherwise. */
+struct bss2k_event
+{
+	__u64 insn;
+	__u64 data;
+};
+
+#define BSS2K_EVENT_IP(insn)		((insn) & 0xffffff)
+#define BSS2K_EVENT_OPCODE(insn)	(((insn) >> 24) & 0xffff)
+#define BSS2K_EVENT_REGISTER(insn)	(((insn) >> 40) & 0xff)
+#define BSS2K_EVENT_VALUE(data)		((data) & 0xffffffff)
+#define BSS2K_EVENT_CYCLES(data)	((data) >> 32)
+
+#define BSS2K_EVENT_CHECKPOINT		0xfff8
+#define BSS2K_EVENT_PRINTREGISTER	0xfff9
+#define BSS2K_EVENT_DEBUGBREAK		0xfffa
+#define BSS2K_EVENT_DUMPMEMORY		0xfffe
+#define BSS2K_EVENT_DUMPREGISTERS	0xffff
+
+/* pass the events read so far, and return how far the card got, counted
+ * like trace records. Once the status shows the CPU stopped, every event
+ * it raised is in the ring or waits for room there. */
+#define BSS2K_IOC_EVENT_POSITION	_IOWR(BSS2K_MAGIC, 67, struct bss2k_trace_position)
+
+/* sleep until the status stops showing the CPU running, or the time runs
+ * out, and return the status. Needs the halt interrupt, which
+ * BSS2K_IOC_START_CPU enables. */
+struct bss2k_wait_halt
+{
+	/* longest time to wait, zero only reads the status (in) */
+	__u64 timeout_ns;
+	/* status register, still running if the time ran out (out) */
+	__u64 status;
+};
+
+#define BSS2K_IOC_WAIT_HALT		_IOWR(BSS2K_MAGIC, 68, struct bss2k_wait_halt)
+
+/* export one of the textmode texture buffers as a dma_buf. An update
+ * started through BSS2K_IOC_WRITE_CONTROL while the display interrupt is
+ * enabled adds a write fence to the buffer it goes to, signaled when the
+ * update completes. */
+struct bss2k_textmode_texture
+{
+	/* buffer number (in) */
+	__u32 index;
+	/* file descriptor of the dma_buf (out) */
+	__s32 fd;
+};
+
+#define BSS2K_IOC_GET_TEXTMODE_TEXTURE	_IOWR(BSS2K_MAGIC, 64, struct bss2k_textmode_texture)
+
+/* export a framebuffer. The buffer covers whole pages, so the framebuffer
+ * starts at an offset inside it. */
+struct bss2k_framebuffer
+{
+	/* framebuffer number (in) */
+	__u32 index;
+	/* file descriptor of the dma_buf (out) */
+	__s32 fd;
+	/* start of the framebuffer in the dma_buf (out) */
+	__u32 offset;
+	/* size of the dma_buf (out) */
+	__u32 size;
+};
+
+#define BSS2K_IOC_GET_FRAMEBUFFER	_IOWR(BSS2K_MAGIC, 65, struct bss2k_framebuffer)
+
+/* control register bit for BSS2K_IOC_WRITE_CONTROL: textmode updates
+ * write the 2 KiB character RAM to the texture instead of pixels. The upper
+ * half of the value masks the lower half. */
+#define BSS2K_CTL_TEXTMODE_CHARACTERS		(1ULL << 3)
+#define BSS2K_CTL_MASK_TEXTMODE_CHARACTERS	(1ULL << 35)
 
 /* write card registers */
 #define BSS2K_IOC_WRITE_CONTROL		_IOW(BSS2K_MAGIC, 1, unsigned long long)
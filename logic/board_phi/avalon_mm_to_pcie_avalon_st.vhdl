@@ -7,7 +7,16 @@ use ieee.numeric_std.ALL;
 entity avalon_mm_to_pcie_avalon_st is
 	generic(
 		word_width : natural;
-		tag : std_logic_vector(7 downto 0)
+		tag : std_logic_vector(7 downto 0);
+		-- maximum number of words in a read burst
+		max_burst : positive := 1;
+		-- maximum number of reads in flight (power of two). With more than
+		-- one, waitrequest low acknowledges a read request, and the data is
+		-- returned later, in order, with rddatavalid. Otherwise waitrequest
+		-- is released with the (last) data word. Each read uses its own tag,
+		-- the lower bits of the tag generic must be zero. A write waits until
+		-- all reads have completed, as PCIe lets it pass them.
+		max_outstanding : positive := 1
 	);
 	port(
 		-- async reset
@@ -18,8 +27,11 @@ entity avalon_mm_to_pcie_avalon_st is
 
 		-- requester side (Avalon-MM)
 		req_addr : in std_logic_vector(63 downto 0);
+		req_byteenable : in std_logic_vector(word_width / 8 - 1 downto 0) := (others => '1');
 		req_rdreq : in std_logic;
+		req_burstcount : in natural range 1 to max_burst := 1;
 		req_rddata : out std_logic_vector(word_width - 1 downto 0);
+		req_rddatavalid : out std_logic;
 		req_wrreq : in std_logic;
 		req_wrdata : in std_logic_vector(word_width - 1 downto 0);
 		req_waitrequest : out std_logic;
@@ -46,7 +58,11 @@ entity avalon_mm_to_pcie_avalon_st is
 
 		cmp_cpl_pending : out std_logic;
 
-		device_id : in std_logic_vector(15 downto 0)
+		device_id : in std_logic_vector(15 downto 0);
+
+		-- statistics
+		read_requests : out std_logic_vector(63 downto 0);
+		read_completions : out std_logic_vector(63 downto 0)
 	);
 end entity;
 
@@ -61,6 +77,16 @@ architecture syn of avalon_mm_to_pcie_avalon_st is
 		end case;
 	end function;
 
+	function clog2(constant val : in positive) return natural is
+		variable ret : natural;
+	begin
+		ret := 0;
+		while(2 ** ret < val) loop
+			ret := ret + 1;
+		end loop;
+		return ret;
+	end function;
+
 	constant bits_per_byte : natural := 8;
 
 	-- address bus
@@ -98,13 +124,85 @@ architecture syn of avalon_mm_to_pcie_avalon_st is
 					length_field'length));
 	constant one_dword : length_field :=
 			length_field(to_unsigned(1, length_field'length));
+	constant one_dword_count : byte_count :=
+			byte_count(to_unsigned(4, byte_count'length));
+
+	-- first DWORD of a single DWORD access
+	constant one_dword_be : std_logic_vector(7 downto 0) := "00001111";
+
+	-- partial accesses select one half of the word, the upper half is the
+	-- lower address
+	constant half : natural := word_width / 2;
+
+	-- length of current request
+	signal req_length : length_field;
+
+	-- outstanding reads, tags are allocated in order and completions are
+	-- stored until all earlier reads have been returned
+	constant pipelined : boolean := max_outstanding > 1;
+	constant slot_bits : natural := clog2(max_outstanding);
+	subtype slot_num is integer range 0 to max_outstanding - 1;
+	-- one extra bit to tell full from empty
+	subtype slot_ptr is unsigned(slot_bits downto 0);
+
+	function slot_of(p : slot_ptr) return slot_num is
+	begin
+		if(slot_bits = 0) then
+			return 0;
+		end if;
+		return to_integer(p(slot_bits - 1 downto 0));
+	end function;
+
+	function slot_of(t : std_logic_vector(7 downto 0)) return slot_num is
+	begin
+		if(slot_bits = 0) then
+			return 0;
+		end if;
+		return to_integer(unsigned(t(slot_bits - 1 downto 0)));
+	end function;
+
+	function tag_of(n : slot_num) return std_logic_vector is
+		variable ret : std_logic_vector(7 downto 0);
+	begin
+		ret := tag;
+		if(slot_bits > 0) then
+			ret(slot_bits - 1 downto 0) := std_logic_vector(to_unsigned(n, slot_bits));
+		end if;
+		return ret;
+	end function;
+
+	type lower_address_per_slot is array(slot_num) of std_logic_vector(6 downto 0);
+	type length_per_slot is array(slot_num) of length_field;
+	type count_per_slot is array(slot_num) of byte_count;
+	type burst_per_slot is array(slot_num) of natural range 1 to max_burst;
+	type burst_words is array(0 to max_burst - 1) of word;
+	type data_per_slot is array(slot_num) of burst_words;
+
+	-- written when a read is issued
+	signal slot_lower_address : lower_address_per_slot;
+	signal slot_length : length_per_slot;
+	signal slot_count : count_per_slot;
+	signal slot_burst : burst_per_slot;
+	signal issue_ptr : slot_ptr;
+
+	-- written when the completion arrives, and when returned
+	signal slot_data : data_per_slot;
+	signal slot_done : std_logic_vector(slot_num);
+	signal retire_ptr : slot_ptr;
+
+	signal reads_full : std_logic;
+	signal reads_pending : std_logic;
+
+	-- tag for current request
+	signal cur_tag : std_logic_vector(7 downto 0);
 
 	signal addr : address;
 	signal is_64bit : std_logic;
-	signal used_lane : lane;
 
 	-- endian converted
 	signal rddata_be : std_logic_vector(63 downto 0);
+	-- single DWORD, repeated across the word
+	signal rddata_dword : std_logic_vector(word_width - 1 downto 0);
 
 	signal is_write : std_logic;
 	signal wrdata : pcie_word;
@@ -114,22 +212,41 @@ architecture syn of avalon_mm_to_pcie_avalon_st is
 	signal busy : std_logic;
 
 	signal rd_waitrequest : std_logic;
+	signal rd_ack : std_logic;
 
 	signal set_busy : std_logic;
 	signal reset_busy_rd : std_logic;
 	signal reset_busy_wr : std_logic;
+
+	signal read_request_counter : unsigned(63 downto 0);
+	signal read_completion_counter : unsigned(63 downto 0);
 begin
+	-- bursts return one word per PCIe data cycle
+	assert max_burst = 1 or word_width = pcie_word_width
+		report "bursts require full width words" severity failure;
+	-- larger bursts may be split into multiple completions
+	assert max_burst * word_width / bits_per_byte <= 64
+		report "bursts may not exceed the read completion boundary" severity failure;
+	assert 2 ** slot_bits = max_outstanding
+		report "max_outstanding must be a power of two" severity failure;
+	assert to_integer(unsigned(tag)) mod max_outstanding = 0
+		report "tag overlaps with slot number" severity failure;
+
+	reads_full <= '1' when issue_ptr - retire_ptr = max_outstanding else
+		      '0';
+	reads_pending <= '1' when issue_ptr /= retire_ptr else
+			 '0';
+
 	busy <= '1' when ?? set_busy else
 			'0' when ?? reset_busy_rd else
 			'0' when ?? reset_busy_wr else
 			unaffected;
 
-	-- pulse waitrequest low to acknowledge a write, otherwise
-	-- use the value from read mechanism
-	req_waitrequest <= rd_waitrequest and not reset_busy_wr;
+	-- pulse waitrequest low to acknowledge a write or a pipelined read,
+	-- otherwise use the value from read mechanism
+	req_waitrequest <= rd_waitrequest and not reset_busy_wr and not rd_ack;
 
 	is_64bit <= or_reduce(addr(63 downto 32));
-	used_lane <= addr(lane'range);
 
 	rddata_be <= cmp_rx_data(7 downto 0) &
 			cmp_rx_data(15 downto 8) &
@@ -140,6 +257,10 @@ begin
 			cmp_rx_data(55 downto 48) &
 			cmp_rx_data(63 downto 56);
 
+	dword_lanes : for i in 0 to word_width / 32 - 1 generate
+		rddata_dword(i * 32 + 31 downto i * 32) <= rddata_be(31 downto 0);
+	end generate;
+
 	wrdata_le <= wrdata(7 downto 0) &
 			wrdata(15 downto 8) &
 			wrdata(23 downto 16) &
@@ -149,13 +270,22 @@ begin
 			wrdata(55 downto 48) &
 			wrdata(63 downto 56);
 
-	cmp_cpl_pending <= busy;
+	cmp_cpl_pending <= busy or reads_pending;
+
+	read_requests <= std_logic_vector(read_request_counter);
+	read_completions <= std_logic_vector(read_completion_counter);
 
 	request_generator : process(reset, clk) is
 		type state is (idle, header1, header2, data, wait_read);
 		variable s : state;
 
 		variable used_lane_num : lane_num;
+
+		-- read request, adjusted for partial access
+		variable rd_addr : address;
+		variable rd_length : length_field;
+		variable rd_count : byte_count;
+		variable slot : slot_num;
 	begin
 		if(?? reset) then
 			s := idle;
@@ -163,6 +293,9 @@ begin
 			cmp_tx_valid <= '0';
 			set_busy <= '0';
 			reset_busy_wr <= '0';
+			rd_ack <= '0';
+			issue_ptr <= (others => '0');
+			read_request_counter <= (others => '0');
 		elsif(rising_edge(clk)) then
 			cmp_tx_req <= '0';
 			cmp_tx_valid <= '0';
@@ -172,31 +305,82 @@ begin
 			cmp_tx_err <= '0';
 			set_busy <= '0';
 			reset_busy_wr <= '0';
+			rd_ack <= '0';
 			case s is
 				when idle =>
-					if(?? (req_rdreq and not busy)) then
+					if(?? (req_rdreq and not reads_full)) then
 						s := header1;
 						is_write <= '0';
-						addr <= req_addr;
 						cmp_tx_req <= '1';
+						rd_addr := req_addr;
+						rd_length :=
+								length_field(
+									to_unsigned(
+										req_burstcount * word_width / 32,
+										length_field'length));
+						rd_count :=
+								byte_count(
+									to_unsigned(
+										req_burstcount * word_width / 8,
+										byte_count'length));
 						byte_enable <= (others => '0');
 						byte_enable(req_be'range) <= req_be;
-					elsif(?? (req_wrreq and not busy)) then
+						if(req_byteenable /= req_be) then
+							-- single DWORD
+							assert word_width = 64 and req_burstcount = 1 and
+									(req_byteenable = "11110000" or req_byteenable = "00001111")
+								report "unsupported byte enables" severity error;
+							rd_addr(2) := not req_byteenable(req_byteenable'high);
+							rd_length := one_dword;
+							rd_count := one_dword_count;
+							byte_enable <= one_dword_be;
+						end if;
+						addr <= rd_addr;
+						req_length <= rd_length;
+
+						-- allocate next tag
+						slot := slot_of(issue_ptr);
+						slot_lower_address(slot) <= rd_addr(6 downto 0);
+						slot_length(slot) <= rd_length;
+						slot_count(slot) <= rd_count;
+						slot_burst(slot) <= req_burstcount;
+						cur_tag <= tag_of(slot);
+						issue_ptr <= issue_ptr + 1;
+						read_request_counter <= read_request_counter + 1;
+					elsif(?? (req_wrreq and not busy and not reads_pending)) then
 						s := header1;
 						is_write <= '1';
 						addr <= req_addr;
+						cur_tag <= tag;
+						req_length <= length;
 						wrdata <= (others => '0');
 						byte_enable <= (others => '0');
 
-						used_lane_num := to_integer(unsigned(used_lane));
+						used_lane_num := to_integer(unsigned(req_addr(lane'range)));
 						wrdata(req_wrdata'high + used_lane_num * req_wrdata'length downto req_wrdata'low + used_lane_num * req_wrdata'length) <= req_wrdata;
 						byte_enable(req_be'range) <= req_be;
+						if(req_byteenable /= req_be) then
+							-- single DWORD, placed like from a 32 bit
+							-- requester
+							assert word_width = 64 and
+									(req_byteenable = "11110000" or req_byteenable = "00001111")
+								report "unsupported byte enables" severity error;
+							addr(2) <= not req_byteenable(req_byteenable'high);
+							wrdata <= (others => '0');
+							if(?? req_byteenable(req_byteenable'high)) then
+								wrdata(half - 1 downto 0) <= req_wrdata(word_width - 1 downto half);
+							else
+								wrdata(word_width - 1 downto half) <= req_wrdata(half - 1 downto 0);
+							end if;
+							req_length <= one_dword;
+							byte_enable <= one_dword_be;
+						end if;
 					end if;
 				when header1 =>
 					if(?? (cmp_tx_ready and cmp_tx_start)) then
 						cmp_tx_valid <= '1';
 						cmp_tx_data <= device_id &	-- requester id
-								   tag &			-- tag
+								   cur_tag &		-- tag
 								   byte_enable(7 downto 4) &	-- last DWORD BE
 								   byte_enable(3 downto 0) &	-- first DWORD BE
 								   "0" &			-- reserved
@@ -210,10 +394,10 @@ begin
 								   "0" &			-- not poisoned
 								   "00" &			-- attributes
 								   "00" &			-- reserved
-								   length;		-- length in DWORDs
+								   req_length;		-- length in DWORDs
 						cmp_tx_sop <= '1';
 						cmp_tx_eop <= '0';
-						set_busy <= '1';
+						set_busy <= is_write;
 						s := header2;
 					else
 						cmp_tx_req <= '1';
@@ -233,6 +417,10 @@ begin
 							s := data;
 						else
 							cmp_tx_eop <= '1';
+							if(pipelined) then
+								-- request accepted, data follows later
+								rd_ack <= '1';
+							end if;
 							s := wait_read;
 						end if;
 					end if;
@@ -245,7 +433,8 @@ begin
 						s := idle;
 					end if;
 				when wait_read =>
-					if ?? reset_busy_rd then
+					-- pipelined reads wait while the ack is visible
+					if(pipelined or (?? reset_busy_rd)) then
 						s := idle;
 					end if;
 			end case;
@@ -271,15 +460,30 @@ begin
 		variable rx_req_id : std_logic_vector(15 downto 0);
 		variable rx_tag : std_logic_vector(7 downto 0);
 		variable rx_lower_address : std_logic_vector(6 downto 0);
+
+		-- slot the current completion belongs to
+		variable rx_slot : slot_num;
+		-- next word of the burst to receive
+		variable rx_beat : natural range 0 to max_burst - 1;
+
+		-- next word of the oldest read to return
+		variable retire_slot : slot_num;
+		variable retire_beat : natural range 0 to max_burst - 1;
 	begin
 		if(?? reset) then
 			s := idle;
+			retire_beat := 0;
 			reset_busy_rd <= '1';
 			req_rddata <= (others => 'U');
+			req_rddatavalid <= '0';
 			rd_waitrequest <= '1';
+			slot_done <= (others => '0');
+			retire_ptr <= (others => '0');
+			read_completion_counter <= (others => '0');
 		elsif(rising_edge(clk)) then
 			reset_busy_rd <= '0';
 			req_rddata <= (others => 'U');
+			req_rddatavalid <= '0';
 			rd_waitrequest <= '1';
 			if(?? cmp_rx_valid) then
 				if(?? cmp_rx_sop) then
@@ -293,14 +497,13 @@ begin
 					rx_status := cmp_rx_data(47 downto 45);
 					rx_byte_count := cmp_rx_data(43 downto 32);
 
+					-- length is checked once the tag is known
 					if((?? rx_has_data) and
 							rx_type = "01010" and
 							rx_tc = "000" and
 							rx_ep = '0' and
 							rx_attr = "00" and
-							rx_length = length and
-							rx_status = "000" and
-							rx_byte_count = count) then
+							rx_status = "000") then
 						s := header2;
 					end if;
 				else
@@ -311,35 +514,69 @@ begin
 							rx_req_id := cmp_rx_data(31 downto 16);
 							rx_tag := cmp_rx_data(15 downto 8);
 							rx_lower_address := cmp_rx_data(6 downto 0);
+							rx_slot := slot_of(rx_tag);
 
 							if(rx_req_id /= device_id or
-									rx_tag /= tag or
-									rx_lower_address /= addr(6 downto 0)) then
+									rx_tag(7 downto slot_bits) /= tag(7 downto slot_bits) or
+									slot_done(rx_slot) = '1' or
+									rx_length /= slot_length(rx_slot) or
+									rx_byte_count /= slot_count(rx_slot) or
+									rx_lower_address /= slot_lower_address(rx_slot)) then
 								-- not for us
 								s := idle;
-							elsif(length = one_dword and (?? cmp_rx_eop)) then
+							elsif(rx_length = one_dword and (?? cmp_rx_eop)) then
 								-- special case: a single DWORD is returned
 								-- in the second cycle, not padded, but only if
 								-- bit 2 of the address is set.
-								req_rddata <= rddata_be(req_rddata'range);
-								rd_waitrequest <= '0';
-								reset_busy_rd <= '1';
+								slot_data(rx_slot)(0) <= rddata_dword;
+								slot_done(rx_slot) <= '1';
+								read_completion_counter <= read_completion_counter + 1;
 								s := idle;
-							elsif(length /= one_dword or not (?? cmp_rx_eop)) then
+							elsif(rx_length /= one_dword or not (?? cmp_rx_eop)) then
 								-- expect data in the next cycle
+								rx_beat := 0;
 								s := data;
 							else
 								-- TODO: handle error
 								s := idle;
 							end if;
 						when data =>
-							req_rddata <= rddata_be(req_rddata'range);
-							rd_waitrequest <= '0';
-							reset_busy_rd <= '1';
-							s := idle;
+							-- one word per cycle
+							if(rx_length = one_dword) then
+								slot_data(rx_slot)(rx_beat) <= rddata_dword;
+							else
+								slot_data(rx_slot)(rx_beat) <= rddata_be(word'range);
+							end if;
+							if(rx_beat = slot_burst(rx_slot) - 1) then
+								slot_done(rx_slot) <= '1';
+								read_completion_counter <= read_completion_counter + 1;
+								s := idle;
+							else
+								rx_beat := rx_beat + 1;
+							end if;
 					end case;
 				end if;
 			end if;
+
+			-- return completed reads in the order they were issued, one
+			-- word per cycle. Without pipelining, waitrequest is released
+			-- with the last word of a burst.
+			retire_slot := slot_of(retire_ptr);
+			if(?? slot_done(retire_slot)) then
+				req_rddata <= slot_data(retire_slot)(retire_beat);
+				req_rddatavalid <= '1';
+				if(retire_beat = slot_burst(retire_slot) - 1) then
+					retire_beat := 0;
+					slot_done(retire_slot) <= '0';
+					retire_ptr <= retire_ptr + 1;
+					if(not pipelined) then
+						rd_waitrequest <= '0';
+						reset_busy_rd <= '1';
+					end if;
+				else
+					retire_beat := retire_beat + 1;
+				end if;
+			end if;
 		end if;
 	end process;
 end architecture;
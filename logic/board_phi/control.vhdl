@@ -4,6 +4,10 @@ use ieee.std_logic_misc.ALL;
 use ieee.numeric_std.ALL;
 
 entity control is
+	generic(
+		-- textmode buffers the updates rotate through
+		textmode_buffers : positive := 1
+	);
 	port(
 		-- async reset
 		reset : in std_logic;
@@ -44,6 +48,39 @@ entity control is
 		cpu_halted : in std_logic;
 		cpu_assertion_failed : in std_logic;
 
+		-- framebuffer flips, the data cache is written back before
+		cpu_front_framebuffer : in std_logic;
+		cpu_swap_request : in std_logic;
+		cpu_swap_done : out std_logic;
+
+		-- instruction cache statistics
+		icache_hits : in std_logic_vector(63 downto 0);
+		icache_misses : in std_logic_vector(63 downto 0);
+
+		-- data cache interface
+		dcache_flush : out std_logic;
+		dcache_clean : in std_logic;
+		dcache_hits : in std_logic_vector(63 downto 0);
+		dcache_misses : in std_logic_vector(63 downto 0);
+
+		-- branch prediction statistics
+		branch_mispredicts : in std_logic_vector(63 downto 0);
+		branch_redirects : in std_logic_vector(63 downto 0);
+		redirect_penalty : in std_logic_vector(63 downto 0);
+
+		-- CPU statistics
+		cpu_retired : in std_logic_vector(63 downto 0);
+		cpu_fetch_stalls : in std_logic_vector(63 downto 0);
+		cpu_data_stalls : in std_logic_vector(63 downto 0);
+
+		-- PCIe statistics, per DMA requester
+		dma_i_read_requests : in std_logic_vector(63 downto 0);
+		dma_i_read_completions : in std_logic_vector(63 downto 0);
+		dma_d_read_requests : in std_logic_vector(63 downto 0);
+		dma_d_read_completions : in std_logic_vector(63 downto 0);
+		textmode_packets : in std_logic_vector(63 downto 0);
+		arbiter_wait_cycles : in std_logic_vector(63 downto 0);
+
 		-- memory translation
 		mmu_address_in_a : in std_logic_vector(23 downto 0);
 		mmu_address_out_a : out std_logic_vector(63 downto 0);
@@ -53,7 +90,31 @@ entity control is
 		-- target address for textmode
 		textmode_target_host : out std_logic_vector(63 downto 0);
 		textmode_start : out std_logic;
-		textmode_done : in std_logic
+		textmode_done : in std_logic;
+		-- send the character RAM instead of pixels
+		textmode_characters : out std_logic;
+		-- character rows sent by the last update
+		textmode_damage : in std_logic_vector(24 downto 0);
+		-- a buffer address was changed
+		textmode_invalidate : out std_logic;
+
+		-- instruction trace ring in host memory
+		trace_enable : out std_logic;
+		trace_period : out std_logic_vector(31 downto 0);
+		trace_base : out std_logic_vector(63 downto 0);
+		trace_size : out std_logic_vector(4 downto 0);
+		trace_consumer : out std_logic_vector(31 downto 0);
+		trace_producer : in std_logic_vector(31 downto 0);
+		trace_dropped : in std_logic_vector(31 downto 0);
+
+		-- debug event ring in host memory
+		event_base : out std_logic_vector(63 downto 0);
+		event_size : out std_logic_vector(4 downto 0);
+		event_consumer : out std_logic_vector(31 downto 0);
+		event_producer : in std_logic_vector(31 downto 0);
+		event_dropped : in std_logic_vector(31 downto 0);
+		-- events taken so far are in host memory
+		event_drained : in std_logic
 	);
 end entity;
 
@@ -69,6 +130,8 @@ architecture rtl of control is
 	-- control register
 	signal should_reset : std_logic;
 	signal should_start : std_logic;
+	signal should_flush : std_logic;
+	signal characters : std_logic;
 
 	-- status register
 	signal status : std_logic_vector(63 downto 0);
@@ -79,11 +142,63 @@ architecture rtl of control is
 	signal int_sts : std_logic_vector(31 downto 0);
 	-- interrupt mask register
 	signal int_mask : std_logic_vector(31 downto 0);
-
-	signal textmode_texture : host_address;
+	-- framebuffers were swapped, cleared by writing 1
+	signal flip : std_logic;
+	-- the CPU stopped, and whether on a failed assertion, cleared by
+	-- writing 1
+	signal halted : std_logic;
+	signal assertion : std_logic;
+	-- status running bit in the previous cycle, to find the halt
+	signal running_r : std_logic;
+	-- the trace ring filled up to half, cleared by writing 1
+	signal trace_watermark : std_logic;
+	signal trace_half_full, trace_half_full_r : std_logic;
+
+	-- one target per buffer, the card rotates through them after each
+	-- update
+	type host_addresses is array(0 to textmode_buffers - 1) of host_address;
+	signal textmode_texture : host_addresses;
+	subtype textmode_buffer is integer range 0 to textmode_buffers - 1;
+	signal textmode_current : textmode_buffer;
+	signal textmode_newest : textmode_buffer;
+	signal invalidate : std_logic;
+	-- an update finished, cleared by writing 1
+	signal display : std_logic;
+
+	-- rows sent by updates since the host last cleared them
+	signal damage : std_logic_vector(24 downto 0);
 
 	signal textmode_done_r, reset_textmode_start : std_logic;
 
+	-- counter bank, read through a window after copying all counters at
+	-- once, so they are consistent with each other
+	constant counter_count : integer := 17;
+	subtype counter is std_logic_vector(63 downto 0);
+	type counter_bank is array(0 to counter_count - 1) of counter;
+	signal counters : counter_bank;
+	signal counter_snapshot : counter_bank;
+	subtype counter_num is integer range 0 to 31;
+	signal counter_index : counter_num;
+
+	-- cycles the CPU ran, cleared while it is held in reset
+	signal cpu_cycles : unsigned(63 downto 0);
+
+	-- instruction trace ring, at least a page of records
+	constant trace_min_size : integer := 9;
+	constant trace_max_size : integer := 24;
+	signal tracing : std_logic;
+	signal trace_sample_period : std_logic_vector(31 downto 0);
+	signal trace_ring : host_address;
+	signal trace_ring_size : integer range trace_min_size to trace_max_size;
+	signal trace_read : std_logic_vector(31 downto 0);
+
+	-- debug event ring, at least a page of events, zero size disables
+	constant event_min_size : integer := 8;
+	constant event_max_size : integer := 20;
+	signal event_ring : host_address;
+	signal event_ring_size : integer range 0 to event_max_size;
+	signal event_read : std_logic_vector(31 downto 0);
+
 	constant page_size_bits : integer := 21;	-- 12 (4k) or 21 (2M)
 	constant page_num_bits : integer := cpu_address_width - page_size_bits;
 	constant page_count : integer := 2 ** page_num_bits;
@@ -113,12 +228,30 @@ architecture rtl of control is
 	constant reg_int_status	: reg_addr := "00010000";
 	constant reg_int_mask	: reg_addr := "00011000";
 	constant reg_textmode	: reg_addr := "00100000";
+	constant reg_textmode_damage	: reg_addr := "00101000";
+	constant reg_counter_select	: reg_addr := "00110000";
+	constant reg_counter	: reg_addr := "00111000";
+	constant reg_icache_hits	: reg_addr := "01000000";
+	constant reg_icache_misses	: reg_addr := "01001000";
+	constant reg_dcache_hits	: reg_addr := "01010000";
+	constant reg_dcache_misses	: reg_addr := "01011000";
+	constant reg_branch_mispredicts	: reg_addr := "01100000";
+	constant reg_branch_redirects	: reg_addr := "01101000";
+	constant reg_redirect_penalty	: reg_addr := "01110000";
+	constant reg_trace_base	: reg_addr := "11000000";
+	constant reg_trace_control	: reg_addr := "11001000";
+	constant reg_trace_producer	: reg_addr := "11010000";
+	constant reg_trace_consumer	: reg_addr := "11011000";
+	constant reg_trace_period	: reg_addr := "11100000";
+	constant reg_event_ring	: reg_addr := "11101000";
+	constant reg_event_producer	: reg_addr := "11110000";
+	constant reg_event_consumer	: reg_addr := "11111000";
 	constant reg_mapping	: reg_addr := (
 			reg_addr'high => '1',
 			mapping_bits'range => '-',
 			others => '0');		-- "10---000"
 
-	type sel is (sel_status, sel_control, sel_int_status, sel_int_mask, sel_textmode, sel_mapping, sel_invalid);
+	type sel is (sel_status, sel_control, sel_int_status, sel_int_mask, sel_textmode, sel_textmode_damage, sel_counter_select, sel_counter, sel_icache_hits, sel_icache_misses, sel_dcache_hits, sel_dcache_misses, sel_branch_mispredicts, sel_branch_redirects, sel_redirect_penalty, sel_trace_base, sel_trace_control, sel_trace_producer, sel_trace_consumer, sel_trace_period, sel_event_ring, sel_event_producer, sel_event_consumer, sel_mapping, sel_invalid);
 
 	subtype pci_address_bdf is std_logic_vector(15 downto 0);
 	subtype pcie_type is std_logic_vector(4 downto 0);
@@ -144,8 +277,25 @@ begin
 
 	mapping_error <= or_reduce(mapping_invalid);
 
-	textmode_target_host <= textmode_texture;
+	textmode_target_host <= textmode_texture(textmode_current);
+	textmode_invalidate <= invalidate;
 	textmode_start <= should_start;
+	textmode_characters <= characters;
+
+	trace_enable <= tracing;
+	trace_period <= trace_sample_period;
+	trace_base <= trace_ring;
+	trace_size <= std_logic_vector(to_unsigned(trace_ring_size, trace_size'length));
+	trace_consumer <= trace_read;
+
+	event_base <= event_ring;
+	event_size <= std_logic_vector(to_unsigned(event_ring_size, event_size'length));
+	event_consumer <= event_read;
+
+	-- write back data cache on request, when the CPU stops, and before
+	-- a framebuffer flip
+	dcache_flush <= should_flush or cpu_halted or cpu_swap_request;
+	cpu_swap_done <= dcache_clean;
 
 	textmode_done_r <= textmode_done when rising_edge(clk);
 	reset_textmode_start <= textmode_done and not textmode_done_r;
@@ -161,19 +311,65 @@ begin
 			mmu_address_in_b(page_size_bits - 1 downto 0);	-- offset
 
 	status <= (
-			0 => not should_reset and not cpu_halted,
+			-- still running until the data cache has been written back
+			-- and the debug events have been sent
+			0 => not should_reset and not (cpu_halted and dcache_clean and event_drained),
 			1 => mapping_error,
 			2 => cpu_assertion_failed,
 			others => '0'
 		);
 	int_sts <= (
-			0 => should_reset,
-			1 => textmode_done,
+			0 => halted,
+			1 => display,
+			2 => flip,
+			-- not interrupt sources, can't be enabled
+			3 => cpu_front_framebuffer,
+			5 downto 4 => std_logic_vector(to_unsigned(textmode_newest, 2)),
+			6 => assertion,
+			7 => trace_watermark,
 			others => '0'
 		);
 
+	-- records the host has not read yet
+	trace_half_full <= '1' when tracing = '1' and
+			unsigned(trace_producer) - unsigned(trace_read) >=
+				shift_left(to_unsigned(1, 32), trace_ring_size - 1) else '0';
+
 	interrupts <= int_sts and int_mask;
 
+	counters <= (
+			0 => std_logic_vector(cpu_cycles),
+			1 => cpu_retired,
+			2 => cpu_fetch_stalls,
+			3 => cpu_data_stalls,
+			4 => icache_hits,
+			5 => icache_misses,
+			6 => dcache_hits,
+			7 => dcache_misses,
+			8 => branch_mispredicts,
+			9 => branch_redirects,
+			10 => redirect_penalty,
+			11 => dma_i_read_requests,
+			12 => dma_i_read_completions,
+			13 => dma_d_read_requests,
+			14 => dma_d_read_completions,
+			15 => textmode_packets,
+			16 => arbiter_wait_cycles
+		);
+
+	process(reset, clk) is
+	begin
+		if(?? reset) then
+			cpu_cycles <= (others => '0');
+		elsif(rising_edge(clk)) then
+			if(?? should_reset) then
+				cpu_cycles <= (others => '0');
+			elsif(not (?? cpu_halted)) then
+				cpu_cycles <= cpu_cycles + 1;
+			end if;
+		end if;
+	end process;
+
 	process(reset, clk) is
 		variable has_data : std_logic;
 		variable has_64bit_address : std_logic;
@@ -197,6 +393,8 @@ begin
 		variable selected : sel;
 
 		variable page : page_num;
+
+		variable clear_damage : std_logic_vector(24 downto 0);
 	begin
 		if(reset = '1') then
 			-- reset mapping to all NULL pointers
@@ -204,14 +402,42 @@ begin
 			mapping_invalid <= (others => '1');
 			readback_strobe <= '0';
 			int_mask <= (others => '0');
+			flip <= '0';
+			display <= '0';
+			halted <= '0';
+			assertion <= '0';
+			running_r <= '0';
+			trace_watermark <= '0';
+			trace_half_full_r <= '0';
+			-- the buffer being written always follows the newest one
+			textmode_current <= 0;
+			textmode_newest <= textmode_buffers - 1;
+			invalidate <= '0';
+			damage <= (others => '0');
+			counter_index <= 0;
+			tracing <= '0';
+			trace_sample_period <= (others => '0');
+			trace_ring <= (others => '0');
+			trace_ring_size <= trace_min_size;
+			trace_read <= (others => '0');
+			event_ring <= (others => '0');
+			event_ring_size <= 0;
+			event_read <= (others => '0');
 			should_reset <= '1';
 			should_start <= '0';
+			should_flush <= '0';
+			characters <= '0';
 			s := header1;
 		elsif(rising_edge(clk)) then
 			if ?? reset_textmode_start then
 				should_start <= '0';
 			end if;
+			if ?? dcache_clean then
+				should_flush <= '0';
+			end if;
 			readback_strobe <= '0';
+			invalidate <= '0';
+			clear_damage := (others => '0');
 			if(?? rx_valid) then
 				if(?? rx_sop) then
 					-- first QWORD, header DWORDs 0/1
@@ -245,6 +471,24 @@ begin
 									when reg_int_status	=> selected := sel_int_status;
 									when reg_int_mask	=> selected := sel_int_mask;
 									when reg_textmode	=> selected := sel_textmode;
+									when reg_textmode_damage	=> selected := sel_textmode_damage;
+									when reg_counter_select	=> selected := sel_counter_select;
+									when reg_counter	=> selected := sel_counter;
+									when reg_icache_hits	=> selected := sel_icache_hits;
+									when reg_icache_misses	=> selected := sel_icache_misses;
+									when reg_dcache_hits	=> selected := sel_dcache_hits;
+									when reg_dcache_misses	=> selected := sel_dcache_misses;
+									when reg_branch_mispredicts	=> selected := sel_branch_mispredicts;
+									when reg_branch_redirects	=> selected := sel_branch_redirects;
+									when reg_redirect_penalty	=> selected := sel_redirect_penalty;
+									when reg_trace_base	=> selected := sel_trace_base;
+									when reg_trace_control	=> selected := sel_trace_control;
+									when reg_trace_producer	=> selected := sel_trace_producer;
+									when reg_trace_consumer	=> selected := sel_trace_consumer;
+									when reg_trace_period	=> selected := sel_trace_period;
+									when reg_event_ring	=> selected := sel_event_ring;
+									when reg_event_producer	=> selected := sel_event_producer;
+									when reg_event_consumer	=> selected := sel_event_consumer;
 									when reg_mapping	=> selected := sel_mapping;
 									when others		=> selected := sel_invalid;
 								end case?;
@@ -277,13 +521,98 @@ begin
 									if(?? rx_data(33)) then
 										should_start <= rx_data(1);
 									end if;
+									if(?? rx_data(34)) then
+										should_flush <= rx_data(2);
+									end if;
+									if(?? rx_data(35)) then
+										characters <= rx_data(3);
+									end if;
 								when sel_int_status =>
-									null;		-- read only
+									-- write 1 to clear
+									if(?? rx_data(1)) then
+										display <= '0';
+									end if;
+									if(?? rx_data(2)) then
+										flip <= '0';
+									end if;
+									if(?? rx_data(0)) then
+										halted <= '0';
+									end if;
+									if(?? rx_data(6)) then
+										assertion <= '0';
+									end if;
+									if(?? rx_data(7)) then
+										trace_watermark <= '0';
+									end if;
 								when sel_int_mask =>
-									int_mask(31 downto 1) <= (others => '0');
+									int_mask <= (others => '0');
 									int_mask(0) <= rx_data(0);
+									int_mask(1) <= rx_data(1);
+									int_mask(2) <= rx_data(2);
+									int_mask(6) <= rx_data(6);
+									int_mask(7) <= rx_data(7);
 								when sel_textmode =>
-									textmode_texture <= rx_data;
+									-- the buffers are 2 MiB aligned, the low
+									-- bits select one, buffer 0 sets all of
+									-- them, so a single buffer still works
+									if(unsigned(rx_data(1 downto 0)) = 0) then
+										textmode_texture <= (others => rx_data(63 downto 2) & "00");
+									elsif(to_integer(unsigned(rx_data(1 downto 0))) < textmode_buffers) then
+										textmode_texture(to_integer(unsigned(rx_data(1 downto 0)))) <=
+												rx_data(63 downto 2) & "00";
+									end if;
+									invalidate <= '1';
+								when sel_textmode_damage =>
+									-- write 1 to clear
+									clear_damage := rx_data(damage'range);
+								when sel_counter_select =>
+									-- bit 63 copies all counters, the low
+									-- bits select the one read next
+									if(?? rx_data(63)) then
+										counter_snapshot <= counters;
+									end if;
+									counter_index <= to_integer(unsigned(rx_data(4 downto 0)));
+								when sel_counter =>
+									null;		-- read only
+								when sel_icache_hits | sel_icache_misses | sel_dcache_hits | sel_dcache_misses |
+									sel_branch_mispredicts | sel_branch_redirects | sel_redirect_penalty =>
+									null;		-- read only
+								when sel_trace_base =>
+									-- the ring starts on a page
+									trace_ring <= rx_data(63 downto 12) & x"000";
+								when sel_trace_control =>
+									tracing <= rx_data(0);
+									if(unsigned(rx_data(12 downto 8)) < trace_min_size) then
+										trace_ring_size <= trace_min_size;
+									elsif(unsigned(rx_data(12 downto 8)) > trace_max_size) then
+										trace_ring_size <= trace_max_size;
+									else
+										trace_ring_size <= to_integer(unsigned(rx_data(12 downto 8)));
+									end if;
+								when sel_trace_producer =>
+									null;		-- read only
+								when sel_trace_consumer =>
+									trace_read <= rx_data(31 downto 0);
+								when sel_trace_period =>
+									-- zero traces every instruction
+									trace_sample_period <= rx_data(31 downto 0);
+								when sel_event_ring =>
+									-- the ring starts on a page, the size
+									-- is in the low bits
+									event_ring <= rx_data(63 downto 12) & x"000";
+									if(unsigned(rx_data(4 downto 0)) = 0) then
+										event_ring_size <= 0;
+									elsif(unsigned(rx_data(4 downto 0)) < event_min_size) then
+										event_ring_size <= event_min_size;
+									elsif(unsigned(rx_data(4 downto 0)) > event_max_size) then
+										event_ring_size <= event_max_size;
+									else
+										event_ring_size <= to_integer(unsigned(rx_data(4 downto 0)));
+									end if;
+								when sel_event_producer =>
+									null;		-- read only
+								when sel_event_consumer =>
+									event_read <= rx_data(31 downto 0);
 								when sel_mapping =>
 									page := to_integer(unsigned(reg_address(mapping_bits'range)));
 									mapping(page) <= rx_data(host_page'range);
@@ -296,6 +625,44 @@ begin
 					end case;
 				end if;
 			end if;
+			-- an update finished, the next one goes to the next buffer
+			if(?? (reset_textmode_start and should_start)) then
+				display <= '1';
+				textmode_newest <= textmode_current;
+				if(textmode_current = textmode_buffers - 1) then
+					textmode_current <= 0;
+				else
+					textmode_current <= textmode_current + 1;
+				end if;
+			end if;
+			-- an update finishing in the same cycle as the write wins
+			if(?? reset_textmode_start) then
+				damage <= (damage and not clear_damage) or textmode_damage;
+			else
+				damage <= damage and not clear_damage;
+			end if;
+			-- a flip in the same cycle as the write wins
+			if(?? should_reset) then
+				flip <= '0';
+			elsif(?? (cpu_swap_request and dcache_clean)) then
+				flip <= '1';
+			end if;
+			-- raised when the status stops showing the CPU running, so
+			-- memory and the debug events are complete. A halt in the
+			-- same cycle as the write wins.
+			running_r <= status(0);
+			if(?? should_reset) then
+				halted <= '0';
+				assertion <= '0';
+			elsif(?? (running_r and not status(0))) then
+				halted <= '1';
+				assertion <= cpu_assertion_failed;
+			end if;
+			-- raised again once the host has read below half
+			trace_half_full_r <= trace_half_full;
+			if(?? (trace_half_full and not trace_half_full_r)) then
+				trace_watermark <= '1';
+			end if;
 		end if;
 	end process;
 
@@ -352,14 +719,58 @@ begin
 							when sel_status =>
 								tx_data <= status;
 							when sel_control =>
-								tx_data <= (0 => should_reset, 1 => should_start, others => '0');
+								tx_data <= (0 => should_reset, 1 => should_start, 2 => should_flush, 3 => characters, others => '0');
 							when sel_int_status =>
 								tx_data <= x"00000000" & int_sts;
 							when sel_int_mask =>
 								tx_data <= (others => '0');
 								tx_data(int_mask'range) <= int_mask;
 							when sel_textmode =>
-								tx_data <= textmode_texture;
+								tx_data <= textmode_texture(0);
+							when sel_textmode_damage =>
+								tx_data <= (others => '0');
+								tx_data(damage'range) <= damage;
+							when sel_counter_select =>
+								tx_data <= std_logic_vector(to_unsigned(counter_index, 64));
+							when sel_counter =>
+								if(counter_index < counter_count) then
+									tx_data <= counter_snapshot(counter_index);
+								else
+									tx_data <= (others => '1');
+								end if;
+							when sel_icache_hits =>
+								tx_data <= icache_hits;
+							when sel_icache_misses =>
+								tx_data <= icache_misses;
+							when sel_dcache_hits =>
+								tx_data <= dcache_hits;
+							when sel_dcache_misses =>
+								tx_data <= dcache_misses;
+							when sel_branch_mispredicts =>
+								tx_data <= branch_mispredicts;
+							when sel_branch_redirects =>
+								tx_data <= branch_redirects;
+							when sel_redirect_penalty =>
+								tx_data <= redirect_penalty;
+							when sel_trace_base =>
+								tx_data <= trace_ring;
+							when sel_trace_control =>
+								tx_data <= (others => '0');
+								tx_data(0) <= tracing;
+								tx_data(12 downto 8) <= std_logic_vector(to_unsigned(trace_ring_size, 5));
+							when sel_trace_producer =>
+								tx_data <= trace_dropped & trace_producer;
+							when sel_trace_consumer =>
+								tx_data <= x"00000000" & trace_read;
+							when sel_trace_period =>
+								tx_data <= x"00000000" & trace_sample_period;
+							when sel_event_ring =>
+								tx_data <= event_ring;
+								tx_data(4 downto 0) <= std_logic_vector(to_unsigned(event_ring_size, 5));
+							when sel_event_producer =>
+								tx_data <= event_dropped & event_producer;
+							when sel_event_consumer =>
+								tx_data <= x"00000000" & event_read;
 							when sel_mapping =>
 								page := to_integer(unsigned(readback_lower_address(mapping_bits'range)));
 								tx_data <= (others => '0');
@@ -0,0 +1,301 @@
+library ieee;
+
+use ieee.std_logic_1164.ALL;
+use ieee.std_logic_misc.ALL;
+use ieee.numeric_std.ALL;
+
+use work.bss2k.ALL;
+
+-- debug events: CHECKPOINT, PRINTREGISTER and the other debug opcodes are
+-- written to a ring buffer in host memory, so programs can report
+-- progress without stopping the CPU.
+entity event_output is
+	generic(
+		-- events buffered while waiting for the link, as a power of two
+		fifo_bits : positive := 6
+	);
+	port(
+		-- async reset
+		reset : in std_logic;
+
+		-- clock
+		clk : in std_logic;
+
+		-- events, one per cycle at most, written as two little endian
+		-- qwords, bits 63:0 first
+		event_valid : in std_logic;
+		event_data : in std_logic_vector(127 downto 0);
+		-- the CPU is held in reset, the ring is emptied
+		clear : in std_logic;
+		-- the CPU is neither held in reset nor halted
+		cpu_running : in std_logic;
+		-- every event taken is in host memory, or waits for the host to
+		-- make room
+		drained : out std_logic;
+
+		-- ring buffer, 4 KiB aligned, holding 2 ** ring_size events, zero
+		-- disables
+		ring_base : in std_logic_vector(63 downto 0);
+		ring_size : in std_logic_vector(4 downto 0);
+		-- events read by the host, and written by the card, both
+		-- counting up from zero
+		consumer : in std_logic_vector(31 downto 0);
+		producer : out std_logic_vector(31 downto 0);
+		-- events lost because the ring and the FIFO were full
+		dropped : out std_logic_vector(31 downto 0);
+
+		-- PCIe interface
+
+		tx_ready : in std_logic;
+		tx_valid : out std_logic;
+		tx_data : out std_logic_vector(63 downto 0);
+		tx_sop : out std_logic;
+		tx_eop : out std_logic;
+		tx_err : out std_logic;
+
+		cpl_pending : out std_logic;
+
+		tx_req : out std_logic;
+		tx_start : in std_logic;
+
+		device_id : in std_logic_vector(15 downto 0)
+	);
+end entity;
+
+architecture rtl of event_output is
+	-- events per write TLP, at most. A TLP stays inside a 64 byte block
+	-- of the ring, so it never crosses a 4 KiB boundary.
+	constant burst_events : integer := 4;
+
+	-- a partial burst is sent when no event was taken for this many
+	-- cycles, or right away when the CPU stops
+	constant flush_cycles : integer := 255;
+
+	constant fifo_depth : integer := 2 ** fifo_bits;
+
+	subtype event_record is std_logic_vector(127 downto 0);
+	type event_records is array(0 to fifo_depth - 1) of event_record;
+	signal fifo : event_records;
+	signal fifo_q : event_record;
+
+	-- one bit wider than the address, so full and empty differ
+	subtype fifo_ptr is unsigned(fifo_bits downto 0);
+	signal wr_ptr, wr_ptr_r : fifo_ptr;
+	signal rd_ptr, rd_next : fifo_ptr;
+	signal available : fifo_ptr;
+	signal fifo_full : std_logic;
+	signal fifo_push : std_logic;
+	signal fifo_pop : std_logic;
+
+	signal enable : std_logic;
+
+	-- cycles since the previous event, up to flush_cycles
+	signal idle_cycles : integer range 0 to flush_cycles;
+	signal flush : std_logic;
+
+	signal producer_counter : unsigned(31 downto 0);
+	signal dropped_counter : unsigned(31 downto 0);
+
+	signal ring_events : unsigned(31 downto 0);
+	signal ring_space : unsigned(31 downto 0);
+
+	-- events the next TLP would carry
+	subtype burst_length is unsigned(2 downto 0);
+	signal to_boundary : burst_length;
+	signal burst : burst_length;
+	signal burst_ready : std_logic;
+
+	-- an event is sent as its low qword, then its high qword
+	type state is (idle, waiting, header, data_low, data_high);
+	signal s : state;
+
+	signal tlp_events : burst_length;
+	signal remaining : burst_length;
+	signal current_address : std_logic_vector(63 downto 0);
+	signal is_64bit : std_logic;
+begin
+	producer <= std_logic_vector(producer_counter);
+	dropped <= std_logic_vector(dropped_counter);
+
+	cpl_pending <= '0';
+	tx_err <= '0';
+
+	enable <= or_reduce(ring_size) and not clear;
+
+	-- the event written in a cycle can be read two cycles later, so the
+	-- sending side sees the write pointer late
+	available <= wr_ptr_r - rd_ptr;
+	fifo_full <= '1' when wr_ptr - rd_ptr = fifo_depth else '0';
+	fifo_push <= event_valid and enable and not fifo_full;
+
+	-- whatever was not sent when the ring was disabled is thrown away
+	fifo_pop <= '1' when s = data_high and tx_ready = '1' else '0';
+	rd_next <= wr_ptr_r when s = idle and enable = '0' else
+			rd_ptr + 1 when ?? fifo_pop else
+			rd_ptr;
+
+	event_in : process(reset, clk) is
+	begin
+		if(?? reset) then
+			wr_ptr <= to_unsigned(0, wr_ptr'length);
+			wr_ptr_r <= to_unsigned(0, wr_ptr_r'length);
+			idle_cycles <= 0;
+			dropped_counter <= (others => '0');
+		elsif(rising_edge(clk)) then
+			wr_ptr_r <= wr_ptr;
+			if(idle_cycles /= flush_cycles) then
+				idle_cycles <= idle_cycles + 1;
+			end if;
+			if(?? clear) then
+				dropped_counter <= (others => '0');
+			elsif(?? (event_valid and enable)) then
+				idle_cycles <= 0;
+				if(?? fifo_full) then
+					dropped_counter <= dropped_counter + 1;
+				end if;
+			end if;
+			if(?? fifo_push) then
+				wr_ptr <= wr_ptr + 1;
+			end if;
+		end if;
+	end process;
+
+	-- block RAM, read address registered
+	event_ram : process(clk) is
+	begin
+		if(rising_edge(clk)) then
+			if(?? fifo_push) then
+				fifo(to_integer(wr_ptr(fifo_bits - 1 downto 0))) <= event_data;
+			end if;
+			fifo_q <= fifo(to_integer(rd_next(fifo_bits - 1 downto 0)));
+		end if;
+	end process;
+
+	flush <= '1' when idle_cycles = flush_cycles or cpu_running = '0' else '0';
+
+	ring_events <= shift_left(to_unsigned(1, 32), to_integer(unsigned(ring_size)));
+	ring_space <= ring_events - (producer_counter - unsigned(consumer));
+
+	to_boundary <= burst_events - resize(producer_counter(1 downto 0), burst_length'length);
+
+	-- as many events as are there, up to the end of the 64 byte block,
+	-- and as long as the host has made room for them
+	burst_size : process(to_boundary, ring_space, available) is
+		variable n : burst_length;
+	begin
+		n := to_boundary;
+		if(ring_space < n) then
+			n := resize(ring_space, n'length);
+		end if;
+		if(available < n) then
+			n := resize(available, n'length);
+		end if;
+		burst <= n;
+	end process;
+
+	-- full blocks go out right away, partial ones when the CPU is quiet
+	burst_ready <= '1' when burst /= 0 and (burst = to_boundary or flush = '1') else '0';
+
+	-- lets the status register show the CPU as running until the events
+	-- before the halt are visible to the host
+	drained <= '1' when s = idle and (burst = 0 or enable = '0') else '0';
+
+	is_64bit <= or_reduce(current_address(63 downto 32));
+
+	pcie_write : process(reset, clk) is
+		procedure defaults is
+		begin
+			tx_req <= '0';
+			tx_valid <= '0';
+		end procedure;
+	begin
+		if(?? reset) then
+			s <= idle;
+			rd_ptr <= to_unsigned(0, rd_ptr'length);
+			producer_counter <= (others => '0');
+			tlp_events <= to_unsigned(0, tlp_events'length);
+			remaining <= to_unsigned(0, remaining'length);
+			defaults;
+		elsif(rising_edge(clk)) then
+			defaults;
+			rd_ptr <= rd_next;
+			case s is
+				when idle =>
+					if(?? clear) then
+						producer_counter <= (others => '0');
+					elsif(?? (enable and burst_ready)) then
+						tlp_events <= burst;
+						current_address <= std_logic_vector(
+								unsigned(ring_base(63 downto 12) & x"000") +
+								shift_left(resize(producer_counter and (ring_events - 1), 64), 4));
+						tx_req <= '1';
+						s <= waiting;
+					end if;
+				when waiting =>
+					if ?? (tx_start and tx_ready) then
+						tx_valid <= '1';
+						tx_data <= device_id &		-- requester id
+									x"00" &			-- tag (unused)
+									x"ff" &			-- byte enables
+									"0" &			-- reserved
+									"1" &			-- data attached
+									is_64bit &		-- 64 bit address
+									"00000" &		-- type: memory access
+									"0" &			-- reserved
+									"000" &			-- traffic class
+									"0000" &		-- reserved
+									"0" &			-- no digest
+									"0" &			-- not poisoned
+									"00" &			-- attributes
+									"00" &			-- reserved
+									std_logic_vector(resize(tlp_events, 8)) & "00";	-- four DWORDs per event
+						tx_sop <= '1';
+						tx_eop <= '0';
+						s <= header;
+					else
+						tx_req <= '1';
+					end if;
+				when header =>
+					if ?? tx_ready then
+						tx_valid <= '1';
+						if(?? is_64bit) then
+							tx_data <= current_address(31 downto 2) & "00" &
+										current_address(63 downto 32);
+						else
+							tx_data <= x"00000000" &
+										current_address(31 downto 2) & "00";
+						end if;
+						tx_sop <= '0';
+						tx_eop <= '0';
+						remaining <= tlp_events;
+						s <= data_low;
+					end if;
+				when data_low =>
+					if(?? tx_ready) then
+						tx_valid <= '1';
+						tx_data <= fifo_q(63 downto 0);
+						tx_sop <= '0';
+						tx_eop <= '0';
+						s <= data_high;
+					end if;
+				when data_high =>
+					if(?? tx_ready) then
+						tx_valid <= '1';
+						tx_data <= fifo_q(127 downto 64);
+						tx_sop <= '0';
+						remaining <= remaining - 1;
+						if(remaining = 1) then
+							tx_eop <= '1';
+							-- the host sees the events before the
+							-- index, reads do not pass posted writes
+							producer_counter <= producer_counter + tlp_events;
+							s <= idle;
+						else
+							tx_eop <= '0';
+							s <= data_low;
+						end if;
+					end if;
+			end case;
+		end if;
+	end process;
+end architecture;
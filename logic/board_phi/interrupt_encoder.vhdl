@@ -1,8 +1,12 @@
 library ieee;
 
 use ieee.std_logic_1164.ALL;
+use ieee.std_logic_misc.ALL;
 use ieee.numeric_std.ALL;
 
+-- interrupt source n is sent as MSI message n, as long as the host enabled
+-- that many, the sources beyond share the last message. Without MSI, any
+-- pending source asserts the legacy interrupt.
 entity interrupt_encoder is
 	port(
 		-- async reset
@@ -14,6 +18,11 @@ entity interrupt_encoder is
 		-- interrupt sources
 		int_sts : in std_logic_vector(31 downto 0);
 
+		-- MSI control register of the configuration space: enable, and
+		-- the base 2 logarithm of the messages the host enabled
+		msi_enable : in std_logic;
+		msi_messages : in std_logic_vector(2 downto 0);
+
 		-- legacy interrupt interface
 		legacy_int_sts : out std_logic;
 		legacy_int_ack : in std_logic;
@@ -36,9 +45,15 @@ architecture rtl of interrupt_encoder is
 
 	type state is (idle, waiting_for_ack, waiting_for_not_ack);
 	signal s : state;
+
+	-- highest message number the host enabled
+	signal last_message : int;
 begin
-	-- TODO not implemented yet
-	legacy_int_sts <= '0';
+	-- level triggered, the sources are cleared by the host
+	legacy_int_sts <= or_reduce(int_sts) and not msi_enable;
+
+	last_message <= num_irqs - 1 when unsigned(msi_messages) >= 5 else
+			2 ** to_integer(unsigned(msi_messages)) - 1;
 
 	process(reset, clk) is
 		variable pending : ints;
@@ -54,7 +69,11 @@ begin
 		elsif(rising_edge(clk)) then
 			case s is
 				when idle =>
-					pending := int_sts and not already_sent;
+					if(?? msi_enable) then
+						pending := int_sts and not already_sent;
+					else
+						pending := (others => '0');
+					end if;
 
 					have_int := false;
 
@@ -73,7 +92,11 @@ begin
 					if(have_int) then
 						s <= waiting_for_ack;
 						msi_int_req <= '1';
-						msi_int_num <= std_logic_vector(to_unsigned(highest, 5));
+						if(highest > last_message) then
+							msi_int_num <= std_logic_vector(to_unsigned(last_message, 5));
+						else
+							msi_int_num <= std_logic_vector(to_unsigned(highest, 5));
+						end if;
 						msi_int_tc <= (others => '0');
 					end if;
 				when waiting_for_ack =>
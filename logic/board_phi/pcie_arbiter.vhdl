@@ -15,6 +15,7 @@ library ieee;
 
 use ieee.std_logic_1164.ALL;
 use ieee.std_logic_misc.ALL;
+use ieee.numeric_std.ALL;
 use work.pcie_arbiter_types.ALL;
 
 entity pcie_arbiter is
@@ -50,13 +51,18 @@ entity pcie_arbiter is
 		arb_tx_eop : in logic_per_agent(1 to num_agents);
 		arb_tx_err : in logic_per_agent(1 to num_agents);
 
-		arb_cpl_pending : in logic_per_agent(1 to num_agents)
+		arb_cpl_pending : in logic_per_agent(1 to num_agents);
+
+		-- statistics: cycles in which an agent waited for the link
+		wait_cycles : out std_logic_vector(63 downto 0)
 	);
 end entity;
 
 architecture syn of pcie_arbiter is
 	signal idle : boolean;
 	signal selected : natural range 1 to num_agents;
+
+	signal wait_counter : unsigned(63 downto 0);
 begin
 	-- distribute "ready" signal
 	arb_tx_ready <= (others => merged_tx_ready);
@@ -71,6 +77,20 @@ begin
 	-- combine "completion pending"
 	merged_cpl_pending <= or_reduce(arb_cpl_pending);
 
+	-- agents hold their request until they are started
+	wait_cycles <= std_logic_vector(wait_counter);
+
+	process(reset_n, clk) is
+	begin
+		if(reset_n = '0') then
+			wait_counter <= (others => '0');
+		elsif(rising_edge(clk)) then
+			if(or_reduce(arb_tx_req) = '1') then
+				wait_counter <= wait_counter + 1;
+			end if;
+		end if;
+	end process;
+
 	-- selection logic
 	process(reset_n, clk) is
 		-- currently selected source is sending EOP
@@ -1,23 +1,47 @@
 library ieee;
 
 use ieee.std_logic_1164.ALL;
+use ieee.numeric_std.ALL;
+use ieee.math_real.ALL;
 
 library std;
 
 use std.env.finish;
 
+-- Issues a random mix of reads and writes against a completer model that
+-- answers reads after a random latency and in random order, and checks that
+-- read data is returned in the order of the requests. With 64 bit words,
+-- some accesses enable only one half, and the length and byte enables of
+-- every request TLP are checked.
 entity tb_avalon_mm_to_pcie_avalon_st is
+	generic(
+		-- requester word width, 32 or 64
+		word_width : positive := 32;
+		-- reads in flight
+		max_outstanding : positive := 4;
+		-- number of requests
+		requests : positive := 200;
+		seed : positive := 1;
+		-- completion latency range, in cycles
+		min_latency : natural := 4;
+		max_latency : natural := 60
+	);
 end entity;
 
 architecture sim of tb_avalon_mm_to_pcie_avalon_st is
 	signal reset : std_logic;
 	signal clk : std_logic := '0';
 
+	subtype word is std_logic_vector(word_width - 1 downto 0);
+	subtype byteenable is std_logic_vector(word_width / 8 - 1 downto 0);
+
 	signal req_addr : std_logic_vector(63 downto 0);
+	signal req_byteenable : byteenable;
 	signal req_rdreq : std_logic;
-	signal req_rddata : std_logic_vector(31 downto 0);
+	signal req_rddata : word;
+	signal req_rddatavalid : std_logic;
 	signal req_wrreq : std_logic;
-	signal req_wrdata : std_logic_vector(31 downto 0);
+	signal req_wrdata : word;
 	signal req_waitrequest : std_logic;
 
 	signal cmp_rx_ready : std_logic;
@@ -42,6 +66,57 @@ architecture sim of tb_avalon_mm_to_pcie_avalon_st is
 	signal cmp_cpl_pending : std_logic;
 
 	signal device_id : std_logic_vector(15 downto 0);
+
+	subtype address is std_logic_vector(63 downto 0);
+	subtype dword is std_logic_vector(31 downto 0);
+
+	-- addresses and byte enables of the reads, in request order
+	type address_list is array(0 to requests - 1) of address;
+	type byteenable_list is array(0 to requests - 1) of byteenable;
+	signal read_addr : address_list;
+	signal read_be : byteenable_list;
+
+	-- length in DWORDs of the TLP for each request
+	type length_list is array(0 to requests - 1) of natural;
+	signal tlp_length : length_list;
+	signal reads_issued : natural;
+	signal writes_issued : natural;
+
+	signal reads_accepted : natural;
+	signal reads_returned : natural;
+	signal max_in_flight : natural;
+	signal writes_seen : natural;
+
+	-- memory contents, written data is inverted
+	function contents(a : address) return dword is
+	begin
+		return a(31 downto 0) xor a(63 downto 32) xor x"5a5aa5a5";
+	end function;
+
+	function swap(d : dword) return dword is
+	begin
+		return d(7 downto 0) & d(15 downto 8) & d(23 downto 16) & d(31 downto 24);
+	end function;
+
+	-- a word, the upper half is the lower address
+	function word_contents(a : address) return word is
+		variable ret : word;
+	begin
+		for i in 0 to word_width / 32 - 1 loop
+			ret(word_width - 1 - 32 * i downto word_width - 32 - 32 * i) :=
+				contents(std_logic_vector(unsigned(a) + 4 * i));
+		end loop;
+		return ret;
+	end function;
+
+	function byte_mask(be : byteenable) return word is
+		variable ret : word;
+	begin
+		for i in be'range loop
+			ret(8 * i + 7 downto 8 * i) := (others => be(i));
+		end loop;
+		return ret;
+	end function;
 begin
 	reset <= '1', '0' after 100 ns;
 
@@ -50,75 +125,339 @@ begin
 	-- timeout
 	process
 	begin
-		wait for 1 us;
+		wait for 10 ms;
 		report "sim timeout" severity error;
 		finish;
 	end process;
 
 	-- stimuli
 	process
+		variable seed1 : positive := seed;
+		variable seed2 : positive := 1;
+		variable x : real;
+		variable a : address;
+		variable reads : natural;
+		variable writes : natural;
+		variable start : time;
+		variable be : byteenable;
+
+		impure function random(constant range_size : in positive) return natural is
+		begin
+			uniform(seed1, seed2, x);
+			return integer(trunc(x * real(range_size)));
+		end function;
 	begin
 		cmp_tx_ready <= '1';
 		req_addr <= (others => 'U');
+		req_byteenable <= (others => 'U');
 		req_rdreq <= '0';
 		req_wrreq <= '0';
 		req_wrdata <= (others => 'U');
+		reads := 0;
+		writes := 0;
+		reads_issued <= 0;
+		writes_issued <= 0;
 		wait until ?? (not reset);
 		wait until rising_edge(clk);
-		req_addr <= x"0123456789abcdec";
-		req_rdreq <= '1';
-		wait until ?? (not req_waitrequest);
-		req_addr <= (others => 'U');
-		req_rdreq <= '0';
+		start := now;
+		for n in 0 to requests - 1 loop
+			-- some addresses need a 64 bit header
+			a := (others => '0');
+			if(random(4) = 0) then
+				a(63 downto 32) := std_logic_vector(to_unsigned(random(2 ** 30), 32));
+			end if;
+			a(31 downto 2) := std_logic_vector(to_unsigned(random(2 ** 30), 30));
+			be := (others => '1');
+			tlp_length(n) <= word_width / 32;
+			if(word_width = 64) then
+				a(2) := '0';
+				-- a single DWORD, selected by the byte enables
+				case random(4) is
+					when 0 =>
+						be := "11110000";
+						tlp_length(n) <= 1;
+					when 1 =>
+						be := "00001111";
+						tlp_length(n) <= 1;
+					when others =>
+						null;
+				end case;
+			end if;
+			req_addr <= a;
+			req_byteenable <= be;
+			if(random(4) = 0) then
+				req_wrreq <= '1';
+				req_wrdata <= not word_contents(a);
+				writes := writes + 1;
+				writes_issued <= writes;
+			else
+				req_rdreq <= '1';
+				read_addr(reads) <= a;
+				read_be(reads) <= be;
+				reads := reads + 1;
+				reads_issued <= reads;
+			end if;
+			wait until rising_edge(clk) and req_waitrequest = '0';
+			req_addr <= (others => 'U');
+			req_byteenable <= (others => 'U');
+			req_rdreq <= '0';
+			req_wrreq <= '0';
+			req_wrdata <= (others => 'U');
+			-- occasional idle cycles
+			while(random(4) = 0) loop
+				wait until rising_edge(clk);
+			end loop;
+		end loop;
+
+		wait until rising_edge(clk) and reads_returned = reads and writes_seen = writes;
 		wait until rising_edge(clk);
-		req_addr <= x"0123456789abcdec";
-		req_wrreq <= '1';
-		req_wrdata <= x"87654321";
-		wait until ?? (not req_waitrequest);
-		req_wrreq <= '0';
-		wait;
+		assert cmp_cpl_pending = '0'
+			report "completions still pending" severity error;
+		report natural'image(reads) & " reads, " &
+			natural'image(writes) & " writes, " &
+			natural'image((now - start) / 20 ns) & " cycles, at most " &
+			natural'image(max_in_flight) & " reads in flight";
+		finish;
 	end process;
 
-	-- PCIe responder
-	process
+	-- check read data order
+	process(reset, clk)
 	begin
-		cmp_rx_valid <= '0';
-		wait until ?? (not reset);
-		wait until rising_edge(clk) and (?? cmp_tx_valid);
-		wait until rising_edge(clk) and (?? cmp_tx_valid);
-		wait until rising_edge(clk);
-		cmp_rx_valid <= '1';
-		cmp_rx_data <= x"000000044a000001";
-		cmp_rx_sop <= '1';
-		cmp_rx_eop <= '0';
-		wait until rising_edge(clk);
-		cmp_rx_data <= x"000000001234006c";
-		cmp_rx_sop <= '0';
-		wait until rising_edge(clk);
-		cmp_rx_data <= x"2244668800000000";
-		cmp_rx_eop <= '1';
-		wait until rising_edge(clk);
-		cmp_rx_valid <= '0';
+		if(?? reset) then
+			reads_accepted <= 0;
+			reads_returned <= 0;
+			max_in_flight <= 0;
+		elsif(rising_edge(clk)) then
+			if(req_rdreq = '1' and req_waitrequest = '0') then
+				reads_accepted <= reads_accepted + 1;
+			end if;
+			if(?? req_rddatavalid) then
+				assert reads_returned < reads_issued
+					report "data returned without request" severity error;
+				-- only the enabled bytes are defined
+				assert (req_rddata and byte_mask(read_be(reads_returned))) =
+						(word_contents(read_addr(reads_returned)) and byte_mask(read_be(reads_returned)))
+					report "wrong data for read " & natural'image(reads_returned) &
+						": expected " & to_hstring(word_contents(read_addr(reads_returned))) &
+						", got " & to_hstring(req_rddata)
+					severity error;
+				reads_returned <= reads_returned + 1;
+			end if;
+			if(reads_accepted - reads_returned > max_in_flight) then
+				max_in_flight <= reads_accepted - reads_returned;
+			end if;
+			assert reads_accepted - reads_returned <= max_outstanding
+				report "too many reads in flight" severity error;
+		end if;
+	end process;
+
+	-- PCIe completer: requests are parsed from the tx stream, reads are
+	-- answered after a random latency, picking one of the due reads at
+	-- random, so completions arrive out of order
+	process(reset, clk)
+		variable seed1 : positive := seed;
+		variable seed2 : positive := 2;
+		variable x : real;
 
-		wait;
+		type tx_state is (idle, header2, data);
+		variable tx : tx_state;
+		variable hdr : std_logic_vector(63 downto 0);
+		variable wr_addr : address;
+		variable wr_data : dword;
+		-- request TLPs seen, in request order
+		variable tlps : natural;
+
+		type rx_state is (idle, header2, data);
+		variable rx : rx_state;
+
+		-- outstanding reads by tag
+		type pending_list is array(0 to 255) of boolean;
+		type address_by_tag is array(0 to 255) of address;
+		type delay_by_tag is array(0 to 255) of natural;
+		type length_by_tag is array(0 to 255) of natural range 1 to 2;
+		variable pending : pending_list;
+		variable pending_addr : address_by_tag;
+		variable pending_length : length_by_tag;
+		variable delay : delay_by_tag;
+
+		variable t : natural range 0 to 255;
+		variable due : natural;
+		variable pick : integer;
+		variable cur : natural range 0 to 255;
+
+		impure function random(constant range_size : in positive) return natural is
+		begin
+			uniform(seed1, seed2, x);
+			return integer(trunc(x * real(range_size)));
+		end function;
+	begin
+		if(?? reset) then
+			tx := idle;
+			rx := idle;
+			tlps := 0;
+			pending := (others => false);
+			writes_seen <= 0;
+			cmp_rx_valid <= '0';
+			cmp_rx_data <= (others => 'U');
+			cmp_rx_sop <= '0';
+			cmp_rx_eop <= '0';
+		elsif(rising_edge(clk)) then
+			for i in pending'range loop
+				if(pending(i) and delay(i) /= 0) then
+					delay(i) := delay(i) - 1;
+				end if;
+			end loop;
+
+			if(?? cmp_tx_valid) then
+				if(?? cmp_tx_sop) then
+					hdr := cmp_tx_data;
+					assert hdr(63 downto 48) = device_id
+						report "wrong requester id" severity error;
+					assert to_integer(unsigned(hdr(9 downto 0))) = tlp_length(tlps)
+						report "unexpected length for request " & natural'image(tlps) severity error;
+					-- first DWORD BE, last DWORD BE only with more than one
+					assert hdr(35 downto 32) = "1111"
+						report "unexpected first DWORD byte enables" severity error;
+					if(hdr(9 downto 0) = "0000000001") then
+						assert hdr(39 downto 36) = "0000"
+							report "last DWORD byte enables on a single DWORD" severity error;
+					else
+						assert hdr(39 downto 36) = "1111"
+							report "unexpected last DWORD byte enables" severity error;
+					end if;
+					tlps := tlps + 1;
+					tx := header2;
+				else
+					case tx is
+						when idle =>
+							report "data without header" severity error;
+						when header2 =>
+							if(hdr(29) = '1') then
+								wr_addr := cmp_tx_data(31 downto 0) & cmp_tx_data(63 downto 32);
+							else
+								wr_addr := x"00000000" & cmp_tx_data(31 downto 0);
+							end if;
+							if(hdr(30) = '1') then
+								-- a posted write may pass reads in the fabric
+								assert pending = pending_list'(others => false)
+									report "write issued while reads are outstanding" severity error;
+								tx := data;
+							else
+								t := to_integer(unsigned(hdr(47 downto 40)));
+								assert not pending(t)
+									report "tag " & natural'image(t) & " reused while outstanding" severity error;
+								pending(t) := true;
+								pending_addr(t) := wr_addr;
+								pending_length(t) := to_integer(unsigned(hdr(9 downto 0)));
+								delay(t) := min_latency + random(max_latency - min_latency + 1);
+								tx := idle;
+							end if;
+						when data =>
+							if(hdr(9 downto 0) /= "0000000001") then
+								-- two DWORDs, the first one in the lower lane
+								assert swap(cmp_tx_data(31 downto 0)) = not contents(wr_addr)
+									report "wrong data written to " & to_hstring(wr_addr) severity error;
+								wr_addr := std_logic_vector(unsigned(wr_addr) + 4);
+								wr_data := swap(cmp_tx_data(63 downto 32));
+							elsif(wr_addr(2) = '0') then
+								-- placed in the lane selected by address bit 2
+								wr_data := swap(cmp_tx_data(63 downto 32));
+							else
+								wr_data := swap(cmp_tx_data(31 downto 0));
+							end if;
+							assert wr_data = not contents(wr_addr)
+								report "wrong data written to " & to_hstring(wr_addr) severity error;
+							writes_seen <= writes_seen + 1;
+							tx := idle;
+					end case;
+				end if;
+			end if;
+
+			cmp_rx_valid <= '0';
+			cmp_rx_data <= (others => 'U');
+			cmp_rx_sop <= '0';
+			cmp_rx_eop <= '0';
+			case rx is
+				when idle =>
+					due := 0;
+					for i in pending'range loop
+						if(pending(i) and delay(i) = 0) then
+							due := due + 1;
+						end if;
+					end loop;
+					if(due /= 0) then
+						pick := random(due);
+						for i in pending'range loop
+							if(pending(i) and delay(i) = 0) then
+								if(pick = 0) then
+									cur := i;
+								end if;
+								pick := pick - 1;
+							end if;
+						end loop;
+						cmp_rx_valid <= '1';
+						-- completer id, status, byte count, fmt/type, length
+						if(pending_length(cur) = 2) then
+							cmp_rx_data <= x"00000008" & x"4a000002";
+						else
+							cmp_rx_data <= x"00000004" & x"4a000001";
+						end if;
+						cmp_rx_sop <= '1';
+						rx := header2;
+					end if;
+				when header2 =>
+					cmp_rx_valid <= '1';
+					cmp_rx_data(31 downto 0) <= device_id &
+						std_logic_vector(to_unsigned(cur, 8)) &
+						"0" & pending_addr(cur)(6 downto 0);
+					if(pending_length(cur) = 1 and pending_addr(cur)(2) = '1') then
+						-- single DWORD in the second cycle
+						cmp_rx_data(63 downto 32) <= swap(contents(pending_addr(cur)));
+						cmp_rx_eop <= '1';
+						pending(cur) := false;
+						rx := idle;
+					else
+						cmp_rx_data(63 downto 32) <= x"00000000";
+						rx := data;
+					end if;
+				when data =>
+					cmp_rx_valid <= '1';
+					if(pending_length(cur) = 2) then
+						-- the first DWORD in the lower lane
+						cmp_rx_data <= swap(contents(std_logic_vector(unsigned(pending_addr(cur)) + 4))) &
+							swap(contents(pending_addr(cur)));
+					else
+						cmp_rx_data <= swap(contents(pending_addr(cur))) & x"00000000";
+					end if;
+					cmp_rx_eop <= '1';
+					pending(cur) := false;
+					rx := idle;
+			end case;
+		end if;
 	end process;
 
 	cmp_tx_start <= cmp_tx_req;
 
+	cmp_rx_err <= '0';
+	cmp_rx_bardec <= (others => '0');
+
 	device_id <= x"1234";
 
 	-- dut
 	dut : entity work.avalon_mm_to_pcie_avalon_st
 		generic map(
-			word_width => 32,
-			tag => x"00"
+			word_width => word_width,
+			tag => x"00",
+			max_outstanding => max_outstanding
 		)
 		port map(
 			reset => reset,
 			clk => clk,
 			req_addr => req_addr,
+			req_byteenable => req_byteenable,
 			req_rdreq => req_rdreq,
 			req_rddata => req_rddata,
+			req_rddatavalid => req_rddatavalid,
 			req_wrreq => req_wrreq,
 			req_wrdata => req_wrdata,
 			req_waitrequest => req_waitrequest,
@@ -15,6 +15,11 @@ architecture sim of tb_interrupt_encoder is
 
 	signal int_sts : std_logic_vector(31 downto 0);
 
+	signal msi_enable : std_logic;
+	signal msi_messages : std_logic_vector(2 downto 0);
+
+	signal legacy_int_sts : std_logic;
+
 	signal msi_int_req : std_logic;
 	signal msi_int_num : std_logic_vector(4 downto 0);
 	signal msi_int_tc : std_logic_vector(2 downto 0);
@@ -29,7 +34,7 @@ begin
 	-- sim timeout
 	process is
 	begin
-		wait for 1 us;
+		wait for 2 us;
 		report "sim timeout" severity error;
 		finish;
 	end process;
@@ -43,6 +48,9 @@ begin
 	begin
 		int_sts <= (others => '0');
 		msi_int_ack <= '0';
+		-- all 32 messages
+		msi_enable <= '1';
+		msi_messages <= "101";
 
 		wait until not (?? reset);
 
@@ -104,6 +112,73 @@ begin
 
 		wait until not (?? msi_int_req);
 
+		msi_int_ack <= '0';
+		int_sts <= (others => '0');
+		tick;
+		tick;
+
+		-- four messages, the sources beyond share the last one
+		msi_messages <= "010";
+		int_sts(17) <= '1';
+
+		wait until ?? msi_int_req;
+		assert msi_int_num = "00011" report "source not sent as the last message" severity error;
+
+		tick;
+		msi_int_ack <= '1';
+
+		wait until not (?? msi_int_req);
+
+		msi_int_ack <= '0';
+		tick;
+		int_sts(2) <= '1';
+
+		wait until ?? msi_int_req;
+		assert msi_int_num = "00010" report "wrong interrupt number reported" severity error;
+
+		tick;
+		msi_int_ack <= '1';
+
+		wait until not (?? msi_int_req);
+
+		msi_int_ack <= '0';
+		int_sts <= (others => '0');
+		tick;
+		tick;
+
+		-- a single message
+		msi_messages <= "000";
+		int_sts(2) <= '1';
+
+		wait until ?? msi_int_req;
+		assert msi_int_num = "00000" report "source not sent as the only message" severity error;
+
+		tick;
+		msi_int_ack <= '1';
+
+		wait until not (?? msi_int_req);
+
+		msi_int_ack <= '0';
+		int_sts <= (others => '0');
+		tick;
+		tick;
+
+		-- no MSI, the legacy interrupt follows the sources
+		msi_enable <= '0';
+		tick;
+		assert not (?? legacy_int_sts) report "legacy interrupt with no source" severity error;
+
+		int_sts(1) <= '1';
+		tick;
+		tick;
+		assert ?? legacy_int_sts report "legacy interrupt not asserted" severity error;
+		assert not (?? msi_int_req) report "MSI sent while disabled" severity error;
+
+		int_sts(1) <= '0';
+		tick;
+		tick;
+		assert not (?? legacy_int_sts) report "legacy interrupt not deasserted" severity error;
+
 		wait for 10 ns;
 		finish;
 	end process;
@@ -115,7 +190,10 @@ begin
 
 			int_sts => int_sts,
 
-			legacy_int_sts => open,
+			msi_enable => msi_enable,
+			msi_messages => msi_messages,
+
+			legacy_int_sts => legacy_int_sts,
 			legacy_int_ack => '0',
 
 			msi_int_req => msi_int_req,
@@ -7,6 +7,11 @@ use ieee.numeric_std.ALL;
 use work.bss2k.ALL;
 
 entity textmode_output is
+	generic(
+		-- number of host buffers the updates rotate through, each update
+		-- renders the rows changed since its buffer was last written
+		buffers : positive := 1
+	);
 	port(
 		-- async reset
 		reset : in std_logic;
@@ -18,6 +23,13 @@ entity textmode_output is
 		target_address : in std_logic_vector(63 downto 0);
 		start : in std_logic;
 		done : out std_logic;
+		-- send the character RAM instead of rendering it, sampled at start
+		characters : in std_logic := '0';
+		-- character rows rendered by the current update, valid from
+		-- start until the next start
+		damage : out std_logic_vector(24 downto 0);
+		-- buffer contents are lost, render all rows into every buffer
+		invalidate : in std_logic := '0';
 
 		-- PCIe interface
 
@@ -35,6 +47,9 @@ entity textmode_output is
 
 		device_id : in std_logic_vector(15 downto 0);
 
+		-- statistics: write TLPs sent
+		packets : out std_logic_vector(63 downto 0);
+
 		-- internal data bus
 		d_addr : in address;
 		d_wrreq : in std_logic;
@@ -115,6 +130,60 @@ architecture rtl of textmode_output is
 
 	signal pixels : std_logic_vector(1 downto 0);
 
+	-- one bit per character row, row 0 in bit 0
+	subtype row_mask is std_logic_vector(24 downto 0);
+
+	-- rows written since the last start, all rows after reset
+	signal dirty : row_mask;
+	-- rows written before the previous starts, newest first, which the
+	-- buffer about to be written has not seen yet
+	type row_masks is array(natural range <>) of row_mask;
+	signal history : row_masks(1 to buffers - 1);
+	signal stale : row_mask;
+	-- rows rendered by the current update
+	signal damaged, damaged_r : row_mask;
+	signal row_damaged : std_logic;
+	-- rows whose TLPs have not been sent yet
+	signal unsent : row_mask;
+
+	-- one bit for the row an address in the character RAM belongs to,
+	-- none for the cursor words behind the last row
+	function row_of(a : std_logic_vector(10 downto 0)) return row_mask is
+		variable ret : row_mask := (others => '0');
+	begin
+		for i in row_mask'range loop
+			if(unsigned(a) >= i * 80 and unsigned(a) < (i + 1) * 80) then
+				ret(i) := '1';
+			end if;
+		end loop;
+		return ret;
+	end function;
+
+	-- a pixel row is exactly 105 TLPs of 256 bytes, so each character row
+	-- starts on a TLP boundary
+	constant row_tlps : integer := 105;
+
+	function first_tlp(m : row_mask) return unsigned is
+	begin
+		for i in row_mask'range loop
+			if(?? m(i)) then
+				return to_unsigned(i * row_tlps, 12);
+			end if;
+		end loop;
+		return to_unsigned(0, 12);
+	end function;
+
+	-- character mode, the RAM is sent as is, eight bytes per qword
+	signal raw, raw_r : std_logic;
+	signal b, b_r : unsigned(10 downto 0);
+	signal char_qword : std_logic_vector(63 downto 0);
+	signal char_valid : std_logic;
+
+	signal fifo_data : std_logic_vector(63 downto 0);
+	signal fifo_wrreq : std_logic;
+	signal tlp_ready : std_logic;
+	signal rendering : std_logic;
+
 	signal tex_rdreq : std_logic;
 	signal tex_data : std_logic_vector(63 downto 0);
 	signal tex_almost_full : std_logic;
@@ -122,13 +191,15 @@ architecture rtl of textmode_output is
 	signal tex_usedw : std_logic_vector(7 downto 0);
 
 	signal transfer_counter : unsigned(11 downto 0);
-	constant transfer_count : unsigned(11 downto 0) := to_unsigned(2700, 12);
+	signal row_tlp : unsigned(6 downto 0);
 
 	signal current_address : std_logic_vector(63 downto 0);
 	signal is_64bit : std_logic;
 
 	signal qword_counter : unsigned(4 downto 0);
 
+	signal packet_counter : unsigned(63 downto 0);
+
 	signal t0b, t0r, t1b, t1r : std_logic_vector(7 downto 0);
 begin
 	writing_char_ram <= d_wrreq and
@@ -137,7 +208,58 @@ begin
 	start_r <= start when rising_edge(clk);
 	start_strobe <= start and not start_r and ready;
 
-	v <= font_active;
+	packets <= std_logic_vector(packet_counter);
+
+	v <= font_active and (raw or row_damaged);
+
+	raw <= characters when ?? start_strobe else raw_r;
+	raw_r <= '0' when ?? reset else raw when rising_edge(clk);
+
+	stale_rows : process(history) is
+		variable s : row_mask;
+	begin
+		s := (others => '0');
+		for i in history'range loop
+			s := s or history(i);
+		end loop;
+		stale <= s;
+	end process;
+
+	damaged <= (dirty or stale) when ?? start_strobe else damaged_r;
+	damaged_r <= (others => '0') when ?? reset else damaged when rising_edge(clk);
+	row_damaged <= damaged(to_integer(r));
+
+	damage <= damaged;
+
+	dirty_rows : process(reset, clk) is
+		variable d : row_mask;
+	begin
+		if(?? reset) then
+			dirty <= (others => '1');
+			history <= (others => (others => '1'));
+		elsif(rising_edge(clk)) then
+			d := dirty;
+			if(?? start_strobe) then
+				for i in history'range loop
+					if(i = 1) then
+						history(i) <= dirty;
+					else
+						history(i) <= history(i - 1);
+					end if;
+				end loop;
+				d := (others => '0');
+			end if;
+			-- a row written during an update is sent again next time
+			if(?? writing_char_ram) then
+				d := d or row_of(d_addr(10 downto 0));
+			end if;
+			dirty <= d;
+			if(?? invalidate) then
+				dirty <= (others => '1');
+				history <= (others => (others => '1'));
+			end if;
+		end if;
+	end process;
 
 	addr_gen : process(reset, clk) is
 	begin
@@ -146,11 +268,26 @@ begin
 			l <= to_unsigned(0, l'length);
 			r <= to_unsigned(0, r'length);
 			c <= to_unsigned(0, c'length);
+			b <= to_unsigned(0, b'length);
 			font_done <= '0';
 		elsif(rising_edge(clk)) then
 			if(?? font_active) then
 				font_done <= '0';
-				if(p = font_width - 1) then
+				if(?? raw) then
+					-- wraps to zero after the last byte
+					b <= b + 1;
+					if(b = 2047) then
+						font_done <= '1';
+					end if;
+				elsif(not (?? row_damaged)) then
+					-- skip clean rows, one cycle each
+					if(r = rows - 1) then
+						r <= to_unsigned(0, r'length);
+						font_done <= '1';
+					else
+						r <= r + 1;
+					end if;
+				elsif(p = font_width - 1) then
 					p <= to_unsigned(0, p'length);
 					if(c = columns - 1) then
 						c <= to_unsigned(0, c'length);
@@ -176,7 +313,7 @@ begin
 	end process;
 
 	ram_addr_tmp <= std_logic_vector(r * columns + c);
-	ram_addr <= ram_addr_tmp(ram_addr'range);
+	ram_addr <= std_logic_vector(b) when ?? raw else ram_addr_tmp(ram_addr'range);
 
 	ram_inst : textmode_ram
 		port map(
@@ -194,6 +331,23 @@ begin
 	r_r <= r when rising_edge(clk);
 	c_r <= c when rising_edge(clk);
 	v_r <= v when rising_edge(clk);
+	b_r <= b when rising_edge(clk);
+
+	-- lowest address in the low byte, like the pixels
+	pack : process(clk) is
+	begin
+		if(rising_edge(clk)) then
+			char_valid <= '0';
+			if(?? (v_r and raw)) then
+				for i in 0 to 7 loop
+					if(to_integer(b_r(2 downto 0)) = i) then
+						char_qword(i * 8 + 7 downto i * 8) <= ram_data;
+					end if;
+				end loop;
+				char_valid <= and_reduce(std_logic_vector(b_r(2 downto 0)));
+			end if;
+		end if;
+	end process;
 
 	d_waitrequest <= '1';
 
@@ -233,19 +387,26 @@ begin
 	t0b <= x"ff" when ?? pixels(0) else "0" & std_logic_vector(c_rr);
 	t0r <= x"ff" when ?? pixels(0) else "000" & std_logic_vector(r_rr);
 
+	fifo_data <= char_qword when ?? raw else
+			x"ff" & t0b & (7 downto 0 => pixels(0)) & t0r &
+			x"ff" & t1b & (7 downto 0 => pixels(1)) & t1r;
+	fifo_wrreq <= char_valid when ?? raw else v_rr;
+
+	-- data is still coming out of the RAM and ROM
+	rendering <= font_running or v_r or v_rr;
+
+	-- characters trickle in at a qword every eight cycles, so wait for a
+	-- whole TLP; pixels arrive faster than they are sent
+	tlp_ready <= '1' when unsigned(tex_usedw) >= 32 else
+			'0' when ?? raw else
+			not tex_empty;
+
 	fifo_inst : textmode_pixel_fifo
 		port map(
 			aclr => reset,
 			clock => clk,
-			data(63 downto 56) => x"ff",
-			data(55 downto 48) => t0b,
-			data(47 downto 40) => (others => pixels(0)),
-			data(39 downto 32) => t0r,
-			data(31 downto 24) => x"ff",
-			data(23 downto 16) => t1b,
-			data(15 downto 8) => (others => pixels(1)),
-			data(7 downto 0) => t1r,
-			wrreq => v_rr,
+			data => fifo_data,
+			wrreq => fifo_wrreq,
 			almost_full	=> tex_almost_full,
 			empty => tex_empty,
 			rdreq => tex_rdreq,
@@ -276,21 +437,33 @@ begin
 		if(?? reset) then
 			s := idle;
 			transfer_counter <= to_unsigned(0, transfer_counter'length);
+			row_tlp <= to_unsigned(0, row_tlp'length);
+			unsent <= (others => '0');
 			qword_counter <= to_unsigned(0, qword_counter'length);
+			packet_counter <= (others => '0');
 			ready <= '1';
 			defaults;
 		elsif(rising_edge(clk)) then
 			defaults;
 			if(?? start_strobe) then
 				ready <= '0';
+				row_tlp <= to_unsigned(0, row_tlp'length);
+				if(?? raw) then
+					transfer_counter <= to_unsigned(0, transfer_counter'length);
+					unsent <= (others => '0');
+				else
+					transfer_counter <= first_tlp(damaged);
+					unsent <= damaged;
+				end if;
 			end if;
 			case s is
 				when idle =>
-					done <= '1';
-					if(?? font_done) then
-						transfer_counter <= to_unsigned(0, transfer_counter'length);
+					-- characters may still be on their way
+					if(not (?? (rendering or tlp_ready))) then
+						done <= '1';
+						ready <= '1';
 					end if;
-					if(not (?? tex_empty)) then
+					if(?? tlp_ready) then
 						s := waiting;
 						tx_req <= '1';
 					end if;
@@ -317,16 +490,21 @@ begin
 						tx_sop <= '1';
 						tx_eop <= '0';
 						tex_rdreq <= '1';
+						packet_counter <= packet_counter + 1;
 					else
 						tx_req <= '1';
 					end if;
 				when header =>
 					done <= '0';
 					if ?? tx_ready then
-						if(transfer_counter = transfer_count - 1) then
-							transfer_counter <= to_unsigned(0, transfer_counter'length);
-						else
+						if((?? raw) or row_tlp /= row_tlps - 1) then
 							transfer_counter <= transfer_counter + 1;
+							row_tlp <= row_tlp + 1;
+						else
+							-- continue at the next damaged row
+							row_tlp <= to_unsigned(0, row_tlp'length);
+							unsent <= unsent and std_logic_vector(unsigned(unsent) - 1);
+							transfer_counter <= first_tlp(unsent and std_logic_vector(unsigned(unsent) - 1));
 						end if;
 						tx_valid <= '1';
 						s := data;
@@ -349,12 +527,11 @@ begin
 						tx_data <= tex_data;
 						tx_sop <= '0';
 						if(qword_counter = x"1f") then
-							if(not (?? tex_empty)) then
+							if(?? tlp_ready) then
 								tx_req <= '1';
 								s := waiting;
 							else
 								s := idle;
-								ready <= '1';
 							end if;
 							tex_rdreq <= '0';
 							tx_eop <= '1';
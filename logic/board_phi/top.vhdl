@@ -28,6 +28,9 @@ entity top is
 end entity;
 
 architecture rtl of top is
+	-- host buffers for textmode updates
+	constant textmode_buffers : positive := 3;
+
 	-- async reset
 	signal cpu_reset : std_logic;
 
@@ -38,12 +41,84 @@ architecture rtl of top is
 	signal cpu_halted : std_logic;
 	signal cpu_assertion_failed : std_logic;
 
+	-- framebuffers
+	signal cpu_front_framebuffer : std_logic;
+	signal cpu_swap_request : std_logic;
+	signal cpu_swap_done : std_logic;
+
 	-- instruction bus (Avalon-MM)
 	signal cpu_i_addr : address;
 	signal cpu_i_rddata : instruction;
 	signal cpu_i_rdreq : std_logic;
 	signal cpu_i_waitrequest : std_logic;
 
+	-- instruction cache
+	constant icache_line_words : positive := 4;
+	constant icache_sets : positive := 64;
+	constant icache_ways : positive := 2;
+
+	-- instruction cache memory side (Avalon-MM, burst reads)
+	signal icache_m_addr : address;
+	signal icache_m_burstcount : natural range 1 to icache_line_words;
+	signal icache_m_rdreq : std_logic;
+	signal icache_m_rddata : instruction;
+	signal icache_m_rddatavalid : std_logic;
+	signal icache_m_waitrequest : std_logic;
+
+	-- instructions stored by the CPU are written back before a refill
+	signal icache_sync_req : std_logic;
+	signal icache_sync_waitrequest : std_logic;
+
+	signal icache_hits : std_logic_vector(63 downto 0);
+	signal icache_misses : std_logic_vector(63 downto 0);
+
+	-- branch prediction statistics
+	signal cpu_mispredicts : std_logic_vector(63 downto 0);
+	signal cpu_branch_redirects : std_logic_vector(63 downto 0);
+	signal cpu_redirect_penalty : std_logic_vector(63 downto 0);
+
+	-- pipeline statistics
+	signal cpu_retired : std_logic_vector(63 downto 0);
+	signal cpu_fetch_stalls : std_logic_vector(63 downto 0);
+	signal cpu_data_stalls : std_logic_vector(63 downto 0);
+
+	-- PCIe statistics
+	signal dma_i_read_requests : std_logic_vector(63 downto 0);
+	signal dma_i_read_completions : std_logic_vector(63 downto 0);
+	signal dma_d_read_requests : std_logic_vector(63 downto 0);
+	signal dma_d_read_completions : std_logic_vector(63 downto 0);
+	signal textmode_packets : std_logic_vector(63 downto 0);
+	signal arbiter_wait_cycles : std_logic_vector(63 downto 0);
+
+	-- instruction trace
+	signal cpu_trace_valid : std_logic;
+	signal cpu_trace_ip : address;
+	signal cpu_trace_opcode : std_logic_vector(15 downto 0);
+
+	signal trace_enable : std_logic;
+	signal trace_period : std_logic_vector(31 downto 0);
+	signal trace_base : std_logic_vector(63 downto 0);
+	signal trace_size : std_logic_vector(4 downto 0);
+	signal trace_consumer : std_logic_vector(31 downto 0);
+	signal trace_producer : std_logic_vector(31 downto 0);
+	signal trace_dropped : std_logic_vector(31 downto 0);
+
+	-- debug events
+	signal cpu_debug_valid : std_logic;
+	signal cpu_debug_ip : address;
+	signal cpu_debug_opcode : std_logic_vector(15 downto 0);
+	signal cpu_debug_register : reg;
+	signal cpu_debug_value : word;
+	signal cpu_debug_cycles : word;
+	signal cpu_debug_event : std_logic_vector(127 downto 0);
+
+	signal event_base : std_logic_vector(63 downto 0);
+	signal event_size : std_logic_vector(4 downto 0);
+	signal event_consumer : std_logic_vector(31 downto 0);
+	signal event_producer : std_logic_vector(31 downto 0);
+	signal event_dropped : std_logic_vector(31 downto 0);
+	signal event_drained : std_logic;
+
 	-- data bus (Avalon-MM)
 	signal cpu_d_addr : address;
 	signal cpu_d_rddata : word;
@@ -55,6 +130,24 @@ architecture rtl of top is
 	signal cpu_d_waitrequest_ram : std_logic;
 	signal cpu_d_waitrequest_textmode : std_logic;
 
+	-- data cache
+	constant dcache_line_words : positive := 4;
+	constant dcache_sets : positive := 256;
+
+	-- data cache memory side (Avalon-MM)
+	signal dcache_m_addr : address;
+	signal dcache_m_rdreq : std_logic;
+	signal dcache_m_rddata : word;
+	signal dcache_m_wrreq : std_logic;
+	signal dcache_m_wrdata : word;
+	signal dcache_m_waitrequest : std_logic;
+
+	signal dcache_flush : std_logic;
+	signal dcache_clean : std_logic;
+
+	signal dcache_hits : std_logic_vector(63 downto 0);
+	signal dcache_misses : std_logic_vector(63 downto 0);
+
 	-- debug port
 	signal debug_clk_int : std_logic;
 	signal debug_data_valid_int : std_logic;
@@ -69,6 +162,9 @@ architecture rtl of top is
 	signal textmode_address_host : std_logic_vector(63 downto 0);
 	signal textmode_start : std_logic;
 	signal textmode_done : std_logic;
+	signal textmode_characters : std_logic;
+	signal textmode_damage : std_logic_vector(24 downto 0);
+	signal textmode_invalidate : std_logic;
 
 	component cpu is
 		port(
@@ -82,6 +178,32 @@ architecture rtl of top is
 			halted : out std_logic;
 			assertion_failed : out std_logic;
 
+			-- framebuffers
+			front_framebuffer : out std_logic;
+			swap_request : out std_logic;
+			swap_done : in std_logic;
+
+			-- statistics
+			retired : out std_logic_vector(63 downto 0);
+			fetch_stalls : out std_logic_vector(63 downto 0);
+			data_stalls : out std_logic_vector(63 downto 0);
+			mispredicts : out std_logic_vector(63 downto 0);
+			branch_redirects : out std_logic_vector(63 downto 0);
+			redirect_penalty : out std_logic_vector(63 downto 0);
+
+			-- instruction trace
+			trace_valid : out std_logic;
+			trace_ip : out address;
+			trace_opcode : out std_logic_vector(15 downto 0);
+
+			-- debug events
+			debug_valid : out std_logic;
+			debug_ip : out address;
+			debug_opcode : out std_logic_vector(15 downto 0);
+			debug_register : out reg;
+			debug_value : out word;
+			debug_cycles : out word;
+
 			-- instruction bus (Avalon-MM)
 			i_addr : out address;
 			i_rddata : in instruction;
@@ -213,9 +335,41 @@ architecture rtl of top is
 	signal textmode_tx_req : std_logic;
 	signal textmode_tx_start : std_logic;
 
+	-- PCIe internal interface for instruction trace
+	-- tx side
+	signal trace_tx_ready : std_logic;
+	signal trace_tx_valid : std_logic;
+	signal trace_tx_data : std_logic_vector(63 downto 0);
+	signal trace_tx_sop : std_logic;
+	signal trace_tx_eop : std_logic;
+	signal trace_tx_err : std_logic;
+	-- power management
+	signal trace_cpl_pending : std_logic;
+	-- arbiter interface
+	signal trace_tx_req : std_logic;
+	signal trace_tx_start : std_logic;
+
+	-- PCIe internal interface for debug events
+	-- tx side
+	signal event_tx_ready : std_logic;
+	signal event_tx_valid : std_logic;
+	signal event_tx_data : std_logic_vector(63 downto 0);
+	signal event_tx_sop : std_logic;
+	signal event_tx_eop : std_logic;
+	signal event_tx_err : std_logic;
+	-- power management
+	signal event_cpl_pending : std_logic;
+	-- arbiter interface
+	signal event_tx_req : std_logic;
+	signal event_tx_start : std_logic;
+
 	-- interrupts
 	-- current status
 	signal int_sts : std_logic_vector(31 downto 0);
+	-- one MSI message each, see linux/bss2k.c
+	signal int_vectors : std_logic_vector(31 downto 0);
+	-- MSI control register
+	signal cfg_msicsr : std_logic_vector(15 downto 0);
 	-- to PCIe block
 	signal app_int_sts : std_logic;
 	signal app_int_ack : std_logic;
@@ -279,6 +433,24 @@ begin
 			clk => cpu_clk,
 			halted => cpu_halted,
 			assertion_failed => cpu_assertion_failed,
+			front_framebuffer => cpu_front_framebuffer,
+			swap_request => cpu_swap_request,
+			swap_done => cpu_swap_done,
+			retired => cpu_retired,
+			fetch_stalls => cpu_fetch_stalls,
+			data_stalls => cpu_data_stalls,
+			mispredicts => cpu_mispredicts,
+			branch_redirects => cpu_branch_redirects,
+			redirect_penalty => cpu_redirect_penalty,
+			trace_valid => cpu_trace_valid,
+			trace_ip => cpu_trace_ip,
+			trace_opcode => cpu_trace_opcode,
+			debug_valid => cpu_debug_valid,
+			debug_ip => cpu_debug_ip,
+			debug_opcode => cpu_debug_opcode,
+			debug_register => cpu_debug_register,
+			debug_value => cpu_debug_value,
+			debug_cycles => cpu_debug_cycles,
 			i_addr => cpu_i_addr,
 			i_rddata => cpu_i_rddata,
 			i_rdreq => cpu_i_rdreq,
@@ -291,6 +463,63 @@ begin
 			d_waitrequest => cpu_d_waitrequest
 		);
 
+	icache : entity work.icache
+		generic map(
+			line_words => icache_line_words,
+			sets => icache_sets,
+			ways => icache_ways
+		)
+		port map(
+			reset => cpu_reset,
+			clk => cpu_clk,
+			i_addr => cpu_i_addr,
+			i_rdreq => cpu_i_rdreq,
+			i_rddata => cpu_i_rddata,
+			i_waitrequest => cpu_i_waitrequest,
+			m_addr => icache_m_addr,
+			m_burstcount => icache_m_burstcount,
+			m_rdreq => icache_m_rdreq,
+			m_rddata => icache_m_rddata,
+			m_rddatavalid => icache_m_rddatavalid,
+			m_waitrequest => icache_m_waitrequest,
+			sync_req => icache_sync_req,
+			sync_waitrequest => icache_sync_waitrequest,
+			snoop_addr => cpu_d_addr,
+			snoop_wrreq => cpu_d_wrreq,
+			hits => icache_hits,
+			misses => icache_misses
+		);
+
+	dcache : entity work.dcache
+		generic map(
+			line_words => dcache_line_words,
+			sets => dcache_sets,
+			sync_bytes => icache_line_words * 8
+		)
+		port map(
+			reset => cpu_reset,
+			clk => cpu_clk,
+			d_addr => cpu_d_addr,
+			d_rdreq => cpu_d_rdreq,
+			d_rddata => cpu_d_rddata,
+			d_wrreq => cpu_d_wrreq,
+			d_wrdata => cpu_d_wrdata,
+			d_waitrequest => cpu_d_waitrequest_ram,
+			m_addr => dcache_m_addr,
+			m_rdreq => dcache_m_rdreq,
+			m_rddata => dcache_m_rddata,
+			m_wrreq => dcache_m_wrreq,
+			m_wrdata => dcache_m_wrdata,
+			m_waitrequest => dcache_m_waitrequest,
+			flush => dcache_flush,
+			clean => dcache_clean,
+			sync_addr => icache_m_addr,
+			sync_req => icache_sync_req,
+			sync_waitrequest => icache_sync_waitrequest,
+			hits => dcache_hits,
+			misses => dcache_misses
+		);
+
 	pcie_rx_ready <= control_rx_ready and cpu_i_rx_ready and cpu_d_rx_ready;
 
 	control_rx_valid <= pcie_rx_valid;
@@ -316,7 +545,7 @@ begin
 
 	arbiter : entity work.pcie_arbiter
 		generic map(
-			num_agents => 4
+			num_agents => 6
 		)
 		port map(
 			reset_n => app_rstn,
@@ -341,45 +570,68 @@ begin
 			arb_tx_req(2) => cpu_i_tx_req,
 			arb_tx_req(3) => cpu_d_tx_req,
 			arb_tx_req(4) => textmode_tx_req,
+			arb_tx_req(5) => trace_tx_req,
+			arb_tx_req(6) => event_tx_req,
 
 			-- start strobe (high one cycle before bus free)
 			arb_tx_start(1) => control_tx_start,
 			arb_tx_start(2) => cpu_i_tx_start,
 			arb_tx_start(3) => cpu_d_tx_start,
 			arb_tx_start(4) => textmode_tx_start,
+			arb_tx_start(5) => trace_tx_start,
+			arb_tx_start(6) => event_tx_start,
 
 			arb_tx_ready(1) => control_tx_ready,
 			arb_tx_ready(2) => cpu_i_tx_ready,
 			arb_tx_ready(3) => cpu_d_tx_ready,
 			arb_tx_ready(4) => textmode_tx_ready,
+			arb_tx_ready(5) => trace_tx_ready,
+			arb_tx_ready(6) => event_tx_ready,
 			arb_tx_valid(1) => control_tx_valid,
 			arb_tx_valid(2) => cpu_i_tx_valid,
 			arb_tx_valid(3) => cpu_d_tx_valid,
 			arb_tx_valid(4) => textmode_tx_valid,
+			arb_tx_valid(5) => trace_tx_valid,
+			arb_tx_valid(6) => event_tx_valid,
 			arb_tx_data(1) => control_tx_data,
 			arb_tx_data(2) => cpu_i_tx_data,
 			arb_tx_data(3) => cpu_d_tx_data,
 			arb_tx_data(4) => textmode_tx_data,
+			arb_tx_data(5) => trace_tx_data,
+			arb_tx_data(6) => event_tx_data,
 			arb_tx_sop(1) => control_tx_sop,
 			arb_tx_sop(2) => cpu_i_tx_sop,
 			arb_tx_sop(3) => cpu_d_tx_sop,
 			arb_tx_sop(4) => textmode_tx_sop,
+			arb_tx_sop(5) => trace_tx_sop,
+			arb_tx_sop(6) => event_tx_sop,
 			arb_tx_eop(1) => control_tx_eop,
 			arb_tx_eop(2) => cpu_i_tx_eop,
 			arb_tx_eop(3) => cpu_d_tx_eop,
 			arb_tx_eop(4) => textmode_tx_eop,
+			arb_tx_eop(5) => trace_tx_eop,
+			arb_tx_eop(6) => event_tx_eop,
 			arb_tx_err(1) => control_tx_err,
 			arb_tx_err(2) => cpu_i_tx_err,
 			arb_tx_err(3) => cpu_d_tx_err,
 			arb_tx_err(4) => textmode_tx_err,
+			arb_tx_err(5) => trace_tx_err,
+			arb_tx_err(6) => event_tx_err,
 
 			arb_cpl_pending(1) => control_cpl_pending,
 			arb_cpl_pending(2) => cpu_i_cpl_pending,
 			arb_cpl_pending(3) => cpu_d_cpl_pending,
-			arb_cpl_pending(4) => textmode_cpl_pending
+			arb_cpl_pending(4) => textmode_cpl_pending,
+			arb_cpl_pending(5) => trace_cpl_pending,
+			arb_cpl_pending(6) => event_cpl_pending,
+
+			wait_cycles => arbiter_wait_cycles
 		);
 
 	control_inst : entity work.control
+		generic map(
+			textmode_buffers => textmode_buffers
+		)
 		port map(
 			reset => not app_rstn,
 			clk => app_clk,
@@ -411,23 +663,69 @@ begin
 			cpu_halted => cpu_halted,
 			cpu_assertion_failed => cpu_assertion_failed,
 
+			cpu_front_framebuffer => cpu_front_framebuffer,
+			cpu_swap_request => cpu_swap_request,
+			cpu_swap_done => cpu_swap_done,
+
+			icache_hits => icache_hits,
+			icache_misses => icache_misses,
+
+			dcache_flush => dcache_flush,
+			dcache_clean => dcache_clean,
+			dcache_hits => dcache_hits,
+			dcache_misses => dcache_misses,
+
+			branch_mispredicts => cpu_mispredicts,
+			branch_redirects => cpu_branch_redirects,
+			redirect_penalty => cpu_redirect_penalty,
+
+			cpu_retired => cpu_retired,
+			cpu_fetch_stalls => cpu_fetch_stalls,
+			cpu_data_stalls => cpu_data_stalls,
+
+			dma_i_read_requests => dma_i_read_requests,
+			dma_i_read_completions => dma_i_read_completions,
+			dma_d_read_requests => dma_d_read_requests,
+			dma_d_read_completions => dma_d_read_completions,
+			textmode_packets => textmode_packets,
+			arbiter_wait_cycles => arbiter_wait_cycles,
+
 			interrupts => int_sts,
 
-			mmu_address_in_a => cpu_i_addr,
+			mmu_address_in_a => icache_m_addr,
 			mmu_address_out_a => cpu_i_addr_host,
 
-			mmu_address_in_b => cpu_d_addr,
+			mmu_address_in_b => dcache_m_addr,
 			mmu_address_out_b => cpu_d_addr_host,
 
 			textmode_target_host => textmode_address_host,
 			textmode_start => textmode_start,
-			textmode_done => textmode_done
+			textmode_done => textmode_done,
+			textmode_characters => textmode_characters,
+			textmode_damage => textmode_damage,
+			textmode_invalidate => textmode_invalidate,
+
+			trace_enable => trace_enable,
+			trace_period => trace_period,
+			trace_base => trace_base,
+			trace_size => trace_size,
+			trace_consumer => trace_consumer,
+			trace_producer => trace_producer,
+			trace_dropped => trace_dropped,
+
+			event_base => event_base,
+			event_size => event_size,
+			event_consumer => event_consumer,
+			event_producer => event_producer,
+			event_dropped => event_dropped,
+			event_drained => event_drained
 		);
 
 	cpu_dma_inst_i : entity work.avalon_mm_to_pcie_avalon_st
 		generic map(
 			word_width => 64,
-			tag => x"00"
+			tag => x"00",
+			max_burst => icache_line_words
 		)
 		port map(
 			reset => not app_rstn,
@@ -436,11 +734,13 @@ begin
 
 			-- requester side (Avalon-MM)
 			req_addr => cpu_i_addr_host,
-			req_rdreq => cpu_i_rdreq,
-			req_rddata => cpu_i_rddata,
+			req_rdreq => icache_m_rdreq,
+			req_burstcount => icache_m_burstcount,
+			req_rddata => icache_m_rddata,
+			req_rddatavalid => icache_m_rddatavalid,
 			req_wrreq => '0',
 			req_wrdata => (others => 'U'),
-			req_waitrequest => cpu_i_waitrequest,
+			req_waitrequest => icache_m_waitrequest,
 
 			-- completer side (PCIe Avalon-ST)
 			cmp_rx_ready => cpu_i_rx_ready,
@@ -464,7 +764,10 @@ begin
 
 			cmp_cpl_pending => cpu_i_cpl_pending,
 
-			device_id => cfg_busdev & "000"
+			device_id => cfg_busdev & "000",
+
+			read_requests => dma_i_read_requests,
+			read_completions => dma_i_read_completions
 		);
 
 	cpu_dma_inst_d : entity work.avalon_mm_to_pcie_avalon_st
@@ -479,11 +782,11 @@ begin
 
 			-- requester side (Avalon-MM)
 			req_addr => cpu_d_addr_host,
-			req_rdreq => cpu_d_rdreq,
-			req_rddata => cpu_d_rddata,
-			req_wrreq => cpu_d_wrreq,
-			req_wrdata => cpu_d_wrdata,
-			req_waitrequest => cpu_d_waitrequest_ram,
+			req_rdreq => dcache_m_rdreq,
+			req_rddata => dcache_m_rddata,
+			req_wrreq => dcache_m_wrreq,
+			req_wrdata => dcache_m_wrdata,
+			req_waitrequest => dcache_m_waitrequest,
 
 			-- completer side (PCIe Avalon-ST)
 			cmp_rx_ready => cpu_d_rx_ready,
@@ -507,10 +810,16 @@ begin
 
 			cmp_cpl_pending => cpu_d_cpl_pending,
 
-			device_id => cfg_busdev & "000"
+			device_id => cfg_busdev & "000",
+
+			read_requests => dma_d_read_requests,
+			read_completions => dma_d_read_completions
 		);
 
 	textmode_inst : entity work.textmode_output
+		generic map(
+			buffers => textmode_buffers
+		)
 		port map(
 			reset => not app_rstn,
 			clk => app_clk,
@@ -518,6 +827,9 @@ begin
 			target_address => textmode_address_host,
 			start => textmode_start,
 			done => textmode_done,
+			characters => textmode_characters,
+			damage => textmode_damage,
+			invalidate => textmode_invalidate,
 
 			tx_ready => textmode_tx_ready,
 			tx_valid => textmode_tx_valid,
@@ -533,6 +845,8 @@ begin
 
 			device_id => cfg_busdev & "000",
 
+			packets => textmode_packets,
+
 			-- internal data bus
 			d_addr => cpu_d_addr,
 			d_wrreq => cpu_d_wrreq,
@@ -540,6 +854,77 @@ begin
 			d_waitrequest => cpu_d_waitrequest_textmode
 		);
 
+	trace_inst : entity work.trace_output
+		port map(
+			reset => not app_rstn,
+			clk => app_clk,
+
+			insn_valid => cpu_trace_valid,
+			insn_ip => cpu_trace_ip,
+			insn_opcode => cpu_trace_opcode,
+			cpu_running => not cpu_reset and not cpu_halted,
+
+			enable => trace_enable,
+			sample_period => trace_period,
+			ring_base => trace_base,
+			ring_size => trace_size,
+			consumer => trace_consumer,
+			producer => trace_producer,
+			dropped => trace_dropped,
+
+			tx_ready => trace_tx_ready,
+			tx_valid => trace_tx_valid,
+			tx_data => trace_tx_data,
+			tx_sop => trace_tx_sop,
+			tx_eop => trace_tx_eop,
+			tx_err => trace_tx_err,
+
+			cpl_pending => trace_cpl_pending,
+
+			tx_req => trace_tx_req,
+			tx_start => trace_tx_start,
+
+			device_id => cfg_busdev & "000"
+		);
+
+	-- the second qword holds the value and the cycles, the first one
+	-- the instruction, laid out like a trace record
+	cpu_debug_event <=
+			cpu_debug_cycles & cpu_debug_value &
+			x"0000" & cpu_debug_register & cpu_debug_opcode & cpu_debug_ip;
+
+	event_inst : entity work.event_output
+		port map(
+			reset => not app_rstn,
+			clk => app_clk,
+
+			event_valid => cpu_debug_valid,
+			event_data => cpu_debug_event,
+			clear => cpu_reset,
+			cpu_running => not cpu_reset and not cpu_halted,
+			drained => event_drained,
+
+			ring_base => event_base,
+			ring_size => event_size,
+			consumer => event_consumer,
+			producer => event_producer,
+			dropped => event_dropped,
+
+			tx_ready => event_tx_ready,
+			tx_valid => event_tx_valid,
+			tx_data => event_tx_data,
+			tx_sop => event_tx_sop,
+			tx_eop => event_tx_eop,
+			tx_err => event_tx_err,
+
+			cpl_pending => event_cpl_pending,
+
+			tx_req => event_tx_req,
+			tx_start => event_tx_start,
+
+			device_id => cfg_busdev & "000"
+		);
+
 	-- clocks
 	pld_clk <= core_clk_out;		-- needs to be connected
 	app_clk <= pld_clk;			-- app is synchronous to pld_clk
@@ -548,13 +933,23 @@ begin
 	-- PCIe internal rx interface (Avalon-ST)
 	pcie_rx_mask <= '0';
 
-	-- interrupts
+	-- interrupts: halt (and the failed assertion raised with it), display
+	-- update, framebuffer flip and trace watermark
+	int_vectors <= (
+			0 => int_sts(0) or int_sts(6),
+			1 => int_sts(1),
+			2 => int_sts(2),
+			3 => int_sts(7),
+			others => '0'
+		);
+
 	int : entity work.interrupt_encoder
 		port map(
 			reset => not app_rstn,
 			clk => app_clk,
-			int_sts(31 downto 1) => (others => '0'),
-			int_sts(0) => or_reduce(int_sts),
+			int_sts => int_vectors,
+			msi_enable => cfg_msicsr(0),
+			msi_messages => cfg_msicsr(6 downto 4),
 			legacy_int_sts => app_int_sts,
 			legacy_int_ack => app_int_ack,
 			msi_int_req => app_msi_req,
@@ -812,7 +1207,7 @@ begin
 			cfg_pr_bas => open,
 			cfg_pr_lim => open,
 			cfg_tcvcmap => open,
-			cfg_msicsr => open
+			cfg_msicsr => cfg_msicsr
 	);
 
 	-- debug port clock generation
@@ -856,7 +1251,10 @@ use work.ALL;
 configuration rtl of top is
 	for rtl
 		for c : cpu
-			use entity work.cpu_sequential;
+			use entity work.cpu_sequential
+				generic map(
+					overlap_fetch => true
+				);
 			for rtl
 				for register_file : registers
 					use entity work.altera_registers;
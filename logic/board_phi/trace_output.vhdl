@@ -0,0 +1,336 @@
+library ieee;
+
+use ieee.std_logic_1164.ALL;
+use ieee.std_logic_misc.ALL;
+use ieee.numeric_std.ALL;
+
+use work.bss2k.ALL;
+
+-- instruction trace: every decoded instruction becomes a record, which is
+-- written to a ring buffer in host memory. When sampling, only the
+-- instruction being executed every so many cycles does.
+entity trace_output is
+	generic(
+		-- records buffered while waiting for the link, as a power of two
+		fifo_bits : positive := 8
+	);
+	port(
+		-- async reset
+		reset : in std_logic;
+
+		-- clock
+		clk : in std_logic;
+
+		-- decoded instructions, one per cycle at most. Address and opcode
+		-- are held until the next one.
+		insn_valid : in std_logic;
+		insn_ip : in address;
+		insn_opcode : in std_logic_vector(15 downto 0);
+		-- the CPU is neither held in reset nor halted
+		cpu_running : in std_logic;
+
+		-- ring buffer, 4 KiB aligned, holding 2 ** ring_size records.
+		-- Enabling clears the producer index and the dropped count.
+		enable : in std_logic;
+		-- cycles the CPU runs between samples, zero traces every
+		-- instruction
+		sample_period : in std_logic_vector(31 downto 0);
+		ring_base : in std_logic_vector(63 downto 0);
+		ring_size : in std_logic_vector(4 downto 0);
+		-- records read by the host, and written by the card, both
+		-- counting up from zero
+		consumer : in std_logic_vector(31 downto 0);
+		producer : out std_logic_vector(31 downto 0);
+		-- records lost because the ring and the FIFO were full
+		dropped : out std_logic_vector(31 downto 0);
+
+		-- PCIe interface
+
+		tx_ready : in std_logic;
+		tx_valid : out std_logic;
+		tx_data : out std_logic_vector(63 downto 0);
+		tx_sop : out std_logic;
+		tx_eop : out std_logic;
+		tx_err : out std_logic;
+
+		cpl_pending : out std_logic;
+
+		tx_req : out std_logic;
+		tx_start : in std_logic;
+
+		device_id : in std_logic_vector(15 downto 0)
+	);
+end entity;
+
+architecture rtl of trace_output is
+	-- records per write TLP, at most. A TLP stays inside a 64 byte block
+	-- of the ring, so it never crosses a 4 KiB boundary.
+	constant burst_records : integer := 8;
+
+	-- a partial burst is sent when no record was taken for this many
+	-- cycles, so the end of a program is not held back. Samples wait
+	-- for a full burst while the CPU runs.
+	constant flush_cycles : integer := 255;
+
+	constant fifo_depth : integer := 2 ** fifo_bits;
+
+	-- cycle delta, opcode and address, written as a little endian qword
+	subtype trace_record is std_logic_vector(63 downto 0);
+	type trace_records is array(0 to fifo_depth - 1) of trace_record;
+	signal fifo : trace_records;
+	signal fifo_q : trace_record;
+
+	-- one bit wider than the address, so full and empty differ
+	subtype fifo_ptr is unsigned(fifo_bits downto 0);
+	signal wr_ptr, wr_ptr_r : fifo_ptr;
+	signal rd_ptr, rd_next : fifo_ptr;
+	signal available : fifo_ptr;
+	signal fifo_full : std_logic;
+	signal fifo_push : std_logic;
+	signal fifo_pop : std_logic;
+
+	signal enable_r, start : std_logic;
+
+	-- a record is taken in this cycle
+	signal take : std_logic;
+
+	-- cycles until the next sample
+	signal sampling : std_logic;
+	signal sample_countdown : unsigned(31 downto 0);
+	signal sample_tick : std_logic;
+	-- an instruction was decoded since the CPU started
+	signal ip_valid : std_logic;
+
+	-- cycles since the previous record, saturating
+	signal delta : unsigned(23 downto 0);
+	-- cycles since the previous record, up to flush_cycles
+	signal idle_cycles : integer range 0 to flush_cycles;
+	signal flush : std_logic;
+
+	signal producer_counter : unsigned(31 downto 0);
+	signal dropped_counter : unsigned(31 downto 0);
+
+	signal ring_records : unsigned(31 downto 0);
+	signal ring_space : unsigned(31 downto 0);
+
+	-- records the next TLP would carry
+	subtype burst_length is unsigned(3 downto 0);
+	signal to_boundary : burst_length;
+	signal burst : burst_length;
+	signal burst_ready : std_logic;
+
+	type state is (idle, waiting, header, data);
+	signal s : state;
+
+	signal tlp_records : burst_length;
+	signal remaining : burst_length;
+	signal current_address : std_logic_vector(63 downto 0);
+	signal is_64bit : std_logic;
+begin
+	producer <= std_logic_vector(producer_counter);
+	dropped <= std_logic_vector(dropped_counter);
+
+	cpl_pending <= '0';
+	tx_err <= '0';
+
+	enable_r <= '0' when ?? reset else enable when rising_edge(clk);
+	start <= enable and not enable_r;
+
+	-- the record written in a cycle can be read two cycles later, so the
+	-- sending side sees the write pointer late
+	available <= wr_ptr_r - rd_ptr;
+	fifo_full <= '1' when wr_ptr - rd_ptr = fifo_depth else '0';
+	fifo_push <= take and enable and not start and not fifo_full;
+
+	sampling <= or_reduce(sample_period);
+	sample_tick <= '1' when cpu_running = '1' and sample_countdown <= 1 else '0';
+	take <= (sample_tick and ip_valid) when ?? sampling else insn_valid;
+
+	-- the countdown runs with the CPU, so halted time is not sampled
+	sample_timer : process(reset, clk) is
+	begin
+		if(?? reset) then
+			sample_countdown <= (others => '0');
+			ip_valid <= '0';
+		elsif(rising_edge(clk)) then
+			if(?? (start or sample_tick)) then
+				sample_countdown <= unsigned(sample_period);
+			elsif(?? cpu_running) then
+				sample_countdown <= sample_countdown - 1;
+			end if;
+			if(not (?? cpu_running)) then
+				ip_valid <= '0';
+			elsif(?? insn_valid) then
+				ip_valid <= '1';
+			end if;
+		end if;
+	end process;
+
+	-- whatever was not sent when tracing stopped is thrown away
+	fifo_pop <= '1' when s = data and tx_ready = '1' else '0';
+	rd_next <= wr_ptr_r when s = idle and enable = '0' else
+			rd_ptr + 1 when ?? fifo_pop else
+			rd_ptr;
+
+	record_in : process(reset, clk) is
+	begin
+		if(?? reset) then
+			wr_ptr <= to_unsigned(0, wr_ptr'length);
+			wr_ptr_r <= to_unsigned(0, wr_ptr_r'length);
+			delta <= to_unsigned(0, delta'length);
+			idle_cycles <= 0;
+			dropped_counter <= (others => '0');
+		elsif(rising_edge(clk)) then
+			wr_ptr_r <= wr_ptr;
+			if(delta /= 2 ** delta'length - 1) then
+				delta <= delta + 1;
+			end if;
+			if(idle_cycles /= flush_cycles) then
+				idle_cycles <= idle_cycles + 1;
+			end if;
+			if(?? start) then
+				-- the first record has no predecessor
+				delta <= to_unsigned(0, delta'length);
+				dropped_counter <= (others => '0');
+			elsif(?? (take and enable)) then
+				delta <= to_unsigned(1, delta'length);
+				idle_cycles <= 0;
+				if(?? fifo_full) then
+					dropped_counter <= dropped_counter + 1;
+				end if;
+			end if;
+			if(?? fifo_push) then
+				wr_ptr <= wr_ptr + 1;
+			end if;
+		end if;
+	end process;
+
+	-- block RAM, read address registered
+	record_ram : process(clk) is
+	begin
+		if(rising_edge(clk)) then
+			if(?? fifo_push) then
+				fifo(to_integer(wr_ptr(fifo_bits - 1 downto 0))) <=
+						std_logic_vector(delta) & insn_opcode & insn_ip;
+			end if;
+			fifo_q <= fifo(to_integer(rd_next(fifo_bits - 1 downto 0)));
+		end if;
+	end process;
+
+	flush <= '1' when idle_cycles = flush_cycles and
+			(sampling = '0' or cpu_running = '0') else '0';
+
+	ring_records <= shift_left(to_unsigned(1, 32), to_integer(unsigned(ring_size)));
+	ring_space <= ring_records - (producer_counter - unsigned(consumer));
+
+	to_boundary <= burst_records - resize(producer_counter(2 downto 0), burst_length'length);
+
+	-- as many records as are there, up to the end of the 64 byte block,
+	-- and as long as the host has made room for them
+	burst_size : process(to_boundary, ring_space, available) is
+		variable n : burst_length;
+	begin
+		n := to_boundary;
+		if(ring_space < n) then
+			n := resize(ring_space, n'length);
+		end if;
+		if(available < n) then
+			n := resize(available, n'length);
+		end if;
+		burst <= n;
+	end process;
+
+	-- full blocks go out right away, partial ones when the CPU is quiet
+	burst_ready <= '1' when burst /= 0 and (burst = to_boundary or flush = '1') else '0';
+
+	is_64bit <= or_reduce(current_address(63 downto 32));
+
+	pcie_write : process(reset, clk) is
+		procedure defaults is
+		begin
+			tx_req <= '0';
+			tx_valid <= '0';
+		end procedure;
+	begin
+		if(?? reset) then
+			s <= idle;
+			rd_ptr <= to_unsigned(0, rd_ptr'length);
+			producer_counter <= (others => '0');
+			tlp_records <= to_unsigned(0, tlp_records'length);
+			remaining <= to_unsigned(0, remaining'length);
+			defaults;
+		elsif(rising_edge(clk)) then
+			defaults;
+			rd_ptr <= rd_next;
+			if(?? start) then
+				producer_counter <= (others => '0');
+			end if;
+			case s is
+				when idle =>
+					if(?? (enable and not start and burst_ready)) then
+						tlp_records <= burst;
+						current_address <= std_logic_vector(
+								unsigned(ring_base(63 downto 12) & x"000") +
+								shift_left(resize(producer_counter and (ring_records - 1), 64), 3));
+						tx_req <= '1';
+						s <= waiting;
+					end if;
+				when waiting =>
+					if ?? (tx_start and tx_ready) then
+						tx_valid <= '1';
+						tx_data <= device_id &		-- requester id
+									x"00" &			-- tag (unused)
+									x"ff" &			-- byte enables
+									"0" &			-- reserved
+									"1" &			-- data attached
+									is_64bit &		-- 64 bit address
+									"00000" &		-- type: memory access
+									"0" &			-- reserved
+									"000" &			-- traffic class
+									"0000" &		-- reserved
+									"0" &			-- no digest
+									"0" &			-- not poisoned
+									"00" &			-- attributes
+									"00" &			-- reserved
+									std_logic_vector(resize(tlp_records, 9)) & "0";	-- two DWORDs per record
+						tx_sop <= '1';
+						tx_eop <= '0';
+						s <= header;
+					else
+						tx_req <= '1';
+					end if;
+				when header =>
+					if ?? tx_ready then
+						tx_valid <= '1';
+						if(?? is_64bit) then
+							tx_data <= current_address(31 downto 2) & "00" &
+										current_address(63 downto 32);
+						else
+							tx_data <= x"00000000" &
+										current_address(31 downto 2) & "00";
+						end if;
+						tx_sop <= '0';
+						tx_eop <= '0';
+						remaining <= tlp_records;
+						s <= data;
+					end if;
+				when data =>
+					if(?? tx_ready) then
+						tx_valid <= '1';
+						tx_data <= fifo_q;
+						tx_sop <= '0';
+						remaining <= remaining - 1;
+						if(remaining = 1) then
+							tx_eop <= '1';
+							-- the host sees the records before the
+							-- index, reads do not pass posted writes
+							producer_counter <= producer_counter + tlp_records;
+							s <= idle;
+						else
+							tx_eop <= '0';
+						end if;
+					end if;
+			end case;
+		end if;
+	end process;
+end architecture;
@@ -1,10 +1,24 @@
 library ieee;
 use ieee.std_logic_1164.ALL;
 use ieee.numeric_std.ALL;
+use ieee.std_logic_misc.or_reduce;
 
 use work.bss2k.ALL;
 
 entity cpu_pipelined is
+	generic(
+		-- instructions fetched ahead of the decoder, including reads in
+		-- flight
+		prefetch_depth : positive := 4;
+		-- reads in flight on the instruction bus. With one, data is valid
+		-- when waitrequest is low. With more, waitrequest low accepts a
+		-- read, and the data is returned later, in order, with rddatavalid.
+		max_fetches : positive := 1;
+		-- branch target buffer entries (power of two)
+		btb_entries : positive := 16;
+		-- return address stack entries
+		ras_depth : positive := 4
+	);
 	port(
 		-- async reset
 		reset : in std_logic;
@@ -16,6 +30,7 @@ entity cpu_pipelined is
 		i_addr : out address;
 		i_rddata : in instruction;
 		i_rdreq : out std_logic;
+		i_rddatavalid : in std_logic := '0';
 		i_waitrequest : in std_logic;
 
 		-- data bus (Avalon-MM)
@@ -27,11 +42,46 @@ entity cpu_pipelined is
 		d_waitrequest : in std_logic;
 
 		-- status
-		halted : out std_logic
+		halted : out std_logic;
+		assertion_failed : out std_logic;
+
+		-- statistics
+		fetch_stalls : out std_logic_vector(63 downto 0);	-- decoder waiting for fetch
+		decode_stalls : out std_logic_vector(63 downto 0);	-- fetched instruction waiting for decoder
+		mispredicts : out std_logic_vector(63 downto 0);	-- wrong prediction, found in execute
+		branch_redirects : out std_logic_vector(63 downto 0);	-- wrong prediction, found in decode
+		redirect_penalty : out std_logic_vector(63 downto 0)	-- cycles without instruction after a redirect
 	);
 end entity;
 
+-- Three stages: fetch, decode with register read, and execute.
+--
+-- The decoder reads the operands in the cycle before the instruction enters
+-- execute. Results are written back in the cycle after execute, so a value
+-- can be in flight in two places when the next instruction needs it: still
+-- being written (wb), or written in the last cycle while the register file
+-- returned the old value (rrfb). Both are forwarded.
+--
+-- The register file has two ports, shared between reads and writes. Writes
+-- have priority, a decoder that cannot get the ports it needs waits.
+--
+-- The fetch engine predicts the next address from a branch target buffer
+-- and a return address stack. Decode checks the prediction against jumps to
+-- a constant address and redirects fetch. Jumps are resolved in execute; a
+-- wrong prediction redirects the fetch engine, and the instructions fetched
+-- after the jump are skipped until the fetch engine signals the restart.
 architecture rtl of cpu_pipelined is
+	function log2(constant val : in positive) return natural is
+		variable ret : natural;
+	begin
+		ret := 0;
+		while(2 ** ret < val) loop
+			ret := ret + 1;
+		end loop;
+		assert 2 ** ret = val report "not a power of two" severity failure;
+		return ret;
+	end function;
+
 	component registers is
 		port
 		(
@@ -65,372 +115,1354 @@ architecture rtl of cpu_pipelined is
 
 	-- handover between fetch and decode
 	signal decode_insn : instruction;	-- current instruction
-	signal decode_strobe : std_logic;	-- current instruction is new
+	signal decode_ip : address;		-- address of current instruction
+	signal decode_next : address;		-- predicted address of next instruction
+	signal decode_strobe : std_logic;	-- current instruction is valid
 	signal decode_restart : std_logic;	-- restart after broken pipeline
 	signal decode_waitrequest : std_logic;	-- decoder is busy
 
-	subtype lane is integer range 1 to 2;
-
-	type data_lane_source is (unused, c_field, r_field);
-
-	type data_lane is record
-		source : data_lane_source;
-
-		c_value : word;
-
-		r_num : reg;
-		r_valid : std_logic;
-		r_value : word;
-
-		valid : std_logic;
-		value : word;
-
-		writeback_active : std_logic;
-		writeback_target : reg;
-
-		reg_lookup_busy : std_logic;
-		reg_writeback_busy : std_logic;
-
-		busy : std_logic;
-	end record;
-
-	type data_lanes is array(lane) of data_lane;
+	-- handover between execute and fetch
+	signal redirect : std_logic;		-- continue at redirect_target
+	signal redirect_target : address;
+	signal stop : std_logic;		-- HALT, stop fetching
+
+	-- jump type, for prediction
+	type jmp_op is (
+		nop,		-- not a jump
+		jump,		-- to constant address
+		jump_if,	-- conditional, to constant address
+		jump_reg,	-- to register, conditional or not
+		call,		-- to constant address
+		call_reg,	-- to register or memory
+		ret
+	);
 
-	type jmp_op is (nop, halt);
-	type alu_op is (nop);
-	type store_op is (nop, store);
+	-- handover between decode and fetch
+	signal branch_redirect : std_logic;	-- prediction wrong, continue at d_next
+	signal branch_call : std_logic;		-- push return address
 
-	type decoded_insn is record
-		strobe : std_logic;	-- strobe when a new instruction is fed
-		skip : std_logic;	-- skip instruction (conditional or branch delay)
-		jmp : jmp_op;		-- opcode for fetch engine
-		op : data_lanes;	-- operands
-		store : store_op;	-- store value from lane 2 to address from lane 1
-		alu : alu_op;		-- opcode for ALU
+	-- handover between execute and fetch
+	signal btb_update : std_logic;		-- jump completed
+	signal btb_update_ip : address;		-- address of jump
+	signal btb_update_target : address;
+	signal btb_update_jmp : jmp_op;
+	signal btb_update_taken : std_logic;
 
-		store_busy : std_logic;
-	end record;
+	subtype lane is integer range 1 to 2;
 
-	signal i : decoded_insn;
+	type reg_per_lane is array(lane) of reg;
 
-	-- feedback for register read after register write
-	type register_register_feedback is record
+	-- register write, kept for a cycle as feedback for register read after
+	-- register write
+	type register_write is record
 		active : std_logic;
 		number : reg;
 		value : word;
 	end record;
 
-	type register_register_feedbacks is array(lane) of register_register_feedback;
+	type register_writes is array(lane) of register_write;
+
+	constant no_write : register_write := (
+		active => '0',
+		number => (others => '0'),
+		value => (others => '0'));
+
+	-- writes to the register file in this cycle
+	signal wb : register_writes;
+	-- writes to the register file in the last cycle
+	signal rrfb : register_writes;
+
+	-- decoded instruction, handed over to execute with d_go
+	signal d_src : reg_per_lane;			-- registers read
+	signal d_read : std_logic_vector(lane);		-- lane needs register read
+	signal d_simple : std_logic;			-- single cycle, no jump
+	signal d_jmp : jmp_op;
+	signal d_next : address;			-- predicted address of next instruction
+	signal d_go : std_logic;
+
+	-- execute can take an instruction at the next clock edge, because the
+	-- current instruction finishes
+	signal x_ready : std_logic;
+
+	type flags is record
+		c : std_logic;
+		z : std_logic;
+	end record;
+
+	-- value of register n, newest write first
+	function forward(n : reg; current, last : register_writes; q : word) return word is
+	begin
+		for l in lane loop
+			if(current(l).active = '1' and current(l).number = n) then
+				return current(l).value;
+			end if;
+		end loop;
+		for l in lane loop
+			if(last(l).active = '1' and last(l).number = n) then
+				return last(l).value;
+			end if;
+		end loop;
+		return q;
+	end function;
 
-	signal rrfb : register_register_feedbacks;
+	-- JUMPif conditions, in opcode order
+	function ternary_condition(n : integer; v : word) return boolean is
+	begin
+		case n is
+			when 0 => return signed(v) = 0;
+			when 1 => return signed(v) > 0;
+			when 2 => return signed(v) >= 0;
+			when 3 => return signed(v) < 0;
+			when others => return signed(v) <= 0;
+		end case;
+	end function;
+
+	-- JUMPeq .. JUMPle and CMPeq .. CMPle conditions, in opcode order
+	function flag_condition(n : integer; f : flags) return boolean is
+	begin
+		case n is
+			when 0 => return f.z = '1';			-- eq
+			when 1 => return f.z = '0';			-- ne
+			when 2 => return f.c = '0' and f.z = '0';	-- gt
+			when 3 => return f.c = '0';			-- ge
+			when 4 => return f.c = '1';			-- lt
+			when others => return f.c = '1' or f.z = '1';	-- le
+		end case;
+	end function;
 begin
-	-- Fetch one instruction from an Avalon-MM compatible interface
+	-- Fetch instructions ahead of the decoder
 	--
-	-- This interface can provide data on the next cycle or ask for more time.
-	-- If i_waitrequest is low at the next rising edge, i_rddata is valid.
+	-- Reads are started while there is space in the prefetch queue, counting
+	-- reads still in flight. A redirect or HALT from execute flushes the
+	-- queue; reads still in flight cannot be cancelled, so their data is
+	-- dropped when it arrives. After a redirect, fetching restarts at the
+	-- target, and decode_restart tells the decoder to stop skipping.
 	--
-	-- In any case, the current transaction has been started, so the next fetch
-	-- address can be presented right away
+	-- The address after current_ip is predicted from a branch target buffer
+	-- and a return address stack. Every instruction carries its predicted
+	-- successor, which decode and execute check. Decode redirects without
+	-- flushing the instruction it holds.
 	fetch : block is
+		constant pipelined_bus : boolean := max_fetches > 1;
+
 		signal current_ip : address;
 
-		signal stash : instruction;
+		-- prefetched instructions, their addresses, and the predicted
+		-- address of the next instruction, in program order
+		type queue is array(0 to prefetch_depth - 1) of instruction;
+		type address_queue is array(0 to prefetch_depth - 1) of address;
+		signal q : queue;
+		signal q_ip : address_queue;
+		signal q_next : address_queue;
+		signal q_head : integer range 0 to prefetch_depth - 1;
+		signal q_tail : integer range 0 to prefetch_depth - 1;
+		signal q_count : integer range 0 to prefetch_depth;
+
+		-- addresses of reads in flight, in order
+		type fetch_queue is array(0 to max_fetches - 1) of address;
+		signal f_ip : fetch_queue;
+		signal f_next : fetch_queue;
+		signal f_head : integer range 0 to max_fetches - 1;
+		signal f_tail : integer range 0 to max_fetches - 1;
+
+		-- reads started, but not yet returned
+		signal in_flight : integer range 0 to max_fetches;
+		-- of these, reads started before a flush
+		signal discard : integer range 0 to max_fetches;
+
+		signal rdreq : std_logic;
+
+		-- branch target buffer, direct mapped on the instruction address
+		constant btb_bits : natural := log2(btb_entries);
+
+		subtype btb_index is integer range 0 to btb_entries - 1;
+		subtype btb_tag is std_logic_vector(address'high downto btb_bits + 3);
+
+		type btb_entry is record
+			valid : std_logic;
+			tag : btb_tag;
+			target : address;
+			jmp : jmp_op;
+		end record;
+
+		type btb_array is array(btb_index) of btb_entry;
+		signal btb : btb_array;
+
+		function index_of(a : address) return btb_index is
+		begin
+			if(btb_bits = 0) then
+				return 0;
+			end if;
+			return to_integer(unsigned(a(btb_bits + 2 downto 3)));
+		end function;
+
+		-- return address stack, the oldest entry is overwritten when full
+		type return_stack is array(0 to ras_depth - 1) of address;
+		signal ras : return_stack;
+		signal ras_top : integer range 0 to ras_depth - 1;
+		signal ras_count : integer range 0 to ras_depth;
 
-		type state is (start, normal, overflow, halt);
+		-- no instruction for the decoder since a flush
+		signal refill : std_logic;
+
+		signal fetch_stall_counter : unsigned(63 downto 0);
+		signal decode_stall_counter : unsigned(63 downto 0);
+		signal redirect_counter : unsigned(63 downto 0);
+		signal penalty_counter : unsigned(63 downto 0);
+
+		type state is (start, normal, halt);
 
 		signal s : state;
 	begin
 		halted <= '1' when s = halt else
 			  '0';
 
+		i_rdreq <= rdreq;
+
+		fetch_stalls <= std_logic_vector(fetch_stall_counter);
+		decode_stalls <= std_logic_vector(decode_stall_counter);
+		branch_redirects <= std_logic_vector(redirect_counter);
+		redirect_penalty <= std_logic_vector(penalty_counter);
+
 		process(reset, clk) is
-			procedure start_fetch is
+			function next_slot(n : integer range 0 to prefetch_depth - 1) return integer is
 			begin
-				i_addr <= current_ip;
-				i_rdreq <= '1';
+				if(n = prefetch_depth - 1) then
+					return 0;
+				end if;
+				return n + 1;
+			end function;
+
+			function next_fetch(n : integer range 0 to max_fetches - 1) return integer is
+			begin
+				if(n = max_fetches - 1) then
+					return 0;
+				end if;
+				return n + 1;
+			end function;
+
+			function next_return(n : integer range 0 to ras_depth - 1) return integer is
+			begin
+				if(n = ras_depth - 1) then
+					return 0;
+				end if;
+				return n + 1;
+			end function;
+
+			function previous_return(n : integer range 0 to ras_depth - 1) return integer is
+			begin
+				if(n = 0) then
+					return ras_depth - 1;
+				end if;
+				return n - 1;
+			end function;
+
+			variable accepted : boolean;
+			variable returned : boolean;
+			variable flush : boolean;
+			variable decode_flush : boolean;
+			-- decoder takes an instruction at this clock edge
+			variable take : boolean;
+
+			-- updated copies of queue and read state
+			variable head : integer range 0 to prefetch_depth - 1;
+			variable tail : integer range 0 to prefetch_depth - 1;
+			variable count : integer range 0 to prefetch_depth;
+			variable reads : integer range 0 to max_fetches;
+			variable drop : integer range 0 to max_fetches;
+			variable fed : boolean;
+
+			-- address and prediction of the returned instruction
+			variable returned_ip : address;
+			variable returned_next : address;
+
+			variable e : btb_entry;
+
+			procedure push_return(constant a : in address) is
+			begin
+				ras(next_return(ras_top)) <= a;
+				ras_top <= next_return(ras_top);
+				if(ras_count /= ras_depth) then
+					ras_count <= ras_count + 1;
+				end if;
 			end procedure;
 
-			procedure increment is
+			procedure start_fetch is
+				variable next_ip : address;
 			begin
-				current_ip <= address(unsigned(current_ip) + 8);
+				next_ip := address(unsigned(current_ip) + 8);
+				e := btb(index_of(current_ip));
+				if(e.valid = '1' and e.tag = current_ip(btb_tag'range)) then
+					case e.jmp is
+						when call | call_reg =>
+							push_return(next_ip);
+							next_ip := e.target;
+						when ret =>
+							if(ras_count /= 0) then
+								next_ip := ras(ras_top);
+								ras_top <= previous_return(ras_top);
+								ras_count <= ras_count - 1;
+							else
+								next_ip := e.target;
+							end if;
+						when others =>
+							next_ip := e.target;
+					end case;
+				end if;
+				i_addr <= current_ip;
+				rdreq <= '1';
+				f_ip(f_tail) <= current_ip;
+				f_next(f_tail) <= next_ip;
+				f_tail <= next_fetch(f_tail);
+				current_ip <= next_ip;
+				reads := reads + 1;
 			end procedure;
 		begin
 			if(reset = '1') then
 				s <= start;
 				current_ip <= entry_point;
 				i_addr <= (others => 'U');
-				i_rdreq <= '0';
+				rdreq <= '0';
+				q_head <= 0;
+				q_tail <= 0;
+				q_count <= 0;
+				f_head <= 0;
+				f_tail <= 0;
+				in_flight <= 0;
+				discard <= 0;
+				for n in btb_index loop
+					btb(n).valid <= '0';
+				end loop;
+				ras_top <= 0;
+				ras_count <= 0;
+				refill <= '1';
 				decode_insn <= (others => 'U');
+				decode_ip <= (others => 'U');
+				decode_next <= (others => 'U');
 				decode_strobe <= '0';
 				decode_restart <= '0';
+				fetch_stall_counter <= (others => '0');
+				decode_stall_counter <= (others => '0');
+				redirect_counter <= (others => '0');
+				penalty_counter <= (others => '0');
 			elsif(rising_edge(clk)) then
-				i_addr <= (others => 'U');
-				i_rdreq <= '0';
-				decode_strobe <= '0';
 				decode_restart <= '0';
-				case s is
-					when start =>
-						-- no read in progress, pipeline has space
-						start_fetch;
-						increment;
-						s <= normal;
-						decode_restart <= '1';
-					when normal =>
-						-- read in progress, pipeline might have space
-						if(i_waitrequest = '0') then
-							if(decode_waitrequest = '0') then
-								-- directly copy
-								decode_insn <= i_rddata;
-								decode_strobe <= '1';
-								-- proceed
-								start_fetch;
-								increment;
-							else
-								-- stash
-								stash <= i_rddata;
-								s <= overflow;
-							end if;
+
+				head := q_head;
+				tail := q_tail;
+				count := q_count;
+				reads := in_flight;
+				drop := discard;
+				fed := false;
+
+				accepted := rdreq = '1' and i_waitrequest = '0';
+				if(pipelined_bus) then
+					returned := i_rddatavalid = '1';
+				else
+					returned := accepted;
+				end if;
+				flush := redirect = '1' or stop = '1';
+				decode_flush := branch_redirect = '1';
+				take := decode_strobe = '0' or decode_waitrequest = '0';
+
+				-- learn from jumps in execute
+				if(btb_update = '1') then
+					if(btb_update_taken = '1') then
+						btb(index_of(btb_update_ip)) <= (
+							valid => '1',
+							tag => btb_update_ip(btb_tag'range),
+							target => btb_update_target,
+							jmp => btb_update_jmp);
+					elsif(btb(index_of(btb_update_ip)).tag = btb_update_ip(btb_tag'range)) then
+						btb(index_of(btb_update_ip)).valid <= '0';
+					end if;
+				end if;
+
+				-- the request stays on the bus until accepted
+				if(accepted) then
+					i_addr <= (others => 'U');
+					rdreq <= '0';
+				end if;
+
+				if(returned) then
+					reads := reads - 1;
+					returned_ip := f_ip(f_head);
+					returned_next := f_next(f_head);
+					f_head <= next_fetch(f_head);
+				end if;
+
+				if(flush) then
+					-- everything fetched so far is dropped
+					head := 0;
+					tail := 0;
+					count := 0;
+					drop := reads;
+					decode_strobe <= '0';
+					refill <= '1';
+					if(stop = '1') then
+						s <= halt;
+					else
+						current_ip <= redirect_target;
+						s <= start;
+					end if;
+				elsif(decode_flush) then
+					-- everything after the instruction in decode is dropped
+					head := 0;
+					tail := 0;
+					count := 0;
+					drop := reads;
+					if(take) then
+						decode_strobe <= '0';
+						refill <= '1';
+					else
+						decode_next <= d_next;
+					end if;
+					if(branch_call = '1') then
+						push_return(address(unsigned(decode_ip) + 8));
+					end if;
+					redirect_counter <= redirect_counter + 1;
+					current_ip <= d_next;
+					s <= start;
+				else
+					if(returned) then
+						if(drop /= 0) then
+							drop := drop - 1;
+						elsif(take and count = 0 and s = normal) then
+							-- queue empty, hand over directly
+							decode_insn <= i_rddata;
+							decode_ip <= returned_ip;
+							decode_next <= returned_next;
+							decode_strobe <= '1';
+							fed := true;
+						else
+							q(tail) <= i_rddata;
+							q_ip(tail) <= returned_ip;
+							q_next(tail) <= returned_next;
+							tail := next_slot(tail);
+							count := count + 1;
 						end if;
-					when overflow =>
-						-- no read in progress, pipeline was busy
+					end if;
 
-						-- feed from stash (always)
-						decode_insn <= stash;
+					if(take and not fed and q_count /= 0) then
+						decode_insn <= q(head);
+						decode_ip <= q_ip(head);
+						decode_next <= q_next(head);
 						decode_strobe <= '1';
-
-						if(decode_waitrequest = '0') then
-							start_fetch;
-							increment;
-							s <= normal;
+						head := next_slot(head);
+						count := count - 1;
+						fed := true;
+					end if;
+
+					if(take and not fed) then
+						decode_strobe <= '0';
+					end if;
+
+					if(fed) then
+						refill <= '0';
+					end if;
+
+					if(s /= halt) then
+						if(take and not fed) then
+							fetch_stall_counter <= fetch_stall_counter + 1;
+							if(refill = '1') then
+								penalty_counter <= penalty_counter + 1;
+							end if;
+						elsif(not take) then
+							decode_stall_counter <= decode_stall_counter + 1;
 						end if;
-					when halt =>
-						null;
-				end case;
-				if(i.strobe = '1' and i.jmp = halt) then
-					s <= halt;
+					end if;
+
+					case s is
+						when start =>
+							-- start at new address as soon as the bus is free
+							if(rdreq = '0' or accepted) then
+								start_fetch;
+								s <= normal;
+								decode_restart <= '1';
+							end if;
+						when normal =>
+							-- keep the queue filled
+							if((rdreq = '0' or accepted) and
+									reads < max_fetches and
+									count + reads < prefetch_depth) then
+								start_fetch;
+							end if;
+						when halt =>
+							null;
+					end case;
 				end if;
+
+				q_head <= head;
+				q_tail <= tail;
+				q_count <= count;
+				in_flight <= reads;
+				discard <= drop;
 			end if;
 		end process;
 	end block;
 
+	-- Decode and register read
+	--
+	-- The operands are read in the cycle the instruction is handed over to
+	-- execute; if execute is busy, or the write ports are in use, the read
+	-- is repeated in the next cycle. ip is never read from the register
+	-- file, execute knows the address of the instruction.
 	decode : block is
 		alias insn : instruction is decode_insn;
 		alias o : std_logic_vector(15 downto 0) is insn(63 downto 48);
-		alias r1 : reg is insn(47 downto 40);
-		alias r2 : reg is insn(39 downto 32);
-		alias r3 : reg is insn(31 downto 24);
-		alias r4 : reg is insn(23 downto 16);
-		alias c : word is insn(31 downto 0);
 
-		type slot is (unused, reg1, reg2, reg3, reg4, const);
-		subtype writeback_slot is slot range unused to reg4;
-		type mem_op is (nop, load, store);
+		-- operand source or destination
+		type operand is (
+			none,	-- not used
+			i_r1,	-- register number in insn, field 1
+			i_r2,
+			i_r3,
+			i_r4,
+			r_sp	-- stack pointer
+		);
 
-		type slot_per_lane is array(lane) of slot;
-		type writeback_slot_per_lane is array(lane) of writeback_slot;
+		type operand_per_lane is array(lane) of operand;
+
+		type kind is (
+			simple,	-- single cycle
+			memory,	-- load or store
+			multi,	-- multi cycle arithmetic
+			halt	-- HALT and invalid opcodes
+		);
 
 		type mapping is record
-			jmp : jmp_op;
-			src : slot_per_lane;
-			dst : writeback_slot_per_lane;
-			alu : alu_op;
-			mem : mem_op;
+			src : operand_per_lane;
+			dst : operand_per_lane;
+			k : kind;
+			j : jmp_op;
 		end record;
 
 		signal m : mapping;
 
+		function number(op : operand; i : instruction) return reg is
+		begin
+			case op is
+				when none => return (others => '0');
+				when i_r1 => return i(47 downto 40);
+				when i_r2 => return i(39 downto 32);
+				when i_r3 => return i(31 downto 24);
+				when i_r4 => return i(23 downto 16);
+				when r_sp => return sp;
+			end case;
+		end function;
+
+		signal d_dst : reg_per_lane;
+		signal d_writes_ip : std_logic;
+
+		-- address of the next instruction, if not jumping
+		signal d_fallthrough : address;
+
+		-- instruction is on decode_insn and should be executed
+		signal valid : std_logic;
+		-- register ports are free for the reads needed
+		signal reads_ok : std_logic;
+
 		-- pipeline broken, skip until restart
 		signal skip : std_logic;
 	begin
-		-- FIXME: latches
-		skip <= '1' when reset = '1' else
-			'0' when decode_restart = '1' else
-			'1' when m.jmp /= nop and rising_edge(clk);
+		-- load/store use lane 1 for address, lane 2 for value
+		with o select m <=
+		--   (1) src (2)     (1) dst (2)    kind    jump
+		( ( none, none ), ( i_r1, none ), simple, nop      ) when x"0000",	-- MOVE immediate -> register
+		( ( none, none ), ( i_r1, none ), memory, nop      ) when x"0001",	-- LOAD address -> register
+		( ( i_r2, none ), ( i_r1, none ), simple, nop      ) when x"0002",	-- MOVE register -> register
+		( ( none, i_r1 ), ( none, none ), memory, nop      ) when x"0003",	-- STORE register -> address
+		( ( i_r2, none ), ( i_r1, none ), memory, nop      ) when x"0004",	-- LOAD [register] -> register
+		( ( i_r1, i_r2 ), ( none, none ), memory, nop      ) when x"0005",	-- STORE register -> [register]
+		( ( none, none ), ( none, none ), halt  , nop      ) when x"0006",	-- HALT and catch fire
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"0007",	-- ADD register, register -> register
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"0008",	-- SUB register, register -> register
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"0009",	-- SUB register, register, carry -> register
+		( ( i_r3, i_r4 ), ( i_r1, i_r2 ), multi , nop      ) when x"000a",	-- MUL register, register -> (register, register)
+		( ( i_r3, i_r4 ), ( i_r1, i_r2 ), multi , nop      ) when x"000b",	-- DIVMOD register, register -> register, register
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"000c",	-- AND register, register -> register
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"000d",	-- OR register, register -> register
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"000e",	-- XOR register, register -> register
+		( ( i_r2, none ), ( i_r1, none ), simple, nop      ) when x"000f",	-- NOT register -> register
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"0010",	-- SHIFT LEFT register, register -> register
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"0011",	-- SHIFT RIGHT register, register -> register
+		( ( i_r2, none ), ( i_r1, none ), simple, nop      ) when x"0012",	-- ADD register, immediate -> register
+		( ( i_r2, none ), ( i_r1, none ), simple, nop      ) when x"0013",	-- SUB register, immediate -> register
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"0014",	-- CMP register, register -> register:ternary
+		( ( r_sp, i_r1 ), ( r_sp, none ), memory, nop      ) when x"0015",	-- PUSH register => STORE register, [sp++]
+		( ( r_sp, none ), ( i_r1, r_sp ), memory, nop      ) when x"0016",	-- POP register => LOAD [--sp] -> register
+		( ( r_sp, none ), ( r_sp, none ), memory, call     ) when x"0017",	-- CALL address => PUSH ip + 8; JMP address
+		( ( r_sp, none ), ( r_sp, none ), memory, ret      ) when x"0018",	-- RETURN => POP ip
+		( ( none, none ), ( none, none ), simple, jump     ) when x"0019",	-- JUMP address
+		( ( i_r1, none ), ( none, none ), simple, jump_reg ) when x"001a",	-- JUMP [register]
+		( ( i_r1, none ), ( none, none ), simple, jump_if  ) when x"001b",	-- JUMPif register:ternary == 0, address
+		( ( i_r1, none ), ( none, none ), simple, jump_if  ) when x"001c",	-- JUMPif register:ternary > 0, address
+		( ( i_r1, none ), ( none, none ), simple, jump_if  ) when x"001d",	-- JUMPif register:ternary >= 0, address
+		( ( i_r1, none ), ( none, none ), simple, jump_if  ) when x"001e",	-- JUMPif register:ternary < 0, address
+		( ( i_r1, none ), ( none, none ), simple, jump_if  ) when x"001f",	-- JUMPif register:ternary <= 0, address
+		( ( none, none ), ( none, none ), simple, jump_if  ) when x"0020",	-- JUMPeq address
+		( ( none, none ), ( none, none ), simple, jump_if  ) when x"0021",	-- JUMPne address
+		( ( none, none ), ( none, none ), simple, jump_if  ) when x"0022",	-- JUMPgt address
+		( ( none, none ), ( none, none ), simple, jump_if  ) when x"0023",	-- JUMPge address
+		( ( none, none ), ( none, none ), simple, jump_if  ) when x"0024",	-- JUMPlt address
+		( ( none, none ), ( none, none ), simple, jump_if  ) when x"0025",	-- JUMPle address
+		( ( i_r2, i_r1 ), ( none, none ), simple, jump_reg ) when x"0026",	-- JUMPif register:ternary == 0, [register]
+		( ( i_r2, i_r1 ), ( none, none ), simple, jump_reg ) when x"0027",	-- JUMPif register:ternary > 0, [register]
+		( ( i_r2, i_r1 ), ( none, none ), simple, jump_reg ) when x"0028",	-- JUMPif register:ternary >= 0, [register]
+		( ( i_r2, i_r1 ), ( none, none ), simple, jump_reg ) when x"0029",	-- JUMPif register:ternary < 0, [register]
+		( ( i_r2, i_r1 ), ( none, none ), simple, jump_reg ) when x"002a",	-- JUMPif register:ternary <= 0, [register]
+		( ( i_r1, none ), ( none, none ), simple, jump_reg ) when x"002b",	-- JUMPeq [register]
+		( ( i_r1, none ), ( none, none ), simple, jump_reg ) when x"002c",	-- JUMPne [register]
+		( ( i_r1, none ), ( none, none ), simple, jump_reg ) when x"002d",	-- JUMPgt [register]
+		( ( i_r1, none ), ( none, none ), simple, jump_reg ) when x"002e",	-- JUMPge [register]
+		( ( i_r1, none ), ( none, none ), simple, jump_reg ) when x"002f",	-- JUMPlt [register]
+		( ( i_r1, none ), ( none, none ), simple, jump_reg ) when x"0030",	-- JUMPle [register]
+		( ( none, none ), ( none, none ), simple, nop      ) when x"0031",	-- NOP
+		( ( i_r2, none ), ( i_r1, none ), simple, nop      ) when x"0032",	-- GETKEYSTATE register -> register
+		( ( none, none ), ( i_r1, i_r2 ), simple, nop      ) when x"0033",	-- POLLTIME -> (register, register)
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"0034",	-- ADD register, register, carry -> register
+		( ( none, none ), ( none, none ), simple, nop      ) when x"0035",	-- SWAPFRAMEBUFFERS
+		( ( r_sp, i_r1 ), ( r_sp, none ), memory, call_reg ) when x"0036",	-- CALL [register]
+		( ( r_sp, i_r1 ), ( r_sp, none ), memory, call_reg ) when x"0037",	-- CALL [[register]]
+		( ( none, none ), ( i_r1, none ), simple, nop      ) when x"0038",	-- INVISIBLEFRAMEBUFFERADDRESS -> register
+		( ( none, none ), ( i_r1, i_r2 ), simple, nop      ) when x"0039",	-- POLLCYCLECOUNT -> (register, register)
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"003a",	-- CMPeq register, register -> register:bool
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"003b",	-- CMPne register, register -> register:bool
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"003c",	-- CMPgt register, register -> register:bool
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"003d",	-- CMPge register, register -> register:bool
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"003e",	-- CMPlt register, register -> register:bool
+		( ( i_r2, i_r3 ), ( i_r1, none ), simple, nop      ) when x"003f",	-- CMPle register, register -> register:bool
+		( ( r_sp, none ), ( r_sp, none ), simple, nop      ) when x"0040",	-- POP <discard>
+		( ( none, none ), ( none, none ), simple, nop      ) when x"fff8",	-- CHECKPOINT immediate
+		( ( i_r1, none ), ( none, none ), simple, nop      ) when x"fff9",	-- PRINTREGISTER
+		( ( none, none ), ( none, none ), simple, nop      ) when x"fffa",	-- DEBUGBREAK
+		( ( i_r1, none ), ( none, none ), memory, nop      ) when x"fffb",	-- ASSERT [register] == immediate
+		( ( i_r1, none ), ( none, none ), simple, nop      ) when x"fffc",	-- ASSERT register == immediate
+		( ( i_r2, i_r1 ), ( none, none ), simple, nop      ) when x"fffd",	-- ASSERT register == register
+		( ( none, none ), ( none, none ), simple, nop      ) when x"fffe",	-- DUMPMEMORY
+		( ( none, none ), ( none, none ), simple, nop      ) when x"ffff",	-- DUMPREGISTERS
+		( ( none, none ), ( none, none ), halt  , nop      ) when others;
 
-		decode_waitrequest <= i.op(1).busy or i.op(2).busy or i.store_busy;
+		lanes : for l in lane generate
+		begin
+			d_src(l) <= number(m.src(l), insn);
+			d_dst(l) <= number(m.dst(l), insn);
+			d_read(l) <= '0' when m.src(l) = none else
+				     '0' when d_src(l) = ip else
+				     '1';
+		end generate;
 
-		with o select m <=
-		-- jmp     (1) src (2)         (1) dst (2)       alu    mem
-		(  nop,  ( const,  unused ), ( reg1,   unused ), nop,   nop     ) when x"0000",	-- LI
-		(  nop,  ( const,  unused ), ( unused, reg1   ), nop,   load    ) when x"0001",	-- LD abs
-		(  nop,  ( reg2,   unused ), ( reg1,   unused ), nop,   nop     ) when x"0002",	-- MOV
-		(  nop,  ( const,  reg1   ), ( unused, unused ), nop,   store   ) when x"0003",	-- ST abs
-		(  nop,  ( reg2,   unused ), ( unused, reg1   ), nop,   load    ) when x"0004",	-- LD [r]
-		(  nop,  ( reg1,   reg2   ), ( unused, unused ), nop,   store   ) when x"0005",	-- ST [r]
-		(  halt, ( unused, unused ), ( unused, unused ), nop,   nop     ) when x"0006",	-- HCF
-		(  nop,  ( unused, unused ), ( unused, unused ), nop,   nop     ) when others;
+		-- writing ip is a jump
+		d_writes_ip <= '1' when m.dst(1) /= none and d_dst(1) = ip else
+			       '1' when m.dst(2) /= none and d_dst(2) = ip else
+			       '0';
 
-		i.strobe <= decode_strobe and not skip;
+		d_simple <= '1' when m.k = simple else
+			    '0';
+		d_jmp <= m.j;
 
-		i.skip <= skip;
+		-- Static prediction: jumps to a constant address are taken, except
+		-- conditional forward jumps the branch target buffer did not predict
+		-- as taken. Targets from registers or memory are left to fetch.
+		d_fallthrough <= address(unsigned(decode_ip) + 8);
 
-		i.jmp <= m.jmp;
+		d_next <= to_address(insn(31 downto 0)) when m.j = jump or m.j = call else
+			  to_address(insn(31 downto 0)) when m.j = jump_if and decode_next /= d_fallthrough else
+			  to_address(insn(31 downto 0)) when m.j = jump_if and unsigned(insn(23 downto 0)) <= unsigned(decode_ip) else
+			  decode_next when m.j /= nop or d_writes_ip = '1' else
+			  d_fallthrough;
 
-		lanes : for l in lane generate
+		branch_redirect <= valid when d_next /= decode_next else
+				   '0';
+		branch_call <= '1' when m.j = call else
+			       '0';
+
+		process(reset, clk) is
 		begin
-			with m.src(l) select i.op(l).source <=
-				unused when unused,
-				c_field when const,
-				r_field when reg1|reg2|reg3|reg4;
-			i.op(l).c_value <= c;
-			with m.src(l) select i.op(l).r_num <=
-				(others => 'U') when unused|const,
-				r1 when reg1,
-				r2 when reg2,
-				r3 when reg3,
-				r4 when reg4;
-
-			with m.dst(l) select i.op(l).writeback_active <=
-				'0' when unused,
-				'1' when reg1|reg2|reg3|reg4;
-			with m.dst(l) select i.op(l).writeback_target <=
-				(others => 'U') when unused,
-				r1 when reg1,
-				r2 when reg2,
-				r3 when reg3,
-				r4 when reg4;
-		end generate;
+			if(reset = '1') then
+				skip <= '1';
+			elsif(rising_edge(clk)) then
+				if(decode_restart = '1') then
+					skip <= '0';
+				end if;
+				if(redirect = '1' or stop = '1') then
+					skip <= '1';
+				end if;
+			end if;
+		end process;
 
-		with m.mem select i.store <=
-			nop when nop|load,
-			store when store;
+		valid <= decode_strobe and not skip and not redirect and not stop;
 
-		i.alu <= m.alu;
-	end block;
+		d_go <= valid and reads_ok and x_ready;
 
-	reg_access : for l in lane generate
-		signal read_selected_register : reg;
-		signal write_selected_register : reg;
+		-- skipped instructions are taken and dropped
+		decode_waitrequest <= not d_go when valid = '1' else
+				      '0';
 
-		-- what we'd like to read
-		signal selected_register : reg;
-		-- what we're actually seeing
-		signal active_register : reg;
+		-- Reads use the port of their lane, writes take the ports left over.
+		ports : process(all) is
+			variable reads : natural range 0 to 2;
+			variable writes : natural range 0 to 2;
+			variable w : register_write;
+		begin
+			reads := 0;
+			if(d_read(1) = '1') then
+				reads := reads + 1;
+			end if;
+			if(d_read(2) = '1') then
+				reads := reads + 1;
+			end if;
+			writes := 0;
+			if(wb(1).active = '1') then
+				writes := writes + 1;
+			end if;
+			if(wb(2).active = '1') then
+				writes := writes + 1;
+			end if;
 
-		-- read data, valid when register is already active
-		signal r_valid : std_logic;
-		signal r_q : word;
+			if(reads + writes <= 2) then
+				reads_ok <= '1';
+			else
+				reads_ok <= '0';
+			end if;
 
-		-- read data, including all shortcuts
-		signal valid : std_logic;
-		signal q : word;
+			r(1).address <= d_src(1);
+			r(1).data <= (others => '-');
+			r(1).wren <= '0';
+			r(2).address <= d_src(2);
+			r(2).data <= (others => '-');
+			r(2).wren <= '0';
+
+			if(writes = 2) then
+				r(1).address <= wb(1).number;
+				r(1).data <= wb(1).value;
+				r(1).wren <= '1';
+				r(2).address <= wb(2).number;
+				r(2).data <= wb(2).value;
+				r(2).wren <= '1';
+			elsif(writes = 1) then
+				if(wb(1).active = '1') then
+					w := wb(1);
+				else
+					w := wb(2);
+				end if;
+				if(d_read(1) = '1' and d_read(2) = '0') then
+					r(2).address <= w.number;
+					r(2).data <= w.value;
+					r(2).wren <= '1';
+				else
+					r(1).address <= w.number;
+					r(1).data <= w.value;
+					r(1).wren <= '1';
+				end if;
+			end if;
+		end process;
+	end block;
 
-		-- write data
-		signal data : word;
-		signal wren : std_logic;
+	reg_access : for l in reg_port generate
 	begin
-		-- FIXME: assuming enough register ports for all lanes
-		r(l).address <= selected_register;
-		r(l).data <= data;
-		r(l).wren <= wren;
+		rrfb(l) <= (active => r(l).wren, number => r(l).address, value => r(l).data) when rising_edge(clk);
+	end generate;
 
-		data <= i.op(l).value;
-		wren <= i.op(l).writeback_active and i.op(l).valid;
+	-- Execute
+	--
+	-- Most instructions complete in their first cycle here. Memory accesses,
+	-- MUL and DIVMOD hold the stage until they are done, operands are latched
+	-- for them. When an instruction is done, the address of the next one is
+	-- compared with the prediction, and the fetch engine is redirected if it
+	-- was wrong. Jumps are reported to the branch target buffer.
+	execute : block is
+		type state is (idle, run, load, store, mul, div, halt);
+		signal s : state;
+
+		-- instruction in execute
+		signal x_insn : instruction;
+		signal x_ip : address;
+		signal x_src : reg_per_lane;
+		signal x_simple : std_logic;
+		signal x_jmp : jmp_op;
+		signal x_next : address;
+
+		alias opcode : std_logic_vector(15 downto 0) is x_insn(63 downto 48);
+		alias reg1 : reg is x_insn(47 downto 40);
+		alias reg2 : reg is x_insn(39 downto 32);
+		alias c : word is x_insn(31 downto 0);
+
+		-- operands in the first cycle, including shortcuts
+		type word_per_lane is array(lane) of word;
+		signal operand : word_per_lane;
+
+		-- stack pointer, latched for CALL [[register]]
+		signal x_a : word;
 
-		read_selected_register <= (others => '0') when reset = '1' else			-- reset
-					  i.op(l).r_num when i.op(l).source = r_field else	-- active
-					  unaffected;						-- inactive
+		signal f : flags;
 
-		rrfb(l) <= (active => wren, number => write_selected_register, value => data) when rising_edge(clk);
+		-- register for memory load operation
+		signal m_reg : reg;
+		-- written back when memory operation is done
+		signal m_wb : register_writes;
 
-		write_selected_register <= (others => '0') when reset = '1' else
-					   i.op(l).writeback_target when i.op(l).writeback_active = '1';
+		-- MUL and DIVMOD units, started from the run state
+		signal mul_start : std_logic;
+		signal mul_busy : std_logic;
+		signal product : std_logic_vector(63 downto 0);
 
-		selected_register <= write_selected_register when wren = '1' else
-				     read_selected_register;
+		signal div_start : std_logic;
+		signal div_busy : std_logic;
+		signal quotient : word;
+		signal remainder : word;
 
-		-- replicate delay of register file
-		active_register <= (others => '0') when reset = '1' else
-				   selected_register when rising_edge(clk);
+		-- framebuffer shown, the other one is drawn to
+		signal front_framebuffer : std_logic;
 
-		-- FIXME: assuming enough register ports for all lanes
-		r_valid <= '1' when active_register = selected_register else
-				  '0';
-		r_q <= r(l).q;
+		signal ms_counter, cycle_counter : unsigned(63 downto 0);
 
-		shortcut : block is
-			subtype std_logic_per_lane is std_logic_vector(lane);
-			type word_per_lane is array(lane) of word;
+		-- app_clk is 125 MHz
+		constant cycle_time : time := 8 ns;
+		constant ms_time : time := 1 ms;
 
-			-- read data, interfaces between r-r shortcut blocks
-			signal valid_in, valid_out : std_logic_per_lane;
-			signal q_in, q_out : word_per_lane;
+		constant cycles_per_ms : integer := ms_time / cycle_time;
+
+		signal cycle_per_ms_counter : integer range cycles_per_ms - 1 downto 0;
+
+		signal mispredict_counter : unsigned(63 downto 0);
+	begin
+		mispredicts <= std_logic_vector(mispredict_counter);
+
+		cycle_counter <= to_unsigned(0, cycle_counter'length) when ?? reset else
+			cycle_counter + 1 when rising_edge(clk);
+
+		process(reset, clk) is
 		begin
-			-- selectors for all shortcut paths
-			selector : for ll in lane generate
-				signal active : std_logic;
+			if ?? reset then
+				cycle_per_ms_counter <= 0;
+			elsif rising_edge(clk) then
+				if cycle_per_ms_counter = cycles_per_ms - 1 then
+					cycle_per_ms_counter <= 0;
+					ms_counter <= ms_counter + 1;
+				else
+					cycle_per_ms_counter <= cycle_per_ms_counter + 1;
+				end if;
+			end if;
+		end process;
+
+		shortcuts : for l in lane generate
+		begin
+			operand(l) <= to_word(x_ip) when x_src(l) = ip else
+				      forward(x_src(l), wb, rrfb, r(l).q);
+		end generate;
+
+		mul_start <= '1' when s = run and opcode = x"000a" else
+			     '0';
+		div_start <= '1' when s = run and opcode = x"000b" else
+			     '0';
+
+		multiplier_unit : entity work.multiplier
+			port map(
+				reset => reset,
+				clk => clk,
+				start => mul_start,
+				a => operand(1),
+				b => operand(2),
+				busy => mul_busy,
+				product => product
+			);
+
+		divider_unit : entity work.divider
+			port map(
+				reset => reset,
+				clk => clk,
+				start => div_start,
+				dividend => operand(1),
+				divisor => operand(2),
+				busy => div_busy,
+				quotient => quotient,
+				remainder => remainder
+			);
+
+		x_ready <= '1' when s = idle else
+			   x_simple when s = run else
+			   '1' when s = load and d_waitrequest = '0' and opcode /= x"0037" else
+			   '1' when s = store and d_waitrequest = '0' else
+			   '1' when s = mul and mul_busy = '0' else
+			   '1' when s = div and div_busy = '0' else
+			   '0';
+
+		process(reset, clk) is
+			-- operands
+			variable a, b : word;
+
+			-- 32 bit wide temporary
+			variable tmp32 : std_logic_vector(31 downto 0);
+
+			-- 33 bit wide temporary
+			variable tmp33 : std_logic_vector(32 downto 0);
+
+			variable shift : natural range 0 to 63;
+
+			-- flags of a CMPxx comparison
+			variable cmp : flags;
+
+			-- results of this cycle
+			variable w : register_writes;
+			variable done : boolean;
+			variable jump : boolean;
+			variable target : address;
+			variable halting : boolean;
+			-- address of the next instruction
+			variable actual : address;
+			variable mispredicted : boolean;
+
+			procedure writeback1(constant reg1 : in reg; constant value1 : in word) is
+			begin
+				w(1) := (active => '1', number => reg1, value => value1);
+			end procedure;
+
+			procedure writeback2(constant reg2 : in reg; constant value2 : in word) is
 			begin
-				active <= '0' when rrfb(ll).active = '0' else
-					  '1' when rrfb(ll).number = read_selected_register else
-					  '0';
-				valid_out(ll) <= active or valid_in(ll);
-				q_out(ll) <= rrfb(ll).value when active = '1' else
-					     q_in(ll);
-			end generate;
-
-			-- connections between selectors
-			valid <= valid_out(lane'low);
-			q <= q_out(lane'low);
-
-			connection : for ll in lane'low + 1 to lane'high generate
+				w(2) := (active => '1', number => reg2, value => value2);
+			end procedure;
+
+			procedure jump_to(constant t : in word) is
 			begin
-				valid_in(ll - 1) <= valid_out(ll);
-				q_in(ll - 1) <= q_out(ll);
-			end generate;
-
-			valid_in(lane'high) <= r_valid;
-			q_in(lane'high) <= r_q;
-		end block;
-
-		i.op(l).r_valid <= valid;
-		i.op(l).r_value <= q;
-
-		with i.op(l).source select i.op(l).reg_lookup_busy <=
-			'0' when unused|c_field,
-			not i.op(l).r_valid when r_field;
-
-		with i.op(l).source select i.op(l).valid <=
-			'0' when unused,
-			'1' when c_field,
-			i.op(l).r_valid when r_field;
-		with i.op(l).source select i.op(l).value <=
-			(others => 'U') when unused,
-			i.op(l).c_value when c_field,
-			i.op(l).r_value when r_field;
-
-		i.op(l).reg_writeback_busy <= not i.op(l).valid when i.op(l).writeback_active = '1' else
-					      '0';
-
-		i.op(l).busy <= i.op(l).reg_lookup_busy or i.op(l).reg_writeback_busy;
-	end generate;
+				jump := true;
+				target := to_address(t);
+			end procedure;
 
-	mem_access : block
-		signal store_active : std_logic;
-		signal store_ready : std_logic;
-	begin
-		with i.store select store_active <=
-			'1' when store,
-			'0' when nop;
-		store_ready <= i.op(1).valid and i.op(2).valid;
+			procedure set_flags(constant carry : in std_logic; constant result : in word) is
+			begin
+				f.c <= carry;
+				f.z <= not or_reduce(result);
+			end procedure;
+
+			procedure start_load(constant a : in word; constant r : in reg) is
+			begin
+				d_addr <= to_address(a);
+				d_rdreq <= '1';
+				m_reg <= r;
+				s <= load;
+			end procedure;
 
-		-- store value from lane 2 to address from lane 1
+			procedure start_store(constant a : in word; constant value : in word) is
+			begin
+				d_addr <= to_address(a);
+				d_wrdata <= value;
+				d_wrreq <= '1';
+				s <= store;
+			end procedure;
 
-		i.store_busy <= store_active and not store_ready;
+			procedure fail is
+			begin
+				assertion_failed <= '1';
+				halting := true;
+			end procedure;
 
-		process(reset, clk) is
+			impure function return_address return word is
+			begin
+				-- increment by eight, because instructions are 64 bit
+				return to_word(address(unsigned(x_ip) + 8));
+			end function;
 		begin
 			if(reset = '1') then
+				s <= idle;
+				x_insn <= (others => '0');
+				x_ip <= (others => '0');
+				x_src <= (others => (others => '0'));
+				x_simple <= '0';
+				x_jmp <= nop;
+				x_next <= (others => '0');
+				-- the register file starts with the stack pointer
+				wb <= (1 => (active => '1', number => sp, value => to_word(stack_start)),
+				       2 => no_write);
+				m_wb <= (others => no_write);
+				redirect <= '0';
+				redirect_target <= (others => '0');
+				stop <= '0';
+				btb_update <= '0';
+				btb_update_ip <= (others => '0');
+				btb_update_target <= (others => '0');
+				btb_update_jmp <= nop;
+				btb_update_taken <= '0';
+				mispredict_counter <= (others => '0');
 				d_addr <= (others => 'U');
 				d_rdreq <= '0';
 				d_wrreq <= '0';
+				f.c <= '0';
+				f.z <= '0';
+				front_framebuffer <= '0';
+				assertion_failed <= '0';
 			elsif(rising_edge(clk)) then
-				d_addr <= (others => 'U');
-				d_rdreq <= '0';
-				d_wrreq <= '0';
-				if(store_active = '1' and store_ready = '1') then
-					d_addr <= to_address(i.op(1).value);
-					d_wrdata <= i.op(2).value;
-					d_wrreq <= '1';
+				wb <= (others => no_write);
+				redirect <= '0';
+				btb_update <= '0';
+
+				w := (others => no_write);
+				done := false;
+				jump := false;
+				halting := false;
+				mispredicted := false;
+
+				case s is
+					when idle =>
+						null;
+					when run =>
+						a := operand(1);
+						b := operand(2);
+						x_a <= a;
+						done := true;
+						case opcode is
+							when x"0000" =>
+								-- LI
+								writeback1(reg1, c);
+							when x"0001" =>
+								-- LD abs
+								m_wb <= (others => no_write);
+								start_load(c, reg1);
+								done := false;
+							when x"0002" =>
+								-- MOV
+								writeback1(reg1, a);
+							when x"0003" =>
+								-- ST abs
+								m_wb <= (others => no_write);
+								start_store(c, b);
+								done := false;
+							when x"0004" =>
+								-- LD [r]
+								m_wb <= (others => no_write);
+								start_load(a, reg1);
+								done := false;
+							when x"0005" =>
+								-- ST [r]
+								m_wb <= (others => no_write);
+								start_store(a, b);
+								done := false;
+							when x"0006" =>
+								-- HCF
+								halting := true;
+							when x"0007" =>
+								-- ADD
+								tmp33 := std_logic_vector(unsigned('0' & a) + unsigned('0' & b));
+								writeback1(reg1, tmp33(31 downto 0));
+								set_flags(tmp33(32), tmp33(31 downto 0));
+							when x"0008" =>
+								-- SUB
+								tmp33 := std_logic_vector(unsigned('0' & a) - unsigned('0' & b));
+								writeback1(reg1, tmp33(31 downto 0));
+								set_flags(tmp33(32), tmp33(31 downto 0));
+							when x"0009" =>
+								-- SBC
+								tmp33 := std_logic_vector(unsigned('0' & a) - unsigned('0' & b) - unsigned'("" & f.c));
+								writeback1(reg1, tmp33(31 downto 0));
+								set_flags(tmp33(32), tmp33(31 downto 0));
+							when x"000a" =>
+								-- MUL, operands are taken by the multiplier
+								s <= mul;
+								done := false;
+							when x"000b" =>
+								-- DIVMOD, operands are taken by the divider
+								s <= div;
+								done := false;
+							when x"000c" =>
+								-- AND
+								tmp32 := a and b;
+								writeback1(reg1, tmp32);
+								set_flags('0', tmp32);
+							when x"000d" =>
+								-- OR
+								tmp32 := a or b;
+								writeback1(reg1, tmp32);
+								set_flags('0', tmp32);
+							when x"000e" =>
+								-- XOR
+								tmp32 := a xor b;
+								writeback1(reg1, tmp32);
+								set_flags('0', tmp32);
+							when x"000f" =>
+								-- NOT
+								tmp32 := not a;
+								writeback1(reg1, tmp32);
+								set_flags('0', tmp32);
+							when x"0010" | x"0011" =>
+								-- SHL, SHR
+								if(or_reduce(b(31 downto 6)) = '1') then
+									shift := 63;
+								else
+									shift := to_integer(unsigned(b(5 downto 0)));
+								end if;
+								if(opcode = x"0010") then
+									tmp33 := std_logic_vector(unsigned('0' & a) sll shift);
+									writeback1(reg1, tmp33(31 downto 0));
+									set_flags(tmp33(32), tmp33(31 downto 0));
+								else
+									tmp33 := std_logic_vector(unsigned(a & '0') srl shift);
+									writeback1(reg1, tmp33(32 downto 1));
+									set_flags(tmp33(0), tmp33(32 downto 1));
+								end if;
+							when x"0012" =>
+								-- ADDI
+								tmp33 := std_logic_vector(unsigned('0' & a) + unsigned('0' & c));
+								writeback1(reg1, tmp33(31 downto 0));
+								set_flags(tmp33(32), tmp33(31 downto 0));
+							when x"0013" =>
+								-- SUBI
+								tmp33 := std_logic_vector(unsigned('0' & a) - unsigned('0' & c));
+								writeback1(reg1, tmp33(31 downto 0));
+								set_flags(tmp33(32), tmp33(31 downto 0));
+							when x"0014" =>
+								-- CMP
+								if(a = b) then
+									writeback1(reg1, x"00000000");
+									f.c <= '0';
+									f.z <= '1';
+								elsif(unsigned(a) > unsigned(b)) then
+									writeback1(reg1, x"00000001");
+									f.c <= '0';
+									f.z <= '0';
+								else
+									writeback1(reg1, x"ffffffff");
+									f.c <= '1';
+									f.z <= '0';
+								end if;
+							when x"0015" =>
+								-- PUSH
+								m_wb <= (1 => (active => '1', number => sp, value => std_logic_vector(unsigned(a) - 4)),
+									 2 => no_write);
+								start_store(a, b);
+								done := false;
+							when x"0016" =>
+								-- POP
+								tmp32 := std_logic_vector(unsigned(a) + 4);
+								m_wb <= (1 => no_write,
+									 2 => (active => '1', number => sp, value => tmp32));
+								start_load(tmp32, reg1);
+								done := false;
+							when x"0017" | x"0036" =>
+								-- CALL, CALL [register]
+								if(opcode = x"0017") then
+									tmp32 := c;
+								else
+									tmp32 := b;
+								end if;
+								m_wb <= (1 => (active => '1', number => sp, value => std_logic_vector(unsigned(a) - 4)),
+									 2 => (active => '1', number => ip, value => tmp32));
+								start_store(a, return_address);
+								done := false;
+							when x"0037" =>
+								-- CALL [[register]], load target first
+								m_wb <= (1 => (active => '1', number => sp, value => std_logic_vector(unsigned(a) - 4)),
+									 2 => no_write);
+								start_load(b, ip);
+								done := false;
+							when x"0018" =>
+								-- RET
+								tmp32 := std_logic_vector(unsigned(a) + 4);
+								m_wb <= (1 => no_write,
+									 2 => (active => '1', number => sp, value => tmp32));
+								start_load(tmp32, ip);
+								done := false;
+							when x"0019" =>
+								-- JUMP
+								jump_to(c);
+							when x"001a" =>
+								-- JUMP [register]
+								jump_to(a);
+							when x"001b" | x"001c" | x"001d" | x"001e" | x"001f" =>
+								-- JUMPif register, address
+								if(ternary_condition(to_integer(unsigned(opcode)) - 16#1b#, a)) then
+									jump_to(c);
+								end if;
+							when x"0020" | x"0021" | x"0022" | x"0023" | x"0024" | x"0025" =>
+								-- JUMPxx address
+								if(flag_condition(to_integer(unsigned(opcode)) - 16#20#, f)) then
+									jump_to(c);
+								end if;
+							when x"0026" | x"0027" | x"0028" | x"0029" | x"002a" =>
+								-- JUMPif register, [register]
+								if(ternary_condition(to_integer(unsigned(opcode)) - 16#26#, a)) then
+									jump_to(b);
+								end if;
+							when x"002b" | x"002c" | x"002d" | x"002e" | x"002f" | x"0030" =>
+								-- JUMPxx [register]
+								if(flag_condition(to_integer(unsigned(opcode)) - 16#2b#, f)) then
+									jump_to(a);
+								end if;
+							when x"0031" =>
+								-- NOP
+								null;
+							when x"0032" =>
+								-- GETKEYSTATE, there is no keyboard
+								writeback1(reg1, x"00000000");
+							when x"0033" =>
+								-- POLL_TIME
+								writeback1(reg1, std_logic_vector(ms_counter(63 downto 32)));
+								writeback2(reg2, std_logic_vector(ms_counter(31 downto 0)));
+							when x"0034" =>
+								-- ADDC
+								tmp33 := std_logic_vector(unsigned('0' & a) + unsigned('0' & b) + unsigned'("" & f.c));
+								writeback1(reg1, tmp33(31 downto 0));
+								set_flags(tmp33(32), tmp33(31 downto 0));
+							when x"0035" =>
+								-- SWAPFRAMEBUFFERS
+								front_framebuffer <= not front_framebuffer;
+							when x"0038" =>
+								-- INVISIBLEFRAMEBUFFERADDRESS
+								if(front_framebuffer = '0') then
+									writeback1(reg1, to_word(second_framebuffer_start));
+								else
+									writeback1(reg1, to_word(first_framebuffer_start));
+								end if;
+							when x"0039" =>
+								-- POLL_CYCLECOUNT
+								writeback1(reg1, std_logic_vector(cycle_counter(63 downto 32)));
+								writeback2(reg2, std_logic_vector(cycle_counter(31 downto 0)));
+							when x"003a" | x"003b" | x"003c" | x"003d" | x"003e" | x"003f" =>
+								-- CMPxx, unsigned like CMP, flags are not changed
+								cmp.c := '0';
+								cmp.z := '0';
+								if(unsigned(a) < unsigned(b)) then
+									cmp.c := '1';
+								end if;
+								if(a = b) then
+									cmp.z := '1';
+								end if;
+								if(flag_condition(to_integer(unsigned(opcode)) - 16#3a#, cmp)) then
+									writeback1(reg1, x"00000001");
+								else
+									writeback1(reg1, x"00000000");
+								end if;
+							when x"0040" =>
+								-- POP <discard>
+								writeback1(sp, std_logic_vector(unsigned(a) + 4));
+							when x"fff8" =>
+								-- CHECKPOINT
+								report "checkpoint " & to_hstring(c) severity note;
+							when x"fff9" =>
+								-- PRINTREGISTER
+								report "r" & integer'image(to_integer(unsigned(reg1))) & " = " & to_hstring(a) severity note;
+							when x"fffa" | x"fffe" | x"ffff" =>
+								-- DEBUGBREAK, DUMPMEMORY, DUMPREGISTERS
+								null;
+							when x"fffb" =>
+								-- ASSERT [register] == immediate
+								m_wb <= (others => no_write);
+								start_load(a, x"00");
+								done := false;
+							when x"fffc" =>
+								-- ASSERT register == immediate
+								if(a /= c) then
+									fail;
+								end if;
+							when x"fffd" =>
+								-- ASSERT register == register
+								if(a /= b) then
+									fail;
+								end if;
+							when others =>
+								report "invalid opcode encountered" severity error;
+								halting := true;
+						end case;
+					when load =>
+						if(d_waitrequest = '0') then
+							d_addr <= (others => 'U');
+							d_rdreq <= '0';
+							if(opcode = x"0037") then
+								-- CALL [[register]], target loaded
+								m_wb(2) <= (active => '1', number => ip, value => d_rddata);
+								start_store(x_a, return_address);
+							elsif(opcode = x"fffb") then
+								if(d_rddata /= c) then
+									fail;
+								end if;
+								done := true;
+							else
+								writeback1(m_reg, d_rddata);
+								w(2) := m_wb(2);
+								done := true;
+							end if;
+						end if;
+					when store =>
+						if(d_waitrequest = '0') then
+							d_addr <= (others => 'U');
+							d_wrreq <= '0';
+							w := m_wb;
+							done := true;
+						end if;
+					when mul =>
+						if(mul_busy = '0') then
+							writeback1(reg1, product(63 downto 32));
+							writeback2(reg2, product(31 downto 0));
+							f.c <= '0';
+							f.z <= not or_reduce(product);
+							done := true;
+						end if;
+					when div =>
+						if(div_busy = '0') then
+							writeback1(reg1, quotient);
+							writeback2(reg2, remainder);
+							done := true;
+						end if;
+					when halt =>
+						null;
+				end case;
+
+				assert s /= run or x_simple = '0' or done or halting
+					report "single cycle instruction not done" severity failure;
+
+				if(done) then
+					for l in lane loop
+						if(w(l).active = '1' and w(l).number = ip) then
+							-- writing ip is a jump
+							jump_to(w(l).value);
+							w(l).active := '0';
+						end if;
+					end loop;
+					wb <= w;
+					s <= idle;
+
+					if(jump) then
+						actual := target;
+					else
+						actual := address(unsigned(x_ip) + 8);
+					end if;
+
+					if(x_jmp /= nop or jump) then
+						btb_update <= '1';
+						btb_update_ip <= x_ip;
+						btb_update_target <= target;
+						if(x_jmp = nop) then
+							-- write to ip
+							btb_update_jmp <= jump_reg;
+						else
+							btb_update_jmp <= x_jmp;
+						end if;
+						if(jump) then
+							btb_update_taken <= '1';
+						else
+							btb_update_taken <= '0';
+						end if;
+					end if;
+
+					if(actual /= x_next and not halting) then
+						mispredicted := true;
+						mispredict_counter <= mispredict_counter + 1;
+						redirect <= '1';
+						redirect_target <= actual;
+					end if;
+				end if;
+
+				-- the instruction after a wrong prediction is dropped
+				if(halting) then
+					stop <= '1';
+					s <= halt;
+				elsif(d_go = '1' and not mispredicted) then
+					x_insn <= decode_insn;
+					x_ip <= decode_ip;
+					x_src <= d_src;
+					x_simple <= d_simple;
+					x_jmp <= d_jmp;
+					x_next <= d_next;
+					s <= run;
 				end if;
 			end if;
 		end process;
@@ -6,6 +6,12 @@ use ieee.std_logic_misc.or_reduce;
 use work.bss2k.ALL;
 
 entity cpu_sequential is
+	generic(
+		-- request the next instruction as soon as the current one is known
+		-- not to change ip, instead of after its writeback; ip is then kept
+		-- in a register outside the register file
+		overlap_fetch : boolean := false
+	);
 	port(
 		-- async reset
 		reset : in std_logic;
@@ -29,7 +35,37 @@ entity cpu_sequential is
 
 		-- status
 		halted : out std_logic;
-		assertion_failed : out std_logic
+		assertion_failed : out std_logic;
+
+		-- framebuffers: SWAPFRAMEBUFFERS holds swap_request high until
+		-- swap_done, so memory can be written back before the flip
+		front_framebuffer : out std_logic;
+		swap_request : out std_logic;
+		swap_done : in std_logic := '1';
+
+		-- statistics
+		retired : out std_logic_vector(63 downto 0);		-- instructions decoded, none are discarded
+		fetch_stalls : out std_logic_vector(63 downto 0);	-- decoder waiting for the instruction bus
+		data_stalls : out std_logic_vector(63 downto 0);	-- load or store waiting for the data bus
+		mispredicts : out std_logic_vector(63 downto 0);
+		branch_redirects : out std_logic_vector(63 downto 0);
+		redirect_penalty : out std_logic_vector(63 downto 0);
+
+		-- instruction trace, for one cycle per decoded instruction
+		trace_valid : out std_logic;
+		trace_ip : out address;
+		trace_opcode : out std_logic_vector(15 downto 0);
+
+		-- debug events, for one cycle per CHECKPOINT, PRINTREGISTER,
+		-- DEBUGBREAK, DUMPMEMORY and DUMPREGISTERS
+		debug_valid : out std_logic;
+		debug_ip : out address;
+		debug_opcode : out std_logic_vector(15 downto 0);
+		debug_register : out reg;
+		-- immediate of CHECKPOINT, register of PRINTREGISTER
+		debug_value : out word;
+		-- low half of the cycle counter
+		debug_cycles : out word
 	);
 end entity;
 
@@ -52,7 +88,7 @@ architecture rtl of cpu_sequential is
 	constant ip : reg := x"fe";
 	constant sp : reg := x"ff";
 
-	type state is (ifetch1, ifetch15, ifetch2, decode, reg_read, execute, writeback, advance1, advance15, advance2, load, load2, store, store2, mul, div, halt);
+	type state is (ifetch1, ifetch15, ifetch2, decode, reg_read, execute, writeback, advance1, advance15, advance2, load, load2, store, store2, mul, div, swap, halt);
 
 	signal ms_counter, cycle_counter : unsigned(63 downto 0);
 
@@ -77,8 +113,25 @@ architecture rtl of cpu_sequential is
 	end record;
 	signal f : flags;
 
+	-- framebuffer shown, the other one is drawn to
+	signal front : std_logic;
+
 	signal i_buffer : instruction;
 
+	-- address of the current instruction
+	signal pc : address;
+
+	-- overlapped fetch: request outstanding, instruction received
+	signal f_pending, f_valid : std_logic;
+	signal f_buffer : instruction;
+
+	-- register operands, reads of ip are served from pc in overlap mode
+	signal q_a, q_b : word;
+
+	signal retired_counter : unsigned(63 downto 0);
+	signal fetch_stall_counter : unsigned(63 downto 0);
+	signal data_stall_counter : unsigned(63 downto 0);
+
 	-- address for memory operation
 	signal m_addr : address;
 	-- register for memory load operation
@@ -124,12 +177,54 @@ architecture rtl of cpu_sequential is
 
 	alias opcode : std_logic_vector(15 downto 0) is decoder_input(63 downto 48);
 
+	-- MUL and DIVMOD units, started from the execute state
+	signal mul_start : std_logic;
+	signal mul_busy : std_logic;
 	signal product : std_logic_vector(63 downto 0);
 	signal product_reg_u, product_reg_l : reg;
+
+	signal div_start : std_logic;
+	signal div_busy : std_logic;
+	signal quotient : word;
+	signal remainder : word;
+
+	-- whether an instruction may change ip, so the next instruction cannot
+	-- be fetched before it completes. Register fields are checked without
+	-- regard to whether they are written.
+	function may_write_ip(i : instruction) return boolean is
+		alias opcode : std_logic_vector(15 downto 0) is i(63 downto 48);
+		alias reg1 : reg is i(47 downto 40);
+		alias reg2 : reg is i(39 downto 32);
+	begin
+		-- CALL, RET and jumps
+		if(unsigned(opcode) >= 16#17# and unsigned(opcode) <= 16#30#) then
+			return true;
+		end if;
+		-- CALL [register], CALL [[register]]
+		if(opcode = x"0036" or opcode = x"0037") then
+			return true;
+		end if;
+		return reg1 = ip or reg2 = ip;
+	end function;
 begin
 	halted <= '1' when s = halt else '0';
 
-	decoder_input <= i_rddata;
+	front_framebuffer <= front;
+	swap_request <= '1' when s = swap else '0';
+
+	retired <= std_logic_vector(retired_counter);
+	fetch_stalls <= std_logic_vector(fetch_stall_counter);
+	data_stalls <= std_logic_vector(data_stall_counter);
+
+	-- no branch prediction
+	mispredicts <= (others => '0');
+	branch_redirects <= (others => '0');
+	redirect_penalty <= (others => '0');
+
+	decoder_input <= f_buffer when f_valid = '1' else i_rddata;
+
+	q_a <= to_word(pc) when overlap_fetch and r_address_a = ip else r_q_a;
+	q_b <= to_word(pc) when overlap_fetch and r_address_b = ip else r_q_b;
 
 	cycle_counter <= to_unsigned(0, cycle_counter'length) when ?? reset else
 		cycle_counter + 1 when rising_edge(clk);
@@ -232,21 +327,52 @@ begin
 		'0' when none,
 		'1' when i_r1|i_r2|i_r3|i_r4|r_sp;
 
-	product <= std_logic_vector(unsigned(r_q_a) * unsigned(r_q_b));
+	mul_start <= '1' when s = execute and i_buffer(63 downto 48) = x"000a" else '0';
+	div_start <= '1' when s = execute and i_buffer(63 downto 48) = x"000b" else '0';
+
+	multiplier_unit : entity work.multiplier
+		port map(
+			reset => reset,
+			clk => clk,
+			start => mul_start,
+			a => q_a,
+			b => q_b,
+			busy => mul_busy,
+			product => product
+		);
+
+	divider_unit : entity work.divider
+		port map(
+			reset => reset,
+			clk => clk,
+			start => div_start,
+			dividend => q_a,
+			divisor => q_b,
+			busy => div_busy,
+			quotient => quotient,
+			remainder => remainder
+		);
 
 	process(reset, clk) is
-		variable dividend : unsigned(31 downto 0);
-		variable dividend_tmp : unsigned(63 downto 0);
-		variable divisor : unsigned(63 downto 0);
-		variable divider_counter : integer range 31 downto 0;
-		variable quotient : unsigned(31 downto 0);
-		variable remainder : unsigned(31 downto 0);
 		variable quotient_reg : reg;
 		variable remainder_reg : reg;
 
 		procedure done is
 		begin
-			s <= advance1;
+			if(overlap_fetch) then
+				-- increment by eight, because instructions are 64 bit
+				pc <= address(unsigned(pc) + 8);
+				s <= writeback;
+			else
+				s <= advance1;
+			end if;
+		end procedure;
+
+		procedure fetch_start(constant a : in address) is
+		begin
+			i_addr <= a;
+			i_rdreq <= '1';
+			f_pending <= '1';
 		end procedure;
 
 		procedure writeback1(constant reg1 : in reg; constant value1 : in word) is
@@ -265,43 +391,22 @@ begin
 
 		procedure divide_done is
 		begin
-			writeback1(quotient_reg, word(quotient));
-			writeback2(remainder_reg, word(remainder));
+			writeback1(quotient_reg, quotient);
+			writeback2(remainder_reg, remainder);
 			done;
 		end procedure;
 
-		procedure divide_step is
+		-- operands are taken by the divider in this cycle
+		procedure divide_begin(constant q_reg, r_reg : in reg) is
 		begin
-			divisor := divisor srl 1;
-			if(dividend >= divisor) then
-				quotient(divider_counter) := '1';
-				dividend_tmp := dividend - divisor;
-				dividend := dividend_tmp(dividend'range);
-			else
-				quotient(divider_counter) := '0';
-			end if;
-			if(divider_counter = 0) then
-				remainder := dividend;
-				divide_done;
-			else
-				divider_counter := divider_counter - 1;
-			end if;
-		end procedure;
-
-		procedure divide_begin(constant n, d : in word; constant q_reg, r_reg : in reg) is
-		begin
-			dividend := unsigned(n);
-			divisor := unsigned(d) & x"00000000";
-			divider_counter := 31;
 			quotient_reg := q_reg;
 			remainder_reg := r_reg;
 			s <= div;
-			divide_step;
 		end procedure;
 
 		procedure decode_insn is
-			-- instruction is on i_rddata in this cycle
-			alias i : instruction is i_rddata;
+			-- instruction is on decoder_input in this cycle
+			alias i : instruction is decoder_input;
 
 			alias reg1 : reg is i(47 downto 40);
 			alias reg2 : reg is i(39 downto 32);
@@ -309,6 +414,12 @@ begin
 			alias reg4 : reg is i(23 downto 16);
 			alias c : word is i(31 downto 0);
 		begin
+			-- nothing is speculative, so every decoded instruction retires
+			retired_counter <= retired_counter + 1;
+			-- pc holds the address of the instruction being decoded
+			trace_valid <= '1';
+			trace_ip <= pc;
+			trace_opcode <= i(63 downto 48);
 			case decoder_output.op.src(1) is
 				when none	=> null;
 				when i_r1	=> r_address_a <= reg1;
@@ -368,43 +479,43 @@ begin
 					s <= load;
 				when x"0002" =>
 					-- MOV
-					writeback1(reg1, r_q_a);
+					writeback1(reg1, q_a);
 					done;
 				when x"0003" =>
 					-- ST abs
 					m_addr <= to_address(c);
-					m_value <= r_q_b;
+					m_value <= q_b;
 					s <= store;
 				when x"0004" =>
 					-- LD [r]
-					m_addr <= to_address(r_q_a);
+					m_addr <= to_address(q_a);
 					m_reg <= reg1;
 					s <= load;
 				when x"0005" =>
 					-- ST [r]
-					m_addr <= to_address(r_q_a);
-					m_value <= r_q_b;
+					m_addr <= to_address(q_a);
+					m_value <= q_b;
 					s <= store;
 				when x"0006" =>
 					-- HCF
 					s <= halt;
 				when x"0007" =>
 					-- ADD
-					tmp33 := std_logic_vector(unsigned('0' & r_q_a) + unsigned('0' & r_q_b));
+					tmp33 := std_logic_vector(unsigned('0' & q_a) + unsigned('0' & q_b));
 					writeback1(reg1, tmp33(31 downto 0));
 					f.c <= tmp33(32);
 					f.z <= not or_reduce(tmp33(31 downto 0));
 					done;
 				when x"0008" =>
 					-- SUB
-					tmp33 := std_logic_vector(unsigned('0' & r_q_a) - unsigned('0' & r_q_b));
+					tmp33 := std_logic_vector(unsigned('0' & q_a) - unsigned('0' & q_b));
 					writeback1(reg1, tmp33(31 downto 0));
 					f.c <= tmp33(32);
 					f.z <= not or_reduce(tmp33(31 downto 0));
 					done;
 				when x"0009" =>
 					-- SBC
-					tmp33 := std_logic_vector(unsigned('0' & r_q_a) - unsigned('0' & r_q_b) - unsigned'("" & f.c));
+					tmp33 := std_logic_vector(unsigned('0' & q_a) - unsigned('0' & q_b) - unsigned'("" & f.c));
 					writeback1(reg1, tmp33(31 downto 0));
 					f.c <= tmp33(32);
 					f.z <= not or_reduce(tmp33(31 downto 0));
@@ -416,70 +527,70 @@ begin
 					s <= mul;
 				when x"000b" =>
 					-- DIVMOD
-					divide_begin(r_q_a, r_q_b, reg1, reg2);
+					divide_begin(reg1, reg2);
 				when x"000c" =>
 					-- AND
-					tmp32 := r_q_a and r_q_b;
+					tmp32 := q_a and q_b;
 					writeback1(reg1, tmp32);
 					f.c <= '0';
 					f.z <= not or_reduce(tmp32);
 					done;
 				when x"000d" =>
 					-- OR
-					tmp32 := r_q_a or r_q_b;
+					tmp32 := q_a or q_b;
 					writeback1(reg1, tmp32);
 					f.c <= '0';
 					f.z <= not or_reduce(tmp32);
 					done;
 				when x"000e" =>
 					-- XOR
-					tmp32 := r_q_a xor r_q_b;
+					tmp32 := q_a xor q_b;
 					writeback1(reg1, tmp32);
 					f.c <= '0';
 					f.z <= not or_reduce(tmp32);
 					done;
 				when x"000f" =>
 					-- NOT
-					tmp32 := not r_q_a;
+					tmp32 := not q_a;
 					writeback1(reg1, tmp32);
 					f.c <= '0';
 					f.z <= not or_reduce(tmp32);
 					done;
 				when x"0010" =>
 					-- SHL
-					tmp33 := std_logic_vector(unsigned('0' & r_q_a) sll to_integer(unsigned(r_q_b)));
+					tmp33 := std_logic_vector(unsigned('0' & q_a) sll to_integer(unsigned(q_b)));
 					writeback1(reg1, tmp33(31 downto 0));
 					f.c <= tmp33(32);
 					f.z <= not or_reduce(tmp33(31 downto 0));
 					done;
 				when x"0011" =>
 					-- SHR
-					tmp33 := std_logic_vector(unsigned(r_q_a & '0') srl to_integer(unsigned(r_q_b)));
+					tmp33 := std_logic_vector(unsigned(q_a & '0') srl to_integer(unsigned(q_b)));
 					writeback1(reg1, tmp33(32 downto 1));
 					f.c <= tmp33(0);
 					f.z <= not or_reduce(tmp33(32 downto 1));
 					done;
 				when x"0012" =>
 					-- ADDI
-					tmp33 := std_logic_vector(unsigned('0' & r_q_a) + unsigned('0' & c));
+					tmp33 := std_logic_vector(unsigned('0' & q_a) + unsigned('0' & c));
 					writeback1(reg1, tmp33(31 downto 0));
 					f.c <= tmp33(32);
 					f.z <= not or_reduce(tmp33(31 downto 0));
 					done;
 				when x"0013" =>
 					-- SUBI
-					tmp33 := std_logic_vector(unsigned('0' & r_q_a) - unsigned('0' & c));
+					tmp33 := std_logic_vector(unsigned('0' & q_a) - unsigned('0' & c));
 					writeback1(reg1, tmp33(31 downto 0));
 					f.c <= tmp33(32);
 					f.z <= not or_reduce(tmp33(31 downto 0));
 					done;
 				when x"0014" =>
 					-- CMP
-					if(r_q_a = r_q_b) then
+					if(q_a = q_b) then
 						writeback1(reg1, x"00000000");
 						f.c <= '0';
 						f.z <= '1';
-					elsif(unsigned(r_q_a) > unsigned(r_q_b)) then
+					elsif(unsigned(q_a) > unsigned(q_b)) then
 						writeback1(reg1, x"00000001");
 						f.c <= '0';
 						f.z <= '0';
@@ -491,30 +602,30 @@ begin
 					done;
 				when x"0015" =>
 					-- PUSH
-					tmp32 := std_logic_vector(unsigned(r_q_a) - 4);
+					tmp32 := std_logic_vector(unsigned(q_a) - 4);
 					writeback1(sp, tmp32);
-					m_addr <= to_address(r_q_a);
-					m_value <= r_q_b;
+					m_addr <= to_address(q_a);
+					m_value <= q_b;
 					s <= store;
 				when x"0016" =>
 					-- POP
-					tmp32 := std_logic_vector(unsigned(r_q_a) + 4);
+					tmp32 := std_logic_vector(unsigned(q_a) + 4);
 					writeback2(sp, tmp32);
 					m_addr <= to_address(tmp32);
 					m_reg <= reg1;
 					s <= load;
 				when x"0017" =>
 					-- CALL
-					tmp32 := std_logic_vector(unsigned(r_q_a) - 4);
+					tmp32 := std_logic_vector(unsigned(q_a) - 4);
 					writeback1(sp, tmp32);
-					tmp32 := std_logic_vector(unsigned(r_q_b) + 8);
+					tmp32 := to_word(address(unsigned(pc) + 8));
 					writeback2(ip, c);
-					m_addr <= to_address(r_q_a);
+					m_addr <= to_address(q_a);
 					m_value <= tmp32;
 					s <= store;
 				when x"0018" =>
 					-- RET
-					tmp32 := std_logic_vector(unsigned(r_q_a) + 4);
+					tmp32 := std_logic_vector(unsigned(q_a) + 4);
 					writeback2(sp, tmp32);
 					m_addr <= to_address(tmp32);
 					m_reg <= ip;
@@ -524,14 +635,42 @@ begin
 					writeback1(reg1, std_logic_vector(ms_counter(63 downto 32)));
 					writeback2(reg2, std_logic_vector(ms_counter(31 downto 0)));
 					done;
+				when x"0035" =>
+					-- SWAPFRAMEBUFFERS
+					s <= swap;
+				when x"0038" =>
+					-- INVISIBLEFRAMEBUFFERADDRESS
+					if(front = '0') then
+						writeback1(reg1, to_word(second_framebuffer_start));
+					else
+						writeback1(reg1, to_word(first_framebuffer_start));
+					end if;
+					done;
 				when x"0039" =>
 					-- POLL_CYCLECOUNT
 					writeback1(reg1, std_logic_vector(cycle_counter(63 downto 32)));
 					writeback2(reg2, std_logic_vector(cycle_counter(31 downto 0)));
 					done;
+				when x"fff8" | x"fff9" | x"fffa" | x"fffe" | x"ffff" =>
+					-- CHECKPOINT, PRINTREGISTER, DEBUGBREAK, DUMPMEMORY,
+					-- DUMPREGISTERS: reported to the host, nothing is
+					-- dumped
+					debug_valid <= '1';
+					debug_ip <= pc;
+					debug_opcode <= opcode;
+					debug_register <= reg1;
+					if(opcode = x"fff8") then
+						debug_value <= c;
+					elsif(opcode = x"fff9") then
+						debug_value <= q_a;
+					else
+						debug_value <= (others => '0');
+					end if;
+					debug_cycles <= std_logic_vector(cycle_counter(31 downto 0));
+					done;
 				when x"fffc" =>
 					-- ASSERT register == immediate
-					if r_q_a /= c then
+					if q_a /= c then
 						assertion_failed <= '1';
 						s <= halt;
 					else
@@ -539,7 +678,7 @@ begin
 					end if;
 				when x"fffd" =>
 					-- ASSERT register == register
-					if r_q_a /= r_q_b then
+					if q_a /= q_b then
 						assertion_failed <= '1';
 						s <= halt;
 					else
@@ -567,12 +706,34 @@ begin
 			r_wren_a <= '0';
 			r_wren_b <= '0';
 			assertion_failed <= '0';
+			front <= '0';
+			pc <= entry_point;
+			f_pending <= '0';
+			f_valid <= '0';
+			retired_counter <= (others => '0');
+			fetch_stall_counter <= (others => '0');
+			data_stall_counter <= (others => '0');
+			trace_valid <= '0';
+			debug_valid <= '0';
 		elsif(rising_edge(clk)) then
 			i_rdreq <= '0';
+			trace_valid <= '0';
+			debug_valid <= '0';
 			d_rdreq <= '0';
 			d_wrreq <= '0';
 			r_wren_a <= '0';
 			r_wren_b <= '0';
+			-- overlapped fetch runs alongside the states below, and is
+			-- completed even when the CPU halts
+			if(overlap_fetch and f_pending = '1') then
+				if(i_waitrequest = '0') then
+					f_buffer <= i_rddata;
+					f_valid <= '1';
+					f_pending <= '0';
+				else
+					i_rdreq <= '1';
+				end if;
+			end if;
 			case s is
 				when ifetch1 =>
 					r_address_a <= ip;
@@ -580,17 +741,34 @@ begin
 				when ifetch15 =>
 					s <= ifetch2;
 				when ifetch2 =>
-					i_addr <= to_address(r_q_a);
-					i_rdreq <= '1';
+					if(overlap_fetch) then
+						fetch_start(pc);
+					else
+						i_addr <= to_address(r_q_a);
+						i_rdreq <= '1';
+						pc <= to_address(r_q_a);
+					end if;
 					s <= decode;
 				when decode =>
-					if(i_waitrequest = '0') then
+					if(overlap_fetch) then
+						if(f_valid = '1' or (f_pending = '1' and i_waitrequest = '0')) then
+							i_buffer <= decoder_input;
+							f_valid <= '0';
+							decode_insn;
+							if(not may_write_ip(decoder_input)) then
+								fetch_start(address(unsigned(pc) + 8));
+							end if;
+						else
+							fetch_stall_counter <= fetch_stall_counter + 1;
+						end if;
+					elsif(i_waitrequest = '0') then
 						i_buffer <= i_rddata;
 						-- defined above because long
 						decode_insn;
 					else
 						i_addr <= to_address(r_q_a);
 						i_rdreq <= '1';
+						fetch_stall_counter <= fetch_stall_counter + 1;
 					end if;
 				when reg_read =>
 					s <= execute;
@@ -610,16 +788,31 @@ begin
 					s <= writeback;
 				when writeback =>
 					if(wb_active1 = '1') then
-						r_address_a <= wb_reg1;
-						r_wren_a <= '1';
-						r_data_a <= wb_value1;
+						if(overlap_fetch and wb_reg1 = ip) then
+							pc <= to_address(wb_value1);
+						else
+							r_address_a <= wb_reg1;
+							r_wren_a <= '1';
+							r_data_a <= wb_value1;
+						end if;
 					end if;
 					if(wb_active2 = '1') then
-						r_address_b <= wb_reg2;
-						r_wren_b <= '1';
-						r_data_b <= wb_value2;
+						if(overlap_fetch and wb_reg2 = ip) then
+							pc <= to_address(wb_value2);
+						else
+							r_address_b <= wb_reg2;
+							r_wren_b <= '1';
+							r_data_b <= wb_value2;
+						end if;
+					end if;
+					if(not overlap_fetch) then
+						s <= ifetch1;
+					elsif(f_pending = '1' or f_valid = '1') then
+						-- next instruction was requested in decode
+						s <= decode;
+					else
+						s <= ifetch2;
 					end if;
-					s <= ifetch1;
 					wb_active1 <= '0';
 					wb_active2 <= '0';
 				when load =>
@@ -630,6 +823,7 @@ begin
 					if ?? d_waitrequest then
 						d_addr <= m_addr;
 						d_rdreq <= '1';
+						data_stall_counter <= data_stall_counter + 1;
 					else
 						writeback1(m_reg, d_rddata);
 						done;
@@ -644,17 +838,27 @@ begin
 						d_addr <= m_addr;
 						d_wrdata <= m_value;
 						d_wrreq <= '1';
+						data_stall_counter <= data_stall_counter + 1;
 					else
 						done;
 					end if;
 				when mul =>
-					writeback1(product_reg_u, product(63 downto 32));
-					writeback2(product_reg_l, product(31 downto 0));
-					f.c <= '0';
-					f.z <= not or_reduce(product);
-					done;
+					if(mul_busy = '0') then
+						writeback1(product_reg_u, product(63 downto 32));
+						writeback2(product_reg_l, product(31 downto 0));
+						f.c <= '0';
+						f.z <= not or_reduce(product);
+						done;
+					end if;
 				when div =>
-					divide_step;
+					if(div_busy = '0') then
+						divide_done;
+					end if;
+				when swap =>
+					if(swap_done = '1') then
+						front <= not front;
+						done;
+					end if;
 				when halt =>
 					null;
 			end case;
@@ -0,0 +1,375 @@
+library ieee;
+use ieee.std_logic_1164.ALL;
+use ieee.numeric_std.ALL;
+
+use work.bss2k.ALL;
+
+-- Data cache
+--
+-- Direct mapped write-back cache between the data bus of the CPU and the
+-- memory interface. Misses write back the victim line if it is dirty, then
+-- refill the line word by word; stores allocate a line as well.
+--
+-- While flush is high, all dirty lines are written back. clean is high when
+-- no line is dirty, which is the case after reset and after a flush that
+-- was not interrupted by a store. Flushing is lower priority than CPU
+-- accesses, but is not interrupted once started.
+--
+-- A sync request writes back the dirty lines holding sync_bytes from
+-- sync_addr, so the instruction cache can refill a line the CPU stored to
+-- from memory. It is acknowledged like an Avalon-MM write.
+entity dcache is
+	generic(
+		-- words per cache line (power of two)
+		line_words : positive := 4;
+		-- number of sets (power of two)
+		sets : positive := 256;
+		-- bytes written back per sync request (power of two)
+		sync_bytes : positive := 32
+	);
+	port(
+		-- async reset, invalidates all lines without writing them back
+		reset : in std_logic;
+
+		-- clock
+		clk : in std_logic;
+
+		-- CPU side (Avalon-MM)
+		d_addr : in address;
+		d_rdreq : in std_logic;
+		d_rddata : out word;
+		d_wrreq : in std_logic;
+		d_wrdata : in word;
+		d_waitrequest : out std_logic;
+
+		-- memory side (Avalon-MM)
+		m_addr : out address;
+		m_rdreq : out std_logic;
+		m_rddata : in word;
+		m_wrreq : out std_logic;
+		m_wrdata : out word;
+		m_waitrequest : in std_logic;
+
+		-- write back
+		flush : in std_logic;
+		clean : out std_logic;
+
+		-- write back a range, sync_addr aligned to sync_bytes
+		sync_addr : in address;
+		sync_req : in std_logic;
+		sync_waitrequest : out std_logic;
+
+		-- statistics
+		hits : out std_logic_vector(63 downto 0);
+		misses : out std_logic_vector(63 downto 0)
+	);
+end entity;
+
+architecture rtl of dcache is
+	function log2(constant val : in positive) return natural is
+		variable ret : natural;
+	begin
+		ret := 0;
+		while(2 ** ret < val) loop
+			ret := ret + 1;
+		end loop;
+		assert 2 ** ret = val report "not a power of two" severity failure;
+		return ret;
+	end function;
+
+	-- words are 32 bit
+	constant offset_bits : natural := 2;
+	constant word_bits : natural := log2(line_words);
+	constant index_bits : natural := log2(sets);
+	constant tag_bits : natural := address_width - index_bits - word_bits - offset_bits;
+
+	-- lines covered by a sync request
+	constant line_bytes : positive := line_words * 4;
+	constant sync_lines : positive := maximum(1, sync_bytes / line_bytes);
+
+	subtype word_field is std_logic_vector(word_bits + offset_bits - 1 downto offset_bits);
+	subtype index_field is std_logic_vector(index_bits + word_bits + offset_bits - 1 downto word_bits + offset_bits);
+	subtype tag_field is std_logic_vector(address_width - 1 downto index_bits + word_bits + offset_bits);
+
+	subtype tag is std_logic_vector(tag_bits - 1 downto 0);
+
+	subtype word_num is integer range 0 to line_words - 1;
+	subtype set_num is integer range 0 to sets - 1;
+
+	function word_of(a : address) return word_num is
+	begin
+		if(word_bits = 0) then
+			return 0;
+		end if;
+		return to_integer(unsigned(a(word_field'range)));
+	end function;
+
+	function set_of(a : address) return set_num is
+	begin
+		if(index_bits = 0) then
+			return 0;
+		end if;
+		return to_integer(unsigned(a(index_field'range)));
+	end function;
+
+	function tag_of(a : address) return tag is
+	begin
+		return a(tag_field'range);
+	end function;
+
+	-- memory address of a word in a line
+	function line_address(t : tag; s : set_num; w : word_num) return address is
+		variable ret : address;
+	begin
+		ret := (others => '0');
+		ret(tag_field'range) := t;
+		if(index_bits > 0) then
+			ret(index_field'range) := std_logic_vector(to_unsigned(s, index_bits));
+		end if;
+		if(word_bits > 0) then
+			ret(word_field'range) := std_logic_vector(to_unsigned(w, word_bits));
+		end if;
+		return ret;
+	end function;
+
+	type state is (idle, lookup, wb_read, wb_write, refill, replay, flush_check, flush_next,
+		sync_read, sync_check, sync_next);
+	signal s : state;
+
+	-- request currently being handled
+	signal req_addr : address;
+	signal req_write : std_logic;
+	signal req_wrdata : word;
+
+	-- flush in progress (write back continues with next set, not refill)
+	signal flushing : std_logic;
+
+	-- sync in progress (write back continues with next line, not refill)
+	signal syncing : std_logic;
+	signal sync_left : integer range 0 to sync_lines - 1;
+
+	-- read side of storage
+	signal rd_index : integer range 0 to sets * line_words - 1;
+	signal rd_set : set_num;
+	signal q_data : word;
+	signal q_tag : tag;
+
+	-- valid and dirty bits are kept in registers, so they can be cleared
+	-- on reset
+	signal valid : std_logic_vector(set_num);
+	signal dirty : std_logic_vector(set_num);
+
+	signal hit : std_logic;
+
+	-- word being transferred during write back and refill
+	signal xfer_word : word_num;
+
+	-- storage write port
+	signal data_we : std_logic;
+	signal data_wr_index : integer range 0 to sets * line_words - 1;
+	signal data_wr : word;
+	signal tag_we : std_logic;
+
+	-- lookup repeats a request already counted as a miss
+	signal replayed : std_logic;
+
+	signal hit_counter : unsigned(63 downto 0);
+	signal miss_counter : unsigned(63 downto 0);
+begin
+	assert tag_bits > 0 report "cache larger than address space" severity failure;
+
+	rd_set <= set_of(d_addr) when s = idle else
+		  set_of(req_addr);
+	rd_index <= set_of(d_addr) * line_words + word_of(d_addr) when s = idle else
+		    set_of(req_addr) * line_words + xfer_word when s = wb_read or s = wb_write else
+		    set_of(req_addr) * line_words + word_of(req_addr);
+
+	storage : block is
+		type data_storage is array(0 to sets * line_words - 1) of word;
+		type tag_storage is array(set_num) of tag;
+
+		signal data_ram : data_storage;
+		signal tag_ram : tag_storage;
+	begin
+		process(clk) is
+		begin
+			if(rising_edge(clk)) then
+				if(?? data_we) then
+					data_ram(data_wr_index) <= data_wr;
+				end if;
+				if(?? tag_we) then
+					tag_ram(set_of(req_addr)) <= tag_of(req_addr);
+				end if;
+				q_data <= data_ram(rd_index);
+				q_tag <= tag_ram(rd_set);
+			end if;
+		end process;
+	end block;
+
+	hit <= valid(set_of(req_addr)) when q_tag = tag_of(req_addr) else
+	       '0';
+
+	d_rddata <= q_data;
+	d_waitrequest <= '0' when s = lookup and hit = '1' else
+			 '1';
+
+	-- refilled words are stored as they arrive, stores on hit
+	data_we <= '1' when s = refill and m_waitrequest = '0' else
+		   '1' when s = lookup and hit = '1' and req_write = '1' else
+		   '0';
+	data_wr_index <= set_of(req_addr) * line_words + xfer_word when s = refill else
+			 set_of(req_addr) * line_words + word_of(req_addr);
+	data_wr <= m_rddata when s = refill else
+		   req_wrdata;
+	tag_we <= '1' when s = refill and m_waitrequest = '0' and xfer_word = line_words - 1 else
+		  '0';
+
+	-- storage is read with the same index during write back
+	m_wrdata <= q_data;
+
+	sync_waitrequest <= '0' when s = sync_next and sync_left = 0 else
+			    '1';
+
+	hits <= std_logic_vector(hit_counter);
+	misses <= std_logic_vector(miss_counter);
+
+	process(reset, clk) is
+	begin
+		if(?? reset) then
+			s <= idle;
+			valid <= (others => '0');
+			dirty <= (others => '0');
+			clean <= '1';
+			flushing <= '0';
+			syncing <= '0';
+			replayed <= '0';
+			m_rdreq <= '0';
+			m_wrreq <= '0';
+			hit_counter <= (others => '0');
+			miss_counter <= (others => '0');
+		elsif(rising_edge(clk)) then
+			case s is
+				when idle =>
+					if(d_rdreq = '1' or d_wrreq = '1') then
+						req_addr <= d_addr;
+						req_write <= d_wrreq;
+						req_wrdata <= d_wrdata;
+						replayed <= '0';
+						s <= lookup;
+					elsif(?? sync_req) then
+						req_addr <= line_address(tag_of(sync_addr), set_of(sync_addr), 0);
+						sync_left <= sync_lines - 1;
+						syncing <= '1';
+						s <= sync_read;
+					elsif(flush = '1' and clean = '0') then
+						req_addr <= (others => '0');
+						flushing <= '1';
+						s <= flush_check;
+					end if;
+				when lookup =>
+					if(?? hit) then
+						if(not (?? replayed)) then
+							hit_counter <= hit_counter + 1;
+						end if;
+						if(?? req_write) then
+							dirty(set_of(req_addr)) <= '1';
+							clean <= '0';
+						end if;
+						s <= idle;
+					else
+						if(not (?? replayed)) then
+							miss_counter <= miss_counter + 1;
+						end if;
+						xfer_word <= 0;
+						if(valid(set_of(req_addr)) = '1' and dirty(set_of(req_addr)) = '1') then
+							s <= wb_read;
+						else
+							-- line is invalid until completely refilled
+							valid(set_of(req_addr)) <= '0';
+							m_addr <= line_address(tag_of(req_addr), set_of(req_addr), 0);
+							m_rdreq <= '1';
+							s <= refill;
+						end if;
+					end if;
+				when wb_read =>
+					-- q_tag still holds the tag of the victim
+					m_addr <= line_address(q_tag, set_of(req_addr), xfer_word);
+					m_wrreq <= '1';
+					s <= wb_write;
+				when wb_write =>
+					if(not (?? m_waitrequest)) then
+						m_wrreq <= '0';
+						if(xfer_word /= line_words - 1) then
+							xfer_word <= xfer_word + 1;
+							s <= wb_read;
+						elsif(?? flushing) then
+							dirty(set_of(req_addr)) <= '0';
+							s <= flush_next;
+						elsif(?? syncing) then
+							dirty(set_of(req_addr)) <= '0';
+							s <= sync_next;
+						else
+							valid(set_of(req_addr)) <= '0';
+							dirty(set_of(req_addr)) <= '0';
+							xfer_word <= 0;
+							m_addr <= line_address(tag_of(req_addr), set_of(req_addr), 0);
+							m_rdreq <= '1';
+							s <= refill;
+						end if;
+					end if;
+				when refill =>
+					if(not (?? m_waitrequest)) then
+						if(xfer_word /= line_words - 1) then
+							xfer_word <= xfer_word + 1;
+							m_addr <= line_address(tag_of(req_addr), set_of(req_addr), xfer_word + 1);
+						else
+							valid(set_of(req_addr)) <= '1';
+							m_rdreq <= '0';
+							s <= replay;
+						end if;
+					end if;
+				when replay =>
+					-- storage is read again from req_addr in this cycle
+					replayed <= '1';
+					s <= lookup;
+				when flush_check =>
+					if(valid(set_of(req_addr)) = '1' and dirty(set_of(req_addr)) = '1') then
+						xfer_word <= 0;
+						s <= wb_read;
+					else
+						s <= flush_next;
+					end if;
+				when flush_next =>
+					if(set_of(req_addr) = sets - 1) then
+						flushing <= '0';
+						clean <= '1';
+						s <= idle;
+					else
+						req_addr <= line_address((others => '0'), set_of(req_addr) + 1, 0);
+						s <= flush_check;
+					end if;
+				when sync_read =>
+					-- storage is read from req_addr in this cycle
+					s <= sync_check;
+				when sync_check =>
+					-- only the line holding the address, not another
+					-- one in the same set
+					if(hit = '1' and dirty(set_of(req_addr)) = '1') then
+						xfer_word <= 0;
+						s <= wb_read;
+					else
+						s <= sync_next;
+					end if;
+				when sync_next =>
+					if(sync_left = 0) then
+						syncing <= '0';
+						s <= idle;
+					else
+						sync_left <= sync_left - 1;
+						req_addr <= std_logic_vector(unsigned(req_addr) + line_bytes);
+						s <= sync_read;
+					end if;
+			end case;
+		end if;
+	end process;
+end architecture;
@@ -0,0 +1,131 @@
+library ieee;
+use ieee.std_logic_1164.ALL;
+use ieee.numeric_std.ALL;
+
+use work.bss2k.ALL;
+
+-- Unsigned 32 bit divider for DIVMOD, two quotient bits per cycle.
+--
+-- The operands are taken in the cycle start is high. Quotient digits are
+-- only computed for the positions where the divisor fits into the dividend:
+-- the partial remainder is preloaded with the leading digits of the
+-- dividend that are shorter than the divisor, so a division takes one cycle
+-- per base 4 digit the dividend is longer than the divisor, plus one, and at
+-- most 16. A dividend smaller than the divisor, and a zero divisor, are done
+-- in the start cycle. Busy is high from the cycle after start until the
+-- result is valid, and the result is held until the next start.
+--
+-- Division by zero returns a quotient of all ones and the dividend as the
+-- remainder, like the bit serial divider this replaces.
+entity divider is
+	port(
+		-- async reset
+		reset : in std_logic;
+
+		-- clock
+		clk : in std_logic;
+
+		-- operands, taken when start is high
+		start : in std_logic;
+		dividend : in word;
+		divisor : in word;
+
+		-- result is not valid yet
+		busy : out std_logic;
+		quotient : out word;
+		remainder : out word
+	);
+end entity;
+
+architecture rtl of divider is
+	constant digits : positive := word_size / 2;
+
+	-- dividend digits not yet shifted into the remainder, leading digit
+	-- first
+	signal n : unsigned(word_size - 1 downto 0);
+	-- multiples of the divisor
+	signal d1, d2, d3 : unsigned(word_size + 1 downto 0);
+	-- partial remainder, always less than the divisor
+	signal r : unsigned(word_size - 1 downto 0);
+	signal q : unsigned(word_size - 1 downto 0);
+
+	signal steps : integer range 0 to digits;
+
+	-- number of base 4 digits, without leading zeros
+	function significant_digits(v : unsigned(word_size - 1 downto 0)) return natural is
+	begin
+		for k in digits - 1 downto 0 loop
+			if(v(2 * k + 1 downto 2 * k) /= "00") then
+				return k + 1;
+			end if;
+		end loop;
+		return 0;
+	end function;
+begin
+	quotient <= std_logic_vector(q);
+	remainder <= std_logic_vector(r);
+
+	busy <= '0' when steps = 0 else
+		'1';
+
+	process(reset, clk) is
+		variable nn : unsigned(word_size - 1 downto 0);
+		variable dd : unsigned(word_size - 1 downto 0);
+		variable count : natural range 1 to digits;
+
+		-- partial remainder with the next digit shifted in
+		variable partial : unsigned(word_size + 1 downto 0);
+		variable digit : unsigned(1 downto 0);
+	begin
+		if(reset = '1') then
+			n <= (others => '0');
+			d1 <= (others => '0');
+			d2 <= (others => '0');
+			d3 <= (others => '0');
+			r <= (others => '0');
+			q <= (others => '0');
+			steps <= 0;
+		elsif(rising_edge(clk)) then
+			if(start = '1') then
+				assert steps = 0 report "divider started while busy" severity error;
+				nn := unsigned(dividend);
+				dd := unsigned(divisor);
+				if(dd = 0) then
+					q <= (others => '1');
+					r <= nn;
+				elsif(nn < dd) then
+					q <= (others => '0');
+					r <= nn;
+				else
+					count := significant_digits(nn) - significant_digits(dd) + 1;
+					-- leading digits shorter than the divisor
+					r <= shift_right(nn, 2 * count);
+					n <= shift_left(nn, word_size - 2 * count);
+					d1 <= resize(dd, d1'length);
+					d2 <= shift_left(resize(dd, d2'length), 1);
+					d3 <= resize(dd, d3'length) + shift_left(resize(dd, d3'length), 1);
+					q <= (others => '0');
+					steps <= count;
+				end if;
+			elsif(steps /= 0) then
+				partial := r & n(n'high downto n'high - 1);
+				if(partial >= d3) then
+					digit := "11";
+					partial := partial - d3;
+				elsif(partial >= d2) then
+					digit := "10";
+					partial := partial - d2;
+				elsif(partial >= d1) then
+					digit := "01";
+					partial := partial - d1;
+				else
+					digit := "00";
+				end if;
+				r <= partial(r'range);
+				q <= q(q'high - 2 downto 0) & digit;
+				n <= shift_left(n, 2);
+				steps <= steps - 1;
+			end if;
+		end if;
+	end process;
+end architecture;
@@ -0,0 +1,291 @@
+library ieee;
+use ieee.std_logic_1164.ALL;
+use ieee.numeric_std.ALL;
+
+use work.bss2k.ALL;
+
+-- Instruction cache
+--
+-- Sits between the instruction bus of the CPU and the memory interface, and
+-- refills entire lines using a single burst read. The cache is read-only, so
+-- lines overwritten through the data bus are invalidated by snooping writes.
+-- Those writes may still sit in the data cache, so each refill first asks it
+-- to write back the line through the sync interface.
+--
+-- The CPU side follows the same convention as the memory interfaces: the
+-- request is latched when i_rdreq is seen, and i_rddata is valid in the
+-- cycle where i_waitrequest is low. A hit is returned one cycle after the
+-- request.
+entity icache is
+	generic(
+		-- instructions per cache line (power of two)
+		line_words : positive := 4;
+		-- number of sets (power of two)
+		sets : positive := 64;
+		-- 1 for direct mapped, 2 for two-way set associative
+		ways : positive range 1 to 2 := 1
+	);
+	port(
+		-- async reset, invalidates all lines
+		reset : in std_logic;
+
+		-- clock
+		clk : in std_logic;
+
+		-- CPU side (Avalon-MM)
+		i_addr : in address;
+		i_rdreq : in std_logic;
+		i_rddata : out instruction;
+		i_waitrequest : out std_logic;
+
+		-- memory side (Avalon-MM, burst reads)
+		m_addr : out address;
+		m_burstcount : out natural range 1 to line_words;
+		m_rdreq : out std_logic;
+		m_rddata : in instruction;
+		m_rddatavalid : in std_logic;
+		m_waitrequest : in std_logic;
+
+		-- data cache write back of the line at m_addr before a refill,
+		-- tie sync_waitrequest low without one
+		sync_req : out std_logic;
+		sync_waitrequest : in std_logic;
+
+		-- data bus writes, for invalidation
+		snoop_addr : in address;
+		snoop_wrreq : in std_logic;
+
+		-- statistics
+		hits : out std_logic_vector(63 downto 0);
+		misses : out std_logic_vector(63 downto 0)
+	);
+end entity;
+
+architecture rtl of icache is
+	function log2(constant val : in positive) return natural is
+		variable ret : natural;
+	begin
+		ret := 0;
+		while(2 ** ret < val) loop
+			ret := ret + 1;
+		end loop;
+		assert 2 ** ret = val report "not a power of two" severity failure;
+		return ret;
+	end function;
+
+	-- instructions are 64 bit
+	constant offset_bits : natural := 3;
+	constant word_bits : natural := log2(line_words);
+	constant index_bits : natural := log2(sets);
+	constant tag_bits : natural := address_width - index_bits - word_bits - offset_bits;
+
+	subtype word_field is std_logic_vector(word_bits + offset_bits - 1 downto offset_bits);
+	subtype index_field is std_logic_vector(index_bits + word_bits + offset_bits - 1 downto word_bits + offset_bits);
+	subtype tag_field is std_logic_vector(address_width - 1 downto index_bits + word_bits + offset_bits);
+
+	subtype tag is std_logic_vector(tag_bits - 1 downto 0);
+
+	subtype word_num is integer range 0 to line_words - 1;
+	subtype set_num is integer range 0 to sets - 1;
+	subtype way_num is integer range 0 to ways - 1;
+
+	function word_of(a : address) return word_num is
+	begin
+		if(word_bits = 0) then
+			return 0;
+		end if;
+		return to_integer(unsigned(a(word_field'range)));
+	end function;
+
+	function set_of(a : address) return set_num is
+	begin
+		if(index_bits = 0) then
+			return 0;
+		end if;
+		return to_integer(unsigned(a(index_field'range)));
+	end function;
+
+	function tag_of(a : address) return tag is
+	begin
+		return a(tag_field'range);
+	end function;
+
+	type instruction_per_way is array(way_num) of instruction;
+	type tag_per_way is array(way_num) of tag;
+	type valid_per_way is array(way_num) of std_logic_vector(set_num);
+
+	type state is (idle, lookup, sync, refill, replay);
+	signal s : state;
+
+	-- request currently being handled
+	signal req_addr : address;
+
+	-- read side of storage
+	signal rd_addr : address;
+	signal q_data : instruction_per_way;
+	signal q_tag : tag_per_way;
+
+	-- valid bits are kept in registers, so they can be cleared on reset
+	signal valid : valid_per_way;
+
+	-- way to replace next, per set (only used with two ways)
+	signal lru : std_logic_vector(set_num);
+
+	-- hit detection
+	signal way_hit : std_logic_vector(way_num);
+	signal hit : std_logic;
+	signal hit_way : way_num;
+
+	-- refill
+	signal fill_way : way_num;
+	signal fill_word : word_num;
+	signal fill_data_we : std_logic;
+	signal fill_tag_we : std_logic;
+
+	-- lookup repeats a request already counted as a miss
+	signal replayed : std_logic;
+
+	signal hit_counter : unsigned(63 downto 0);
+	signal miss_counter : unsigned(63 downto 0);
+begin
+	assert tag_bits > 0 report "cache larger than address space" severity failure;
+
+	with s select rd_addr <=
+		i_addr when idle,
+		req_addr when others;
+
+	storage : for w in way_num generate
+		type data_storage is array(0 to sets * line_words - 1) of instruction;
+		type tag_storage is array(set_num) of tag;
+
+		signal data_ram : data_storage;
+		signal tag_ram : tag_storage;
+	begin
+		process(clk) is
+		begin
+			if(rising_edge(clk)) then
+				if(fill_data_we = '1' and fill_way = w) then
+					data_ram(set_of(req_addr) * line_words + fill_word) <= m_rddata;
+				end if;
+				if(fill_tag_we = '1' and fill_way = w) then
+					tag_ram(set_of(req_addr)) <= tag_of(req_addr);
+				end if;
+				q_data(w) <= data_ram(set_of(rd_addr) * line_words + word_of(rd_addr));
+				q_tag(w) <= tag_ram(set_of(rd_addr));
+			end if;
+		end process;
+
+		way_hit(w) <= valid(w)(set_of(req_addr)) when q_tag(w) = tag_of(req_addr) else
+			      '0';
+	end generate;
+
+	process(way_hit) is
+	begin
+		hit <= '0';
+		hit_way <= 0;
+		for w in way_num loop
+			if(?? way_hit(w)) then
+				hit <= '1';
+				hit_way <= w;
+			end if;
+		end loop;
+	end process;
+
+	i_rddata <= q_data(hit_way);
+	i_waitrequest <= '0' when s = lookup and hit = '1' else
+			 '1';
+
+	fill_data_we <= m_rddatavalid when s = refill else
+			'0';
+	fill_tag_we <= not m_waitrequest when s = refill else
+		       '0';
+
+	m_burstcount <= line_words;
+
+	hits <= std_logic_vector(hit_counter);
+	misses <= std_logic_vector(miss_counter);
+
+	process(reset, clk) is
+		variable victim : way_num;
+	begin
+		if(?? reset) then
+			s <= idle;
+			valid <= (others => (others => '0'));
+			lru <= (others => '0');
+			m_rdreq <= '0';
+			sync_req <= '0';
+			replayed <= '0';
+			hit_counter <= (others => '0');
+			miss_counter <= (others => '0');
+		elsif(rising_edge(clk)) then
+			case s is
+				when idle =>
+					if(?? i_rdreq) then
+						req_addr <= i_addr;
+						replayed <= '0';
+						s <= lookup;
+					end if;
+				when lookup =>
+					if(?? hit) then
+						if(not (?? replayed)) then
+							hit_counter <= hit_counter + 1;
+						end if;
+						if(ways > 1) then
+							if(hit_way = 0) then
+								lru(set_of(req_addr)) <= '1';
+							else
+								lru(set_of(req_addr)) <= '0';
+							end if;
+						end if;
+						s <= idle;
+					else
+						if(not (?? replayed)) then
+							miss_counter <= miss_counter + 1;
+						end if;
+						if(ways > 1 and lru(set_of(req_addr)) = '1') then
+							victim := ways - 1;
+						else
+							victim := 0;
+						end if;
+						-- line is invalid until completely refilled
+						valid(victim)(set_of(req_addr)) <= '0';
+						fill_way <= victim;
+						fill_word <= 0;
+						-- start of line
+						m_addr <= req_addr;
+						m_addr(word_bits + offset_bits - 1 downto 0) <= (others => '0');
+						sync_req <= '1';
+						s <= sync;
+					end if;
+				when sync =>
+					if(not (?? sync_waitrequest)) then
+						sync_req <= '0';
+						m_rdreq <= '1';
+						s <= refill;
+					end if;
+				when refill =>
+					if(?? m_rddatavalid) then
+						if(fill_word /= line_words - 1) then
+							fill_word <= fill_word + 1;
+						end if;
+					end if;
+					if(not (?? m_waitrequest)) then
+						valid(fill_way)(set_of(req_addr)) <= '1';
+						m_rdreq <= '0';
+						s <= replay;
+					end if;
+				when replay =>
+					-- storage is read again from req_addr in this cycle
+					replayed <= '1';
+					s <= lookup;
+			end case;
+
+			-- instructions overwritten through the data bus
+			if(?? snoop_wrreq) then
+				for w in way_num loop
+					valid(w)(set_of(snoop_addr)) <= '0';
+				end loop;
+			end if;
+		end if;
+	end process;
+end architecture;
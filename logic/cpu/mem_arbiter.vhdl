@@ -3,7 +3,18 @@ use ieee.std_logic_1164.ALL;
 
 use work.bss2k.ALL;
 
+-- Combines instruction and data bus into a single memory interface.
+--
+-- With a 32 bit combined bus, instructions are fetched as two consecutive
+-- word reads. With a 64 bit combined bus, instructions are fetched in a
+-- single transaction, and data accesses use byte enables to select one half
+-- of the aligned 64 bit word. Data is big endian, so bits 63..32 hold the
+-- word at the lower address, and are selected by byte enables "11110000".
 entity mem_arbiter is
+	generic(
+		-- width of the combined bus, 32 or 64
+		comb_width : positive := 32
+	);
 	port(
 		-- async
 		reset : in std_logic;
@@ -13,10 +24,11 @@ entity mem_arbiter is
 
 		-- combined (Avalon-MM)
 		comb_addr : out address;
+		comb_byteenable : out std_logic_vector(comb_width / byte_size - 1 downto 0);
 		comb_rdreq : out std_logic;
-		comb_rddata : in word;
+		comb_rddata : in std_logic_vector(comb_width - 1 downto 0);
 		comb_wrreq : out std_logic;
-		comb_wrdata : out word;
+		comb_wrdata : out std_logic_vector(comb_width - 1 downto 0);
 		comb_waitrequest : in std_logic;
 
 		-- insn bus (Avalon-MM)
@@ -36,15 +48,22 @@ entity mem_arbiter is
 end entity;
 
 architecture rtl of mem_arbiter is
+	constant wide : boolean := comb_width = instruction_size;
+
+	-- insn2 is only used on a narrow bus
 	type state is (data, insn1, insn2);
 	signal s : state;
 
-	signal i_buffer : word;
+	signal data_addr : address;
+	signal insn1_waitrequest : std_logic;
 begin
+	assert comb_width = word_size or comb_width = instruction_size
+		report "combined bus must be 32 or 64 bits wide" severity failure;
+
 	with s select comb_addr <=
 		i_addr when insn1,
 		i_addr xor x"000004" when insn2,
-		d_addr when data;
+		data_addr when data;
 	with s select comb_rdreq <=
 		i_rdreq when insn1|insn2,
 		d_rdreq when data;
@@ -52,19 +71,49 @@ begin
 		'0' when insn1|insn2,
 		d_wrreq when data;
 
-	comb_wrdata <= d_wrdata;
-	i_rddata(31 downto 0) <= comb_rddata;
-	i_rddata(63 downto 32) <= i_buffer;
-	d_rddata <= comb_rddata;
-
 	with s select i_waitrequest <=
-		'1' when insn1|data,
+		'1' when data,
+		insn1_waitrequest when insn1,
 		comb_waitrequest when insn2;
 	with s select d_waitrequest <=
 		'1' when insn1|insn2,
 		comb_waitrequest when data;
 
-	i_buffer <= comb_rddata when s = insn1 and rising_edge(clk);
+	narrow_bus : if(not wide) generate
+		signal i_buffer : word;
+	begin
+		data_addr <= d_addr;
+		comb_byteenable <= (others => '1');
+
+		comb_wrdata <= d_wrdata;
+		i_rddata(31 downto 0) <= comb_rddata;
+		i_rddata(63 downto 32) <= i_buffer;
+		d_rddata <= comb_rddata;
+
+		insn1_waitrequest <= '1';
+
+		i_buffer <= comb_rddata when s = insn1 and rising_edge(clk);
+	end generate;
+
+	wide_bus : if(wide) generate
+		-- word within the aligned 64 bit word
+		alias d_lane : std_logic is d_addr(2);
+	begin
+		data_addr <= d_addr(address'high downto 3) & "000";
+
+		comb_byteenable <=
+			"11111111" when s /= data else
+			"11110000" when d_lane = '0' else
+			"00001111";
+
+		comb_wrdata <= d_wrdata & d_wrdata;
+		i_rddata <= comb_rddata;
+		with d_lane select d_rddata <=
+			comb_rddata(63 downto 32) when '0',
+			comb_rddata(31 downto 0) when others;
+
+		insn1_waitrequest <= comb_waitrequest;
+	end generate;
 
 	process(reset, clk) is
 	begin
@@ -78,7 +127,11 @@ begin
 					end if;
 				when insn1 =>
 					if(comb_waitrequest = '0') then
-						s <= insn2;
+						if(wide) then
+							s <= data;
+						else
+							s <= insn2;
+						end if;
 					end if;
 				when insn2 =>
 					if(comb_waitrequest = '0') then
@@ -0,0 +1,68 @@
+library ieee;
+use ieee.std_logic_1164.ALL;
+use ieee.numeric_std.ALL;
+
+use work.bss2k.ALL;
+
+-- Unsigned 32 x 32 bit multiplier for MUL.
+--
+-- The operands are taken in the cycle start is high, and multiplied into a
+-- chain of registers that the synthesis tool can move into the DSP blocks.
+-- With one stage, the product is valid in the next cycle and busy is never
+-- raised. With more, busy is high from the cycle after start until the
+-- product is valid. The product is held until the next start.
+entity multiplier is
+	generic(
+		-- register stages after the operands are taken
+		stages : positive := 1
+	);
+	port(
+		-- async reset
+		reset : in std_logic;
+
+		-- clock
+		clk : in std_logic;
+
+		-- operands, taken when start is high
+		start : in std_logic;
+		a : in word;
+		b : in word;
+
+		-- product is not valid yet
+		busy : out std_logic;
+		product : out std_logic_vector(63 downto 0)
+	);
+end entity;
+
+architecture rtl of multiplier is
+	type pipeline is array(1 to stages) of unsigned(63 downto 0);
+	signal p : pipeline;
+
+	signal remaining : integer range 0 to stages - 1;
+begin
+	product <= std_logic_vector(p(stages));
+
+	busy <= '0' when remaining = 0 else
+		'1';
+
+	p(1) <= unsigned(a) * unsigned(b) when rising_edge(clk) and start = '1';
+
+	delay : for k in 2 to stages generate
+	begin
+		p(k) <= p(k - 1) when rising_edge(clk);
+	end generate;
+
+	process(reset, clk) is
+	begin
+		if(reset = '1') then
+			remaining <= 0;
+		elsif(rising_edge(clk)) then
+			if(start = '1') then
+				assert remaining = 0 report "multiplier started while busy" severity error;
+				remaining <= stages - 1;
+			elsif(remaining /= 0) then
+				remaining <= remaining - 1;
+			end if;
+		end if;
+	end process;
+end architecture;
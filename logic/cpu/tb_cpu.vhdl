@@ -7,8 +7,14 @@ use work.bss2k.ALL;
 library std;
 use std.env.finish;
 
+-- Runs a program on the CPU, until it halts. The program is a binary
+-- assembled by upholsterer2k, e.g. one of the tests in tests/tests.
 entity tb_cpu is
-begin
+	generic(
+		program : string := "../roms/hello_world.backseat";
+		-- program is expected to fail an ASSERT
+		expect_assertion : boolean := false
+	);
 end entity;
 
 architecture sim of tb_cpu is
@@ -35,7 +41,8 @@ architecture sim of tb_cpu is
 			d_waitrequest : in std_logic;
 
 			-- status
-			halted : out std_logic
+			halted : out std_logic;
+			assertion_failed : out std_logic
 		);
 	end component;
 
@@ -55,16 +62,19 @@ architecture sim of tb_cpu is
 	signal d_waitrequest : std_logic;
 
 	signal halted : std_logic;
+	signal assertion_failed : std_logic;
 
-	constant rom_size : integer := 256;
+	constant rom_size : integer := 16#10000#;
 	constant rom_start : integer := to_integer(unsigned(entry_point));
 	constant rom_end : integer := rom_start + rom_size - 1;
 
 	type insn_mem is array(rom_start to rom_end) of instruction;
 	signal i : insn_mem;
 
-	type data_mem is array(16#0000# to 16#ffff#) of word;
-	signal d : data_mem;
+	function word_index(a : address) return integer is
+	begin
+		return to_integer(unsigned(a)) / 4;
+	end function;
 begin
 	-- reset gen
 	reset <= '1', '0' after 1 us;
@@ -75,8 +85,8 @@ begin
 	-- sim timeout
 	process is
 	begin
-		wait for 60 us;
-		report "sim timeout" severity error;
+		wait for 1 ms;
+		report "sim timeout" severity failure;
 		finish;
 	end process;
 
@@ -85,6 +95,13 @@ begin
 	begin
 		wait until halted = '1';
 		wait for 400 ns;
+		if(expect_assertion) then
+			assert assertion_failed = '1'
+				report program & ": expected ASSERT to fail" severity failure;
+		else
+			assert assertion_failed = '0'
+				report program & ": ASSERT failed" severity failure;
+		end if;
 		finish;
 	end process;
 
@@ -97,9 +114,13 @@ begin
 		variable a : instruction;
 		variable x : integer;
 	begin
-		file_open(fstatus, rom, "../roms/hello_world.backseat", read_mode);
+		file_open(fstatus, rom, program, read_mode);
+		assert fstatus = open_ok
+			report "cannot open " & program severity failure;
 		x := i'low;
 		while not endfile(rom) loop
+			assert x <= i'high
+				report program & " does not fit into ROM" severity failure;
 			a := (others => '0');
 			for y in 0 to 7 loop
 				read(rom, t);
@@ -116,9 +137,20 @@ begin
 	i_rddata <= i(to_integer(unsigned(i_addr))) when i_rdreq = '1' else (others => 'U');
 	i_waitrequest <= '0';
 
-	-- data bus
-	d_rddata <= d(to_integer(unsigned(d_addr))) when d_rdreq = '1' else (others => 'U');
-	d(to_integer(unsigned(d_addr))) <= d_wrdata when rising_edge(clk) and d_wrreq = '1';
+	-- data bus, covers the whole address space
+	process(clk, d_addr, d_rdreq) is
+		type data_mem is array(0 to 2 ** (address_width - 2) - 1) of integer;
+		variable d : data_mem := (others => 0);
+	begin
+		if(rising_edge(clk) and d_wrreq = '1') then
+			d(word_index(d_addr)) := to_integer(signed(d_wrdata));
+		end if;
+		if(d_rdreq = '1') then
+			d_rddata <= std_logic_vector(to_signed(d(word_index(d_addr)), word'length));
+		else
+			d_rddata <= (others => 'U');
+		end if;
+	end process;
 	d_waitrequest <= '0';
 
 	-- dut
@@ -136,6 +168,7 @@ begin
 			d_wrdata => d_wrdata,
 			d_wrreq => d_wrreq,
 			d_waitrequest => d_waitrequest,
-			halted => halted
+			halted => halted,
+			assertion_failed => assertion_failed
 	);
 end architecture;
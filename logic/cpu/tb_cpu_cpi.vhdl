@@ -0,0 +1,339 @@
+library ieee;
+use ieee.std_logic_1164.ALL;
+use ieee.numeric_std.ALL;
+
+use work.bss2k.ALL;
+
+library std;
+use std.env.finish;
+
+-- Runs short straight-line programs on the sequential CPU against an
+-- instruction memory with PCIe-like latency, one per opcode class, and
+-- reports the cycles per instruction of each class. Every program shares a
+-- prologue and an epilogue with the baseline program, whose cycles are
+-- subtracted, and stores a result that is checked. With overlapped fetch,
+-- register-to-register instructions must not take longer than the fetch.
+entity tb_cpu_cpi is
+	generic(
+		overlap_fetch : boolean := true;
+		-- cycles until an instruction is returned
+		latency : natural := 20;
+		-- instructions of a class in each program
+		repeat : positive := 8
+	);
+end entity;
+
+architecture sim of tb_cpu_cpi is
+	signal reset : std_logic := '1';
+	signal clk : std_logic := '0';
+
+	signal i_addr : address;
+	signal i_rddata : instruction;
+	signal i_rdreq : std_logic;
+	signal i_waitrequest : std_logic;
+
+	signal d_addr : address;
+	signal d_rddata : word;
+	signal d_rdreq : std_logic;
+	signal d_wrdata : word;
+	signal d_wrreq : std_logic;
+	signal d_waitrequest : std_logic;
+
+	signal halted : std_logic;
+	signal assertion_failed : std_logic;
+
+	type class is (baseline, add_reg, add_imm, load, store, push_pop, mul, divmod, call_ret, ip_write);
+
+	constant rom_size : integer := 64;
+	constant rom_start : integer := to_integer(unsigned(entry_point));
+
+	type insn_mem is array(0 to rom_size - 1) of instruction;
+	signal rom : insn_mem := (others => (others => '0'));
+
+	-- r1 is stored here by the epilogue, the prologue stores r3 after it
+	constant result : integer := 16#100#;
+	constant operand : integer := 16#104#;
+
+	type data_mem is array(0 to 16#ff#) of word;
+	signal d : data_mem;
+
+	-- memory outside the ROM reads as zero
+	function fetch(signal rom : insn_mem; a : address) return instruction is
+		variable n : integer;
+	begin
+		n := (to_integer(unsigned(a)) - rom_start) / 8;
+		if(n < 0 or n >= rom_size) then
+			return (others => '0');
+		end if;
+		return rom(n);
+	end function;
+
+	function imm(i : integer) return word is
+	begin
+		return std_logic_vector(to_unsigned(i, word'length));
+	end function;
+
+	function at(i : integer) return word is
+	begin
+		return imm(rom_start + i * 8);
+	end function;
+
+	function r(k : integer) return reg is
+	begin
+		return std_logic_vector(to_unsigned(k, reg'length));
+	end function;
+
+	-- num / den with two decimal places
+	function fixed(num, den : natural) return string is
+		variable hundredths : natural;
+	begin
+		hundredths := (num * 100 + den / 2) / den;
+		if(hundredths mod 100 < 10) then
+			return natural'image(hundredths / 100) & ".0" & natural'image(hundredths mod 100);
+		end if;
+		return natural'image(hundredths / 100) & "." & natural'image(hundredths mod 100);
+	end function;
+
+	signal cycles : natural;
+begin
+	-- clk gen
+	clk <= not clk after 4 ns;
+
+	-- sim timeout
+	process is
+	begin
+		wait for 1 ms;
+		report "sim timeout" severity error;
+		finish;
+	end process;
+
+	-- runs each class after a reset
+	process is
+		variable p : insn_mem;
+		variable n : integer;
+		variable count : natural;
+		variable expect_result, expect_operand : word;
+		variable base : natural;
+		variable sub : integer;
+		variable errors : natural;
+
+		procedure emit(constant opcode : in std_logic_vector(15 downto 0);
+				constant r1 : in reg;
+				constant r2 : in reg;
+				constant c : in word) is
+		begin
+			p(n) := opcode & r1 & r2 & c;
+			n := n + 1;
+		end procedure;
+
+		procedure emit(constant opcode : in std_logic_vector(15 downto 0);
+				constant r1 : in reg;
+				constant c : in word) is
+		begin
+			emit(opcode, r1, x"00", c);
+		end procedure;
+	begin
+		errors := 0;
+		base := 0;
+		for k in class loop
+			p := (others => (others => '0'));
+			n := 0;
+			-- LI r1, 0; LI r2, 3; LI r3, 5; ST r3 -> [operand]
+			emit(x"0000", r(1), imm(0));
+			emit(x"0000", r(2), imm(3));
+			emit(x"0000", r(3), imm(5));
+			emit(x"0003", r(3), imm(operand));
+			expect_result := imm(0);
+			expect_operand := imm(5);
+			count := repeat;
+			-- the subroutine for CALL follows the epilogue
+			sub := 4 + repeat + 2;
+			for j in 1 to repeat loop
+				case k is
+					when baseline =>
+						count := 0;
+					when add_reg =>
+						-- ADD r1, r1, r2
+						emit(x"0007", r(1), r(1), r(2) & x"000000");
+						expect_result := imm(3 * repeat);
+					when add_imm =>
+						-- ADDI r1, r1, 5
+						emit(x"0012", r(1), r(1), imm(5));
+						expect_result := imm(5 * repeat);
+					when load =>
+						-- LD r1 <- [operand]
+						emit(x"0001", r(1), imm(operand));
+						expect_result := imm(5);
+					when store =>
+						-- ST r2 -> [operand]
+						emit(x"0003", r(2), imm(operand));
+						expect_operand := imm(3);
+					when push_pop =>
+						-- PUSH r2; POP r1
+						emit(x"0015", r(2), imm(0));
+						emit(x"0016", r(1), imm(0));
+						count := 2 * repeat;
+						expect_result := imm(3);
+					when mul =>
+						-- MUL r4:r1 <- r3 * r2
+						emit(x"000a", r(4), r(1), r(3) & r(2) & x"0000");
+						expect_result := imm(15);
+					when divmod =>
+						-- DIVMOD r1, r4 <- r3 / r2
+						emit(x"000b", r(1), r(4), r(3) & r(2) & x"0000");
+						expect_result := imm(1);
+					when call_ret =>
+						-- CALL sub, which returns immediately
+						emit(x"0017", x"00", at(sub));
+						count := 2 * repeat;
+					when ip_write =>
+						-- LI ip, over a HCF
+						emit(x"0000", x"fe", at(n + 2));
+						emit(x"0006", x"00", imm(0));
+				end case;
+			end loop;
+			-- ST r1 -> [result]; HCF
+			emit(x"0003", r(1), imm(result));
+			emit(x"0006", x"00", imm(0));
+			if(k = call_ret) then
+				assert n = sub report "subroutine misplaced" severity failure;
+				-- RET
+				emit(x"0018", x"00", imm(0));
+			end if;
+			rom <= p;
+
+			reset <= '1';
+			wait until rising_edge(clk);
+			wait until rising_edge(clk);
+			reset <= '0';
+			wait until halted = '1';
+			-- let the last store complete
+			wait until rising_edge(clk);
+			wait until rising_edge(clk);
+
+			if(assertion_failed = '1') then
+				report class'image(k) & ": ASSERT failed" severity error;
+				errors := errors + 1;
+			end if;
+			if(d(result / 4) /= expect_result) then
+				report class'image(k) & ": result " & to_hstring(d(result / 4)) &
+					", expected " & to_hstring(expect_result)
+					severity error;
+				errors := errors + 1;
+			end if;
+			if(d(operand / 4) /= expect_operand) then
+				report class'image(k) & ": operand " & to_hstring(d(operand / 4)) &
+					", expected " & to_hstring(expect_operand)
+					severity error;
+				errors := errors + 1;
+			end if;
+
+			if(k = baseline) then
+				base := cycles;
+				report "overlap " & boolean'image(overlap_fetch) &
+					", latency " & natural'image(latency) &
+					": baseline cycles: " & natural'image(base);
+			elsif(cycles < base) then
+				report class'image(k) & ": fewer cycles than baseline" severity error;
+				errors := errors + 1;
+			else
+				report "overlap " & boolean'image(overlap_fetch) &
+					", latency " & natural'image(latency) &
+					": " & class'image(k) &
+					": cycles: " & natural'image(cycles - base) &
+					", instructions: " & natural'image(count) &
+					", CPI: " & fixed(cycles - base, count);
+				-- these only read registers, so execution is hidden
+				-- behind the fetch of the next instruction
+				if(overlap_fetch and (k = add_reg or k = add_imm) and cycles - base > count * (latency + 4)) then
+					report class'image(k) & ": execution not overlapped with fetch" severity error;
+					errors := errors + 1;
+				end if;
+			end if;
+		end loop;
+		assert errors = 0 report natural'image(errors) & " errors" severity error;
+		finish;
+	end process;
+
+	process(reset, clk) is
+	begin
+		if(?? reset) then
+			cycles <= 0;
+		elsif(rising_edge(clk)) then
+			if(halted = '0') then
+				cycles <= cycles + 1;
+			end if;
+		end if;
+	end process;
+
+	-- instruction memory, data is returned with waitrequest low
+	process(reset, clk) is
+		type state is (idle, waiting, done);
+		variable s : state;
+		variable delay : natural;
+	begin
+		if(?? reset) then
+			s := idle;
+			i_rddata <= (others => 'U');
+			i_waitrequest <= '1';
+		elsif(rising_edge(clk)) then
+			i_rddata <= (others => 'U');
+			i_waitrequest <= '1';
+			case s is
+				when idle =>
+					if(?? i_rdreq) then
+						delay := latency;
+						s := waiting;
+					end if;
+				when waiting =>
+					if(delay = 0) then
+						i_rddata <= fetch(rom, i_addr);
+						i_waitrequest <= '0';
+						s := done;
+					else
+						delay := delay - 1;
+					end if;
+				when done =>
+					-- request is still asserted while waitrequest is low
+					s := idle;
+			end case;
+		end if;
+	end process;
+
+	-- data bus, the result is poisoned so a missing store shows
+	process(reset, clk) is
+	begin
+		if(?? reset) then
+			d <= (others => (others => '0'));
+			d(result / 4) <= x"deadbeef";
+		elsif(rising_edge(clk)) then
+			if(d_wrreq = '1') then
+				d(to_integer(unsigned(d_addr(9 downto 2)))) <= d_wrdata;
+			end if;
+		end if;
+	end process;
+	d_rddata <= d(to_integer(unsigned(d_addr(9 downto 2)))) when d_rdreq = '1' else (others => 'U');
+	d_waitrequest <= '0';
+
+	-- dut
+	dut : entity work.cpu_sequential
+		generic map(
+			overlap_fetch => overlap_fetch
+		)
+		port map(
+			reset => reset,
+			clk => clk,
+			i_addr => i_addr,
+			i_rddata => i_rddata,
+			i_rdreq => i_rdreq,
+			i_waitrequest => i_waitrequest,
+			d_addr => d_addr,
+			d_rddata => d_rddata,
+			d_rdreq => d_rdreq,
+			d_wrdata => d_wrdata,
+			d_wrreq => d_wrreq,
+			d_waitrequest => d_waitrequest,
+			halted => halted,
+			assertion_failed => assertion_failed
+		);
+end architecture;
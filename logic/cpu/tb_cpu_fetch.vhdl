@@ -0,0 +1,324 @@
+library ieee;
+use ieee.std_logic_1164.ALL;
+use ieee.numeric_std.ALL;
+
+use work.bss2k.ALL;
+
+library std;
+use std.env.finish;
+
+-- Runs a short program on the pipelined CPU against an instruction memory
+-- with PCIe-like latency, and reports cycles, stall and branch prediction
+-- counters. The program jumps over a HALT, so a missing flush stops it early,
+-- and calls a subroutine in a loop, so a wrong return address or a lost
+-- iteration shows in the stored sum.
+entity tb_cpu_fetch is
+	generic(
+		-- fetch engine configuration
+		prefetch_depth : positive := 4;
+		max_fetches : positive := 4;
+		-- cycles until an instruction is returned
+		latency : natural := 20;
+		-- branch prediction configuration
+		btb_entries : positive := 16;
+		ras_depth : positive := 4
+	);
+end entity;
+
+architecture sim of tb_cpu_fetch is
+	signal reset : std_logic;
+	signal clk : std_logic := '0';
+
+	signal i_addr : address;
+	signal i_rddata : instruction;
+	signal i_rdreq : std_logic;
+	signal i_rddatavalid : std_logic;
+	signal i_waitrequest : std_logic;
+
+	signal d_addr : address;
+	signal d_rddata : word;
+	signal d_rdreq : std_logic;
+	signal d_wrdata : word;
+	signal d_wrreq : std_logic;
+	signal d_waitrequest : std_logic;
+
+	signal halted : std_logic;
+
+	signal fetch_stalls : std_logic_vector(63 downto 0);
+	signal decode_stalls : std_logic_vector(63 downto 0);
+	signal mispredicts : std_logic_vector(63 downto 0);
+	signal branch_redirects : std_logic_vector(63 downto 0);
+	signal redirect_penalty : std_logic_vector(63 downto 0);
+
+	constant rom_size : integer := 32;
+	constant rom_start : integer := to_integer(unsigned(entry_point));
+
+	type insn_mem is array(0 to rom_size - 1) of instruction;
+	signal rom : insn_mem := (others => (others => '0'));
+
+	-- results are stored here
+	constant result_start : integer := 16#100#;
+	constant value_regs : integer := 8;
+
+	-- loop iterations, and value added by the subroutine
+	constant iterations : integer := 10;
+	constant increment : integer := 3;
+
+	type data_mem is array(0 to 16#ff#) of word;
+	signal d : data_mem := (others => (others => '0'));
+
+	-- memory outside the ROM reads as zero
+	function fetch(signal rom : insn_mem; a : address) return instruction is
+		variable n : integer;
+	begin
+		n := (to_integer(unsigned(a)) - rom_start) / 8;
+		if(n < 0 or n >= rom_size) then
+			return (others => '0');
+		end if;
+		return rom(n);
+	end function;
+
+	function value(r : integer) return word is
+	begin
+		return std_logic_vector(to_unsigned(16#1000# + r * 16#0101#, word'length));
+	end function;
+
+	function imm(i : integer) return word is
+	begin
+		return std_logic_vector(to_unsigned(i, word'length));
+	end function;
+
+	signal cycles : natural;
+begin
+	-- reset gen
+	reset <= '1', '0' after 100 ns;
+
+	-- clk gen
+	clk <= not clk after 4 ns;
+
+	-- sim timeout
+	process is
+	begin
+		wait for 1 ms;
+		report "sim timeout" severity error;
+		finish;
+	end process;
+
+	-- program
+	process is
+		variable n : integer;
+		variable target : integer;
+		variable loop_start : integer;
+		variable sub : integer;
+
+		procedure emit(constant opcode : in std_logic_vector(15 downto 0);
+				constant r1 : in reg;
+				constant r2 : in reg;
+				constant c : in word) is
+		begin
+			rom(n) <= opcode & r1 & r2 & c;
+			n := n + 1;
+		end procedure;
+
+		procedure emit(constant opcode : in std_logic_vector(15 downto 0);
+				constant r1 : in reg;
+				constant c : in word) is
+		begin
+			emit(opcode, r1, x"00", c);
+		end procedure;
+
+		function at(i : integer) return word is
+		begin
+			return imm(rom_start + i * 8);
+		end function;
+
+		function r(k : integer) return reg is
+		begin
+			return std_logic_vector(to_unsigned(k, reg'length));
+		end function;
+	begin
+		n := 0;
+		for k in 0 to value_regs - 1 loop
+			-- LI
+			emit(x"0000", r(k), value(k));
+		end loop;
+		-- sum up in a loop
+		emit(x"0000", r(8), imm(iterations));
+		emit(x"0000", r(9), imm(0));
+		loop_start := n;
+		-- the subroutine follows the last HALT
+		sub := loop_start + 3 + 3 + value_regs + 2;
+		-- CALL sub
+		emit(x"0017", x"00", at(sub));
+		-- SUBI r8, r8, 1
+		emit(x"0013", r(8), r(8), imm(1));
+		-- JUMPif r8 > 0, loop
+		emit(x"001c", r(8), at(loop_start));
+		-- JUMP over two HALTs
+		target := n + 3;
+		emit(x"0019", x"00", at(target));
+		emit(x"0006", x"00", x"00000000");
+		emit(x"0006", x"00", x"00000000");
+		for k in 0 to value_regs - 1 loop
+			-- ST abs
+			emit(x"0003", r(k), std_logic_vector(to_unsigned(result_start + 4 * k, word'length)));
+		end loop;
+		emit(x"0003", r(9), imm(result_start + 4 * value_regs));
+		emit(x"0006", x"00", x"00000000");
+		assert n = sub report "subroutine misplaced" severity failure;
+		-- ADDI r9, r9, increment
+		emit(x"0012", r(9), r(9), imm(increment));
+		-- RET
+		emit(x"0018", x"00", x"00000000");
+		wait;
+	end process;
+
+	-- normal exit
+	process is
+		variable errors : natural;
+	begin
+		wait until halted = '1';
+		-- let the last store complete
+		wait until rising_edge(clk);
+		wait until rising_edge(clk);
+		report "prefetch depth " & natural'image(prefetch_depth) &
+			", fetches " & natural'image(max_fetches) &
+			", latency " & natural'image(latency) &
+			": cycles: " & natural'image(cycles) &
+			", fetch stalls: " & natural'image(to_integer(unsigned(fetch_stalls))) &
+			", decode stalls: " & natural'image(to_integer(unsigned(decode_stalls))) &
+			", mispredicts: " & natural'image(to_integer(unsigned(mispredicts))) &
+			", redirects: " & natural'image(to_integer(unsigned(branch_redirects))) &
+			", penalty: " & natural'image(to_integer(unsigned(redirect_penalty)));
+		errors := 0;
+		for k in 0 to value_regs - 1 loop
+			if(d(result_start / 4 + k) /= value(k)) then
+				report "r" & natural'image(k) & " stored " & to_hstring(d(result_start / 4 + k)) &
+					", expected " & to_hstring(value(k))
+					severity error;
+				errors := errors + 1;
+			end if;
+		end loop;
+		if(d(result_start / 4 + value_regs) /= imm(iterations * increment)) then
+			report "sum stored " & to_hstring(d(result_start / 4 + value_regs)) &
+				", expected " & to_hstring(imm(iterations * increment))
+				severity error;
+			errors := errors + 1;
+		end if;
+		assert errors = 0 report natural'image(errors) & " results wrong" severity error;
+		finish;
+	end process;
+
+	process(reset, clk) is
+	begin
+		if(?? reset) then
+			cycles <= 0;
+		elsif(rising_edge(clk)) then
+			if(halted = '0') then
+				cycles <= cycles + 1;
+			end if;
+		end if;
+	end process;
+
+	-- instruction memory
+	single : if(max_fetches = 1) generate
+		-- data is returned with waitrequest low
+		process(reset, clk) is
+			type state is (idle, waiting, done);
+			variable s : state;
+			variable delay : natural;
+		begin
+			if(?? reset) then
+				s := idle;
+				i_rddata <= (others => 'U');
+				i_waitrequest <= '1';
+			elsif(rising_edge(clk)) then
+				i_rddata <= (others => 'U');
+				i_waitrequest <= '1';
+				case s is
+					when idle =>
+						if(?? i_rdreq) then
+							delay := latency;
+							s := waiting;
+						end if;
+					when waiting =>
+						if(delay = 0) then
+							i_rddata <= fetch(rom, i_addr);
+							i_waitrequest <= '0';
+							s := done;
+						else
+							delay := delay - 1;
+						end if;
+					when done =>
+						-- request is still asserted while waitrequest is low
+						s := idle;
+				end case;
+			end if;
+		end process;
+
+		i_rddatavalid <= '0';
+	end generate;
+
+	pipelined : if(max_fetches > 1) generate
+		-- every request is accepted, data is returned after a fixed latency
+		type request_list is array(0 to latency) of std_logic_vector(address'length downto 0);
+		signal requests : request_list;
+	begin
+		i_waitrequest <= '0';
+
+		process(reset, clk) is
+		begin
+			if(?? reset) then
+				requests <= (others => (others => '0'));
+				i_rddata <= (others => 'U');
+				i_rddatavalid <= '0';
+			elsif(rising_edge(clk)) then
+				requests(0) <= i_rdreq & i_addr;
+				for k in 1 to latency loop
+					requests(k) <= requests(k - 1);
+				end loop;
+				i_rddata <= (others => 'U');
+				i_rddatavalid <= '0';
+				if(requests(latency)(address'length) = '1') then
+					i_rddata <= fetch(rom, requests(latency)(address'range));
+					i_rddatavalid <= '1';
+				end if;
+			end if;
+		end process;
+	end generate;
+
+	-- data bus
+	d_rddata <= d(to_integer(unsigned(d_addr(9 downto 2)))) when d_rdreq = '1' else (others => 'U');
+	d(to_integer(unsigned(d_addr(9 downto 2)))) <= d_wrdata when rising_edge(clk) and d_wrreq = '1';
+	d_waitrequest <= '0';
+
+	-- dut
+	dut : entity work.cpu_pipelined
+		generic map(
+			prefetch_depth => prefetch_depth,
+			max_fetches => max_fetches,
+			btb_entries => btb_entries,
+			ras_depth => ras_depth
+		)
+		port map(
+			reset => reset,
+			clk => clk,
+			i_addr => i_addr,
+			i_rddata => i_rddata,
+			i_rdreq => i_rdreq,
+			i_rddatavalid => i_rddatavalid,
+			i_waitrequest => i_waitrequest,
+			d_addr => d_addr,
+			d_rddata => d_rddata,
+			d_rdreq => d_rdreq,
+			d_wrdata => d_wrdata,
+			d_wrreq => d_wrreq,
+			d_waitrequest => d_waitrequest,
+			halted => halted,
+			fetch_stalls => fetch_stalls,
+			decode_stalls => decode_stalls,
+			mispredicts => mispredicts,
+			branch_redirects => branch_redirects,
+			redirect_penalty => redirect_penalty
+		);
+end architecture;
@@ -0,0 +1,15 @@
+configuration tb_cpu_sim_seq_overlap of tb_cpu is
+	for sim
+		for dut : cpu
+			use entity work.cpu_sequential(rtl)
+				generic map(
+					overlap_fetch => true
+				);
+			for rtl
+				for register_file : registers
+					use entity work.registers(sim);
+				end for;
+			end for;
+		end for;
+	end for;
+end configuration;
@@ -0,0 +1,367 @@
+library ieee;
+use ieee.std_logic_1164.ALL;
+use ieee.numeric_std.ALL;
+use ieee.math_real.ALL;
+
+use work.bss2k.ALL;
+
+library std;
+use std.env.finish;
+
+-- Runs a randomly generated load/store program on two cores, one with the
+-- data cache in front of a memory with PCIe-like latency, one directly on
+-- memory, and compares the memory images after both have stopped and the
+-- cache has been flushed.
+entity tb_dcache is
+	generic(
+		-- seed for the program generator
+		seed : positive := 1;
+		-- number of random instructions
+		program_length : positive := 500;
+		-- cache geometry, small by default to force evictions
+		line_words : positive := 4;
+		sets : positive := 16;
+		-- cycles until a memory access is acknowledged
+		latency : natural := 20
+	);
+end entity;
+
+architecture sim of tb_dcache is
+	signal reset : std_logic;
+	signal clk : std_logic := '0';
+
+	-- program memory, shared by both cores
+	constant rom_start : integer := to_integer(unsigned(entry_point));
+	-- address registers, stack pointer, stores of the value registers, HALT
+	constant rom_size : integer := program_length + 16;
+
+	type insn_mem is array(0 to rom_size - 1) of instruction;
+	signal rom : insn_mem := (others => (others => '0'));
+
+	-- data memory, indexed by word
+	constant data_start : integer := 16#1000#;
+	constant data_end : integer := 16#1fff#;
+	constant result_start : integer := 16#2000#;
+	constant stack_top : integer := 16#3ffc#;
+	constant mem_words : integer := 16#4000# / 4;
+
+	type data_mem is array(0 to mem_words - 1) of word;
+
+	type bus_record is record
+		i_addr : address;
+		i_rdreq : std_logic;
+		i_rddata : instruction;
+		i_waitrequest : std_logic;
+		d_addr : address;
+		d_rdreq : std_logic;
+		d_rddata : word;
+		d_wrreq : std_logic;
+		d_wrdata : word;
+		d_waitrequest : std_logic;
+		halted : std_logic;
+	end record;
+
+	-- reference core, directly on memory
+	signal ref : bus_record;
+	signal ref_mem : data_mem := (others => (others => '0'));
+	signal ref_cycles : natural;
+
+	-- core with data cache
+	signal dut : bus_record;
+	signal dut_mem : data_mem := (others => (others => '0'));
+	signal dut_cycles : natural;
+
+	signal m_addr : address;
+	signal m_rdreq : std_logic;
+	signal m_rddata : word;
+	signal m_wrreq : std_logic;
+	signal m_wrdata : word;
+	signal m_waitrequest : std_logic;
+
+	signal clean : std_logic;
+	signal hits : std_logic_vector(63 downto 0);
+	signal misses : std_logic_vector(63 downto 0);
+
+	function fetch(signal rom : insn_mem; a : address) return instruction is
+		variable n : integer;
+	begin
+		n := (to_integer(unsigned(a)) - rom_start) / 8;
+		if(n < 0 or n >= rom_size) then
+			return (others => '0');
+		end if;
+		return rom(n);
+	end function;
+
+	function word_index(a : address) return integer is
+	begin
+		return to_integer(unsigned(a)) / 4;
+	end function;
+begin
+	-- reset gen
+	reset <= '1', '0' after 100 ns;
+
+	-- clk gen
+	clk <= not clk after 4 ns;
+
+	-- sim timeout
+	process is
+	begin
+		wait for 10 ms;
+		report "sim timeout" severity error;
+		finish;
+	end process;
+
+	-- program generator
+	process is
+		variable seed1 : positive := seed;
+		variable seed2 : positive := 1;
+		variable x : real;
+		variable n : integer;
+		variable depth : natural;
+
+		-- value registers r0..r7, address registers r8..r11
+		constant value_regs : natural := 8;
+		constant addr_regs : natural := 4;
+
+		impure function random(constant range_size : in positive) return natural is
+		begin
+			uniform(seed1, seed2, x);
+			return integer(trunc(x * real(range_size)));
+		end function;
+
+		impure function random_data_address return word is
+		begin
+			return std_logic_vector(to_unsigned((data_start / 4 + random((data_end - data_start) / 4 + 1)) * 4, word'length));
+		end function;
+
+		impure function value_reg return reg is
+		begin
+			return std_logic_vector(to_unsigned(random(value_regs), reg'length));
+		end function;
+
+		impure function addr_reg return reg is
+		begin
+			return std_logic_vector(to_unsigned(value_regs + random(addr_regs), reg'length));
+		end function;
+
+		procedure emit(constant opcode : in std_logic_vector(15 downto 0);
+				constant r1, r2, r3 : in reg;
+				constant c : in word) is
+			variable i : instruction;
+		begin
+			i := opcode & r1 & r2 & c;
+			if(r3 /= x"00") then
+				i(31 downto 24) := r3;
+			end if;
+			rom(n) <= i;
+			n := n + 1;
+		end procedure;
+	begin
+		n := 0;
+		depth := 0;
+		emit(x"0000", x"ff", x"00", x"00", std_logic_vector(to_unsigned(stack_top, word'length)));
+		for r in 0 to addr_regs - 1 loop
+			emit(x"0000", std_logic_vector(to_unsigned(value_regs + r, reg'length)), x"00", x"00", random_data_address);
+		end loop;
+		for k in 1 to program_length loop
+			case random(9) is
+				when 0 =>
+					-- LI
+					emit(x"0000", value_reg, x"00", x"00", std_logic_vector(to_unsigned(random(2 ** 30), word'length)));
+				when 1 =>
+					-- ST abs
+					emit(x"0003", value_reg, x"00", x"00", random_data_address);
+				when 2 =>
+					-- LD abs
+					emit(x"0001", value_reg, x"00", x"00", random_data_address);
+				when 3 =>
+					-- LI address register
+					emit(x"0000", addr_reg, x"00", x"00", random_data_address);
+				when 4 =>
+					-- ST [r]
+					emit(x"0005", addr_reg, value_reg, x"00", x"00000000");
+				when 5 =>
+					-- LD [r]
+					emit(x"0004", value_reg, addr_reg, x"00", x"00000000");
+				when 6 =>
+					-- ADD
+					emit(x"0007", value_reg, value_reg, value_reg, x"00000000");
+				when 7 =>
+					-- PUSH
+					emit(x"0015", value_reg, x"00", x"00", x"00000000");
+					depth := depth + 1;
+				when others =>
+					-- POP if anything is on the stack, LI otherwise
+					if(depth > 0) then
+						emit(x"0016", value_reg, x"00", x"00", x"00000000");
+						depth := depth - 1;
+					else
+						emit(x"0000", value_reg, x"00", x"00", std_logic_vector(to_unsigned(random(2 ** 30), word'length)));
+					end if;
+			end case;
+		end loop;
+		-- store all value registers, so registers are compared as well
+		for r in 0 to value_regs - 1 loop
+			emit(x"0003", std_logic_vector(to_unsigned(r, reg'length)), x"00", x"00",
+				std_logic_vector(to_unsigned(result_start + 4 * r, word'length)));
+		end loop;
+		emit(x"0006", x"00", x"00", x"00", x"00000000");
+		wait;
+	end process;
+
+	-- instruction buses, no wait states
+	ref.i_rddata <= fetch(rom, ref.i_addr) when ref.i_rdreq = '1' else (others => 'U');
+	ref.i_waitrequest <= '0';
+	dut.i_rddata <= fetch(rom, dut.i_addr) when dut.i_rdreq = '1' else (others => 'U');
+	dut.i_waitrequest <= '0';
+
+	-- reference data bus, no wait states
+	ref.d_rddata <= ref_mem(word_index(ref.d_addr)) when ref.d_rdreq = '1' else (others => 'U');
+	ref_mem(word_index(ref.d_addr)) <= ref.d_wrdata when rising_edge(clk) and ref.d_wrreq = '1';
+	ref.d_waitrequest <= '0';
+
+	-- cached data bus, memory with fixed latency
+	process(reset, clk) is
+		type state is (idle, waiting, done);
+		variable s : state;
+		variable delay : natural;
+	begin
+		if(?? reset) then
+			s := idle;
+			m_rddata <= (others => 'U');
+			m_waitrequest <= '1';
+		elsif(rising_edge(clk)) then
+			m_rddata <= (others => 'U');
+			m_waitrequest <= '1';
+			case s is
+				when idle =>
+					if(m_rdreq = '1' or m_wrreq = '1') then
+						delay := latency;
+						s := waiting;
+					end if;
+				when waiting =>
+					if(delay = 0) then
+						if(?? m_wrreq) then
+							dut_mem(word_index(m_addr)) <= m_wrdata;
+						else
+							m_rddata <= dut_mem(word_index(m_addr));
+						end if;
+						m_waitrequest <= '0';
+						s := done;
+					else
+						delay := delay - 1;
+					end if;
+				when done =>
+					-- request is still asserted while waitrequest is low
+					s := idle;
+			end case;
+		end if;
+	end process;
+
+	-- cycle counters
+	process(reset, clk) is
+	begin
+		if(?? reset) then
+			ref_cycles <= 0;
+			dut_cycles <= 0;
+		elsif(rising_edge(clk)) then
+			if(ref.halted = '0') then
+				ref_cycles <= ref_cycles + 1;
+			end if;
+			if(dut.halted = '0') then
+				dut_cycles <= dut_cycles + 1;
+			end if;
+		end if;
+	end process;
+
+	-- compare results
+	process is
+		variable errors : natural;
+	begin
+		wait until ref.halted = '1' and dut.halted = '1' and clean = '1';
+		wait until rising_edge(clk);
+		report "reference cycles: " & natural'image(ref_cycles) &
+			", cached cycles: " & natural'image(dut_cycles);
+		report "hits: " & natural'image(to_integer(unsigned(hits))) &
+			", misses: " & natural'image(to_integer(unsigned(misses)));
+		errors := 0;
+		for a in ref_mem'range loop
+			if(ref_mem(a) /= dut_mem(a)) then
+				report "mismatch at " & to_hstring(to_unsigned(a * 4, address_width)) &
+					": expected " & to_hstring(ref_mem(a)) &
+					", got " & to_hstring(dut_mem(a))
+					severity error;
+				errors := errors + 1;
+			end if;
+		end loop;
+		assert errors = 0 report natural'image(errors) & " words differ" severity error;
+		finish;
+	end process;
+
+	ref_core : entity work.cpu_sequential
+		port map(
+			reset => reset,
+			clk => clk,
+			i_addr => ref.i_addr,
+			i_rdreq => ref.i_rdreq,
+			i_rddata => ref.i_rddata,
+			i_waitrequest => ref.i_waitrequest,
+			d_addr => ref.d_addr,
+			d_rdreq => ref.d_rdreq,
+			d_rddata => ref.d_rddata,
+			d_wrreq => ref.d_wrreq,
+			d_wrdata => ref.d_wrdata,
+			d_waitrequest => ref.d_waitrequest,
+			halted => ref.halted,
+			assertion_failed => open
+		);
+
+	cache : entity work.dcache
+		generic map(
+			line_words => line_words,
+			sets => sets
+		)
+		port map(
+			reset => reset,
+			clk => clk,
+			d_addr => dut.d_addr,
+			d_rdreq => dut.d_rdreq,
+			d_rddata => dut.d_rddata,
+			d_wrreq => dut.d_wrreq,
+			d_wrdata => dut.d_wrdata,
+			d_waitrequest => dut.d_waitrequest,
+			m_addr => m_addr,
+			m_rdreq => m_rdreq,
+			m_rddata => m_rddata,
+			m_wrreq => m_wrreq,
+			m_wrdata => m_wrdata,
+			m_waitrequest => m_waitrequest,
+			-- written back when the CPU stops, like in the toplevel
+			flush => dut.halted,
+			clean => clean,
+			-- no instruction cache
+			sync_addr => (others => '0'),
+			sync_req => '0',
+			sync_waitrequest => open,
+			hits => hits,
+			misses => misses
+		);
+
+	dut_core : entity work.cpu_sequential
+		port map(
+			reset => reset,
+			clk => clk,
+			i_addr => dut.i_addr,
+			i_rdreq => dut.i_rdreq,
+			i_rddata => dut.i_rddata,
+			i_waitrequest => dut.i_waitrequest,
+			d_addr => dut.d_addr,
+			d_rdreq => dut.d_rdreq,
+			d_rddata => dut.d_rddata,
+			d_wrreq => dut.d_wrreq,
+			d_wrdata => dut.d_wrdata,
+			d_waitrequest => dut.d_waitrequest,
+			halted => dut.halted,
+			assertion_failed => open
+		);
+end architecture;
@@ -0,0 +1,187 @@
+library ieee;
+use ieee.std_logic_1164.ALL;
+use ieee.numeric_std.ALL;
+use ieee.math_real.ALL;
+
+use work.bss2k.ALL;
+
+library std;
+use std.env.finish;
+
+-- Divides all pairs of a set of corner values, then random pairs with
+-- random lengths, and compares against numeric_std. Reports the cycles
+-- taken, and fails if a division takes longer than its quotient length
+-- allows.
+entity tb_divider is
+	generic(
+		-- seed for the operand generator
+		seed : positive := 1;
+		-- number of random divisions
+		iterations : positive := 10000
+	);
+end entity;
+
+architecture sim of tb_divider is
+	signal reset : std_logic;
+	signal clk : std_logic := '0';
+
+	signal start : std_logic;
+	signal dividend : word;
+	signal divisor : word;
+	signal busy : std_logic;
+	signal quotient : word;
+	signal remainder : word;
+
+	type word_list is array(natural range <>) of word;
+
+	constant corners : word_list := (
+		x"00000000", x"00000001", x"00000002", x"00000003",
+		x"00000004", x"00000005", x"00000007", x"0000ffff",
+		x"00010000", x"00010001", x"55555555", x"7fffffff",
+		x"80000000", x"80000001", x"aaaaaaaa", x"fffffffe",
+		x"ffffffff");
+begin
+	reset <= '1', '0' after 100 ns;
+
+	clk <= not clk after 4 ns;
+
+	timeout : process is
+	begin
+		wait for 100 ms;
+		report "sim timeout" severity error;
+		finish;
+	end process;
+
+	stimuli : process is
+		variable seed1 : positive := seed;
+		variable seed2 : positive := 1;
+		variable x : real;
+
+		variable errors : natural;
+		variable divisions : natural;
+		variable total_cycles : natural;
+		variable max_cycles : natural;
+
+		impure function random(constant range_size : in positive) return natural is
+		begin
+			uniform(seed1, seed2, x);
+			return integer(trunc(x * real(range_size)));
+		end function;
+
+		-- random value with a random number of significant bits
+		impure function random_word return word is
+			variable bits : natural;
+			variable v : word;
+		begin
+			bits := random(word_size + 1);
+			for k in v'range loop
+				if(k < bits and random(2) = 1) then
+					v(k) := '1';
+				else
+					v(k) := '0';
+				end if;
+			end loop;
+			return v;
+		end function;
+
+		procedure tick is
+		begin
+			wait until rising_edge(clk);
+		end procedure;
+
+		procedure divide(constant n, d : in word) is
+			variable cycles : natural;
+			variable expected_q, expected_r : word;
+			variable limit : natural;
+		begin
+			dividend <= n;
+			divisor <= d;
+			start <= '1';
+			tick;
+			start <= '0';
+			dividend <= (others => 'U');
+			divisor <= (others => 'U');
+			cycles := 1;
+			tick;
+			while busy = '1' loop
+				cycles := cycles + 1;
+				tick;
+			end loop;
+
+			if(unsigned(d) = 0) then
+				expected_q := (others => '1');
+				expected_r := n;
+			else
+				expected_q := std_logic_vector(unsigned(n) / unsigned(d));
+				expected_r := std_logic_vector(unsigned(n) rem unsigned(d));
+			end if;
+			if(quotient /= expected_q or remainder /= expected_r) then
+				report to_hstring(n) & " / " & to_hstring(d) & " = " &
+					to_hstring(quotient) & " rem " & to_hstring(remainder) &
+					", expected " & to_hstring(expected_q) & " rem " & to_hstring(expected_r)
+					severity error;
+				errors := errors + 1;
+			end if;
+
+			-- one cycle for the start, one per base 4 digit of the
+			-- quotient, and possibly one for a leading zero digit
+			limit := 1;
+			for k in 0 to word_size / 2 - 1 loop
+				if(unsigned(expected_q) >= shift_left(to_unsigned(1, word_size + 2), 2 * k)) then
+					limit := k + 3;
+				end if;
+			end loop;
+			if(unsigned(d) = 0) then
+				limit := 1;
+			end if;
+			if(cycles > limit) then
+				report to_hstring(n) & " / " & to_hstring(d) & " took " & natural'image(cycles) &
+					" cycles, expected at most " & natural'image(limit)
+					severity error;
+				errors := errors + 1;
+			end if;
+
+			divisions := divisions + 1;
+			total_cycles := total_cycles + cycles;
+			if(cycles > max_cycles) then
+				max_cycles := cycles;
+			end if;
+		end procedure;
+	begin
+		start <= '0';
+		errors := 0;
+		divisions := 0;
+		total_cycles := 0;
+		max_cycles := 0;
+		wait until reset = '0';
+		tick;
+
+		for i in corners'range loop
+			for j in corners'range loop
+				divide(corners(i), corners(j));
+			end loop;
+		end loop;
+
+		for i in 1 to iterations loop
+			divide(random_word, random_word);
+		end loop;
+
+		report natural'image(divisions) & " divisions, " &
+			natural'image(total_cycles) & " cycles, at most " &
+			natural'image(max_cycles) & " per division";
+		assert errors = 0 report natural'image(errors) & " errors" severity error;
+		finish;
+	end process;
+
+	dut : entity work.divider
+		port map(
+			reset => reset,
+			clk => clk,
+			start => start,
+			dividend => dividend,
+			divisor => divisor,
+			busy => busy,
+			quotient => quotient,
+			remainder => remainder
+		);
+end architecture;
@@ -0,0 +1,401 @@
+library ieee;
+use ieee.std_logic_1164.ALL;
+use ieee.numeric_std.ALL;
+
+use work.bss2k.ALL;
+
+library std;
+use std.env.finish;
+
+-- Runs hello_world against a memory with PCIe-like latency, with and
+-- without the instruction cache, and reports the resulting CPI.
+--
+-- With self_modifying, runs a program that executes an instruction, stores
+-- a new immediate into it and executes it again, with data going through
+-- the data cache into the same memory.
+entity tb_icache is
+	generic(
+		-- insert instruction cache
+		cached : boolean := true;
+		-- store into code, needs the cache
+		self_modifying : boolean := false;
+		-- cache geometry
+		line_words : positive := 4;
+		sets : positive := 64;
+		ways : positive range 1 to 2 := 1;
+		-- cycles until first word of a read is returned
+		latency : natural := 100
+	);
+end entity;
+
+architecture sim of tb_icache is
+	signal reset : std_logic;
+	signal clk : std_logic := '0';
+
+	-- CPU instruction bus
+	signal i_addr : address;
+	signal i_rddata : instruction;
+	signal i_rdreq : std_logic;
+	signal i_waitrequest : std_logic;
+
+	-- memory instruction bus
+	signal m_addr : address;
+	signal m_burstcount : natural range 1 to line_words;
+	signal m_rdreq : std_logic;
+	signal m_rddata : instruction;
+	signal m_rddatavalid : std_logic;
+	signal m_waitrequest : std_logic;
+
+	signal sync_req : std_logic;
+	signal sync_waitrequest : std_logic;
+
+	signal d_addr : address;
+	signal d_rddata : word;
+	signal d_rdreq : std_logic;
+	signal d_wrdata : word;
+	signal d_wrreq : std_logic;
+	signal d_waitrequest : std_logic;
+
+	-- data cache memory side
+	signal dm_addr : address;
+	signal dm_rdreq : std_logic;
+	signal dm_rddata : word;
+	signal dm_wrreq : std_logic;
+	signal dm_wrdata : word;
+	signal dm_waitrequest : std_logic;
+	signal dcache_clean : std_logic;
+
+	signal halted : std_logic;
+
+	signal hits : std_logic_vector(63 downto 0);
+	signal misses : std_logic_vector(63 downto 0);
+
+	constant rom_size : integer := 256;
+	constant rom_start : integer := to_integer(unsigned(entry_point));
+	constant rom_end : integer := rom_start + rom_size - 1;
+
+	type insn_mem is array(rom_start to rom_end) of instruction;
+	signal i : insn_mem := (others => (others => '0'));
+
+	-- self-modifying program: the instruction rewritten, and where the
+	-- value it loaded the second time is stored
+	constant smc_target : integer := rom_start + 8 * 1;
+	constant smc_result : integer := rom_start + 8 * 15;
+	constant smc_old_value : word := x"11111111";
+	constant smc_new_value : word := x"22222222";
+
+	type data_mem is array(16#0000# to 16#ffff#) of word;
+	signal d : data_mem;
+
+	-- memory outside the ROM reads as zero
+	function fetch(signal i : insn_mem; a : integer) return instruction is
+	begin
+		if(a < rom_start or a > rom_end) then
+			return (others => '0');
+		end if;
+		return i(a);
+	end function;
+
+	signal cycles : natural;
+	signal instructions : natural;
+begin
+	-- reset gen
+	reset <= '1', '0' after 100 ns;
+
+	-- clk gen
+	clk <= not clk after 4 ns;
+
+	-- sim timeout
+	process is
+	begin
+		wait for 1 ms;
+		report "sim timeout" severity error;
+		finish;
+	end process;
+
+	-- normal exit
+	process is
+	begin
+		wait until halted = '1';
+		wait until rising_edge(clk);
+		report "cycles: " & natural'image(cycles) &
+			", instructions: " & natural'image(instructions) &
+			", CPI: " & real'image(real(cycles) / real(instructions));
+		if(cached) then
+			report "hits: " & natural'image(to_integer(unsigned(hits))) &
+				", misses: " & natural'image(to_integer(unsigned(misses)));
+			assert to_integer(unsigned(hits)) + to_integer(unsigned(misses)) = instructions
+				report "every instruction should be counted once" severity error;
+		end if;
+		if(self_modifying) then
+			if(dcache_clean /= '1') then
+				wait until dcache_clean = '1';
+			end if;
+			wait until rising_edge(clk);
+			assert i(smc_result)(31 downto 0) = smc_new_value
+				report "stale instruction executed after store: " &
+					to_hstring(i(smc_result)(31 downto 0)) severity error;
+		end if;
+		finish;
+	end process;
+
+	-- statistics
+	process(reset, clk) is
+	begin
+		if(?? reset) then
+			cycles <= 0;
+			instructions <= 0;
+		elsif(rising_edge(clk)) then
+			if(halted = '0') then
+				cycles <= cycles + 1;
+				if(i_waitrequest = '0') then
+					instructions <= instructions + 1;
+					assert i_rddata = fetch(i, to_integer(unsigned(i_addr)))
+						report "wrong instruction returned" severity error;
+				end if;
+			end if;
+		end if;
+	end process;
+
+	-- memory, returns instruction bursts after a fixed latency. The data
+	-- cache reads and writes the same memory a word at a time, the word at
+	-- the lower address is the upper half of an instruction.
+	process(reset, clk) is
+		type insn_file_type is file of character;
+		file rom : insn_file_type;
+		variable fstatus : file_open_status;
+		variable t : character;
+		variable a : instruction;
+		variable x : integer;
+		variable loaded : boolean := false;
+
+		type state is (idle, waiting, transfer, done);
+		variable s : state;
+		variable delay : natural;
+		variable base : integer;
+		variable count : natural;
+		variable beat : natural;
+
+		variable ds : state;
+		variable d_delay : natural;
+		variable d_base : integer;
+
+		function insn(op : std_logic_vector(15 downto 0); r1, r2 : natural; c : word) return instruction is
+		begin
+			return op & std_logic_vector(to_unsigned(r1, 8)) & std_logic_vector(to_unsigned(r2, 8)) & c;
+		end function;
+
+		function imm(n : integer) return word is
+		begin
+			return std_logic_vector(to_unsigned(n, word'length));
+		end function;
+	begin
+		if(?? reset) then
+			if(not loaded) then
+				if(self_modifying) then
+					-- LI r2, 0
+					i(rom_start) <= insn(x"0000", 2, 0, imm(0));
+					-- LI r0, old value, rewritten below
+					i(smc_target) <= insn(x"0000", 0, 0, smc_old_value);
+					-- second time around, store r0 and halt
+					i(rom_start + 8 * 2) <= insn(x"001b", 2, 0, imm(rom_start + 8 * 5));
+					i(rom_start + 8 * 3) <= insn(x"0003", 0, 0, imm(smc_result + 4));
+					i(rom_start + 8 * 4) <= insn(x"0006", 0, 0, imm(0));
+					-- store the new immediate and jump back
+					i(rom_start + 8 * 5) <= insn(x"0000", 2, 0, imm(1));
+					i(rom_start + 8 * 6) <= insn(x"0000", 3, 0, smc_new_value);
+					i(rom_start + 8 * 7) <= insn(x"0003", 3, 0, imm(smc_target + 4));
+					i(rom_start + 8 * 8) <= insn(x"0019", 0, 0, imm(smc_target));
+				else
+					file_open(fstatus, rom, "../roms/hello_world.backseat", read_mode);
+					x := i'low;
+					while not endfile(rom) loop
+						a := (others => '0');
+						for y in 0 to 7 loop
+							read(rom, t);
+							a := a(55 downto 0) & std_logic_vector(to_unsigned(character'pos(t), 8));
+						end loop;
+						i(x) <= a;
+						-- increment by eight, because instructions are 64 bit
+						x := x + 8;
+					end loop;
+				end if;
+				loaded := true;
+			end if;
+			s := idle;
+			ds := idle;
+			m_rddata <= (others => 'U');
+			m_rddatavalid <= '0';
+			m_waitrequest <= '1';
+			dm_rddata <= (others => 'U');
+			dm_waitrequest <= '1';
+		elsif(rising_edge(clk)) then
+			m_rddata <= (others => 'U');
+			m_rddatavalid <= '0';
+			m_waitrequest <= '1';
+			case s is
+				when idle =>
+					if(?? m_rdreq) then
+						base := to_integer(unsigned(m_addr));
+						count := m_burstcount;
+						beat := 0;
+						delay := latency;
+						s := waiting;
+					end if;
+				when waiting =>
+					if(delay = 0) then
+						s := transfer;
+					else
+						delay := delay - 1;
+					end if;
+				when transfer =>
+					m_rddata <= fetch(i, base + 8 * beat);
+					m_rddatavalid <= '1';
+					if(beat = count - 1) then
+						m_waitrequest <= '0';
+						s := done;
+					else
+						beat := beat + 1;
+					end if;
+				when done =>
+					-- request is still asserted while waitrequest is low
+					s := idle;
+			end case;
+
+			dm_rddata <= (others => 'U');
+			dm_waitrequest <= '1';
+			case ds is
+				when idle =>
+					if(dm_rdreq = '1' or dm_wrreq = '1') then
+						d_delay := latency;
+						ds := waiting;
+					end if;
+				when waiting =>
+					if(d_delay = 0) then
+						d_base := to_integer(unsigned(dm_addr)) / 8 * 8;
+						if(d_base < rom_start or d_base > rom_end) then
+							assert dm_wrreq = '0' report "data write outside of memory" severity error;
+							dm_rddata <= (others => '0');
+						elsif(dm_addr(2) = '0') then
+							if(?? dm_wrreq) then
+								i(d_base)(63 downto 32) <= dm_wrdata;
+							else
+								dm_rddata <= i(d_base)(63 downto 32);
+							end if;
+						else
+							if(?? dm_wrreq) then
+								i(d_base)(31 downto 0) <= dm_wrdata;
+							else
+								dm_rddata <= i(d_base)(31 downto 0);
+							end if;
+						end if;
+						dm_waitrequest <= '0';
+						ds := done;
+					else
+						d_delay := d_delay - 1;
+					end if;
+				when others =>
+					-- request is still asserted while waitrequest is low
+					ds := idle;
+			end case;
+		end if;
+	end process;
+
+	-- data bus
+	flat_data : if(not self_modifying) generate
+		d_rddata <= d(to_integer(unsigned(d_addr))) when d_rdreq = '1' else (others => 'U');
+		d(to_integer(unsigned(d_addr))) <= d_wrdata when rising_edge(clk) and d_wrreq = '1';
+		d_waitrequest <= '0';
+		sync_waitrequest <= '0';
+		dcache_clean <= '1';
+	end generate;
+
+	cached_data : if(self_modifying) generate
+		assert cached report "self_modifying needs the instruction cache" severity failure;
+
+		data_cache : entity work.dcache
+			generic map(
+				sync_bytes => line_words * 8
+			)
+			port map(
+				reset => reset,
+				clk => clk,
+				d_addr => d_addr,
+				d_rdreq => d_rdreq,
+				d_rddata => d_rddata,
+				d_wrreq => d_wrreq,
+				d_wrdata => d_wrdata,
+				d_waitrequest => d_waitrequest,
+				m_addr => dm_addr,
+				m_rdreq => dm_rdreq,
+				m_rddata => dm_rddata,
+				m_wrreq => dm_wrreq,
+				m_wrdata => dm_wrdata,
+				m_waitrequest => dm_waitrequest,
+				-- written back when the CPU stops, like in the toplevel
+				flush => halted,
+				clean => dcache_clean,
+				sync_addr => m_addr,
+				sync_req => sync_req,
+				sync_waitrequest => sync_waitrequest,
+				hits => open,
+				misses => open
+			);
+	end generate;
+
+	with_cache : if(cached) generate
+		cache : entity work.icache
+			generic map(
+				line_words => line_words,
+				sets => sets,
+				ways => ways
+			)
+			port map(
+				reset => reset,
+				clk => clk,
+				i_addr => i_addr,
+				i_rdreq => i_rdreq,
+				i_rddata => i_rddata,
+				i_waitrequest => i_waitrequest,
+				m_addr => m_addr,
+				m_burstcount => m_burstcount,
+				m_rdreq => m_rdreq,
+				m_rddata => m_rddata,
+				m_rddatavalid => m_rddatavalid,
+				m_waitrequest => m_waitrequest,
+				sync_req => sync_req,
+				sync_waitrequest => sync_waitrequest,
+				snoop_addr => d_addr,
+				snoop_wrreq => d_wrreq,
+				hits => hits,
+				misses => misses
+			);
+	end generate;
+
+	without_cache : if(not cached) generate
+		m_addr <= i_addr;
+		m_burstcount <= 1;
+		m_rdreq <= i_rdreq;
+		i_rddata <= m_rddata;
+		i_waitrequest <= m_waitrequest;
+	end generate;
+
+	-- dut
+	dut : entity work.cpu_sequential
+		port map(
+			reset => reset,
+			clk => clk,
+			i_addr => i_addr,
+			i_rdreq => i_rdreq,
+			i_rddata => i_rddata,
+			i_waitrequest => i_waitrequest,
+			d_addr => d_addr,
+			d_rdreq => d_rdreq,
+			d_rddata => d_rddata,
+			d_wrreq => d_wrreq,
+			d_wrdata => d_wrdata,
+			d_waitrequest => d_waitrequest,
+			halted => halted,
+			assertion_failed => open
+		);
+end architecture;
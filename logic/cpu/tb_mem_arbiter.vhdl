@@ -1,5 +1,6 @@
 library ieee;
 use ieee.std_logic_1164.ALL;
+use ieee.numeric_std.ALL;
 
 library std;
 use std.env.finish;
@@ -7,7 +8,14 @@ use std.env.finish;
 use work.bss2k.ALL;
 
 entity tb_mem_arbiter is
-begin
+	generic(
+		-- width of the combined bus, 32 or 64
+		comb_width : positive := 32;
+		-- cycles until the memory acknowledges an access
+		latency : natural := 0;
+		-- number of instruction/load/store sequences to run
+		iterations : positive := 16
+	);
 end entity;
 
 architecture sim of tb_mem_arbiter is
@@ -19,10 +27,11 @@ architecture sim of tb_mem_arbiter is
 
 	-- combined (Avalon-MM)
 	signal comb_addr : address;
+	signal comb_byteenable : std_logic_vector(comb_width / byte_size - 1 downto 0);
 	signal comb_rdreq : std_logic;
-	signal comb_rddata : word;
+	signal comb_rddata : std_logic_vector(comb_width - 1 downto 0);
 	signal comb_wrreq : std_logic;
-	signal comb_wrdata : word;
+	signal comb_wrdata : std_logic_vector(comb_width - 1 downto 0);
 	signal comb_waitrequest : std_logic;
 
 	-- insn bus (Avalon-MM)
@@ -38,6 +47,15 @@ architecture sim of tb_mem_arbiter is
 	signal d_wrreq : std_logic;
 	signal d_wrdata : word;
 	signal d_waitrequest : std_logic;
+
+	-- statistics
+	signal transactions : natural;
+
+	-- memory contents: every word holds its own address
+	function contents(a : address) return word is
+	begin
+		return x"00" & a;
+	end function;
 begin
 	reset <= '1', '0' after 1 us;
 
@@ -45,12 +63,15 @@ begin
 
 	timeout : process is
 	begin
-		wait for 100 us;
+		wait for 10 ms;
 		report "sim timeout" severity error;
 		finish;
 	end process;
 
 	stimuli : process is
+		variable start : time;
+		variable a : address;
+
 		procedure tick is
 		begin
 			wait until rising_edge(clk);
@@ -61,60 +82,110 @@ begin
 		d_wrreq <= '0';
 		wait until reset = '0';
 		tick;
-		i_rdreq <= '1';
-		i_addr <= x"000000";
-		tick;
-		while i_waitrequest = '1' loop
+		start := now;
+		for n in 0 to iterations - 1 loop
+			-- instruction fetch
+			a := std_logic_vector(to_unsigned(n * 8, address_width));
+			i_rdreq <= '1';
+			i_addr <= a;
 			tick;
-		end loop;
-		i_rdreq <= '0';
-		d_rdreq <= '1';
-		d_addr <= x"123456";
-		tick;
-		while d_waitrequest = '1' loop
+			while i_waitrequest = '1' loop
+				tick;
+			end loop;
+			assert i_rddata = contents(a) & contents(a xor x"000004")
+				report "wrong instruction read" severity error;
+			i_rdreq <= '0';
+			-- load, alternating between both halves of a 64 bit word
+			a := std_logic_vector(to_unsigned(16#123450# + n * 4, address_width));
+			d_rdreq <= '1';
+			d_addr <= a;
 			tick;
-		end loop;
-		d_rdreq <= '0';
-		d_wrreq <= '1';
-		d_addr <= x"654321";
-		d_wrdata <= x"2468ace0";
-		tick;
-		while d_waitrequest = '1' loop
+			while d_waitrequest = '1' loop
+				tick;
+			end loop;
+			assert d_rddata = contents(a)
+				report "wrong data read" severity error;
+			d_rdreq <= '0';
+			-- store
+			a := std_logic_vector(to_unsigned(16#654320# + n * 4, address_width));
+			d_wrreq <= '1';
+			d_addr <= a;
+			d_wrdata <= contents(a);
 			tick;
+			while d_waitrequest = '1' loop
+				tick;
+			end loop;
+			d_wrreq <= '0';
 		end loop;
 
+		report "combined bus " & natural'image(comb_width) & " bit: " &
+			natural'image(transactions) & " transactions, " &
+			natural'image((now - start) / 200 ns) & " cycles";
 
 		finish;
 	end process;
 
 	memory : process(reset, clk) is
-		type state is (idle, read, write);
+		type state is (idle, busy, done);
 		variable s : state;
+		variable delay : natural;
+		variable expected : word;
 	begin
 		if(reset = '1') then
 			s := idle;
+			comb_waitrequest <= '1';
+			transactions <= 0;
 		elsif(rising_edge(clk)) then
+			comb_waitrequest <= '1';
+			comb_rddata <= (others => 'U');
 			case s is
 				when idle =>
-					if(comb_rdreq = '1') then
-						comb_waitrequest <= '1';
-						s := read;
-					elsif(comb_wrreq = '1') then
-						comb_waitrequest <= '1';
-						s := write;
+					if(comb_rdreq = '1' or comb_wrreq = '1') then
+						delay := latency;
+						transactions <= transactions + 1;
+						s := busy;
 					end if;
-				when read =>
-					comb_rddata <= x"00" & comb_addr;
-					comb_waitrequest <= '0';
-					s := idle;
-				when write =>
-					comb_waitrequest <= '0';
+				when busy =>
+					if(delay /= 0) then
+						delay := delay - 1;
+					elsif(?? comb_rdreq) then
+						if(comb_width = instruction_size) then
+							assert comb_addr(2 downto 0) = "000"
+								report "unaligned access on 64 bit bus" severity error;
+							comb_rddata <= contents(comb_addr) & contents(comb_addr xor x"000004");
+						else
+							comb_rddata <= contents(comb_addr);
+						end if;
+						comb_waitrequest <= '0';
+						s := done;
+					else
+						expected := contents(d_addr);
+						if(comb_width = instruction_size) then
+							if(d_addr(2) = '0') then
+								assert comb_byteenable = "11110000" and comb_wrdata(63 downto 32) = expected
+									report "wrong store to lower word" severity error;
+							else
+								assert comb_byteenable = "00001111" and comb_wrdata(31 downto 0) = expected
+									report "wrong store to upper word" severity error;
+							end if;
+						else
+							assert comb_wrdata = expected
+								report "wrong store" severity error;
+						end if;
+						comb_waitrequest <= '0';
+						s := done;
+					end if;
+				when done =>
+					-- request is still asserted while waitrequest is low
 					s := idle;
 			end case;
 		end if;
 	end process;
 
 	dut : entity work.mem_arbiter
+		generic map(
+			comb_width => comb_width
+		)
 		port map(
 			-- async
 			reset => reset,
@@ -124,6 +195,7 @@ begin
 
 			-- combined (Avalon-MM)
 			comb_addr => comb_addr,
+			comb_byteenable => comb_byteenable,
 			comb_rdreq => comb_rdreq,
 			comb_rddata => comb_rddata,
 			comb_wrreq => comb_wrreq,
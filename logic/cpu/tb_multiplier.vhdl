@@ -0,0 +1,159 @@
+library ieee;
+use ieee.std_logic_1164.ALL;
+use ieee.numeric_std.ALL;
+use ieee.math_real.ALL;
+
+use work.bss2k.ALL;
+
+library std;
+use std.env.finish;
+
+-- Multiplies all pairs of a set of corner values, then random pairs with
+-- random lengths, and compares against numeric_std. Fails if a product
+-- takes longer than the configured stages.
+entity tb_multiplier is
+	generic(
+		-- seed for the operand generator
+		seed : positive := 1;
+		-- number of random multiplications
+		iterations : positive := 10000;
+		-- multiplier register stages
+		stages : positive := 1
+	);
+end entity;
+
+architecture sim of tb_multiplier is
+	signal reset : std_logic;
+	signal clk : std_logic := '0';
+
+	signal start : std_logic;
+	signal a : word;
+	signal b : word;
+	signal busy : std_logic;
+	signal product : std_logic_vector(63 downto 0);
+
+	type word_list is array(natural range <>) of word;
+
+	constant corners : word_list := (
+		x"00000000", x"00000001", x"00000002", x"00000003",
+		x"0000ffff", x"00010000", x"00010001", x"55555555",
+		x"7fffffff", x"80000000", x"80000001", x"aaaaaaaa",
+		x"fffffffe", x"ffffffff");
+begin
+	reset <= '1', '0' after 100 ns;
+
+	clk <= not clk after 4 ns;
+
+	timeout : process is
+	begin
+		wait for 100 ms;
+		report "sim timeout" severity error;
+		finish;
+	end process;
+
+	stimuli : process is
+		variable seed1 : positive := seed;
+		variable seed2 : positive := 1;
+		variable x : real;
+
+		variable errors : natural;
+		variable multiplications : natural;
+
+		impure function random(constant range_size : in positive) return natural is
+		begin
+			uniform(seed1, seed2, x);
+			return integer(trunc(x * real(range_size)));
+		end function;
+
+		-- random value with a random number of significant bits
+		impure function random_word return word is
+			variable bits : natural;
+			variable v : word;
+		begin
+			bits := random(word_size + 1);
+			for k in v'range loop
+				if(k < bits and random(2) = 1) then
+					v(k) := '1';
+				else
+					v(k) := '0';
+				end if;
+			end loop;
+			return v;
+		end function;
+
+		procedure tick is
+		begin
+			wait until rising_edge(clk);
+		end procedure;
+
+		procedure multiply(constant op1, op2 : in word) is
+			variable cycles : natural;
+			variable expected : std_logic_vector(63 downto 0);
+		begin
+			a <= op1;
+			b <= op2;
+			start <= '1';
+			tick;
+			start <= '0';
+			a <= (others => 'U');
+			b <= (others => 'U');
+			cycles := 1;
+			tick;
+			while busy = '1' loop
+				cycles := cycles + 1;
+				tick;
+			end loop;
+
+			expected := std_logic_vector(unsigned(op1) * unsigned(op2));
+			if(product /= expected) then
+				report to_hstring(op1) & " * " & to_hstring(op2) & " = " & to_hstring(product) &
+					", expected " & to_hstring(expected)
+					severity error;
+				errors := errors + 1;
+			end if;
+			if(cycles /= stages) then
+				report to_hstring(op1) & " * " & to_hstring(op2) & " took " & natural'image(cycles) &
+					" cycles, expected " & natural'image(stages)
+					severity error;
+				errors := errors + 1;
+			end if;
+
+			multiplications := multiplications + 1;
+		end procedure;
+	begin
+		start <= '0';
+		errors := 0;
+		multiplications := 0;
+		wait until reset = '0';
+		tick;
+
+		for i in corners'range loop
+			for j in corners'range loop
+				multiply(corners(i), corners(j));
+			end loop;
+		end loop;
+
+		for i in 1 to iterations loop
+			multiply(random_word, random_word);
+		end loop;
+
+		report natural'image(multiplications) & " multiplications, " &
+			natural'image(stages) & " stages";
+		assert errors = 0 report natural'image(errors) & " errors" severity error;
+		finish;
+	end process;
+
+	dut : entity work.multiplier
+		generic map(
+			stages => stages
+		)
+		port map(
+			reset => reset,
+			clk => clk,
+			start => start,
+			a => a,
+			b => b,
+			busy => busy,
+			product => product
+		);
+end architecture;
@@ -9,6 +9,8 @@ vlib work
 vcom -2008 \
 	cpu/bss2k.vhdl \
 	cpu/altera_registers.vhd \
+	cpu/multiplier.vhdl \
+	cpu/divider.vhdl \
 	cpu/cpu_pipelined.vhdl \
 	cpu/cpu_sequential.vhdl \
 	cpu/tb_cpu.vhdl \
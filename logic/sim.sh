@@ -6,21 +6,85 @@ ghdl -r --std=08 tb_interrupt_encoder --wave=tb_interrupt_encoder.ghw
 
 ghdl -a --std=08 board_phi/avalon_mm_to_pcie_avalon_st.vhdl board_phi/tb_avalon_mm_to_pcie_avalon_st.vhdl
 ghdl -e --std=08 tb_avalon_mm_to_pcie_avalon_st
-ghdl -r --std=08 tb_avalon_mm_to_pcie_avalon_st --wave=tb_avalon_mm_to_pcie_avalon_st.ghw
+ghdl -r --std=08 tb_avalon_mm_to_pcie_avalon_st -gmax_outstanding=1 --wave=tb_avalon_mm_to_pcie_avalon_st.ghw
+ghdl -r --std=08 tb_avalon_mm_to_pcie_avalon_st -gmax_outstanding=4
+ghdl -r --std=08 tb_avalon_mm_to_pcie_avalon_st -gmax_outstanding=8 -gseed=2 -gmax_latency=200
+ghdl -r --std=08 tb_avalon_mm_to_pcie_avalon_st -gword_width=64 -gmax_outstanding=1 --wave=tb_avalon_mm_to_pcie_avalon_st_64.ghw
+ghdl -r --std=08 tb_avalon_mm_to_pcie_avalon_st -gword_width=64 -gmax_outstanding=4 -gseed=3
 
 ghdl -a --std=08 cpu/bss2k.vhdl cpu/mem_arbiter.vhdl cpu/tb_mem_arbiter.vhdl
 ghdl -e --std=08 tb_mem_arbiter
-ghdl -r --std=08 tb_mem_arbiter --wave=tb_mem_arbiter.ghw
+ghdl -r --std=08 tb_mem_arbiter -gcomb_width=32 --wave=tb_mem_arbiter.ghw
+ghdl -r --std=08 tb_mem_arbiter -gcomb_width=64 --wave=tb_mem_arbiter_64.ghw
+ghdl -r --std=08 tb_mem_arbiter -gcomb_width=32 -glatency=100
+ghdl -r --std=08 tb_mem_arbiter -gcomb_width=64 -glatency=100
+
+ghdl -a --std=08 cpu/bss2k.vhdl cpu/multiplier.vhdl cpu/divider.vhdl cpu/tb_multiplier.vhdl cpu/tb_divider.vhdl
+ghdl -e --std=08 tb_multiplier
+ghdl -r --std=08 tb_multiplier --wave=tb_multiplier.ghw
+ghdl -r --std=08 tb_multiplier -gstages=3 -gseed=2
+ghdl -e --std=08 tb_divider
+ghdl -r --std=08 tb_divider --wave=tb_divider.ghw
+ghdl -r --std=08 tb_divider -gseed=2
 
 ghdl -a --std=08 \
 	cpu/bss2k.vhdl \
+	cpu/multiplier.vhdl \
+	cpu/divider.vhdl \
 	cpu/cpu_pipelined.vhdl \
 	cpu/cpu_sequential.vhdl \
 	cpu/registers.vhdl \
 	cpu/tb_cpu.vhdl \
 	cpu/tb_cpu_sim_pipe.vhdl \
-	cpu/tb_cpu_sim_seq.vhdl
+	cpu/tb_cpu_sim_seq.vhdl \
+	cpu/tb_cpu_sim_seq_overlap.vhdl
 ghdl -e --std=08 tb_cpu_sim_seq
 ghdl -r --std=08 tb_cpu_sim_seq --wave=tb_cpu_seq.ghw
+ghdl -e --std=08 tb_cpu_sim_seq_overlap
+ghdl -r --std=08 tb_cpu_sim_seq_overlap --wave=tb_cpu_seq_overlap.ghw
 ghdl -e --std=08 tb_cpu_sim_pipe
 ghdl -r --std=08 tb_cpu_sim_pipe --wave=tb_cpu_pipe.ghw
+
+# instruction tests, assembled by "make check" in tests
+tests=${BSS2K_TESTS:-../tests/tests}
+if [ ! -f $tests/insn/call.backseat ]; then
+	echo "$tests: instruction tests not assembled, run \"make check\" there first" >&2
+	exit 1
+fi
+# jumps, calls and ADDC are only decoded by the pipelined CPU
+for config in tb_cpu_sim_seq tb_cpu_sim_seq_overlap tb_cpu_sim_pipe; do
+	for t in base/halt_insn base/assert_pass insn/add_reg_imm insn/copy_reg_imm insn/mul insn/divmod insn/load_store insn/shift; do
+		ghdl -r --std=08 $config -gprogram=$tests/$t.backseat
+	done
+	ghdl -r --std=08 $config -gprogram=$tests/base/assert_fail.backseat -gexpect_assertion=true
+done
+for t in insn/jump insn/compare insn/flags insn/carry insn/call; do
+	ghdl -r --std=08 tb_cpu_sim_pipe -gprogram=$tests/$t.backseat
+done
+
+ghdl -a --std=08 cpu/tb_cpu_cpi.vhdl
+ghdl -e --std=08 tb_cpu_cpi
+ghdl -r --std=08 tb_cpu_cpi -goverlap_fetch=false
+ghdl -r --std=08 tb_cpu_cpi -goverlap_fetch=true --wave=tb_cpu_cpi.ghw
+ghdl -r --std=08 tb_cpu_cpi -goverlap_fetch=false -glatency=0
+ghdl -r --std=08 tb_cpu_cpi -goverlap_fetch=true -glatency=0
+
+ghdl -a --std=08 cpu/tb_cpu_fetch.vhdl
+ghdl -e --std=08 tb_cpu_fetch
+ghdl -r --std=08 tb_cpu_fetch -gprefetch_depth=1 -gmax_fetches=1 --wave=tb_cpu_fetch_single.ghw
+ghdl -r --std=08 tb_cpu_fetch --wave=tb_cpu_fetch.ghw
+ghdl -r --std=08 tb_cpu_fetch -gprefetch_depth=16 -gmax_fetches=8
+
+ghdl -a --std=08 cpu/icache.vhdl cpu/dcache.vhdl cpu/tb_icache.vhdl
+ghdl -e --std=08 tb_icache
+ghdl -r --std=08 tb_icache -gcached=false --wave=tb_icache_uncached.ghw
+ghdl -r --std=08 tb_icache -gcached=true --wave=tb_icache.ghw
+ghdl -r --std=08 tb_icache -gcached=true -gways=2 --wave=tb_icache_2way.ghw
+ghdl -r --std=08 tb_icache -gself_modifying=true --wave=tb_icache_smc.ghw
+ghdl -r --std=08 tb_icache -gself_modifying=true -gways=2
+
+ghdl -a --std=08 cpu/dcache.vhdl cpu/tb_dcache.vhdl
+ghdl -e --std=08 tb_dcache
+ghdl -r --std=08 tb_dcache -gseed=1 --wave=tb_dcache.ghw
+ghdl -r --std=08 tb_dcache -gseed=2 -gline_words=1
+ghdl -r --std=08 tb_dcache -gseed=3 -gsets=1
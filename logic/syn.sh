@@ -4,3 +4,15 @@ if ! which quartus_sh 2>/dev/null; then
 	PATH=/opt/altera/16.1/quartus/bin:$PATH
 fi
 quartus_sh --flow compile bss2k.qpf
+
+# Fmax per clock, next to that of the previous run
+fmax=output_files/bss2k.fmax
+if [ -f $fmax ]; then
+	mv $fmax $fmax.old
+fi
+sed -n '/Fmax Summary/,/^$/p' output_files/bss2k.sta.rpt >$fmax
+if [ -f $fmax.old ]; then
+	diff -y $fmax.old $fmax || true
+else
+	cat $fmax
+fi
@@ -0,0 +1,393 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <bss2k_ioctl.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <endian.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* status register, see linux/bss2k.c */
+#define STS_RUNNING		(1ULL << 0)
+
+/* instructions are 64 bit aligned in 16 MiB */
+#define INSTRUCTION_SLOTS	(BSS2K_MEMORY_SIZE / 8)
+
+/* a label from the symbol map, or an address without one */
+struct entry
+{
+	uint32_t address;
+	char *name;
+	uint64_t samples;
+};
+
+struct entries
+{
+	struct entry *entry;
+	size_t count;
+	size_t size;
+};
+
+static struct entry *add_entry(struct entries *e, uint32_t address, char *name)
+{
+	if(e->count == e->size)
+	{
+		size_t const size = e->size ? e->size * 2 : 256;
+		struct entry *const entry = realloc(e->entry, size * sizeof *entry);
+		if(!entry)
+			return NULL;
+		e->entry = entry;
+		e->size = size;
+	}
+
+	struct entry *const ret = &e->entry[e->count++];
+	ret->address = address;
+	ret->name = name;
+	ret->samples = 0;
+	return ret;
+}
+
+static int compare_addresses(void const *a, void const *b)
+{
+	struct entry const *const x = a;
+	struct entry const *const y = b;
+	return (x->address > y->address) - (x->address < y->address);
+}
+
+/* most samples first */
+static int compare_samples(void const *a, void const *b)
+{
+	struct entry const *const x = a;
+	struct entry const *const y = b;
+	if(x->samples != y->samples)
+		return (x->samples < y->samples) ? 1 : -1;
+	return compare_addresses(a, b);
+}
+
+/* one label per line, a hexadecimal address and a name, separated by
+ * whitespace. Empty lines and lines starting with # are skipped. */
+static bool read_symbol_map(char const *filename, struct entries *symbols)
+{
+	FILE *const f = fopen(filename, "r");
+	if(!f)
+	{
+		perror(filename);
+		return false;
+	}
+
+	char line[256];
+	unsigned int line_number = 0;
+
+	while(fgets(line, sizeof line, f))
+	{
+		++line_number;
+
+		char *p = line + strspn(line, " \t");
+		if(*p == '#' || *p == '\n' || !*p)
+			continue;
+
+		char *end;
+		errno = 0;
+		unsigned long const address = strtoul(p, &end, 16);
+		if(errno || end == p || address >= BSS2K_MEMORY_SIZE)
+		{
+			fprintf(stderr, "%s:%u: invalid address\n", filename, line_number);
+			fclose(f);
+			return false;
+		}
+
+		p = end + strspn(end, " \t");
+		size_t const len = strcspn(p, " \t\r\n");
+		if(!len)
+		{
+			fprintf(stderr, "%s:%u: missing name\n", filename, line_number);
+			fclose(f);
+			return false;
+		}
+
+		char *const name = strndup(p, len);
+		if(!name || !add_entry(symbols, address, name))
+		{
+			perror("Cannot read symbol map");
+			fclose(f);
+			return false;
+		}
+	}
+
+	fclose(f);
+
+	qsort(symbols->entry, symbols->count, sizeof *symbols->entry, &compare_addresses);
+	return true;
+}
+
+/* last label at or before an address */
+static struct entry *find_symbol(struct entries *symbols, uint32_t address)
+{
+	size_t lo = 0, hi = symbols->count;
+
+	while(lo < hi)
+	{
+		size_t const mid = lo + (hi - lo) / 2;
+		if(symbols->entry[mid].address <= address)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo ? &symbols->entry[lo - 1] : NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void print_profile(
+		struct entries *e,
+		uint64_t total,
+		uint64_t dropped,
+		unsigned long top)
+{
+	qsort(e->entry, e->count, sizeof *e->entry, &compare_samples);
+
+	printf("%llu samples, %llu dropped\n\n",
+			(unsigned long long)total,
+			(unsigned long long)dropped);
+
+	printf("%7s %7s %12s  %s\n", "%", "cumul%", "samples", "symbol");
+
+	uint64_t cumulative = 0;
+
+	for(size_t i = 0; i < e->count && (!top || i < top); ++i)
+	{
+		struct entry const *const entry = &e->entry[i];
+		if(!entry->samples)
+			break;
+
+		cumulative += entry->samples;
+
+		printf("%6.2f%% %6.2f%% %12llu  ",
+				100.0 * entry->samples / total,
+				100.0 * cumulative / total,
+				(unsigned long long)entry->samples);
+		if(entry->name)
+			printf("%s\n", entry->name);
+		else
+			printf("%06x\n", (unsigned int)entry->address);
+	}
+}
+
+static void usage(char const *argv0)
+{
+	fprintf(stderr, "Usage: %s [-p cycles] [-i milliseconds] [-t seconds] "
+			"[-m symbol map] [-n entries]\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+	/* cycles between samples, interval between reading the ring, time
+	 * to sample (0: until the CPU stops), and lines to print (0: all) */
+	unsigned long period = 10000;
+	unsigned long interval_ms = 100;
+	unsigned long duration = 0;
+	unsigned long top = 20;
+	char const *map = NULL;
+
+	for(int opt; (opt = getopt(argc, argv, "p:i:t:m:n:")) != -1; )
+	{
+		char *end;
+		unsigned long *target;
+
+		switch(opt)
+		{
+		case 'p':
+			target = &period;
+			break;
+		case 'i':
+			target = &interval_ms;
+			break;
+		case 't':
+			target = &duration;
+			break;
+		case 'n':
+			target = &top;
+			break;
+		case 'm':
+			map = optarg;
+			continue;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+
+		errno = 0;
+		*target = strtoul(optarg, &end, 10);
+		if(errno || *end || ((opt == 'p' || opt == 'i') && !*target)
+				|| (opt == 'p' && *target > UINT32_MAX))
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind != argc)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	struct entries symbols = { 0 };
+	if(map && !read_symbol_map(map, &symbols))
+		return 1;
+
+	uint64_t *const samples = calloc(INSTRUCTION_SLOTS, sizeof *samples);
+	if(!samples)
+	{
+		perror("Cannot allocate profile");
+		return 1;
+	}
+
+	int const dev_fd = open("/dev/bss2k-0", O_RDWR);
+	if(dev_fd == -1)
+	{
+		perror("Cannot open device");
+		return 1;
+	}
+
+	uint64_t const *const ring = mmap(NULL, BSS2K_TRACE_SIZE,
+			PROT_READ, MAP_SHARED, dev_fd, BSS2K_TRACE_OFFSET);
+	if(ring == MAP_FAILED)
+	{
+		perror("Cannot map trace ring");
+		close(dev_fd);
+		return 1;
+	}
+
+	unsigned long long const sample_period = period;
+	if(ioctl(dev_fd, BSS2K_IOC_TRACE_SAMPLE, &sample_period) == -1)
+	{
+		perror("Cannot start sampling");
+		close(dev_fd);
+		return 1;
+	}
+
+	struct bss2k_trace_position position =
+	{
+		.consumer = 0
+	};
+
+	uint64_t total = 0;
+
+	double const start = now();
+	bool stopping = false;
+
+	for(;;)
+	{
+		struct timespec const interval =
+		{
+			.tv_sec = interval_ms / 1000,
+			.tv_nsec = (interval_ms % 1000) * 1000000
+		};
+
+		nanosleep(&interval, NULL);
+
+		if(ioctl(dev_fd, BSS2K_IOC_TRACE_POSITION, &position) == -1)
+		{
+			perror("Cannot read trace position");
+			close(dev_fd);
+			return 1;
+		}
+
+		for(; position.consumer != position.producer; ++position.consumer)
+		{
+			uint64_t const record = le64toh(ring[position.consumer % BSS2K_TRACE_RECORDS]);
+			++samples[BSS2K_TRACE_IP(record) / 8];
+			++total;
+		}
+
+		/* one more round after the end, for the last partial burst */
+		if(stopping)
+			break;
+
+		if(duration && now() - start >= duration)
+			stopping = true;
+
+		unsigned long long status;
+		if(ioctl(dev_fd, BSS2K_IOC_READ_STATUS, &status) == -1)
+		{
+			perror("Cannot read status");
+			close(dev_fd);
+			return 1;
+		}
+		if(!(status & STS_RUNNING))
+			stopping = true;
+	}
+
+	if(ioctl(dev_fd, BSS2K_IOC_TRACE_STOP) == -1)
+		perror("Cannot stop trace");
+
+	close(dev_fd);
+
+	if(!total)
+	{
+		printf("no samples\n");
+		return 0;
+	}
+
+	/* samples before the first label are counted by address */
+	struct entries addresses = { 0 };
+
+	for(size_t i = 0; i < INSTRUCTION_SLOTS; ++i)
+	{
+		if(!samples[i])
+			continue;
+
+		uint32_t const address = i * 8;
+		struct entry *entry = find_symbol(&symbols, address);
+		if(!entry)
+			entry = add_entry(&addresses, address, NULL);
+		if(!entry)
+		{
+			perror("Cannot build profile");
+			return 1;
+		}
+		entry->samples += samples[i];
+	}
+
+	/* only now, lookups need the symbols sorted by address */
+	for(size_t i = 0; i < addresses.count; ++i)
+	{
+		struct entry *const entry = add_entry(&symbols, addresses.entry[i].address, NULL);
+		if(!entry)
+		{
+			perror("Cannot build profile");
+			return 1;
+		}
+		entry->samples = addresses.entry[i].samples;
+	}
+
+	print_profile(&symbols, total, position.dropped, top);
+
+	for(size_t i = 0; i < symbols.count; ++i)
+		free(symbols.entry[i].name);
+	free(symbols.entry);
+	free(addresses.entry);
+	free(samples);
+
+	return 0;
+}
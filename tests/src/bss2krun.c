@@ -10,11 +10,12 @@
 #endif
 
 #include <sys/types.h>
-#include <sys/time.h>
-#include <sys/select.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 
+#include <endian.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <string.h>
@@ -97,104 +98,165 @@ enum result
 	ERROR
 };
 
-enum result run_program(int prog_fd, int dev_fd)
+/* nanoseconds between reading the debug events while the program runs */
+#define EVENT_INTERVAL	10000000
+
+/* debug events, written to the log as the program runs */
+struct event_log
 {
-	int rc;
+	int fd;
+	struct bss2k_event const *ring;
+	struct bss2k_trace_position position;
+};
 
-	rc = ioctl(dev_fd, BSS2K_IOC_RESET);
-	if(rc == -1)
-		return ERROR;
+static bool log_events(int dev_fd, struct event_log *log)
+{
+	if(log->ring == MAP_FAILED)
+		return true;
 
-	/* TODO: magic value */
-	off_t const start_address = 0x1d1fd8;
+	if(ioctl(dev_fd, BSS2K_IOC_EVENT_POSITION, &log->position) == -1)
+		return false;
+
+	for(; log->position.consumer != log->position.producer; ++log->position.consumer)
+	{
+		struct bss2k_event const *const event =
+				&log->ring[log->position.consumer % BSS2K_EVENT_RECORDS];
+		uint64_t const insn = le64toh(event->insn);
+		uint64_t const data = le64toh(event->data);
+
+		unsigned int const ip = BSS2K_EVENT_IP(insn);
+		unsigned int const cycles = BSS2K_EVENT_CYCLES(data);
+		unsigned int const value = BSS2K_EVENT_VALUE(data);
+
+		switch(BSS2K_EVENT_OPCODE(insn))
+		{
+		case BSS2K_EVENT_CHECKPOINT:
+			dprintf(log->fd, "%10u %06x: checkpoint %08x\n", cycles, ip, value);
+			break;
+		case BSS2K_EVENT_PRINTREGISTER:
+			dprintf(log->fd, "%10u %06x: r%u = %08x\n", cycles, ip,
+					(unsigned int)BSS2K_EVENT_REGISTER(insn), value);
+			break;
+		case BSS2K_EVENT_DEBUGBREAK:
+			dprintf(log->fd, "%10u %06x: debugbreak\n", cycles, ip);
+			break;
+		case BSS2K_EVENT_DUMPMEMORY:
+			dprintf(log->fd, "%10u %06x: dumpmemory\n", cycles, ip);
+			break;
+		case BSS2K_EVENT_DUMPREGISTERS:
+			dprintf(log->fd, "%10u %06x: dumpregisters\n", cycles, ip);
+			break;
+		}
+	}
 
-	off_t const address = lseek(dev_fd, start_address, SEEK_SET);
+	return true;
+}
 
-	if(address != start_address)
+static enum result wait_for_cpu(int dev_fd, struct event_log *log)
+{
+	struct timespec now;
+	if(clock_gettime(CLOCK_MONOTONIC, &now) == -1)
 		return ERROR;
 
+	/* one second timeout */
+	uint64_t const end = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec + 1000000000;
+
 	for(;;)
 	{
-		unsigned char buffer[256];
-		ssize_t const read_count = read(prog_fd, buffer, sizeof buffer);
-		if(read_count < 0)
+		uint64_t const ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+		/* wake up now and then to make room in the ring while the
+		 * program runs */
+		struct bss2k_wait_halt wait =
+		{
+			.timeout_ns = (end - ns < EVENT_INTERVAL) ? end - ns : EVENT_INTERVAL
+		};
+
+		if(ioctl(dev_fd, BSS2K_IOC_WAIT_HALT, &wait) == -1)
 			return ERROR;
-		if(read_count == 0)
-			break;
-		if((size_t)read_count > sizeof buffer)
+
+		if(!log_events(dev_fd, log))
 			return ERROR;
-		ssize_t const write_count = write(dev_fd, buffer, read_count);
-		if(write_count != read_count)
+
+		if(!(wait.status & BSS2K_STATUS_RUNNING))
+		{
+			if(wait.status & BSS2K_STATUS_ASSERTION_FAILED)
+				return FAIL;
+			return PASS;
+		}
+
+		if(clock_gettime(CLOCK_MONOTONIC, &now) == -1)
 			return ERROR;
+		if((uint64_t)now.tv_sec * 1000000000 + now.tv_nsec >= end)
+			return FAIL;
 	}
+}
 
-	rc = ioctl(dev_fd, BSS2K_IOC_START_CPU);
+enum result run_program(int prog_fd, int dev_fd, int log_fd)
+{
+	int rc;
+	enum result result;
+
+	rc = ioctl(dev_fd, BSS2K_IOC_RESET);
 	if(rc == -1)
 		return ERROR;
 
-	struct timeval now;
-	rc = gettimeofday(&now, NULL);
-	if(rc == -1)
+	/* TODO: magic value */
+	size_t const start_address = 0x1d1fd8;
+
+	unsigned char *const mem = mmap(NULL, BSS2K_MEMORY_SIZE,
+			PROT_READ|PROT_WRITE, MAP_SHARED, dev_fd, 0);
+	if(mem == MAP_FAILED)
 		return ERROR;
 
-	struct timeval const end =
-	{
-		/* one second timeout */
-		now.tv_sec + 1,
-		now.tv_usec
-	};
+	/* read program straight into emulated memory */
+	size_t address = start_address;
 
 	for(;;)
 	{
-		struct timeval timeout;
-
-		if(now.tv_sec > end.tv_sec)
-		{
-			return FAIL;
-		}
-		else if(now.tv_sec == end.tv_sec)
-		{
-			if(now.tv_usec > end.tv_usec)
-				return FAIL;
-			timeout.tv_sec = 0;
-			timeout.tv_usec = end.tv_usec - now.tv_usec;
-		}
-		else if(now.tv_usec > end.tv_usec)
+		if(address == BSS2K_MEMORY_SIZE)
 		{
-			timeout.tv_sec = end.tv_sec - 1 - now.tv_sec;
-			timeout.tv_usec = end.tv_usec + 1000000 - now.tv_usec;
+			munmap(mem, BSS2K_MEMORY_SIZE);
+			return ERROR;
 		}
-		else
+		ssize_t const read_count = read(prog_fd, mem + address,
+				BSS2K_MEMORY_SIZE - address);
+		if(read_count < 0)
 		{
-			timeout.tv_sec = end.tv_sec - now.tv_sec;
-			timeout.tv_usec = end.tv_usec - now.tv_usec;
+			munmap(mem, BSS2K_MEMORY_SIZE);
+			return ERROR;
 		}
+		if(read_count == 0)
+			break;
+		address += read_count;
+	}
 
-		fd_set readfds;
+	munmap(mem, BSS2K_MEMORY_SIZE);
 
-		FD_ZERO(&readfds);
-		FD_SET(dev_fd, &readfds);
+	struct event_log log =
+	{
+		.fd = log_fd,
+		.ring = mmap(NULL, BSS2K_EVENT_SIZE,
+				PROT_READ, MAP_SHARED, dev_fd, BSS2K_EVENT_OFFSET),
+		.position = { .consumer = 0 }
+	};
 
-		rc = select(dev_fd + 1, &readfds, NULL, NULL, &timeout);
-		if(rc == -1)
-			return ERROR;
-		if(rc == 0)
-			return FAIL;
+	rc = ioctl(dev_fd, BSS2K_IOC_START_CPU);
+	if(rc == -1)
+		result = ERROR;
+	else
+		result = wait_for_cpu(dev_fd, &log);
 
-		uint64_t status;
+	/* events raised before the CPU stopped are in the ring by now */
+	if(!log_events(dev_fd, &log))
+		result = ERROR;
+	if(log.position.dropped)
+		dprintf(log_fd, "%u debug events lost\n", (unsigned int)log.position.dropped);
 
-		rc = ioctl(dev_fd, BSS2K_IOC_READ_STATUS, &status);
-		if(rc == -1)
-			return ERROR;
+	if(log.ring != MAP_FAILED)
+		munmap((void *)log.ring, BSS2K_EVENT_SIZE);
 
-		/* TODO: magic value */
-		if(!(status & (uint64_t)1))
-		{
-			if(status & (uint64_t)4)
-				return FAIL;
-			return PASS;
-		}
-	}
+	return result;
 }
 
 int main(int argc, char **argv)
@@ -338,7 +400,7 @@ int main(int argc, char **argv)
 			}
 			else
 			{
-				result = run_program(prog_fd, dev_fd);
+				result = run_program(prog_fd, dev_fd, log_fd);
 
 				close(prog_fd);
 			}
@@ -0,0 +1,184 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <bss2k_ioctl.h>
+
+#include <sys/ioctl.h>
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+static char const *const counter_names[BSS2K_COUNTERS] =
+{
+	[BSS2K_COUNTER_CYCLES] = "cycles",
+	[BSS2K_COUNTER_RETIRED] = "instructions",
+	[BSS2K_COUNTER_FETCH_STALLS] = "fetch stall cycles",
+	[BSS2K_COUNTER_DATA_STALLS] = "data stall cycles",
+	[BSS2K_COUNTER_ICACHE_HITS] = "icache hits",
+	[BSS2K_COUNTER_ICACHE_MISSES] = "icache misses",
+	[BSS2K_COUNTER_DCACHE_HITS] = "dcache hits",
+	[BSS2K_COUNTER_DCACHE_MISSES] = "dcache misses",
+	[BSS2K_COUNTER_BRANCH_MISPREDICTS] = "branch mispredicts",
+	[BSS2K_COUNTER_BRANCH_REDIRECTS] = "branch redirects",
+	[BSS2K_COUNTER_REDIRECT_PENALTY] = "redirect penalty cycles",
+	[BSS2K_COUNTER_DMA_I_READ_REQUESTS] = "ifetch read requests",
+	[BSS2K_COUNTER_DMA_I_READ_COMPLETIONS] = "ifetch read completions",
+	[BSS2K_COUNTER_DMA_D_READ_REQUESTS] = "data read requests",
+	[BSS2K_COUNTER_DMA_D_READ_COMPLETIONS] = "data read completions",
+	[BSS2K_COUNTER_TEXTMODE_PACKETS] = "textmode packets",
+	[BSS2K_COUNTER_ARBITER_WAIT] = "arbiter wait cycles"
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* part of total in percent, or zero if nothing happened */
+static double percent(uint64_t part, uint64_t total)
+{
+	return total ? 100.0 * part / total : 0.0;
+}
+
+static void print_rates(
+		struct bss2k_counters const *prev,
+		struct bss2k_counters const *cur,
+		double elapsed)
+{
+	uint64_t delta[BSS2K_COUNTERS];
+
+	/* counters cleared by a reset in between start over */
+	for(unsigned int i = 0; i < BSS2K_COUNTERS; ++i)
+		delta[i] = (cur->value[i] >= prev->value[i])
+				? cur->value[i] - prev->value[i]
+				: cur->value[i];
+
+	for(unsigned int i = 0; i < BSS2K_COUNTERS; ++i)
+		printf("%-24s %14.0f/s\n", counter_names[i], delta[i] / elapsed);
+
+	uint64_t const cycles = delta[BSS2K_COUNTER_CYCLES];
+
+	printf("%-24s %14.3f\n", "IPC",
+			cycles ? (double)delta[BSS2K_COUNTER_RETIRED] / cycles : 0.0);
+	printf("%-24s %14.1f%%\n", "fetch stalled",
+			percent(delta[BSS2K_COUNTER_FETCH_STALLS], cycles));
+	printf("%-24s %14.1f%%\n", "data stalled",
+			percent(delta[BSS2K_COUNTER_DATA_STALLS], cycles));
+	printf("%-24s %14.1f%%\n", "icache hit rate",
+			percent(delta[BSS2K_COUNTER_ICACHE_HITS],
+				delta[BSS2K_COUNTER_ICACHE_HITS] +
+				delta[BSS2K_COUNTER_ICACHE_MISSES]));
+	printf("%-24s %14.1f%%\n", "dcache hit rate",
+			percent(delta[BSS2K_COUNTER_DCACHE_HITS],
+				delta[BSS2K_COUNTER_DCACHE_HITS] +
+				delta[BSS2K_COUNTER_DCACHE_MISSES]));
+	printf("\n");
+	fflush(stdout);
+}
+
+static void usage(char const *argv0)
+{
+	fprintf(stderr, "Usage: %s [-i milliseconds] [-c count]\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+	/* interval between samples, and number of samples (0: forever) */
+	unsigned long interval_ms = 1000;
+	unsigned long count = 0;
+
+	for(int opt; (opt = getopt(argc, argv, "i:c:")) != -1; )
+	{
+		char *end;
+
+		switch(opt)
+		{
+		case 'i':
+			errno = 0;
+			interval_ms = strtoul(optarg, &end, 10);
+			if(errno || *end || !interval_ms)
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'c':
+			errno = 0;
+			count = strtoul(optarg, &end, 10);
+			if(errno || *end)
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind != argc)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	int const dev_fd = open("/dev/bss2k-0", O_RDWR);
+	if(dev_fd == -1)
+	{
+		perror("Cannot open device");
+		return 1;
+	}
+
+	struct bss2k_counters prev, cur;
+
+	if(ioctl(dev_fd, BSS2K_IOC_READ_COUNTERS, &prev) == -1)
+	{
+		perror("Cannot read counters");
+		close(dev_fd);
+		return 1;
+	}
+
+	double prev_time = now();
+
+	for(unsigned long i = 0; !count || i < count; ++i)
+	{
+		struct timespec const interval =
+		{
+			.tv_sec = interval_ms / 1000,
+			.tv_nsec = (interval_ms % 1000) * 1000000
+		};
+
+		nanosleep(&interval, NULL);
+
+		if(ioctl(dev_fd, BSS2K_IOC_READ_COUNTERS, &cur) == -1)
+		{
+			perror("Cannot read counters");
+			close(dev_fd);
+			return 1;
+		}
+
+		double const cur_time = now();
+
+		print_rates(&prev, &cur, cur_time - prev_time);
+
+		prev = cur;
+		prev_time = cur_time;
+	}
+
+	close(dev_fd);
+
+	return 0;
+}
@@ -0,0 +1,257 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <bss2k_ioctl.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <endian.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* status register, see linux/bss2k.c */
+#define STS_RUNNING		(1ULL << 0)
+
+/* instructions are 64 bit aligned in 16 MiB */
+#define INSTRUCTION_SLOTS	(BSS2K_MEMORY_SIZE / 8)
+
+struct hotspot
+{
+	uint32_t ip;
+	uint16_t opcode;
+	/* times decoded, and cycles until the next instruction */
+	uint64_t count;
+	uint64_t cycles;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* most cycles first */
+static int compare_hotspots(void const *a, void const *b)
+{
+	struct hotspot const *const x = a;
+	struct hotspot const *const y = b;
+
+	if(x->cycles != y->cycles)
+		return (x->cycles < y->cycles) ? 1 : -1;
+	if(x->count != y->count)
+		return (x->count < y->count) ? 1 : -1;
+	return (x->ip > y->ip) - (x->ip < y->ip);
+}
+
+static void print_profile(
+		struct hotspot *slots,
+		uint64_t records,
+		uint64_t dropped,
+		unsigned long top)
+{
+	size_t used = 0;
+	uint64_t total_cycles = 0;
+
+	/* sort the addresses seen to the front */
+	for(size_t i = 0; i < INSTRUCTION_SLOTS; ++i)
+		if(slots[i].count)
+		{
+			total_cycles += slots[i].cycles;
+			slots[used++] = slots[i];
+		}
+
+	qsort(slots, used, sizeof *slots, &compare_hotspots);
+
+	printf("%llu instructions traced, %llu dropped, %zu addresses, %llu cycles\n\n",
+			(unsigned long long)records,
+			(unsigned long long)dropped,
+			used,
+			(unsigned long long)total_cycles);
+	if(dropped)
+		printf("the ring overflowed, cycles of dropped instructions are "
+				"counted to the one before them\n\n");
+
+	printf("%-8s %-6s %14s %16s %7s\n", "address", "opcode", "count", "cycles", "cycles%");
+	for(size_t i = 0; i < used && (!top || i < top); ++i)
+		printf("%06x   %04x   %14llu %16llu %6.2f%%\n",
+				(unsigned int)slots[i].ip,
+				(unsigned int)slots[i].opcode,
+				(unsigned long long)slots[i].count,
+				(unsigned long long)slots[i].cycles,
+				total_cycles ? 100.0 * slots[i].cycles / total_cycles : 0.0);
+}
+
+static void usage(char const *argv0)
+{
+	fprintf(stderr, "Usage: %s [-i milliseconds] [-t seconds] [-n entries]\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+	/* interval between reading the ring, time to trace (0: until the
+	 * CPU stops), and addresses to print (0: all) */
+	unsigned long interval_ms = 10;
+	unsigned long duration = 0;
+	unsigned long top = 20;
+
+	for(int opt; (opt = getopt(argc, argv, "i:t:n:")) != -1; )
+	{
+		char *end;
+		unsigned long *target;
+
+		switch(opt)
+		{
+		case 'i':
+			target = &interval_ms;
+			break;
+		case 't':
+			target = &duration;
+			break;
+		case 'n':
+			target = &top;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+
+		errno = 0;
+		*target = strtoul(optarg, &end, 10);
+		if(errno || *end || (opt == 'i' && !*target))
+		{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind != argc)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	struct hotspot *const slots = calloc(INSTRUCTION_SLOTS, sizeof *slots);
+	if(!slots)
+	{
+		perror("Cannot allocate profile");
+		return 1;
+	}
+
+	int const dev_fd = open("/dev/bss2k-0", O_RDWR);
+	if(dev_fd == -1)
+	{
+		perror("Cannot open device");
+		return 1;
+	}
+
+	uint64_t const *const ring = mmap(NULL, BSS2K_TRACE_SIZE,
+			PROT_READ, MAP_SHARED, dev_fd, BSS2K_TRACE_OFFSET);
+	if(ring == MAP_FAILED)
+	{
+		perror("Cannot map trace ring");
+		close(dev_fd);
+		return 1;
+	}
+
+	if(ioctl(dev_fd, BSS2K_IOC_TRACE_START) == -1)
+	{
+		perror("Cannot start trace");
+		close(dev_fd);
+		return 1;
+	}
+
+	struct bss2k_trace_position position =
+	{
+		.consumer = 0
+	};
+
+	uint64_t records = 0;
+	struct hotspot *previous = NULL;
+
+	double const start = now();
+	bool stopping = false;
+
+	for(;;)
+	{
+		/* sooner when the ring fills up to half or the CPU halts */
+		struct pollfd pfd =
+		{
+			.fd = dev_fd,
+			.events = POLLIN | POLLPRI | POLLRDBAND
+		};
+
+		if(poll(&pfd, 1, (interval_ms > INT_MAX) ? INT_MAX : (int)interval_ms) == -1
+				&& errno != EINTR)
+		{
+			perror("Cannot wait for trace");
+			close(dev_fd);
+			return 1;
+		}
+
+		if(ioctl(dev_fd, BSS2K_IOC_TRACE_POSITION, &position) == -1)
+		{
+			perror("Cannot read trace position");
+			close(dev_fd);
+			return 1;
+		}
+
+		/* cycles in a record are those since the previous one, so
+		 * they belong to the instruction before */
+		for(; position.consumer != position.producer; ++position.consumer)
+		{
+			uint64_t const record = le64toh(ring[position.consumer % BSS2K_TRACE_RECORDS]);
+			uint32_t const ip = BSS2K_TRACE_IP(record);
+
+			if(previous)
+				previous->cycles += BSS2K_TRACE_CYCLES(record);
+
+			previous = &slots[ip / 8];
+			previous->ip = ip;
+			previous->opcode = BSS2K_TRACE_OPCODE(record);
+			++previous->count;
+			++records;
+		}
+
+		/* one more round after the end, for the last partial burst */
+		if(stopping)
+			break;
+
+		if(duration && now() - start >= duration)
+			stopping = true;
+
+		unsigned long long status;
+		if(ioctl(dev_fd, BSS2K_IOC_READ_STATUS, &status) == -1)
+		{
+			perror("Cannot read status");
+			close(dev_fd);
+			return 1;
+		}
+		if(!(status & STS_RUNNING))
+			stopping = true;
+	}
+
+	if(ioctl(dev_fd, BSS2K_IOC_TRACE_STOP) == -1)
+		perror("Cannot stop trace");
+
+	close(dev_fd);
+
+	print_profile(slots, records, position.dropped, top);
+
+	free(slots);
+
+	return 0;
+}